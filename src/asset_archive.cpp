@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "asset_archive.hpp"
+
+#define ARCHIVE_MAGIC     0x4B504249 // "IBPK"
+#define ARCHIVE_VERSION   1
+#define ARCHIVE_ALIGNMENT 256        // Payload alignment (cache lines, SIMD loads, PBO uploads)
+
+struct ArchiveHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t alignment;
+};
+
+// Index entries follow the header, sorted by path hash
+struct ArchiveEntry
+{
+    uint64_t pathHash;
+    uint64_t offset; // From the start of the archive
+    uint64_t size;
+    uint32_t format;
+    uint32_t checksum;
+};
+
+struct MappedArchive
+{
+    archive::MappedFile file;
+    const ArchiveEntry* entries = nullptr;
+    uint32_t entryCount = 0;
+};
+
+static MappedArchive mappedArchive;
+
+bool archive::MapFile(const char* filename, MappedFile* mappedFile)
+{
+    *mappedFile = MappedFile();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    mappedFile->file    = file;
+    mappedFile->mapping = mapping;
+    mappedFile->data    = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    mappedFile->size    = (size_t)fileSize.QuadPart;
+    return mappedFile->data != nullptr;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file alive
+    if (data == MAP_FAILED)
+        return false;
+
+    mappedFile->data = (const unsigned char*)data;
+    mappedFile->size = (size_t)fileStat.st_size;
+    return true;
+#endif
+}
+
+void archive::UnmapFile(MappedFile* mappedFile)
+{
+#if defined(_WIN32)
+    if (mappedFile->data)
+        UnmapViewOfFile(mappedFile->data);
+    if (mappedFile->mapping)
+        CloseHandle((HANDLE)mappedFile->mapping);
+    if (mappedFile->file)
+        CloseHandle((HANDLE)mappedFile->file);
+#else
+    if (mappedFile->data)
+        munmap((void*)mappedFile->data, mappedFile->size);
+#endif
+    *mappedFile = MappedFile();
+}
+
+bool archive::Open(const char* filename)
+{
+    Close();
+
+    MappedArchive archive;
+    if (!MapFile(filename, &archive.file))
+    {
+        UnmapFile(&archive.file);
+        return false;
+    }
+
+    ArchiveHeader header = {};
+    if (archive.file.size >= sizeof(ArchiveHeader))
+        memcpy(&header, archive.file.data, sizeof(ArchiveHeader));
+
+    if (header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION ||
+        archive.file.size < sizeof(ArchiveHeader) + (size_t)header.entryCount * sizeof(ArchiveEntry))
+    {
+        fprintf(stderr, "Invalid asset archive %s, using loose files\n", filename);
+        UnmapFile(&archive.file);
+        return false;
+    }
+
+    archive.entries    = (const ArchiveEntry*)(archive.file.data + sizeof(ArchiveHeader));
+    archive.entryCount = header.entryCount;
+
+    // Only the index is read here, payloads are left untouched until they are used
+    for (uint32_t i = 0; i < archive.entryCount; ++i)
+    {
+        const ArchiveEntry& entry = archive.entries[i];
+        if (entry.offset > archive.file.size || entry.size > archive.file.size - entry.offset)
+        {
+            fprintf(stderr, "Truncated asset archive %s, using loose files\n", filename);
+            UnmapFile(&archive.file);
+            return false;
+        }
+    }
+    mappedArchive = archive;
+
+    printf("Asset archive opened: %s (%d files, %.1f MB)\n", filename, (int)header.entryCount, archive.file.size / (1024.f * 1024.f));
+    return true;
+}
+
+void archive::Close()
+{
+    UnmapFile(&mappedArchive.file);
+    mappedArchive = MappedArchive();
+}
+
+bool archive::IsOpen()
+{
+    return mappedArchive.file.data != nullptr;
+}
+
+bool archive::Find(const char* path, const void** data, size_t* size, Format* format)
+{
+    if (!IsOpen())
+        return false;
+
+    uint64_t hash = HashPath(path);
+    const ArchiveEntry* begin = mappedArchive.entries;
+    const ArchiveEntry* end   = mappedArchive.entries + mappedArchive.entryCount;
+    const ArchiveEntry* entry = std::lower_bound(begin, end, hash, [](const ArchiveEntry& e, uint64_t h) { return e.pathHash < h; });
+    if (entry == end || entry->pathHash != hash)
+        return false;
+
+    if (entry->offset + entry->size > mappedArchive.file.size)
+    {
+        fprintf(stderr, "Truncated archive entry %s\n", path);
+        return false;
+    }
+
+    *data = mappedArchive.file.data + entry->offset;
+    *size = (size_t)entry->size;
+    if (format)
+        *format = (Format)entry->format;
+    return true;
+}
+
+bool archive::Verify()
+{
+    if (!IsOpen())
+        return false;
+
+    int mismatchCount = 0;
+    for (uint32_t i = 0; i < mappedArchive.entryCount; ++i)
+    {
+        const ArchiveEntry& entry = mappedArchive.entries[i];
+        if (Checksum(mappedArchive.file.data + entry.offset, (size_t)entry.size) != entry.checksum)
+        {
+            fprintf(stderr, "Checksum mismatch for archive entry %016llx\n", (unsigned long long)entry.pathHash);
+            mismatchCount++;
+        }
+    }
+    return mismatchCount == 0;
+}
+
+// FNV-1a on the normalized path
+uint64_t archive::HashPath(const char* path)
+{
+    if (path[0] == '.' && (path[1] == '/' || path[1] == '\\'))
+        path += 2;
+
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (const char* c = path; *c; ++c)
+    {
+        unsigned char value = (*c == '\\') ? '/' : (unsigned char)*c;
+        hash ^= value;
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Word at a time hash (payloads are large, this has to be much faster than reading them)
+uint32_t archive::Checksum(const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(uint64_t));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+bool archive::Write(const char* filename, const std::vector<PackedFile>& files)
+{
+    // Sort by hash for binary search (also makes the output independent from the input order)
+    std::vector<ArchiveEntry> entries(files.size());
+    std::vector<const PackedFile*> sortedFiles(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+        sortedFiles[i] = &files[i];
+    std::sort(sortedFiles.begin(), sortedFiles.end(), [](const PackedFile* a, const PackedFile* b)
+    {
+        return HashPath(a->path.c_str()) < HashPath(b->path.c_str());
+    });
+
+    uint64_t offset = sizeof(ArchiveHeader) + entries.size() * sizeof(ArchiveEntry);
+    for (size_t i = 0; i < sortedFiles.size(); ++i)
+    {
+        const PackedFile& file = *sortedFiles[i];
+        ArchiveEntry& entry = entries[i];
+        entry.pathHash = HashPath(file.path.c_str());
+        if (i > 0 && entry.pathHash == entries[i - 1].pathHash)
+        {
+            fprintf(stderr, "Archive path hash collision: %s and %s\n", file.path.c_str(), sortedFiles[i - 1]->path.c_str());
+            return false;
+        }
+
+        offset = (offset + ARCHIVE_ALIGNMENT - 1) & ~(uint64_t)(ARCHIVE_ALIGNMENT - 1);
+        entry.offset   = offset;
+        entry.size     = file.data.size();
+        entry.format   = (uint32_t)file.format;
+        entry.checksum = Checksum(file.data.data(), file.data.size());
+        offset += entry.size;
+    }
+
+    FILE* output = fopen(filename, "wb");
+    if (output == nullptr)
+    {
+        fprintf(stderr, "Cannot write asset archive %s\n", filename);
+        return false;
+    }
+
+    ArchiveHeader header = {};
+    header.magic      = ARCHIVE_MAGIC;
+    header.version    = ARCHIVE_VERSION;
+    header.entryCount = (uint32_t)entries.size();
+    header.alignment  = ARCHIVE_ALIGNMENT;
+    fwrite(&header, sizeof(ArchiveHeader), 1, output);
+    fwrite(entries.data(), sizeof(ArchiveEntry), entries.size(), output);
+
+    // Payloads with zero padding
+    uint64_t position = sizeof(ArchiveHeader) + entries.size() * sizeof(ArchiveEntry);
+    const unsigned char padding[ARCHIVE_ALIGNMENT] = {};
+    for (size_t i = 0; i < sortedFiles.size(); ++i)
+    {
+        fwrite(padding, 1, (size_t)(entries[i].offset - position), output);
+        fwrite(sortedFiles[i]->data.data(), 1, sortedFiles[i]->data.size(), output);
+        position = entries[i].offset + entries[i].size;
+    }
+
+    bool success = ferror(output) == 0;
+    fclose(output);
+
+    printf("Asset archive written: %s (%d files, %.1f MB)\n", filename, (int)entries.size(), position / (1024.f * 1024.f));
+    return success;
+}
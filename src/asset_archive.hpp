@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define ARCHIVE_DEFAULT_FILE "media/assets.pack"
+
+// Packed asset archive: one file with a sorted index (path hash -> payload) and aligned payloads
+// The archive is memory mapped once, files are read without copies
+namespace archive
+{
+    enum class Format : uint32_t
+    {
+        RAW,           // Source file bytes (jpg, png, obj...)
+        TEXTURE_CACHE, // Same content as the .tex.cache/.texf.cache files
+        MESH_CACHE,    // Same content as the .obj.cache files
+        DDS,           // DDS file
+    };
+
+    // Map the archive (returns false if missing or invalid, loaders then use loose files)
+    bool Open(const char* filename);
+    void Close();
+    bool IsOpen();
+
+    // Find a file by path ("media/x.jpg" and "media\\x.jpg" are the same file)
+    // Data is valid until Close, payloads are not read (see Verify)
+    bool Find(const char* path, const void** data, size_t* size, Format* format = nullptr);
+
+    // Check the payload checksums of every file (reads the whole archive)
+    bool Verify();
+
+    // Read-only mapping of a whole file (the archive, probe files)
+    struct MappedFile
+    {
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+        void* file = nullptr;    // Windows handles
+        void* mapping = nullptr;
+    };
+    bool MapFile(const char* filename, MappedFile* mappedFile);
+    void UnmapFile(MappedFile* mappedFile);
+
+    uint64_t HashPath(const char* path);
+    uint32_t Checksum(const void* data, size_t size);
+
+    struct PackedFile
+    {
+        std::string path;
+        Format format;
+        std::vector<unsigned char> data;
+    };
+
+    // Write an archive, output only depends on the files (not on their order)
+    bool Write(const char* filename, const std::vector<PackedFile>& files);
+}
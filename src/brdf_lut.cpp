@@ -0,0 +1,331 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BRDF_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "asset_archive.hpp"
+#include "calc.hpp"
+#include "jobs.hpp"
+#include "brdf_lut.hpp"
+
+static float RadicalInverse(uint32_t bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return bits * 2.3283064365386963e-10f;
+}
+
+// Half vectors of a roughness in the tangent space of N, with V in the xz plane only x and z matter.
+// Padded with zeros to a multiple of 4 (the padding is rejected as NdotL <= 0)
+struct HalfVectors
+{
+    int count = 0;
+    std::vector<float> x;
+    std::vector<float> z;
+};
+
+static void GenerateHalfVectors(float roughness, int sampleCount, HalfVectors* h)
+{
+    float a = roughness * roughness;
+    int paddedCount = (sampleCount + 3) & ~3;
+    h->count = sampleCount;
+    h->x.assign(paddedCount, 0.f);
+    h->z.assign(paddedCount, 0.f);
+    for (int i = 0; i < sampleCount; ++i)
+    {
+        float phi = calc::TAU * i / sampleCount;
+        float v = RadicalInverse((uint32_t)i);
+        float cosTheta = sqrtf((1.f - v) / (1.f + (a * a - 1.f) * v));
+        float sinTheta = sqrtf(1.f - cosTheta * cosTheta);
+        h->x[i] = sinTheta * cosf(phi);
+        h->z[i] = cosTheta;
+    }
+}
+
+// Sum of G_Vis * (1 - Fc) and G_Vis * Fc over the samples, divided by the sample count
+static float2 IntegrateTexel(const HalfVectors& h, float NdotV, float roughness)
+{
+    float vx = sqrtf(1.f - NdotV * NdotV);
+    float vz = NdotV;
+    float k = roughness * roughness / 2.f;
+    float G1V = NdotV / (NdotV * (1.f - k) + k);
+
+    float scale = 0.f;
+    float bias = 0.f;
+    int i = 0;
+#ifdef BRDF_USE_SSE2
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one  = _mm_set1_ps(1.f);
+        const __m128 two  = _mm_set1_ps(2.f);
+        const __m128 VX   = _mm_set1_ps(vx);
+        const __m128 VZ   = _mm_set1_ps(vz);
+        const __m128 K    = _mm_set1_ps(k);
+        const __m128 oneMinusK = _mm_set1_ps(1.f - k);
+        const __m128 G1VOverNdotV = _mm_set1_ps(G1V / NdotV);
+
+        __m128 scaleSum = zero;
+        __m128 biasSum = zero;
+        int paddedCount = (int)h.x.size();
+        for (; i < paddedCount; i += 4)
+        {
+            __m128 hx = _mm_loadu_ps(&h.x[i]);
+            __m128 hz = _mm_loadu_ps(&h.z[i]);
+
+            // L = reflect(-V, H)
+            __m128 VdotH = _mm_add_ps(_mm_mul_ps(VX, hx), _mm_mul_ps(VZ, hz));
+            __m128 NdotL = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(two, VdotH), hz), VZ);
+            __m128 valid = _mm_cmpgt_ps(NdotL, zero);
+
+            __m128 G1L = _mm_div_ps(NdotL, _mm_add_ps(_mm_mul_ps(NdotL, oneMinusK), K));
+            __m128 GVis = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(G1L, G1VOverNdotV), VdotH), hz);
+
+            __m128 oneMinusVdotH = _mm_sub_ps(one, VdotH);
+            __m128 square = _mm_mul_ps(oneMinusVdotH, oneMinusVdotH);
+            __m128 Fc = _mm_mul_ps(_mm_mul_ps(square, square), oneMinusVdotH);
+
+            // Rejected samples (and the padding, divided by zero) are masked out
+            scaleSum = _mm_add_ps(scaleSum, _mm_and_ps(valid, _mm_mul_ps(_mm_sub_ps(one, Fc), GVis)));
+            biasSum  = _mm_add_ps(biasSum,  _mm_and_ps(valid, _mm_mul_ps(Fc, GVis)));
+        }
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, scaleSum);
+        scale = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        _mm_storeu_ps(lanes, biasSum);
+        bias = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#endif
+    for (; i < h.count; ++i)
+    {
+        float VdotH = vx * h.x[i] + vz * h.z[i];
+        float NdotL = 2.f * VdotH * h.z[i] - vz;
+        if (NdotL <= 0.f)
+            continue;
+
+        float G1L = NdotL / (NdotL * (1.f - k) + k);
+        float GVis = G1L * G1V * VdotH / (h.z[i] * NdotV);
+        float Fc = powf(1.f - VdotH, 5.f);
+        scale += (1.f - Fc) * GVis;
+        bias += Fc * GVis;
+    }
+
+    return { scale / h.count, bias / h.count };
+}
+
+float2 brdf::Integrate(float NdotV, float roughness, int sampleCount)
+{
+    HalfVectors h;
+    GenerateHalfVectors(roughness, sampleCount, &h);
+    return IntegrateTexel(h, NdotV, roughness);
+}
+
+void brdf::Generate(Lut* lut, const LutSettings& settings)
+{
+    auto start = std::chrono::steady_clock::now();
+    lut->size = settings.size;
+    lut->sampleCount = settings.sampleCount;
+    lut->texels.resize((size_t)settings.size * settings.size * 2);
+
+    jobs::ParallelFor(settings.size, [&](int y)
+    {
+        float roughness = (y + 0.5f) / settings.size;
+        HalfVectors h;
+        GenerateHalfVectors(roughness, settings.sampleCount, &h);
+
+        uint16_t* row = &lut->texels[(size_t)y * settings.size * 2];
+        for (int x = 0; x < settings.size; ++x)
+        {
+            float2 scaleBias = IntegrateTexel(h, (x + 0.5f) / settings.size, roughness);
+            row[x * 2 + 0] = calc::FloatToHalf(scaleBias.x);
+            row[x * 2 + 1] = calc::FloatToHalf(scaleBias.y);
+        }
+    });
+
+    float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("BRDF LUT generated: %dx%d, %d samples (%.1f ms on %d threads, hash %08x)\n",
+        settings.size, settings.size, settings.sampleCount, milliseconds, jobs::ThreadCount(), Hash(*lut));
+}
+
+// Integral over the hemisphere of L, with the same geometry and Fresnel terms as the integrator
+static void IntegrateReference(double NdotV, double roughness, double* scale, double* bias)
+{
+    const double pi = 3.14159265358979;
+    const int thetaSteps = 1024;
+    const int phiSteps = 512;
+
+    double a2 = roughness * roughness * roughness * roughness;
+    double k = roughness * roughness / 2.0;
+    double vx = sqrt(1.0 - NdotV * NdotV);
+    double G1V = NdotV / (NdotV * (1.0 - k) + k);
+
+    // Midpoints in cos(theta) and phi (solid angle = dcos * dphi), symmetric in phi
+    *scale = 0.0;
+    *bias = 0.0;
+    for (int i = 0; i < thetaSteps; ++i)
+    {
+        double NdotL = (i + 0.5) / thetaSteps;
+        double sinTheta = sqrt(1.0 - NdotL * NdotL);
+        for (int j = 0; j < phiSteps; ++j)
+        {
+            double phi = pi * (j + 0.5) / phiSteps;
+            double lx = sinTheta * cos(phi);
+            double ly = sinTheta * sin(phi);
+
+            double hx = lx + vx, hy = ly, hz = NdotL + NdotV;
+            double invLength = 1.0 / sqrt(hx * hx + hy * hy + hz * hz);
+            double NdotH = hz * invLength;
+            double VdotH = (hx * vx + hz * NdotV) * invLength;
+
+            double d = NdotH * NdotH * (a2 - 1.0) + 1.0;
+            double D = a2 / (pi * d * d);
+            double G = G1V * NdotL / (NdotL * (1.0 - k) + k);
+            double Fc = pow(1.0 - VdotH, 5.0);
+
+            // f * NdotL without F0, the NdotL of the BRDF denominator cancels out
+            double value = D * G / (4.0 * NdotV);
+            *scale += value * (1.0 - Fc);
+            *bias += value * Fc;
+        }
+    }
+
+    double solidAngle = (1.0 / thetaSteps) * (pi / phiSteps) * 2.0;
+    *scale *= solidAngle;
+    *bias *= solidAngle;
+}
+
+bool brdf::Verify(int sampleCount)
+{
+    const float tolerance = 0.01f;
+    float maxError = 0.f;
+    int count = 0;
+
+    // Smooth surface: the only sample is the mirror direction, scale = 1 - Fc(NdotV) and bias = Fc(NdotV)
+    const float smoothNdotV[] = { 0.05f, 0.25f, 0.5f, 0.75f, 1.f };
+    for (float NdotV : smoothNdotV)
+    {
+        float Fc = powf(1.f - NdotV, 5.f);
+        float2 scaleBias = Integrate(NdotV, 0.f, sampleCount);
+        maxError = calc::Max(maxError, calc::Max(fabsf(scaleBias.x - (1.f - Fc)), fabsf(scaleBias.y - Fc)));
+        count += 2;
+    }
+
+    // Rough surfaces (the quadrature needs a lobe wider than its steps)
+    const float roughNdotV[] = { 0.2f, 0.5f, 0.9f };
+    const float roughness[] = { 0.5f, 0.75f, 1.f };
+    for (float NdotV : roughNdotV)
+    {
+        for (float r : roughness)
+        {
+            double scale, bias;
+            IntegrateReference(NdotV, r, &scale, &bias);
+            float2 scaleBias = Integrate(NdotV, r, sampleCount);
+            float error = calc::Max(fabsf(scaleBias.x - (float)scale), fabsf(scaleBias.y - (float)bias));
+            if (error > tolerance)
+            {
+                fprintf(stderr, "BRDF integration error at NdotV %.2f roughness %.2f: (%.4f, %.4f) instead of (%.4f, %.4f)\n",
+                    NdotV, r, scaleBias.x, scaleBias.y, scale, bias);
+            }
+            maxError = calc::Max(maxError, error);
+            count += 2;
+        }
+    }
+
+    bool success = maxError <= tolerance;
+    printf("BRDF integration %s: max error %.5f over %d reference values (%d samples)\n",
+        success ? "verified" : "FAILED", maxError, count, sampleCount);
+    return success;
+}
+
+uint32_t brdf::Hash(const Lut& lut)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    const unsigned char* bytes = (const unsigned char*)lut.texels.data();
+    for (size_t i = 0; i < lut.texels.size() * sizeof(uint16_t); ++i)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+struct LutHeader
+{
+    uint32_t version;
+    int32_t size;
+    int32_t sampleCount;
+};
+
+bool brdf::Save(const Lut& lut, const char* filename)
+{
+    FILE* file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Cannot write BRDF LUT cache %s\n", filename);
+        return false;
+    }
+
+    LutHeader header = { BRDF_LUT_CACHE_VERSION, lut.size, lut.sampleCount };
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(lut.texels.data(), sizeof(uint16_t), lut.texels.size(), file);
+    fclose(file);
+    return true;
+}
+
+bool brdf::Load(Lut* lut, const char* filename, const LutSettings& settings)
+{
+    size_t texelCount = (size_t)settings.size * settings.size * 2;
+    std::vector<unsigned char> data(sizeof(LutHeader) + texelCount * sizeof(uint16_t));
+
+    const void* archiveData;
+    size_t archiveSize;
+    if (archive::Find(filename, &archiveData, &archiveSize))
+    {
+        if (archiveSize != data.size())
+            return false;
+        memcpy(data.data(), archiveData, data.size());
+    }
+    else
+    {
+        FILE* file = fopen(filename, "rb");
+        if (file == nullptr)
+            return false;
+        size_t readSize = fread(data.data(), 1, data.size(), file);
+        fclose(file);
+        if (readSize != data.size())
+            return false;
+    }
+
+    LutHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.version != BRDF_LUT_CACHE_VERSION || header.size != settings.size || header.sampleCount != settings.sampleCount)
+        return false;
+
+    lut->size = header.size;
+    lut->sampleCount = header.sampleCount;
+    lut->texels.resize(texelCount);
+    memcpy(lut->texels.data(), data.data() + sizeof(header), texelCount * sizeof(uint16_t));
+    return true;
+}
+
+bool brdf::LoadOrGenerate(Lut* lut, const LutSettings& settings)
+{
+    if (Load(lut, BRDF_LUT_CACHE_FILE, settings))
+    {
+        printf("BRDF LUT loaded from cache: %s\n", BRDF_LUT_CACHE_FILE);
+        return true;
+    }
+
+    Generate(lut, settings);
+
+    // Still used when the verification fails, but not cached
+    if (!Verify(settings.sampleCount))
+        return true;
+    return Save(*lut, BRDF_LUT_CACHE_FILE);
+}
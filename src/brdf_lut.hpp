@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "types.hpp"
+
+#define BRDF_LUT_CACHE_VERSION 1
+#define BRDF_LUT_CACHE_FILE "media/brdf_lut.cache"
+
+// Split sum BRDF integration: specular environment = prefiltered radiance * (F0 * scale + bias)
+// Texel (x, y) of the LUT: NdotV = (x + 0.5) / size, roughness = (y + 0.5) / size
+namespace brdf
+{
+    struct LutSettings
+    {
+        int size        = 128;
+        int sampleCount = 1024;
+    };
+
+    struct Lut
+    {
+        int size        = 0;
+        int sampleCount = 0;
+        std::vector<uint16_t> texels; // RG16F: scale, bias
+    };
+
+    // GGX importance sampled with Hammersley points (4 samples at a time with SSE2),
+    // Smith-Schlick geometry with k = roughness^2 / 2
+    float2 Integrate(float NdotV, float roughness, int sampleCount);
+
+    // One job per roughness row, the result does not depend on the thread count
+    void Generate(Lut* lut, const LutSettings& settings);
+
+    // Integrator against reference values (closed form of a smooth surface, hemisphere quadrature in double)
+    bool Verify(int sampleCount);
+
+    uint32_t Hash(const Lut& lut);
+
+    // Small binary cache (version, settings, texels), read from the asset archive when packed there
+    bool Save(const Lut& lut, const char* filename);
+    bool Load(Lut* lut, const char* filename, const LutSettings& settings);
+
+    // Cache first, generated, verified and cached otherwise
+    bool LoadOrGenerate(Lut* lut, const LutSettings& settings = {});
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include "types.hpp"
 
 namespace calc
@@ -67,6 +69,76 @@ namespace calc
     }
 
     inline float ToRadians(float degrees) { return degrees * TAU / 360.f; }
+
+    // IEEE 754 half precision conversions (round to nearest)
+    inline uint16_t FloatToHalf(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(float));
+
+        uint32_t sign     = (bits >> 16) & 0x8000;
+        int32_t  exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+        uint32_t mantissa = bits & 0x7FFFFF;
+
+        if (((bits >> 23) & 0xFF) == 0xFF) // Inf/NaN
+            return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+        if (exponent >= 31) // Overflow
+            return (uint16_t)(sign | 0x7C00);
+        if (exponent <= 0) // Denormal
+        {
+            if (exponent < -10)
+                return (uint16_t)sign;
+            mantissa |= 0x800000;
+            uint32_t shift = (uint32_t)(14 - exponent);
+            uint32_t half  = mantissa >> shift;
+            if ((mantissa >> (shift - 1)) & 1)
+                half++;
+            return (uint16_t)(sign | half);
+        }
+
+        uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+        if (mantissa & 0x1000)
+            half++; // Carry into exponent is still correct
+        return (uint16_t)half;
+    }
+
+    inline float HalfToFloat(uint16_t half)
+    {
+        uint32_t sign     = (uint32_t)(half & 0x8000) << 16;
+        uint32_t exponent = (half >> 10) & 0x1F;
+        uint32_t mantissa = half & 0x3FF;
+
+        uint32_t bits;
+        if (exponent == 0x1F) // Inf/NaN
+        {
+            bits = sign | 0x7F800000 | (mantissa << 13);
+        }
+        else if (exponent == 0)
+        {
+            if (mantissa == 0)
+            {
+                bits = sign;
+            }
+            else // Denormal, normalize it
+            {
+                exponent = 127 - 15 + 1;
+                while ((mantissa & 0x400) == 0)
+                {
+                    mantissa <<= 1;
+                    exponent--;
+                }
+                bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+            }
+        }
+        else
+        {
+            bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+        }
+
+        float value;
+        memcpy(&value, &bits, sizeof(float));
+        return value;
+    }
 }
 
 inline float2 operator-(float2 a) { return { -a.x, -a.y }; }
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <glad/glad.h>
+
+#include "calc.hpp"
+#include "jobs.hpp"
+#include "vram_budget.hpp"
+#include "color_grading.hpp"
+
+const char* grading::lutShader = R"GLSL(
+uniform sampler3D lutTexture;
+uniform vec4 lutShaper;
+
+vec3 ApplyLut(vec3 exposedColor)
+{
+    vec3 u = clamp(log2(max(exposedColor, vec3(1e-6))) * lutShaper.x + lutShaper.y, 0.0, 1.0);
+    return texture(lutTexture, u * lutShaper.z + lutShaper.w).rgb;
+}
+)GLSL";
+
+static float Luminance(float3 c) { return c.x * 0.2126f + c.y * 0.7152f + c.z * 0.0722f; }
+
+static float Tonemap(grading::Tonemapper tonemapper, float x)
+{
+    switch (tonemapper)
+    {
+    case grading::Tonemapper::ACES:
+        x *= 0.6f; // The fit includes the reference exposure
+        return calc::Clamp((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 0.f, 1.f);
+    case grading::Tonemapper::Reinhard:
+    default:
+        return x / (x + 1.f);
+    }
+}
+
+static float EncodeSRGB(float x)
+{
+    return x <= 0.0031308f ? x * 12.92f : 1.055f * powf(x, 1.f / 2.4f) - 0.055f;
+}
+
+static float3 GradeColor(const grading::Settings& settings, float3 color)
+{
+    // White balance and contrast on scene radiance
+    float3 whiteBalance = { 1.f + 0.2f * settings.temperature, 1.f, 1.f - 0.2f * settings.temperature };
+    color *= whiteBalance;
+    for (int c = 0; c < 3; ++c)
+        color.e[c] = 0.18f * powf(color.e[c] / 0.18f, settings.contrast);
+
+    float luminance = Luminance(color);
+    color = float3(luminance, luminance, luminance) + (color - float3(luminance, luminance, luminance)) * settings.saturation;
+
+    for (int c = 0; c < 3; ++c)
+    {
+        float x = Tonemap(settings.tonemapper, std::max(color.e[c], 0.f));
+
+        // Lift, gamma, gain on the display color
+        x = settings.gain.e[c] * (x + settings.lift.e[c] * (1.f - x));
+        x = powf(std::max(x, 0.f), 1.f / std::max(settings.gamma.e[c], 0.01f));
+        color.e[c] = EncodeSRGB(calc::Clamp(x, 0.f, 1.f));
+    }
+    return color;
+}
+
+void grading::Bake(Lut* lut, const Settings& settings)
+{
+    auto start = std::chrono::steady_clock::now();
+    int size = lut->size;
+    lut->texels.resize((size_t)size * size * size * 3);
+
+    std::vector<float> inputs(size);
+    for (int i = 0; i < size; ++i)
+        inputs[i] = exp2f(calc::Lerp(lut->minLog2, lut->maxLog2, (float)i / (size - 1)));
+
+    jobs::ParallelFor(size, [&](int b)
+    {
+        uint16_t* slice = &lut->texels[(size_t)b * size * size * 3];
+        for (int g = 0; g < size; ++g)
+        {
+            for (int r = 0; r < size; ++r)
+            {
+                float3 color = GradeColor(settings, float3(inputs[r], inputs[g], inputs[b]));
+                uint16_t* texel = &slice[((size_t)g * size + r) * 3];
+                texel[0] = calc::FloatToHalf(color.x);
+                texel[1] = calc::FloatToHalf(color.y);
+                texel[2] = calc::FloatToHalf(color.z);
+            }
+        }
+    });
+
+    lut->bakeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+float4 grading::GetShaper(const Lut& lut)
+{
+    float scale = 1.f / (lut.maxLog2 - lut.minLog2);
+    return { scale, -lut.minLog2 * scale, (lut.size - 1.f) / lut.size, 0.5f / lut.size };
+}
+
+void grading::Upload(const Lut& lut)
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, lut.size, lut.size, lut.size, 0, GL_RGB, GL_HALF_FLOAT, lut.texels.data());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    GLint texture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_3D, &texture);
+    vram::Track(vram::ResourceType::TEXTURE, (GLuint)texture, lut.texels.size() * sizeof(uint16_t));
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "types.hpp"
+
+// Tonemapping, grading and output encoding baked in a 3D LUT indexed by log2 of the exposed linear color
+// Texel (r, g, b) holds the sRGB encoded display color of exp2(mix(minLog2, maxLog2, index / (size - 1)))
+namespace grading
+{
+    enum class Tonemapper : int
+    {
+        Reinhard,
+        ACES, // Narkowicz fit of the ACES reference rendering transform
+    };
+
+    // Compared bytewise to decide when the LUT is baked again, keep it free of padding
+    struct Settings
+    {
+        Tonemapper tonemapper = Tonemapper::Reinhard;
+        float temperature = 0.f;     // White balance, -1 (cool) to 1 (warm)
+        float contrast    = 1.f;     // Log space slope around middle gray, before tonemapping
+        float saturation  = 1.f;
+        float3 lift  = { 0.f, 0.f, 0.f }; // Display space, after tonemapping: (gain * (c + lift * (1 - c))) ^ (1 / gamma)
+        float3 gamma = { 1.f, 1.f, 1.f };
+        float3 gain  = { 1.f, 1.f, 1.f };
+    };
+
+    struct Lut
+    {
+        int size = 32;
+        float minLog2 = -12.f; // Shaper range, about 0.00025 (encodes below 1/255) to 64 (exposed)
+        float maxLog2 = 6.f;
+        std::vector<uint16_t> texels; // RGB16F, r fastest
+        float bakeMilliseconds = 0.f;
+    };
+
+    // One job per blue slice
+    void Bake(Lut* lut, const Settings& settings);
+
+    // GLSL: vec3 ApplyLut(vec3 exposedColor), returns the encoded display color
+    // (uniform sampler3D lutTexture, uniform vec4 lutShaper: log2 scale and bias to [0, 1], texel scale and offset)
+    extern const char* lutShader;
+
+    // Uniform values of lutShader
+    float4 GetShaper(const Lut& lut);
+
+    // RGB16F 3D texture on the bound GL_TEXTURE_3D, clamped and trilinear
+    void Upload(const Lut& lut);
+}
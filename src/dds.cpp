@@ -0,0 +1,467 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "calc.hpp"
+#include "jobs.hpp"
+#include "texture_compression.hpp"
+#include "dds.hpp"
+
+#define DDS_MAGIC 0x20534444 // "DDS "
+
+#define DDS_FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define DDS_FOURCC_DX10    DDS_FOURCC('D', 'X', '1', '0')
+#define DDS_FOURCC_RGBA16F 113 // D3DFMT_A16B16G16R16F
+#define DDS_FOURCC_RGBA32F 116 // D3DFMT_A32B32G32R32F
+
+#define DDS_HEADER_FLAGS_TEXTURE    0x00001007 // DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT
+#define DDS_HEADER_FLAGS_MIPMAP     0x00020000 // DDSD_MIPMAPCOUNT
+#define DDS_HEADER_FLAGS_PITCH      0x00000008 // DDSD_PITCH
+#define DDS_HEADER_FLAGS_LINEARSIZE 0x00080000 // DDSD_LINEARSIZE
+
+#define DDS_PIXEL_FLAGS_FOURCC 0x00000004 // DDPF_FOURCC
+
+#define DDS_SURFACE_FLAGS_TEXTURE 0x00001000 // DDSCAPS_TEXTURE
+#define DDS_SURFACE_FLAGS_MIPMAP  0x00400000 // DDSCAPS_MIPMAP
+#define DDS_SURFACE_FLAGS_CUBEMAP 0x00000008 // DDSCAPS_COMPLEX
+
+#define DDS_CUBEMAP_POSITIVEX 0x00000600 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_POSITIVEX
+#define DDS_CUBEMAP_NEGATIVEX 0x00000a00 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_NEGATIVEX
+#define DDS_CUBEMAP_POSITIVEY 0x00001200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_POSITIVEY
+#define DDS_CUBEMAP_NEGATIVEY 0x00002200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_NEGATIVEY
+#define DDS_CUBEMAP_POSITIVEZ 0x00004200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_POSITIVEZ
+#define DDS_CUBEMAP_NEGATIVEZ 0x00008200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_NEGATIVEZ
+
+#define DDS_CUBEMAP_ALLFACES ( DDS_CUBEMAP_POSITIVEX | DDS_CUBEMAP_NEGATIVEX |\
+                               DDS_CUBEMAP_POSITIVEY | DDS_CUBEMAP_NEGATIVEY |\
+                               DDS_CUBEMAP_POSITIVEZ | DDS_CUBEMAP_NEGATIVEZ )
+
+#define DDS_DIMENSION_TEXTURE2D   3 // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+#define DDS_MISC_FLAG_TEXTURECUBE 4 // D3D10_RESOURCE_MISC_TEXTURECUBE
+
+// DXGI_FORMAT values
+#define DXGI_FORMAT_R32G32B32A32_FLOAT 2
+#define DXGI_FORMAT_R16G16B16A16_FLOAT 10
+#define DXGI_FORMAT_R11G11B10_FLOAT    26
+#define DXGI_FORMAT_BC6H_UF16          95
+
+struct DDSPixelFormat
+{
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourCC;
+    uint32_t rgbBitCount;
+    uint32_t rBitMask;
+    uint32_t gBitMask;
+    uint32_t bBitMask;
+    uint32_t aBitMask;
+};
+
+struct DDSHeader
+{
+    uint32_t       size;
+    uint32_t       flags;
+    uint32_t       height;
+    uint32_t       width;
+    uint32_t       pitchOrLinearSize;
+    uint32_t       depth;
+    uint32_t       mipMapCount;
+    uint32_t       reserved1[11];
+    DDSPixelFormat pixelFormat;
+    uint32_t       caps;
+    uint32_t       caps2;
+    uint32_t       caps3;
+    uint32_t       caps4;
+    uint32_t       reserved2;
+};
+
+struct DDSHeaderDX10
+{
+    uint32_t dxgiFormat;
+    uint32_t resourceDimension;
+    uint32_t miscFlag;
+    uint32_t arraySize;
+    uint32_t miscFlags2;
+};
+
+static dds::Format FormatFromDXGI(uint32_t dxgiFormat)
+{
+    switch (dxgiFormat)
+    {
+    case DXGI_FORMAT_R32G32B32A32_FLOAT: return dds::Format::RGBA32F;
+    case DXGI_FORMAT_R16G16B16A16_FLOAT: return dds::Format::RGBA16F;
+    case DXGI_FORMAT_R11G11B10_FLOAT:    return dds::Format::R11G11B10F;
+    case DXGI_FORMAT_BC6H_UF16:          return dds::Format::BC6H;
+    default:                             return dds::Format::UNKNOWN;
+    }
+}
+
+static uint32_t FormatToDXGI(dds::Format format)
+{
+    switch (format)
+    {
+    case dds::Format::RGBA32F:    return DXGI_FORMAT_R32G32B32A32_FLOAT;
+    case dds::Format::RGBA16F:    return DXGI_FORMAT_R16G16B16A16_FLOAT;
+    case dds::Format::R11G11B10F: return DXGI_FORMAT_R11G11B10_FLOAT;
+    case dds::Format::BC6H:       return DXGI_FORMAT_BC6H_UF16;
+    default:                      return 0;
+    }
+}
+
+static dds::Format FormatFromPixelFormat(const DDSPixelFormat& pixelFormat)
+{
+    if (pixelFormat.flags & DDS_PIXEL_FLAGS_FOURCC)
+    {
+        switch (pixelFormat.fourCC)
+        {
+        case DDS_FOURCC_RGBA32F: return dds::Format::RGBA32F;
+        case DDS_FOURCC_RGBA16F: return dds::Format::RGBA16F;
+        default:                 return dds::Format::UNKNOWN;
+        }
+    }
+
+    // Files written without fourCC by older tools
+    if (pixelFormat.rgbBitCount == 128)
+        return dds::Format::RGBA32F;
+
+    return dds::Format::UNKNOWN;
+}
+
+static int BytesPerPixel(dds::Format format)
+{
+    switch (format)
+    {
+    case dds::Format::RGBA32F:    return 16;
+    case dds::Format::RGBA16F:    return 8;
+    case dds::Format::R11G11B10F: return 4;
+    default:                      return 0;
+    }
+}
+
+// Half float bits to unsigned 11/10 bits floats (same exponent bias, shorter mantissa)
+static uint32_t PackR11G11B10F(const float* rgb)
+{
+    uint32_t packed = 0;
+    for (int c = 0; c < 3; ++c)
+    {
+        float value = rgb[c] > 0.f ? rgb[c] : 0.f;
+        uint32_t half = calc::Min((uint32_t)calc::FloatToHalf(value), 0x7BFFu);
+        uint32_t bits = (c < 2) ? calc::Min((half + 8) >> 4, 0x7BFu) : calc::Min((half + 16) >> 5, 0x3DFu);
+        packed |= bits << (c * 11);
+    }
+    return packed;
+}
+
+static void UnpackR11G11B10F(uint32_t packed, float* rgb)
+{
+    rgb[0] = calc::HalfToFloat((uint16_t)(( packed        & 0x7FF) << 4));
+    rgb[1] = calc::HalfToFloat((uint16_t)(((packed >> 11) & 0x7FF) << 4));
+    rgb[2] = calc::HalfToFloat((uint16_t)(((packed >> 22) & 0x3FF) << 5));
+}
+
+static void EncodeLevel(dds::Format format, const float* rgba, const dds::Level& level)
+{
+    if (format == dds::Format::BC6H)
+    {
+        bc::CompressBC6H(rgba, level.width, level.height, level.data);
+        return;
+    }
+
+    jobs::ParallelFor(level.height, [&](int y)
+    {
+        const float* src = rgba + (size_t)y * level.width * 4;
+        switch (format)
+        {
+        case dds::Format::RGBA32F:
+            memcpy((float*)level.data + (size_t)y * level.width * 4, src, level.width * sizeof(float) * 4);
+            break;
+
+        case dds::Format::RGBA16F:
+        {
+            uint16_t* dst = (uint16_t*)level.data + (size_t)y * level.width * 4;
+            for (int i = 0; i < level.width * 4; ++i)
+                dst[i] = calc::FloatToHalf(src[i]);
+            break;
+        }
+
+        case dds::Format::R11G11B10F:
+        {
+            uint32_t* dst = (uint32_t*)level.data + (size_t)y * level.width;
+            for (int x = 0; x < level.width; ++x)
+                dst[x] = PackR11G11B10F(src + x * 4);
+            break;
+        }
+
+        default:
+            break;
+        }
+    });
+}
+
+void dds::DecodeLevel(Format format, const Level& level, float* rgba)
+{
+    if (format == Format::BC6H)
+    {
+        bc::DecompressBC6H(level.data, level.width, level.height, rgba);
+        return;
+    }
+
+    jobs::ParallelFor(level.height, [&](int y)
+    {
+        float* dst = rgba + (size_t)y * level.width * 4;
+        switch (format)
+        {
+        case Format::RGBA32F:
+            memcpy(dst, (const float*)level.data + (size_t)y * level.width * 4, level.width * sizeof(float) * 4);
+            break;
+
+        case Format::RGBA16F:
+        {
+            const uint16_t* src = (const uint16_t*)level.data + (size_t)y * level.width * 4;
+            for (int i = 0; i < level.width * 4; ++i)
+                dst[i] = calc::HalfToFloat(src[i]);
+            break;
+        }
+
+        case Format::R11G11B10F:
+        {
+            const uint32_t* src = (const uint32_t*)level.data + (size_t)y * level.width;
+            for (int x = 0; x < level.width; ++x)
+            {
+                UnpackR11G11B10F(src[x], dst + x * 4);
+                dst[x * 4 + 3] = 1.f;
+            }
+            break;
+        }
+
+        default:
+            memset(dst, 0, level.width * sizeof(float) * 4);
+            break;
+        }
+    });
+}
+
+const char* dds::FormatName(Format format)
+{
+    switch (format)
+    {
+    case Format::RGBA32F:    return "RGBA32F";
+    case Format::RGBA16F:    return "RGBA16F";
+    case Format::R11G11B10F: return "R11G11B10F";
+    case Format::BC6H:       return "BC6H";
+    default:                 return "Unknown";
+    }
+}
+
+size_t dds::LevelSize(Format format, int width, int height)
+{
+    if (format == Format::BC6H)
+        return bc::CompressedSize(bc::Format::BC6H, width, height);
+
+    return (size_t)width * height * BytesPerPixel(format);
+}
+
+// Set level sizes and pointers for data stored face by face, each face with all its levels
+static size_t SetupLevels(dds::Image* image, unsigned char* data)
+{
+    size_t offset = 0;
+    for (int face = 0; face < image->faceCount; ++face)
+    {
+        for (int level = 0; level < image->levelCount; ++level)
+        {
+            dds::Level& dstLevel = image->levels[face][level];
+            dstLevel.width  = calc::Max(image->width  >> level, 1);
+            dstLevel.height = calc::Max(image->height >> level, 1);
+            dstLevel.size   = dds::LevelSize(image->format, dstLevel.width, dstLevel.height);
+            dstLevel.data   = data ? data + offset : nullptr;
+            offset += dstLevel.size;
+        }
+    }
+    return offset;
+}
+
+void dds::Allocate(Image* image, Format format, int width, int height, int faceCount, int levelCount)
+{
+    image->format     = format;
+    image->width      = width;
+    image->height     = height;
+    image->faceCount  = faceCount;
+    image->levelCount = levelCount;
+
+    size_t totalSize = SetupLevels(image, nullptr);
+    image->memory = malloc(totalSize);
+    SetupLevels(image, (unsigned char*)image->memory);
+}
+
+void dds::Free(Image* image)
+{
+    free(image->memory);
+    *image = Image();
+}
+
+bool dds::LoadFromMemory(Image* image, const void* data, size_t size, const char* filename)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    uint32_t magic = 0;
+    if (size >= sizeof(uint32_t) + sizeof(DDSHeader))
+        memcpy(&magic, bytes, sizeof(uint32_t));
+    if (magic != DDS_MAGIC)
+    {
+        fprintf(stderr, "Not a dds file: %s\n", filename);
+        return false;
+    }
+
+    // Parse header
+    DDSHeader header;
+    memcpy(&header, bytes + sizeof(uint32_t), sizeof(DDSHeader));
+    size_t dataOffset = sizeof(uint32_t) + header.size;
+
+    Format format;
+    bool isCubemap = (header.caps & DDS_SURFACE_FLAGS_CUBEMAP) != 0 && (header.caps2 & DDS_CUBEMAP_ALLFACES) != 0;
+    if ((header.pixelFormat.flags & DDS_PIXEL_FLAGS_FOURCC) && header.pixelFormat.fourCC == DDS_FOURCC_DX10)
+    {
+        DDSHeaderDX10 headerDX10 = {};
+        if (dataOffset + sizeof(DDSHeaderDX10) <= size)
+            memcpy(&headerDX10, bytes + dataOffset, sizeof(DDSHeaderDX10));
+        dataOffset += sizeof(DDSHeaderDX10);
+
+        format = FormatFromDXGI(headerDX10.dxgiFormat);
+        if (headerDX10.miscFlag & DDS_MISC_FLAG_TEXTURECUBE)
+            isCubemap = true;
+        if (headerDX10.arraySize > 1)
+            format = Format::UNKNOWN; // Texture arrays not supported
+    }
+    else
+    {
+        format = FormatFromPixelFormat(header.pixelFormat);
+    }
+
+    if (isCubemap && (header.caps2 & DDS_CUBEMAP_ALLFACES) != 0 && (header.caps2 & DDS_CUBEMAP_ALLFACES) != DDS_CUBEMAP_ALLFACES)
+    {
+        fprintf(stderr, "Incomplete cubemap: %s\n", filename);
+        return false;
+    }
+
+    if (format == Format::UNKNOWN)
+    {
+        fprintf(stderr, "Unsupported dds format: %s\n", filename);
+        return false;
+    }
+
+    // A mipmap count of 0 means the file only has the base level
+    *image = Image();
+    image->format     = format;
+    image->width      = (int)header.width;
+    image->height     = (int)header.height;
+    image->faceCount  = isCubemap ? 6 : 1;
+    image->levelCount = calc::Clamp((int)header.mipMapCount, 1, DDS_MAX_LEVELS);
+
+    size_t dataSize = SetupLevels(image, (unsigned char*)bytes + dataOffset);
+    if (dataOffset + dataSize > size)
+    {
+        fprintf(stderr, "Truncated dds file: %s\n", filename);
+        *image = Image();
+        return false;
+    }
+
+    return true;
+}
+
+bool dds::Load(Image* image, const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == nullptr)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    void* memory = malloc(fileSize > 0 ? fileSize : 1);
+    size_t readSize = fread(memory, 1, fileSize > 0 ? fileSize : 0, file);
+    fclose(file);
+
+    if (!LoadFromMemory(image, memory, readSize, filename))
+    {
+        free(memory);
+        return false;
+    }
+
+    image->memory = memory;
+    return true;
+}
+
+bool dds::Save(const Image& image, const char* filename)
+{
+    FILE* file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Cannot write dds file %s\n", filename);
+        return false;
+    }
+
+    bool compressed = image.format == Format::BC6H;
+
+    DDSHeader header = {};
+    header.size   = sizeof(DDSHeader);
+    header.flags  = DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_MIPMAP;
+    header.flags |= compressed ? DDS_HEADER_FLAGS_LINEARSIZE : DDS_HEADER_FLAGS_PITCH;
+    header.height = (uint32_t)image.height;
+    header.width  = (uint32_t)image.width;
+    header.pitchOrLinearSize = compressed ? (uint32_t)image.levels[0][0].size : (uint32_t)(image.width * BytesPerPixel(image.format));
+    header.mipMapCount = (uint32_t)image.levelCount;
+    header.pixelFormat.size   = sizeof(DDSPixelFormat);
+    header.pixelFormat.flags  = DDS_PIXEL_FLAGS_FOURCC;
+    header.pixelFormat.fourCC = DDS_FOURCC_DX10;
+    header.caps = DDS_SURFACE_FLAGS_TEXTURE;
+    if (image.levelCount > 1)
+        header.caps |= DDS_SURFACE_FLAGS_MIPMAP | DDS_SURFACE_FLAGS_CUBEMAP; // DDSCAPS_COMPLEX is also set for mipmaps
+    if (image.faceCount == 6)
+    {
+        header.caps  |= DDS_SURFACE_FLAGS_CUBEMAP;
+        header.caps2 |= DDS_CUBEMAP_ALLFACES;
+    }
+
+    DDSHeaderDX10 headerDX10 = {};
+    headerDX10.dxgiFormat        = FormatToDXGI(image.format);
+    headerDX10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+    headerDX10.miscFlag          = image.faceCount == 6 ? DDS_MISC_FLAG_TEXTURECUBE : 0;
+    headerDX10.arraySize         = 1;
+
+    uint32_t magic = DDS_MAGIC;
+    fwrite(&magic, sizeof(uint32_t), 1, file);
+    fwrite(&header, sizeof(DDSHeader), 1, file);
+    fwrite(&headerDX10, sizeof(DDSHeaderDX10), 1, file);
+    for (int face = 0; face < image.faceCount; ++face)
+        for (int level = 0; level < image.levelCount; ++level)
+            fwrite(image.levels[face][level].data, 1, image.levels[face][level].size, file);
+
+    fclose(file);
+    return true;
+}
+
+void dds::Convert(const Image& src, Format format, Image* dst)
+{
+    Allocate(dst, format, src.width, src.height, src.faceCount, src.levelCount);
+
+    std::vector<float> rgba;
+    for (int face = 0; face < src.faceCount; ++face)
+    {
+        for (int level = 0; level < src.levelCount; ++level)
+        {
+            const Level& srcLevel = src.levels[face][level];
+            const float* pixels = (const float*)srcLevel.data;
+            if (src.format != Format::RGBA32F)
+            {
+                rgba.resize((size_t)srcLevel.width * srcLevel.height * 4);
+                DecodeLevel(src.format, srcLevel, rgba.data());
+                pixels = rgba.data();
+            }
+
+            EncodeLevel(format, pixels, dst->levels[face][level]);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define DDS_MAX_LEVELS 16
+
+// DDS files (legacy and DX10 headers), used for float/HDR textures and cubemaps
+namespace dds
+{
+    enum class Format : int
+    {
+        UNKNOWN,
+        RGBA32F,    // 16 bytes per pixel
+        RGBA16F,    // 8 bytes per pixel
+        R11G11B10F, // 4 bytes per pixel (packed unsigned floats)
+        BC6H,       // 16 bytes per 4x4 block (unsigned half floats)
+    };
+
+    struct Level
+    {
+        int width;
+        int height;
+        size_t size;
+        void* data;
+    };
+
+    // Faces are stored in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+    struct Image
+    {
+        Format format  = Format::UNKNOWN;
+        int width      = 0;
+        int height     = 0;
+        int faceCount  = 0; // 1 or 6 (cubemap)
+        int levelCount = 0;
+        Level levels[6][DDS_MAX_LEVELS] = {};
+
+        void* memory = nullptr; // Storage of the level data (owned, null when loaded from memory)
+    };
+
+    const char* FormatName(Format format);
+    size_t LevelSize(Format format, int width, int height);
+
+    // Allocate storage for all faces and levels
+    void Allocate(Image* image, Format format, int width, int height, int faceCount, int levelCount);
+    void Free(Image* image);
+
+    // The file is read with a single read, levels point inside the loaded memory
+    bool Load(Image* image, const char* filename);
+
+    // Same from a file already in memory (levels point inside data, which must outlive the image)
+    bool LoadFromMemory(Image* image, const void* data, size_t size, const char* filename);
+
+    // Always written with a DX10 header
+    bool Save(const Image& image, const char* filename);
+
+    // Convert all faces and levels to another format (float formats are converted through RGBA32F)
+    void Convert(const Image& src, Format format, Image* dst);
+
+    // Decode one level to RGBA32F pixels
+    void DecodeLevel(Format format, const Level& level, float* rgba);
+}
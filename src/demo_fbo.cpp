@@ -1,6 +1,8 @@
 
 #include <cstddef>
 #include <cstdio>
+#include <cstring>
+#include <random>
 #include <vector>
 
 #include <imgui.h>
@@ -10,6 +12,7 @@
 #include "calc.hpp"
 #include "gl_helpers.hpp"
 #include "data.hpp"
+#include "irradiance_volume.hpp"
 
 #include "demo_fbo.hpp"
 
@@ -21,6 +24,126 @@ struct Vertex
     float3 normal;
 };
 
+// Shared by the forward pass and the G-buffer pass
+static const char* tavernVertexShader = R"GLSL(
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec2 aUV;
+layout(location = 2) in vec3 aNormal;
+
+out vec2 vUV;
+out vec3 vWorldPosition;
+out vec3 vWorldNormal;
+out float vViewDepth;
+
+invariant gl_Position; // Depth equal to the pre-pass one
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 model;
+
+void main()
+{
+    vec4 worldPos4 = model * vec4(aPosition, 1.0);
+    vec4 viewPos4 = view * worldPos4;
+    gl_Position = projection * viewPos4;
+    vViewDepth = -viewPos4.z;
+    vUV = aUV;
+    vWorldPosition = worldPos4.xyz / worldPos4.w;
+    vWorldNormal = (model * vec4(aNormal, 0.0)).xyz; // Assuming model is scaled linearly
+}
+)GLSL";
+
+// Tavern lights, shared by the forward pass and the deferred lighting pass (see SetLightingUniforms)
+static const char* tavernLighting = R"GLSL(
+uniform vec3 ambientColor       = vec3(0.0063, 0.0014, 0.0008);
+uniform vec3 moonDiffuseColor   = vec3(0.0410, 0.0900, 0.2420);
+uniform vec3 candleDiffuseColor = vec3(1.0000, 1.0000, 0.0711);
+
+uniform float candleQuadAttenuation = 1.0;
+uniform float lightCutoff = 0.02;
+
+// Candles, world position and intensity (see clusters::GetLightRadius for their range)
+uniform samplerBuffer candles; // Texture channel 5
+uniform int candleCount;
+
+// Clustered lighting (see clusters::Build): froxel of the fragment, then its range of light indices
+uniform bool useLightClusters;
+uniform usamplerBuffer clusterRanges;       // Texture channel 6, offset and count
+uniform usamplerBuffer clusterLightIndices; // Texture channel 7
+uniform ivec3 clusterCounts;
+uniform vec2 clusterSliceScaleBias;
+uniform vec4 clusterViewport; // Origin and inverse size
+
+// Baked indirect lighting (see volume::Bake): L1 SH of each color channel, premultiplied
+uniform bool useIrradianceVolume;
+uniform float indirectIntensity = 1.0;
+uniform sampler3D irradianceVolumeR; // Texture channels 2 to 4
+uniform sampler3D irradianceVolumeG;
+uniform sampler3D irradianceVolumeB;
+uniform vec3 irradianceVolumeScale;  // World position to texture coordinates (probes at texel centers)
+uniform vec3 irradianceVolumeBias;
+uniform float irradianceVolumeNormalOffset; // Pushes the lookup off the surface to reduce leaks
+
+vec3 EvaluateIrradianceVolume(vec3 position, vec3 normal)
+{
+    vec3 uvw = (position + normal * irradianceVolumeNormalOffset) * irradianceVolumeScale + irradianceVolumeBias;
+    vec4 basis = vec4(1.0, normal.y, normal.z, normal.x);
+    vec3 irradiance = vec3(dot(texture(irradianceVolumeR, uvw), basis),
+                           dot(texture(irradianceVolumeG, uvw), basis),
+                           dot(texture(irradianceVolumeB, uvw), basis));
+    return max(irradiance, vec3(0.0)) * indirectIntensity;
+}
+
+vec3 CandleDiffuse(int index, vec3 position, vec3 normal)
+{
+    vec4 candle = texelFetch(candles, index);
+    vec3 candleToFragVec = candle.xyz - position;
+    float dist2 = dot(candleToFragVec, candleToFragVec);
+
+    // Faded to zero at the light radius, so no cluster misses a lit fragment (same falloff as the irradiance volume bake)
+    float attenuation = GetLightAttenuation(candle.w, candleQuadAttenuation, lightCutoff, dist2);
+    if (attenuation <= 0.0)
+        return vec3(0.0);
+
+    vec3 dir = candleToFragVec * inversesqrt(dist2);
+    return attenuation * max(dot(dir, normal), 0.0) * candleDiffuseColor;
+}
+
+vec3 ShadeTavern(vec3 albedo, vec3 emissive, vec3 position, vec3 normal, float viewDepth)
+{
+    vec3 moonVec = normalize(vec3(-5.0, 4.0, 3.0));
+
+    vec3 lightDiffuse = vec3(0.0);
+    lightDiffuse += max(dot(moonVec, normal), 0.0) * moonDiffuseColor;
+
+    // Compute candle diffuse lighting
+    if (useLightClusters)
+    {
+        ivec2 tile = ivec2((gl_FragCoord.xy - clusterViewport.xy) * clusterViewport.zw * vec2(clusterCounts.xy));
+        tile = clamp(tile, ivec2(0), clusterCounts.xy - 1);
+        int slice = clamp(int(floor(log(viewDepth) * clusterSliceScaleBias.x + clusterSliceScaleBias.y)), 0, clusterCounts.z - 1);
+        uvec2 range = texelFetch(clusterRanges, (slice * clusterCounts.y + tile.y) * clusterCounts.x + tile.x).xy;
+        for (uint i = 0u; i < range.y; ++i)
+            lightDiffuse += CandleDiffuse(int(texelFetch(clusterLightIndices, int(range.x + i)).x), position, normal);
+    }
+    else
+    {
+        for (int i = 0; i < candleCount; ++i)
+            lightDiffuse += CandleDiffuse(i, position, normal);
+    }
+
+    // Indirect lighting replaces the constant ambient
+    vec3 ambient = ambientColor;
+    if (useIrradianceVolume)
+    {
+        lightDiffuse += EvaluateIrradianceVolume(position, normal);
+        ambient = vec3(0.0);
+    }
+
+    return ambient + albedo * lightDiffuse + emissive;
+}
+)GLSL";
+
 DemoFBO::DemoFBO(const DemoInputs& inputs)
 {
     // Upload vertex buffer
@@ -40,14 +163,22 @@ DemoFBO::DemoFBO(const DemoInputs& inputs)
 
             MeshBuilder meshBuilder(descriptor, (void**)&vertices, &vertexCount);
 
-            fullscreenQuad = meshBuilder.GenQuad(nullptr, 1.0f, 1.0f);
             obj            = meshBuilder.LoadObj(nullptr, "media/fantasy_game_inn.obj", "media", 1.f);
         }
 
+        // Kept for the irradiance volume bakes
+        volumeScene.diffuseTexture  = "media/fantasy_game_inn_diffuse.png";
+        volumeScene.emissiveTexture = "media/fantasy_game_inn_emissive.png";
+        for (int i = obj.start; i < obj.start + obj.count; ++i)
+        {
+            volumeScene.positions.push_back(vertices[i].position);
+            volumeScene.uvs.push_back(vertices[i].uv);
+        }
+
         // In VRAM
         glGenBuffers(1, &vertexBuffer);
         glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+        gl::BufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 
         free(vertices);
     }
@@ -66,79 +197,68 @@ DemoFBO::DemoFBO(const DemoInputs& inputs)
         glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, normal));
     }
 
-    // Main program
+    // Position only stream of the tavern for the depth pre-pass (12 bytes per vertex instead of 32)
     {
-        const char* vertexShaderSources[] = {
-            R"GLSL(
-            layout(location = 0) in vec3 aPosition;
-            layout(location = 1) in vec2 aUV;
-            layout(location = 2) in vec3 aNormal;
+        glGenBuffers(1, &positionBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+        gl::BufferData(GL_ARRAY_BUFFER, volumeScene.positions.size() * sizeof(float3), volumeScene.positions.data(), GL_STATIC_DRAW);
 
-            out vec4 vColor;
-            out vec2 vUV;
-            out vec3 vWorldPosition;
-            out vec3 vWorldNormal;
+        glGenVertexArrays(1, &positionVertexArray);
+        glBindVertexArray(positionVertexArray);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float3), (const GLvoid*)0);
+    }
 
-            uniform mat4 projection;
-            uniform mat4 view;
-            uniform mat4 model;
+    // Depth pre-pass program, same position transform as tavernVertexShader
+    depthProgram = gl::CreateBasicProgram(
+        // Vertex shader
+        R"GLSL(
+        layout(location = 0) in vec3 aPosition;
 
-            void main()
-            {
-                vec4 worldPos4 = model * vec4(aPosition, 1.0);
-                gl_Position = projection * view * worldPos4;
-                vUV = aUV;
-                vWorldPosition = worldPos4.xyz / worldPos4.w;
-                vWorldNormal = (model * vec4(aNormal, 0.0)).xyz; // Assuming model is scaled linearly
-            }
-            )GLSL"
-        };
+        invariant gl_Position;
+
+        uniform mat4 projection;
+        uniform mat4 view;
+        uniform mat4 model;
 
-        char defines[256];
-        sprintf(defines, "#define NB_LIGHTS %d\n", Tavern::CandlesCount);
+        void main()
+        {
+            vec4 worldPos4 = model * vec4(aPosition, 1.0);
+            vec4 viewPos4 = view * worldPos4;
+            gl_Position = projection * viewPos4;
+        }
+        )GLSL",
+
+        // Fragment shader
+        R"GLSL(
+        void main()
+        {
+        }
+        )GLSL"
+    );
 
+    // Main program (forward shading)
+    {
         const char* fragmentShaderSources[] = {
-            defines,
+            clusters::attenuationShader,
+            tavernLighting,
             R"GLSL(
             in vec2 vUV;
             in vec3 vWorldPosition;
             in vec3 vWorldNormal;
+            in float vViewDepth;
             layout(location = 0) out vec4 finalColor;
             layout(location = 1) out vec4 emissiveColor;
 
             uniform sampler2D diffuseTexture;  // Texture channel 0
             uniform sampler2D emissiveTexture; // Texture channel 1
 
-            uniform vec3 ambientColor       = vec3(0.0063, 0.0014, 0.0008);
-            uniform vec3 moonDiffuseColor   = vec3(0.0410, 0.0900, 0.2420);
-            uniform vec3 candleDiffuseColor = vec3(1.0000, 1.0000, 0.0711);
-
-            uniform vec3 candleWorldPositions[NB_LIGHTS];
-            uniform float candleQuadAttenuation = 1.0;
-
             void main()
             {
                 vec3 worldNormal = normalize(vWorldNormal); 
-
-                vec3 moonVec = normalize(vec3(-5.0, 4.0, 3.0));
-
-                vec3 lightDiffuse = vec3(0.0);
-                lightDiffuse += max(dot(moonVec, worldNormal), 0.0) * moonDiffuseColor;
-                
-                // Compute candle diffuse lighting
-                for (int i = 0; i < NB_LIGHTS; ++i)
-                {
-                    vec3 candleToFragVec = candleWorldPositions[i] - vWorldPosition;
-                    float dist = length(candleToFragVec);
-                    vec3 dir = normalize(candleToFragVec);
-                    float attenuation = 1.0 / (1.0 + candleQuadAttenuation * (dist * dist));
-                    lightDiffuse += attenuation * max(dot(dir, worldNormal), 0.0) * candleDiffuseColor;
-                }
-
-                vec3 diffuse = texture(diffuseTexture, vUV).rgb * lightDiffuse;
                 vec3 emissive = texture(emissiveTexture, vUV).rgb;
 
-                finalColor    = vec4(ambientColor + diffuse + emissive, 1.0);
+                finalColor    = vec4(ShadeTavern(texture(diffuseTexture, vUV).rgb, emissive, vWorldPosition, worldNormal, vViewDepth), 1.0);
                 emissiveColor = vec4(emissive, 1.0);
             
                 // Show normals only
@@ -149,50 +269,163 @@ DemoFBO::DemoFBO(const DemoInputs& inputs)
             )GLSL"
         };
 
-        mainProgram = gl::CreateProgram(
-            ARRAYSIZE(vertexShaderSources),
-            vertexShaderSources,
-            ARRAYSIZE(fragmentShaderSources),
-            fragmentShaderSources
+        mainProgram = gl::CreateProgram(1, &tavernVertexShader, ARRAYSIZE(fragmentShaderSources), fragmentShaderSources);
+    }
+
+    // Deferred shading programs: G-buffer pass, then one fullscreen lighting pass
+    {
+        gBufferProgram = gl::CreateBasicProgram(
+            tavernVertexShader,
+
+            // Fragment shader
+            R"GLSL(
+            in vec2 vUV;
+            in vec3 vWorldNormal;
+            layout(location = 0) out vec4 gAlbedo;
+            layout(location = 1) out vec2 gNormal;
+            layout(location = 2) out vec4 gEmissive;
+
+            uniform sampler2D diffuseTexture;  // Texture channel 0
+            uniform sampler2D emissiveTexture; // Texture channel 1
+
+            // Octahedral mapping of the unit sphere to [-1, 1]^2
+            vec2 EncodeNormal(vec3 n)
+            {
+                n /= abs(n.x) + abs(n.y) + abs(n.z);
+                vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+                return n.z >= 0.0 ? n.xy : folded;
+            }
+
+            void main()
+            {
+                gAlbedo   = vec4(texture(diffuseTexture, vUV).rgb, 1.0);
+                gNormal   = EncodeNormal(normalize(vWorldNormal));
+                gEmissive = vec4(texture(emissiveTexture, vUV).rgb, 1.0);
+            }
+            )GLSL"
         );
 
-        glUseProgram(mainProgram);
-        glUniform3fv(glGetUniformLocation(mainProgram, "candleWorldPositions"), Tavern::CandlesCount, Tavern::CandlesPositions[0].e);
+        const char* lightingFragmentShaderSources[] = {
+            clusters::attenuationShader,
+            tavernLighting,
+            R"GLSL(
+            in vec2 vUV;
+            layout(location = 0) out vec4 finalColor;
+            layout(location = 1) out vec4 emissiveColor;
+
+            uniform sampler2D gBufferAlbedo;   // Texture channel 0
+            uniform sampler2D gBufferEmissive; // Texture channel 1
+            uniform sampler2D gBufferNormal;   // Texture channel 8
+            uniform sampler2D gBufferDepth;    // Texture channel 9
+
+            uniform mat4 inverseView;
+            uniform vec4 projectionTerms; // projection[0][0], [1][1], [2][2] and [3][2]
+
+            vec3 DecodeNormal(vec2 e)
+            {
+                vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+                if (n.z < 0.0)
+                    n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+                return normalize(n);
+            }
+
+            void main()
+            {
+                float depth = texture(gBufferDepth, vUV).r;
+                if (depth == 1.0)
+                    discard; // Nothing rendered there
+
+                // Back to view space, then world space
+                vec3 ndc = vec3(vUV, depth) * 2.0 - 1.0;
+                float viewDepth = projectionTerms.w / (ndc.z + projectionTerms.z);
+                vec3 viewPosition = vec3(ndc.xy * viewDepth / projectionTerms.xy, -viewDepth);
+                vec3 worldPosition = (inverseView * vec4(viewPosition, 1.0)).xyz;
+
+                vec3 emissive = texture(gBufferEmissive, vUV).rgb;
+                vec3 albedo   = texture(gBufferAlbedo, vUV).rgb;
+                vec3 normal   = DecodeNormal(texture(gBufferNormal, vUV).xy);
+
+                finalColor    = vec4(ShadeTavern(albedo, emissive, worldPosition, normal, viewDepth), 1.0);
+                emissiveColor = vec4(emissive, 1.0);
+                gl_FragDepth  = depth;
+            }
+            )GLSL"
+        };
+
+        deferredLightingProgram = gl::CreateProgram(1, &post::fullscreenVertexShader, ARRAYSIZE(lightingFragmentShaderSources), lightingFragmentShaderSources);
+        glGenVertexArrays(1, &emptyVertexArray);
     }
 
-    // Post process program
-    postProcessProgram = gl::CreateBasicProgram(
-        // Vertex shader
-        R"GLSL(
-        layout(location = 0) in vec3 aPosition;
-        layout(location = 1) in vec2 aUV;
-        out vec2 vUV;
+    // Light buffers
+    {
+        glGenBuffers(1, &candleBuffer);
+        glGenTextures(1, &candleTexture);
+        glBindBuffer(GL_TEXTURE_BUFFER, candleBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, candleTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, candleBuffer);
+
+        glGenBuffers(1, &clusterRangeBuffer);
+        glGenTextures(1, &clusterRangeTexture);
+        glBindBuffer(GL_TEXTURE_BUFFER, clusterRangeBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, clusterRangeTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, clusterRangeBuffer);
+
+        glGenBuffers(1, &clusterIndexBuffer);
+        glGenTextures(1, &clusterIndexTexture);
+        glBindBuffer(GL_TEXTURE_BUFFER, clusterIndexBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, clusterIndexTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, clusterIndexBuffer);
+
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+        SpawnCandles(extraCandleCount);
+    }
 
-        void main()
-        {
-            gl_Position = vec4(aPosition, 1.0);
-            vUV = aUV;
-        }
-        )GLSL",
+    gl::CreateTimer(&tavernTimer);
+    gl::CreateTimer(&gBufferTimer);
+    gl::CreateTimer(&lightingTimer);
+    gl::CreateTimer(&depthPrepassTimer);
+    gl::CreateTimer(&prepassShadingTimer);
 
-        // Fragment shader
-        R"GLSL(
-        in vec2 vUV;
-        layout(location = 0) out vec4 fragColor;
+    // Post process program
+    {
+        // Bloom and exposure apply to linear radiance, the LUT returns the encoded display color
+        const char* postProcessFragmentShaders[] = {
+            grading::lutShader,
+            post::autoExposureShader,
+            R"GLSL(
+            in vec2 vUV;
+            layout(location = 0) out vec4 fragColor;
 
-        uniform sampler2D colorTexture;
-        uniform mat4 colorTransform;
+            uniform sampler2D colorTexture;
+            uniform sampler2D bloomTexture;
+            uniform float bloomIntensity;
+            uniform float exposure;
+            uniform bool useAutoExposure;
 
-        void main()
-        {
-            fragColor = colorTransform * texture(colorTexture, vUV);
-        }
-        )GLSL"
-    );
+            void main()
+            {
+                vec3 color = texture(colorTexture, vUV).rgb + bloomIntensity * texture(bloomTexture, vUV).rgb;
+                fragColor = vec4(ApplyLut(color * (useAutoExposure ? exposure * GetAutoExposure() : exposure)), 1.0);
+            }
+            )GLSL"
+        };
+        postProcessProgram = gl::CreateProgram(1, &post::fullscreenVertexShader, ARRAYSIZE(postProcessFragmentShaders), postProcessFragmentShaders);
+    }
     
     // Setup sane default uniforms
     glUseProgram(postProcessProgram);
-    glUniformMatrix4fv(glGetUniformLocation(postProcessProgram, "colorTransform"), 1, GL_FALSE, mat4Identity().e);
+    glUniform1i(glGetUniformLocation(postProcessProgram, "bloomTexture"), 1);
+    glUniform1i(glGetUniformLocation(postProcessProgram, "adaptedLuminanceTexture"), 2);
+    glUniform1i(glGetUniformLocation(postProcessProgram, "lutTexture"), 3);
+    glUniform4fv(glGetUniformLocation(postProcessProgram, "lutShaper"), 1, grading::GetShaper(gradingLut).e);
+
+    glGenTextures(1, &gradingLutTexture);
+    glBindTexture(GL_TEXTURE_3D, gradingLutTexture);
+    grading::Bake(&gradingLut, gradingSettings);
+    grading::Upload(gradingLut);
+    bakedGradingSettings = gradingSettings;
 
     // Load diffuse/emissive texture
     {
@@ -209,12 +442,173 @@ DemoFBO::DemoFBO(const DemoInputs& inputs)
         gl::SetTextureDefaultParams();
     }
 
+    glGenTextures(3, irradianceVolumeTextures);
+    BakeIrradianceVolume();
+
     // Create framebuffer (for post process pass)
-    framebuffer.Generate((int)inputs.windowSize.x, (int)inputs.windowSize.y);
+    framebuffer.Generate((int)inputs.windowSize.x, (int)inputs.windowSize.y, post::ColorFormat::R11G11B10F);
+    bloom.Create();
+    bloom.Resize(framebuffer.width, framebuffer.height);
+    autoExposure.Create();
 }
 
-void DemoFBO::Framebuffer::Generate(int width, int height)
+// Cached, baked again only when the lights or the settings change
+void DemoFBO::BakeIrradianceVolume()
 {
+    volume::Lighting lighting;
+    lighting.candlePositions = Tavern::CandlesPositions;
+    lighting.candleCount     = Tavern::CandlesCount;
+    glGetUniformfv(mainProgram, glGetUniformLocation(mainProgram, "moonDiffuseColor"), lighting.moonColor.e);
+    glGetUniformfv(mainProgram, glGetUniformLocation(mainProgram, "candleDiffuseColor"), lighting.candleColor.e);
+    glGetUniformfv(mainProgram, glGetUniformLocation(mainProgram, "candleQuadAttenuation"), &lighting.candleQuadAttenuation);
+    lighting.lightCutoff = lightCutoff;
+
+    volume::Volume irradianceVolume;
+    if (!volume::LoadOrBake(&irradianceVolume, "media/fantasy_game_inn.volume.cache", volumeScene, lighting, volumeSettings))
+    {
+        useIrradianceVolume = false;
+        return;
+    }
+    volume::Upload(irradianceVolume, irradianceVolumeTextures);
+    memcpy(volumeResolution, irradianceVolume.resolution, sizeof(volumeResolution));
+    volumeBakeMilliseconds = irradianceVolume.bakeMilliseconds;
+
+    // Probes at the texel centers
+    float3 scale;
+    float3 bias;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        int resolution = irradianceVolume.resolution[axis];
+        float extent = irradianceVolume.boundsMax.e[axis] - irradianceVolume.boundsMin.e[axis];
+        scale.e[axis] = (resolution - 1) / (resolution * extent);
+        bias.e[axis] = 0.5f / resolution - irradianceVolume.boundsMin.e[axis] * scale.e[axis];
+    }
+
+    glUseProgram(mainProgram);
+    glUniform3fv(glGetUniformLocation(mainProgram, "irradianceVolumeScale"), 1, scale.e);
+    glUniform3fv(glGetUniformLocation(mainProgram, "irradianceVolumeBias"), 1, bias.e);
+    glUniform1f(glGetUniformLocation(mainProgram, "irradianceVolumeNormalOffset"), volumeSettings.probeSpacing * 0.5f);
+}
+
+// Tavern candles, plus small ones scattered on the tavern surfaces to show how lighting scales
+void DemoFBO::SpawnCandles(int extraCount)
+{
+    candles.clear();
+    for (int i = 0; i < Tavern::CandlesCount; ++i)
+        candles.push_back({ Tavern::CandlesPositions[i].x, Tavern::CandlesPositions[i].y, Tavern::CandlesPositions[i].z, 1.f });
+
+    // Same seed, the first candles stay in place when the count changes
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    int triangleCount = (int)volumeScene.positions.size() / 3;
+    while ((int)candles.size() < Tavern::CandlesCount + extraCount && triangleCount > 0)
+    {
+        const float3* triangle = &volumeScene.positions[(int)(uniform(random) * (triangleCount - 1)) * 3];
+        float3 normal = v3Cross(triangle[1] - triangle[0], triangle[2] - triangle[0]);
+        float u = calc::Sqrt(uniform(random));
+        float v = uniform(random);
+        float intensity = 0.05f + uniform(random) * 0.1f;
+        if (v3Length(normal) < 1e-6f)
+            continue;
+
+        // Uniform on the triangle, slightly off the surface
+        float3 position = triangle[0] * (1.f - u) + triangle[1] * (u * (1.f - v)) + triangle[2] * (u * v);
+        position += v3Normalize(normal) * 0.1f;
+        candles.push_back({ position.x, position.y, position.z, intensity });
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, candleBuffer);
+    gl::BufferData(GL_TEXTURE_BUFFER, candles.size() * sizeof(float4), candles.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// Light lists of the froxels seen from this view, streamed to their texture buffers
+void DemoFBO::UpdateLightClusters(const mat4& projection, const mat4& view)
+{
+    float quadAttenuation = 1.f;
+    glGetUniformfv(mainProgram, glGetUniformLocation(mainProgram, "candleQuadAttenuation"), &quadAttenuation);
+
+    clusterLights.resize(candles.size());
+    for (int i = 0; i < (int)candles.size(); ++i)
+    {
+        clusterLights[i].position = { candles[i].x, candles[i].y, candles[i].z };
+        clusterLights[i].radius   = clusters::GetLightRadius(candles[i].w, quadAttenuation, lightCutoff);
+    }
+    clusters::Build(&lightGrid, clusterSettings, projection, view, clusterLights.data(), (int)clusterLights.size());
+
+    // Never empty, texture buffers need storage
+    if (lightGrid.lightIndices.empty())
+        lightGrid.lightIndices.push_back(0);
+
+    glBindBuffer(GL_TEXTURE_BUFFER, clusterRangeBuffer);
+    gl::BufferData(GL_TEXTURE_BUFFER, lightGrid.ranges.size() * sizeof(uint32_t), lightGrid.ranges.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, clusterIndexBuffer);
+    gl::BufferData(GL_TEXTURE_BUFFER, lightGrid.lightIndices.size() * sizeof(uint32_t), lightGrid.lightIndices.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// Light parameters are edited on mainProgram (and baked from there), copied to the other programs using tavernLighting
+void DemoFBO::SetLightingUniforms(GLuint program)
+{
+    glUseProgram(program);
+    if (program != mainProgram)
+    {
+        const char* vectorNames[] = { "ambientColor", "moonDiffuseColor", "candleDiffuseColor", "irradianceVolumeScale", "irradianceVolumeBias" };
+        for (const char* name : vectorNames)
+        {
+            float3 value;
+            glGetUniformfv(mainProgram, glGetUniformLocation(mainProgram, name), value.e);
+            glUniform3fv(glGetUniformLocation(program, name), 1, value.e);
+        }
+
+        const char* scalarNames[] = { "candleQuadAttenuation", "irradianceVolumeNormalOffset" };
+        for (const char* name : scalarNames)
+        {
+            float value;
+            glGetUniformfv(mainProgram, glGetUniformLocation(mainProgram, name), &value);
+            glUniform1f(glGetUniformLocation(program, name), value);
+        }
+    }
+
+    glUniform1i(glGetUniformLocation(program, "irradianceVolumeR"), 2);
+    glUniform1i(glGetUniformLocation(program, "irradianceVolumeG"), 3);
+    glUniform1i(glGetUniformLocation(program, "irradianceVolumeB"), 4);
+    glUniform1i(glGetUniformLocation(program, "useIrradianceVolume"), useIrradianceVolume);
+    glUniform1f(glGetUniformLocation(program, "indirectIntensity"), indirectIntensity);
+    glUniform1i(glGetUniformLocation(program, "candles"), 5);
+    glUniform1i(glGetUniformLocation(program, "candleCount"), (int)candles.size());
+    glUniform1f(glGetUniformLocation(program, "lightCutoff"), lightCutoff);
+    glUniform1i(glGetUniformLocation(program, "useLightClusters"), useLightClusters);
+    glUniform1i(glGetUniformLocation(program, "clusterRanges"), 6);
+    glUniform1i(glGetUniformLocation(program, "clusterLightIndices"), 7);
+
+    // Tiles cover the current viewport
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float2 sliceScaleBias = clusters::GetSliceScaleBias(lightGrid);
+    glUniform3i(glGetUniformLocation(program, "clusterCounts"), clusterSettings.tilesX, clusterSettings.tilesY, clusterSettings.slices);
+    glUniform2f(glGetUniformLocation(program, "clusterSliceScaleBias"), sliceScaleBias.x, sliceScaleBias.y);
+    glUniform4f(glGetUniformLocation(program, "clusterViewport"), (float)viewport[0], (float)viewport[1], 1.f / viewport[2], 1.f / viewport[3]);
+
+    for (int c = 0; c < 3; ++c)
+    {
+        glActiveTexture(GL_TEXTURE2 + c);
+        glBindTexture(GL_TEXTURE_3D, irradianceVolumeTextures[c]);
+    }
+
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_BUFFER, candleTexture);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_BUFFER, clusterRangeTexture);
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_BUFFER, clusterIndexTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void DemoFBO::Framebuffer::Generate(int width, int height, post::ColorFormat format)
+{
+    this->format = format;
+
     // Create base buffer
     {
         glGenTextures(1, &finalTexture);
@@ -224,7 +618,7 @@ void DemoFBO::Framebuffer::Generate(int width, int height)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        gl::AllocateTexture2D(post::GetInternalFormat(format), width, height, GL_RGBA, GL_FLOAT);
 
         glBindTexture(GL_TEXTURE_2D, 0);
     }
@@ -238,7 +632,7 @@ void DemoFBO::Framebuffer::Generate(int width, int height)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        gl::AllocateTexture2D(post::GetInternalFormat(format), width, height, GL_RGBA, GL_FLOAT);
 
         glBindTexture(GL_TEXTURE_2D, 0);
     }
@@ -247,7 +641,7 @@ void DemoFBO::Framebuffer::Generate(int width, int height)
     {
         glGenRenderbuffers(1, &depthRenderbuffer);
         glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
+        gl::RenderbufferStorage(GL_DEPTH_COMPONENT, width, height);
 
         glBindRenderbuffer(GL_RENDERBUFFER, 0);
     }
@@ -276,31 +670,121 @@ void DemoFBO::Framebuffer::Resize(int width, int height)
     this->width = width;
     this->height = height;
     glBindTexture(GL_TEXTURE_2D, finalTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    gl::AllocateTexture2D(post::GetInternalFormat(format), width, height, GL_RGBA, GL_FLOAT);
     glBindTexture(GL_TEXTURE_2D, emissiveTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    gl::AllocateTexture2D(post::GetInternalFormat(format), width, height, GL_RGBA, GL_FLOAT);
     glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
+    gl::RenderbufferStorage(GL_DEPTH_COMPONENT, width, height);
 }
 
 void DemoFBO::Framebuffer::Delete()
 {
     glDeleteFramebuffers(1, &id);
-    glDeleteTextures(1, &finalTexture);
-    glDeleteTextures(1, &emissiveTexture);
-    glDeleteRenderbuffers(1, &depthRenderbuffer);
+    gl::DeleteTextures(1, &finalTexture);
+    gl::DeleteTextures(1, &emissiveTexture);
+    gl::DeleteRenderbuffers(1, &depthRenderbuffer);
+}
+
+void DemoFBO::GBuffer::Generate(int width, int height)
+{
+    GLuint* textures[] = { &albedoTexture, &normalTexture, &emissiveTexture, &depthTexture };
+    for (GLuint* texture : textures)
+    {
+        glGenTextures(1, texture);
+        glBindTexture(GL_TEXTURE_2D, *texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    Resize(width, height);
+
+    glGenFramebuffers(1, &id);
+    glBindFramebuffer(GL_FRAMEBUFFER, id);
+
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, emissiveTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    glDrawBuffers(3, drawBuffers);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    assert(status == GL_FRAMEBUFFER_COMPLETE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DemoFBO::GBuffer::Resize(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    glBindTexture(GL_TEXTURE_2D, albedoTexture);
+    gl::AllocateTexture2D(GL_SRGB8_ALPHA8, width, height, GL_RGBA, GL_UNSIGNED_BYTE);
+    glBindTexture(GL_TEXTURE_2D, normalTexture);
+    gl::AllocateTexture2D(GL_RG16F, width, height, GL_RG, GL_FLOAT);
+    glBindTexture(GL_TEXTURE_2D, emissiveTexture);
+    gl::AllocateTexture2D(GL_SRGB8_ALPHA8, width, height, GL_RGBA, GL_UNSIGNED_BYTE);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    gl::AllocateTexture2D(GL_DEPTH_COMPONENT24, width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void DemoFBO::GBuffer::Delete()
+{
+    glDeleteFramebuffers(1, &id);
+    gl::DeleteTextures(1, &albedoTexture);
+    gl::DeleteTextures(1, &normalTexture);
+    gl::DeleteTextures(1, &emissiveTexture);
+    gl::DeleteTextures(1, &depthTexture);
 }
 
 DemoFBO::~DemoFBO()
 {
     // Delete OpenGL objects
     framebuffer.Delete();
-    glDeleteTextures(1, &diffuseTexture);
-    glDeleteTextures(1, &emissiveTexture);
+    gBuffer.Delete();
+    gl::DeleteTextures(1, &diffuseTexture);
+    gl::DeleteTextures(1, &emissiveTexture);
+    gl::DeleteTextures(3, irradianceVolumeTextures);
+    gl::DeleteTextures(1, &candleTexture);
+    gl::DeleteBuffers(1, &candleBuffer);
+    gl::DeleteTextures(1, &clusterRangeTexture);
+    gl::DeleteBuffers(1, &clusterRangeBuffer);
+    gl::DeleteTextures(1, &clusterIndexTexture);
+    gl::DeleteBuffers(1, &clusterIndexBuffer);
+    gl::DeleteTimer(&tavernTimer);
+    gl::DeleteTimer(&gBufferTimer);
+    gl::DeleteTimer(&lightingTimer);
+    gl::DeleteTimer(&depthPrepassTimer);
+    gl::DeleteTimer(&prepassShadingTimer);
+    glDeleteProgram(depthProgram);
+    glDeleteVertexArrays(1, &positionVertexArray);
+    gl::DeleteBuffers(1, &positionBuffer);
+    glDeleteProgram(gBufferProgram);
+    glDeleteProgram(deferredLightingProgram);
+    glDeleteVertexArrays(1, &emptyVertexArray);
     glDeleteProgram(mainProgram);
     glDeleteProgram(postProcessProgram);
+    gl::DeleteTextures(1, &gradingLutTexture);
+    bloom.Delete();
+    autoExposure.Delete();
     glDeleteVertexArrays(1, &vertexArrayObject);
-    glDeleteBuffers(1, &vertexBuffer);
+    gl::DeleteBuffers(1, &vertexBuffer);
+}
+
+// Inverse of a rotation and translation (camera view matrices)
+static mat4 InverseRigidTransform(const mat4& m)
+{
+    mat4 inverse = mat4Transpose(m);
+    for (int r = 0; r < 3; ++r)
+    {
+        inverse.c[r].e[3] = 0.f;
+        inverse.c[3].e[r] = -(m.c[r].e[0] * m.c[3].e[0] + m.c[r].e[1] * m.c[3].e[1] + m.c[r].e[2] * m.c[3].e[2]);
+    }
+    return inverse;
 }
 
 static void EditFloatUniform(GLuint program, const char* name, float speed = 0.01f)
@@ -335,21 +819,60 @@ static void EditColorUniform(GLuint program, const char* name)
 
 void DemoFBO::UpdateAndRender(const DemoInputs& inputs)
 {
-    time += inputs.deltaTime;
-
     // Resize framebuffer if needed
     if ((int)inputs.windowSize.x != framebuffer.width || (int)inputs.windowSize.y != framebuffer.height)
+    {
         framebuffer.Resize((int)inputs.windowSize.x, (int)inputs.windowSize.y);
+        bloom.Resize(framebuffer.width, framebuffer.height);
+    }
 
     // Update camera
     mainCamera.UpdateFreeFly(inputs.cameraInputs);
 
     // Show debug info
-    static bool applyPostprocess = false;
+    static bool applyPostprocess = true;
     static bool showEmissive = false;
     ImGui::Checkbox("Perform post-process pass (use fbo)", &applyPostprocess);
     if (applyPostprocess)
     {
+        post::ColorFormat format = framebuffer.format;
+        if (post::EditColorFormat("Framebuffer format", &format))
+        {
+            framebuffer.Delete();
+            framebuffer.Generate((int)inputs.windowSize.x, (int)inputs.windowSize.y, format);
+        }
+        ImGui::SliderFloat("Exposure", &exposure, 0.05f, 8.f, "%.2f", ImGuiSliderFlags_Logarithmic);
+        if (ImGui::Checkbox("Auto exposure", &useAutoExposure))
+            autoExposure.reset = true;
+        if (useAutoExposure)
+        {
+            ImGui::SliderFloat("Adaptation speed", &autoExposure.adaptationSpeed, 0.1f, 10.f, "%.1f", ImGuiSliderFlags_Logarithmic);
+            ImGui::DragFloatRange2("Luminance range", &autoExposure.minLuminance, &autoExposure.maxLuminance, 0.01f, 0.001f, 100.f);
+            ImGui::Text("Auto exposure: %.3f ms (GPU)", autoExposure.timer.milliseconds);
+        }
+        ImGui::Checkbox("Bloom", &useBloom);
+        if (useBloom)
+        {
+            ImGui::SliderInt("Bloom levels", &bloom.levelCount, 1, BLOOM_MAX_LEVEL_COUNT);
+            ImGui::SliderFloat("Bloom radius", &bloom.filterRadius, 0.5f, 3.f);
+            ImGui::SliderFloat("Bloom intensity", &bloomIntensity, 0.f, 1.f);
+            ImGui::Text("Bloom: %.3f ms (GPU) at %dx%d", bloom.timer.milliseconds, framebuffer.width, framebuffer.height);
+            if (ImGui::Button("Measure bloom at 1080p and 4K"))
+            {
+                bloomCost1080p = post::MeasureBloom(bloom, 1920, 1080, 16);
+                bloomCost4K    = post::MeasureBloom(bloom, 3840, 2160, 16);
+            }
+            if (bloomCost1080p > 0.f)
+                ImGui::Text("1080p: %.3f ms, 4K: %.3f ms", bloomCost1080p, bloomCost4K);
+        }
+        ImGui::Combo("Tonemapper", (int*)&gradingSettings.tonemapper, "Reinhard\0ACES (fitted)\0");
+        ImGui::SliderFloat("Temperature", &gradingSettings.temperature, -1.f, 1.f);
+        ImGui::SliderFloat("Contrast", &gradingSettings.contrast, 0.5f, 2.f);
+        ImGui::SliderFloat("Saturation", &gradingSettings.saturation, 0.f, 2.f);
+        ImGui::DragFloat3("Lift", gradingSettings.lift.e, 0.005f, -0.5f, 0.5f);
+        ImGui::DragFloat3("Gamma", gradingSettings.gamma.e, 0.01f, 0.2f, 5.f);
+        ImGui::DragFloat3("Gain", gradingSettings.gain.e, 0.01f, 0.f, 4.f);
+        ImGui::Text("Grading LUT %d^3, baked in %.2f ms", gradingLut.size, gradingLut.bakeMilliseconds);
         ImGui::Checkbox("Show emissive only", &showEmissive);
         ImVec2 imageSize = { 128, 128 };
         ImGui::Image((ImTextureID)(size_t)framebuffer.finalTexture, imageSize,  ImVec2(0, 1), ImVec2(1, 0));
@@ -367,18 +890,66 @@ void DemoFBO::UpdateAndRender(const DemoInputs& inputs)
     EditColorUniform(mainProgram, "moonDiffuseColor");
     EditFloatUniform(mainProgram, "candleQuadAttenuation");
 
+    ImGui::Checkbox("Irradiance volume", &useIrradianceVolume);
+    if (useIrradianceVolume)
+    {
+        ImGui::SliderFloat("Indirect intensity", &indirectIntensity, 0.f, 4.f);
+        ImGui::SliderInt("Rays per probe", &volumeSettings.rayCount, 16, 1024);
+        if (ImGui::Button("Bake with current lights"))
+            BakeIrradianceVolume();
+        if (volumeBakeMilliseconds > 0.f)
+            ImGui::Text("%dx%dx%d probes, baked in %.1f ms", volumeResolution[0], volumeResolution[1], volumeResolution[2], volumeBakeMilliseconds);
+        else
+            ImGui::Text("%dx%dx%d probes, loaded from the cache", volumeResolution[0], volumeResolution[1], volumeResolution[2]);
+    }
+
+    ImGui::Checkbox("Clustered lighting", &useLightClusters);
+    if (ImGui::SliderInt("Extra candles", &extraCandleCount, 0, 8192))
+        SpawnCandles(extraCandleCount);
+    ImGui::SliderFloat("Light cutoff", &lightCutoff, 0.001f, 0.1f, "%.3f", ImGuiSliderFlags_Logarithmic);
+    if (useLightClusters)
+    {
+        ImGui::Text("%d candles, %d light indices (max %d per cluster), built in %.2f ms",
+            (int)candles.size(), (int)lightGrid.lightIndices.size(), lightGrid.maxClusterLightCount, lightGrid.buildMilliseconds);
+    }
+    // Last timings of both paths, measured when they were used
+    ImGui::Checkbox("Deferred shading", &useDeferredShading);
+    ImGui::Checkbox("Depth pre-pass", &useDepthPrepass);
+    ImGui::Text("Forward:  %.2f ms (GPU)", tavernTimer.milliseconds);
+    ImGui::Text("Forward with pre-pass: %.2f ms (depth %.2f + shading %.2f)",
+        depthPrepassTimer.milliseconds + prepassShadingTimer.milliseconds, depthPrepassTimer.milliseconds, prepassShadingTimer.milliseconds);
+    // Break-even: the shading saved on overdraw pays for the extra geometry pass
+    if (tavernTimer.milliseconds > 0.f && prepassShadingTimer.milliseconds > 0.f)
+    {
+        float saved = tavernTimer.milliseconds - prepassShadingTimer.milliseconds;
+        ImGui::Text("Pre-pass %s: saves %.2f ms of shading for %.2f ms of depth",
+            saved > depthPrepassTimer.milliseconds ? "pays off" : "does not pay off", saved, depthPrepassTimer.milliseconds);
+    }
+    ImGui::Text("Deferred: %.2f ms (G-buffer %.2f + lighting %.2f)",
+        gBufferTimer.milliseconds + lightingTimer.milliseconds, gBufferTimer.milliseconds, lightingTimer.milliseconds);
+    if (useDeferredShading && gBuffer.id)
+    {
+        ImVec2 imageSize = { 96, 96 };
+        ImGui::Image((ImTextureID)(size_t)gBuffer.albedoTexture, imageSize, ImVec2(0, 1), ImVec2(1, 0));
+        ImGui::SameLine();
+        ImGui::Image((ImTextureID)(size_t)gBuffer.normalTexture, imageSize, ImVec2(0, 1), ImVec2(1, 0));
+        ImGui::SameLine();
+        ImGui::Image((ImTextureID)(size_t)gBuffer.emissiveTexture, imageSize, ImVec2(0, 1), ImVec2(1, 0));
+    }
+
     // Setup post process program uniforms
     {
-        mat4 colorTransform = //mat4Identity();
+        // The LUT is only baked again when a grading setting changed
+        if (memcmp(&gradingSettings, &bakedGradingSettings, sizeof(grading::Settings)) != 0)
         {
-            calc::Sin(time * calc::TAU) * 0.5f + 1.f, 0.f, 0.f, 0.f,
-            0.f, 1.f, 0.f, 0.f,
-            0.f, 0.f, 1.f, 0.f,
-            0.f, 0.f, 0.f, 1.f,
-        };
+            grading::Bake(&gradingLut, gradingSettings);
+            glBindTexture(GL_TEXTURE_3D, gradingLutTexture);
+            grading::Upload(gradingLut);
+            bakedGradingSettings = gradingSettings;
+        }
 
         glUseProgram(postProcessProgram);
-        glUniformMatrix4fv(glGetUniformLocation(postProcessProgram, "colorTransform"), 1, GL_FALSE, colorTransform.e);
+        glUniform1f(glGetUniformLocation(postProcessProgram, "exposure"), exposure);
     }
 
     // =============================================
@@ -409,7 +980,14 @@ void DemoFBO::UpdateAndRender(const DemoInputs& inputs)
             glEnable(GL_FRAMEBUFFER_SRGB);
         }
 
-        RenderTavern(projection, view, model);
+        if (useDeferredShading)
+        {
+            RenderTavernDeferred(projection, view, model);
+        }
+        else
+        {
+            RenderTavern(projection, view, model);
+        }
 
         if (!applyPostprocess)
             glDisable(GL_FRAMEBUFFER_SRGB);
@@ -417,18 +995,32 @@ void DemoFBO::UpdateAndRender(const DemoInputs& inputs)
 
     if (applyPostprocess)
     {
-        // Render framebuffer to screen using postprocess shader and a fullscreen quad
+        GLuint bloomTexture = 0;
+        if (useBloom)
+            bloomTexture = bloom.Apply(framebuffer.emissiveTexture);
+        GLuint adaptedLuminanceTexture = 0;
+        if (useAutoExposure)
+            adaptedLuminanceTexture = autoExposure.Apply(framebuffer.finalTexture, inputs.deltaTime);
+
+        // Render framebuffer to screen using postprocess shader and a fullscreen triangle
         {
             glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
             glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
-            glEnable(GL_FRAMEBUFFER_SRGB);
             glUseProgram(postProcessProgram);
-
+            glUniform1f(glGetUniformLocation(postProcessProgram, "bloomIntensity"), useBloom && !showEmissive ? bloomIntensity : 0.f);
+            glUniform1i(glGetUniformLocation(postProcessProgram, "useAutoExposure"), useAutoExposure);
+
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, bloomTexture);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, adaptedLuminanceTexture);
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_3D, gradingLutTexture);
+            glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, showEmissive ? framebuffer.emissiveTexture : framebuffer.finalTexture);
-            glBindVertexArray(vertexArrayObject);
+            glBindVertexArray(emptyVertexArray);
 
-            glDrawArrays(GL_TRIANGLES, fullscreenQuad.start, fullscreenQuad.count);
-            glDisable(GL_FRAMEBUFFER_SRGB);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
         }
 
         // Copy framebuffer depth into backbuffer
@@ -446,6 +1038,30 @@ void DemoFBO::UpdateAndRender(const DemoInputs& inputs)
 
 void DemoFBO::RenderTavern(const mat4& projection, const mat4& view, const mat4& model)
 {
+    if (useLightClusters)
+        UpdateLightClusters(projection, view);
+
+    // Depth only: the shading pass then runs once per pixel instead of once per overdrawn fragment
+    if (useDepthPrepass)
+    {
+        gl::BeginTimer(&depthPrepassTimer);
+        glUseProgram(depthProgram);
+        glUniformMatrix4fv(glGetUniformLocation(depthProgram, "projection"), 1, GL_FALSE, projection.e);
+        glUniformMatrix4fv(glGetUniformLocation(depthProgram, "view"), 1, GL_FALSE, view.e);
+        glUniformMatrix4fv(glGetUniformLocation(depthProgram, "model"), 1, GL_FALSE, model.e);
+
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glBindVertexArray(positionVertexArray);
+        glDrawArrays(GL_TRIANGLES, 0, obj.count);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        gl::EndTimer(&depthPrepassTimer);
+
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    gl::BeginTimer(useDepthPrepass ? &prepassShadingTimer : &tavernTimer);
+
     // Setup main program uniforms
     {
         glUseProgram(mainProgram);
@@ -456,6 +1072,7 @@ void DemoFBO::RenderTavern(const mat4& projection, const mat4& view, const mat4&
 
         glUniform1i(glGetUniformLocation(mainProgram, "diffuseTexture"), 0);
         glUniform1i(glGetUniformLocation(mainProgram, "emissiveTexture"), 1);
+        SetLightingUniforms(mainProgram);
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, diffuseTexture);
@@ -469,4 +1086,92 @@ void DemoFBO::RenderTavern(const mat4& projection, const mat4& view, const mat4&
 
         glActiveTexture(GL_TEXTURE0);
     }
+
+    gl::EndTimer(useDepthPrepass ? &prepassShadingTimer : &tavernTimer);
+
+    if (useDepthPrepass)
+    {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+}
+
+// G-buffer of the current viewport size, then one lighting pass into the bound framebuffer (depth written back too)
+void DemoFBO::RenderTavernDeferred(const mat4& projection, const mat4& view, const mat4& model)
+{
+    if (useLightClusters)
+        UpdateLightClusters(projection, view);
+
+    GLint previousFramebuffer;
+    GLint viewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLboolean srgb = glIsEnabled(GL_FRAMEBUFFER_SRGB);
+
+    if (gBuffer.id == 0)
+        gBuffer.Generate(viewport[2], viewport[3]);
+    else if (gBuffer.width != viewport[2] || gBuffer.height != viewport[3])
+        gBuffer.Resize(viewport[2], viewport[3]);
+
+    // Geometry pass: no lighting, overdraw only costs the texture fetches
+    gl::BeginTimer(&gBufferTimer);
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, gBuffer.id);
+        glViewport(0, 0, gBuffer.width, gBuffer.height);
+        glEnable(GL_FRAMEBUFFER_SRGB); // Albedo and emissive are encoded
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glUseProgram(gBufferProgram);
+        glUniformMatrix4fv(glGetUniformLocation(gBufferProgram, "projection"), 1, GL_FALSE, projection.e);
+        glUniformMatrix4fv(glGetUniformLocation(gBufferProgram, "view"), 1, GL_FALSE, view.e);
+        glUniformMatrix4fv(glGetUniformLocation(gBufferProgram, "model"), 1, GL_FALSE, model.e);
+        glUniform1i(glGetUniformLocation(gBufferProgram, "diffuseTexture"), 0);
+        glUniform1i(glGetUniformLocation(gBufferProgram, "emissiveTexture"), 1);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, diffuseTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, emissiveTexture);
+
+        glBindVertexArray(vertexArrayObject);
+        glDrawArrays(GL_TRIANGLES, obj.start, obj.count);
+    }
+    gl::EndTimer(&gBufferTimer);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (!srgb)
+        glDisable(GL_FRAMEBUFFER_SRGB);
+
+    // Lighting pass: each pixel is lit once, by the lights of its cluster
+    gl::BeginTimer(&lightingTimer);
+    {
+        mat4 inverseView = InverseRigidTransform(view);
+
+        SetLightingUniforms(deferredLightingProgram);
+        glUniformMatrix4fv(glGetUniformLocation(deferredLightingProgram, "inverseView"), 1, GL_FALSE, inverseView.e);
+        glUniform4f(glGetUniformLocation(deferredLightingProgram, "projectionTerms"),
+            projection.c[0].e[0], projection.c[1].e[1], projection.c[2].e[2], projection.c[3].e[2]);
+        glUniform1i(glGetUniformLocation(deferredLightingProgram, "gBufferAlbedo"), 0);
+        glUniform1i(glGetUniformLocation(deferredLightingProgram, "gBufferEmissive"), 1);
+        glUniform1i(glGetUniformLocation(deferredLightingProgram, "gBufferNormal"), 8);
+        glUniform1i(glGetUniformLocation(deferredLightingProgram, "gBufferDepth"), 9);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, gBuffer.albedoTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, gBuffer.emissiveTexture);
+        glActiveTexture(GL_TEXTURE8);
+        glBindTexture(GL_TEXTURE_2D, gBuffer.normalTexture);
+        glActiveTexture(GL_TEXTURE9);
+        glBindTexture(GL_TEXTURE_2D, gBuffer.depthTexture);
+
+        glDepthFunc(GL_ALWAYS);
+        glBindVertexArray(emptyVertexArray);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glDepthFunc(GL_LESS);
+
+        glActiveTexture(GL_TEXTURE0);
+    }
+    gl::EndTimer(&lightingTimer);
 }
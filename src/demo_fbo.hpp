@@ -2,7 +2,14 @@
 
 #include "glad/glad.h"
 
+#include <vector>
+
+#include "color_grading.hpp"
+#include "gl_helpers.hpp"
+#include "irradiance_volume.hpp"
+#include "light_clusters.hpp"
 #include "mesh_builder.hpp"
+#include "postprocess.hpp"
 
 #include "demo.hpp"
 
@@ -16,18 +23,25 @@ public:
 
     void RenderTavern(const mat4& projection, const mat4& view, const mat4& model);
     void RenderTavernWithPostprocess(const mat4& projection, const mat4& view, const mat4& model);
+    void RenderTavernDeferred(const mat4& projection, const mat4& view, const mat4& model);
 
     GLuint GetDiffuseTexture() const { return diffuseTexture; }
 
 protected:
+    void BakeIrradianceVolume();
+    void SpawnCandles(int extraCount);
+    void UpdateLightClusters(const mat4& projection, const mat4& view);
+    void SetLightingUniforms(GLuint program);
+
     struct Framebuffer
     {
-        void Generate(int width, int height);
+        void Generate(int width, int height, post::ColorFormat format);
         void Resize(int width, int height);
         void Delete();
 
         int width = 0;
         int height = 0;
+        post::ColorFormat format = post::ColorFormat::R11G11B10F;
 
         GLuint id = 0;
         GLuint finalTexture = 0;
@@ -35,6 +49,23 @@ protected:
         GLuint depthRenderbuffer = 0;
     };
 
+    // Deferred shading inputs: albedo and emissive (sRGB), octahedral normal (RG16F) and depth
+    struct GBuffer
+    {
+        void Generate(int width, int height);
+        void Resize(int width, int height);
+        void Delete();
+
+        int width = 0;
+        int height = 0;
+
+        GLuint id = 0;
+        GLuint albedoTexture = 0;
+        GLuint normalTexture = 0;
+        GLuint emissiveTexture = 0;
+        GLuint depthTexture = 0;
+    };
+
     Camera mainCamera = {};
 
     GLuint vertexBuffer = 0;
@@ -45,11 +76,70 @@ protected:
     GLuint mainProgram = 0;
     GLuint diffuseTexture = 0;
     GLuint emissiveTexture = 0;
-    MeshSlice fullscreenQuad = {};
 
-    // Second pass data (postprocess)
+    // Second pass data (postprocess): exposure, then one fetch in the grading LUT of the HDR framebuffer
     GLuint postProcessProgram = 0;
+    float exposure = 1.f;
+
+    // Tonemapping, grading and sRGB encoding, baked again when the settings change
+    grading::Settings gradingSettings;
+    grading::Settings bakedGradingSettings;
+    grading::Lut gradingLut;
+    GLuint gradingLutTexture = 0;
+
+    // Bloom of the emissive target, added to the scene before tonemapping
+    post::Bloom bloom;
+    bool useBloom = true;
+    float bloomIntensity = 0.1f;
+    float bloomCost1080p = 0.f; // Measured on demand (ms)
+    float bloomCost4K = 0.f;
+
+    // Exposure adapted to the average scene luminance, computed and consumed on the GPU
+    post::AutoExposure autoExposure;
+    bool useAutoExposure = true;
     MeshSlice obj = {};
 
-    float time = 0.f;
+    // Static indirect lighting
+    volume::Scene volumeScene;
+    volume::BakeSettings volumeSettings;
+    GLuint irradianceVolumeTextures[3] = {};
+    int volumeResolution[3] = {};
+    float volumeBakeMilliseconds = 0.f; // Blocks the first frame when the cache is stale, 0 when loaded from it
+    bool useIrradianceVolume = true;
+    float indirectIntensity = 1.f;
+
+    // Candles: world position and intensity (multiplies candleDiffuseColor), read by the shader from a texture buffer
+    std::vector<float4> candles;
+    GLuint candleBuffer = 0;
+    GLuint candleTexture = 0;
+    int extraCandleCount = 0;
+    float lightCutoff = 0.02f; // Lights fade out where their attenuation falls to this
+
+    // Clustered forward lighting: light lists of the froxels, rebuilt each frame
+    bool useLightClusters = true;
+    clusters::GridSettings clusterSettings;
+    clusters::Grid lightGrid;
+    std::vector<clusters::Light> clusterLights;
+    GLuint clusterRangeBuffer = 0;
+    GLuint clusterRangeTexture = 0;
+    GLuint clusterIndexBuffer = 0;
+    GLuint clusterIndexTexture = 0;
+    gl::GpuTimer tavernTimer; // Forward pass without pre-pass
+
+    // Depth pre-pass with its own position only vertex stream
+    bool useDepthPrepass = false;
+    GLuint positionBuffer = 0;
+    GLuint positionVertexArray = 0;
+    GLuint depthProgram = 0;
+    gl::GpuTimer depthPrepassTimer;
+    gl::GpuTimer prepassShadingTimer;
+
+    // Deferred shading: G-buffer pass, then a fullscreen lighting pass
+    bool useDeferredShading = false;
+    GBuffer gBuffer = {};
+    GLuint gBufferProgram = 0;
+    GLuint deferredLightingProgram = 0;
+    GLuint emptyVertexArray = 0;
+    gl::GpuTimer gBufferTimer;
+    gl::GpuTimer lightingTimer;
 };
\ No newline at end of file
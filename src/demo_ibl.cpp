@@ -1,5 +1,8 @@
 #include "demo_ibl.hpp"
 
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <string>
 
 #include <GLFW/glfw3.h>
@@ -7,7 +10,10 @@
 
 #include "types.hpp"
 #include "calc.hpp"
+#include "brdf_lut.hpp"
+#include "environment.hpp"
 #include "gl_helpers.hpp"
+#include "probe.hpp"
 
 constexpr int nrRows = 7;
 constexpr int nrColumns = 7;
@@ -20,6 +26,258 @@ struct Vertex
     float3 normal;
 };
 
+// Reloaded from the probe file when evicted
+static void UploadProbeCubemap(const probe::Probe& probe, const std::string& filename)
+{
+    auto reload = [filename]()
+    {
+        probe::Probe reloaded;
+        if (probe::Load(&reloaded, filename.c_str()))
+            UploadProbeCubemap(reloaded, filename);
+        probe::Close(&reloaded);
+    };
+    gl::UploadCubemap(probe.prefiltered, reload);
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+// Prefiltered cubemap of a loaded probe
+static void UploadProbe(const probe::Probe& probe, const char* filename, GLuint prefilteredTexture)
+{
+    auto start = std::chrono::steady_clock::now();
+    GLint boundTexture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_CUBE_MAP, &boundTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilteredTexture);
+    UploadProbeCubemap(probe, filename);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, (GLuint)boundTexture);
+
+    float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Probe uploaded: %s (%s, %.1f ms)\n", filename, dds::FormatName(probe.prefiltered.format), milliseconds);
+}
+
+// Same filter as env::PrefilterGGX, the source mips come from glGenerateMipmap and the cube faces are seamless
+static const char* prefilterVertexShader = R"GLSL(
+void main()
+{
+    // Fullscreen triangle
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)GLSL";
+
+static const char* prefilterFragmentShader = R"GLSL(
+out vec4 fragColor;
+
+uniform samplerCube source;
+uniform float sourceSize;
+
+// Face and level rendered
+uniform vec3 faceS;
+uniform vec3 faceT;
+uniform vec3 faceN;
+uniform float size;
+uniform float roughness;
+uniform float minLod;
+uniform int sampleCount;
+
+const float PI = 3.14159265359;
+
+float RadicalInverse(uint bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10;
+}
+
+// See env::GetPrefilterSampleLod
+float GetSampleLod(float NdotH)
+{
+    float a2 = roughness * roughness * roughness * roughness;
+    float d = NdotH * NdotH * (a2 - 1.0) + 1.0;
+    float pdf = a2 / (PI * d * d) / 4.0;
+
+    float sampleSolidAngle = 1.0 / (float(sampleCount) * pdf + 0.0001);
+    float texelSolidAngle  = 4.0 * PI / (6.0 * sourceSize * sourceSize);
+    return max(0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0, minLod);
+}
+
+void main()
+{
+    vec2 st = gl_FragCoord.xy / size * 2.0 - 1.0;
+    vec3 N = normalize(st.x * faceS + st.y * faceT + faceN);
+    if (roughness == 0.0)
+    {
+        fragColor = textureLod(source, N, minLod);
+        return;
+    }
+
+    vec3 up = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 T = normalize(cross(up, N));
+    vec3 B = cross(N, T);
+
+    float a = roughness * roughness;
+    vec4 sum = vec4(0.0);
+    float weightSum = 0.0;
+    for (int i = 0; i < sampleCount; ++i)
+    {
+        float u = float(i) / float(sampleCount);
+        float v = RadicalInverse(uint(i));
+
+        float phi = 2.0 * PI * u;
+        float cosTheta = sqrt((1.0 - v) / (1.0 + (a * a - 1.0) * v));
+        float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+        vec3 h = vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+
+        // L = reflect(-V, H) with V = N
+        vec3 l = h * (2.0 * cosTheta) - vec3(0.0, 0.0, 1.0);
+        if (l.z <= 0.0)
+            continue;
+
+        vec3 L = T * l.x + B * l.y + N * l.z;
+        sum += textureLod(source, L, GetSampleLod(cosTheta)) * l.z;
+        weightSum += l.z;
+    }
+    fragColor = sum / weightSum;
+}
+)GLSL";
+
+// GPU backend of env::PrefilterGGX: renders each face and level of a cubemap, read back as RGBA16F
+static bool PrefilterCubemapGGX(const env::Cubemap& source, const env::PrefilterSettings& settings, dds::Image* prefiltered)
+{
+    if (source.size <= 0 || settings.size <= 0 || (settings.size & (settings.size - 1)) != 0)
+    {
+        fprintf(stderr, "Invalid prefilter size %d (power of two expected)\n", settings.size);
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int levelCount = env::GetPrefilterLevelCount(settings);
+
+    GLint previousFramebuffer;
+    GLint previousViewport[4];
+    GLint previousCubemap;
+    GLint previousProgram;
+    GLint previousVertexArray;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    glGetIntegerv(GL_TEXTURE_BINDING_CUBE_MAP, &previousCubemap);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    GLboolean seamless  = glIsEnabled(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    // Source with its full mip chain
+    GLuint sourceTexture;
+    glGenTextures(1, &sourceTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, sourceTexture);
+    for (int i = 0; i < 6; ++i)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA16F, source.size, source.size, 0, GL_RGBA, GL_FLOAT, source.faces[i].data());
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+    // Render target: every face and level of a cubemap
+    GLuint targetTexture;
+    glGenTextures(1, &targetTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, targetTexture);
+    for (int level = 0; level < levelCount; ++level)
+        for (int i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGBA16F, settings.size >> level, settings.size >> level, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    GLuint program = gl::CreateBasicProgram(prefilterVertexShader, prefilterFragmentShader);
+    GLuint vertexArray;
+    glGenVertexArrays(1, &vertexArray);
+    glBindVertexArray(vertexArray);
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    glUseProgram(program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, sourceTexture);
+    glUniform1i(glGetUniformLocation(program, "source"), 0);
+    glUniform1f(glGetUniformLocation(program, "sourceSize"), (float)source.size);
+    glUniform1i(glGetUniformLocation(program, "sampleCount"), settings.sampleCount);
+
+    bool success = true;
+    for (int level = 0; level < levelCount && success; ++level)
+    {
+        int size = settings.size >> level;
+        glViewport(0, 0, size, size);
+        glUniform1f(glGetUniformLocation(program, "size"), (float)size);
+        glUniform1f(glGetUniformLocation(program, "roughness"), env::GetPrefilterRoughness(level, levelCount));
+        glUniform1f(glGetUniformLocation(program, "minLod"), log2f((float)source.size / size));
+
+        for (int i = 0; i < 6; ++i)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, targetTexture, level);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            {
+                fprintf(stderr, "Prefilter framebuffer incomplete\n");
+                success = false;
+                break;
+            }
+
+            const env::FaceAxes& axes = env::faceAxes[i];
+            glUniform3f(glGetUniformLocation(program, "faceS"), axes.s.x, axes.s.y, axes.s.z);
+            glUniform3f(glGetUniformLocation(program, "faceT"), axes.t.x, axes.t.y, axes.t.z);
+            glUniform3f(glGetUniformLocation(program, "faceN"), axes.n.x, axes.n.y, axes.n.z);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+    }
+
+    // Read back (waits for the GPU)
+    if (success)
+    {
+        dds::Image image;
+        dds::Allocate(&image, dds::Format::RGBA32F, settings.size, settings.size, 6, levelCount);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, targetTexture);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        for (int i = 0; i < 6; ++i)
+            for (int level = 0; level < levelCount; ++level)
+                glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGBA, GL_FLOAT, image.levels[i][level].data);
+        dds::Convert(image, dds::Format::RGBA16F, prefiltered);
+        dds::Free(&image);
+    }
+
+    // Unbound first, a program deleted while current would stay alive
+    glUseProgram(previousProgram);
+    glBindVertexArray(previousVertexArray);
+    glDeleteVertexArrays(1, &vertexArray);
+    glDeleteProgram(program);
+    glDeleteFramebuffers(1, &framebuffer);
+    gl::DeleteTextures(1, &targetTexture);
+    gl::DeleteTextures(1, &sourceTexture);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, previousCubemap);
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+    if (!seamless)
+        glDisable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (success)
+        printf("Prefiltered GGX on GPU: %d levels from %d to %d, %d samples (%.1f ms with upload and read back)\n",
+            levelCount, settings.size, settings.size >> (levelCount - 1), settings.sampleCount, milliseconds);
+    return success;
+}
+
 DemoIBL::DemoIBL(const DemoInputs& inputs)
 {
     mainCamera.position = { 0,0,4.f };
@@ -45,7 +303,7 @@ DemoIBL::DemoIBL(const DemoInputs& inputs)
         // In VRAM
         glGenBuffers(1, &pbrSphere.VBO);
         glBindBuffer(GL_ARRAY_BUFFER, pbrSphere.VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+        gl::BufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 
         //free(vertices);
     }
@@ -108,6 +366,13 @@ DemoIBL::DemoIBL(const DemoInputs& inputs)
         uniform vec3 lightPositions[4];
         uniform vec3 lightColors[4];
 
+        //Environment (diffuse irradiance as order 3 SH, see sh::GetShaderCoefficients, and GGX prefiltered radiance)
+        uniform vec3 shIrradiance[9];
+        uniform samplerCube prefilteredMap;
+        uniform float prefilteredMaxLod;
+        uniform sampler2D brdfLUT; // Split sum scale and bias of F0 by NdotV and roughness
+        uniform float environmentIntensity;
+
         const float PI = 3.14159265359;
         
 
@@ -116,6 +381,28 @@ DemoIBL::DemoIBL(const DemoInputs& inputs)
             return F0 + (1.0 - F0) * pow(max(1.0 - cosTheta, 0.0), 5.0);
         }  
 
+        vec3 FresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
+        {
+            return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(max(1.0 - cosTheta, 0.0), 5.0);
+        }
+
+        vec3 EvaluateIrradiance(vec3 n)
+        {
+            vec3 irradiance = shIrradiance[0]
+                + shIrradiance[1] * n.y + shIrradiance[2] * n.z + shIrradiance[3] * n.x
+                + shIrradiance[4] * (n.x * n.y) + shIrradiance[5] * (n.y * n.z) + shIrradiance[6] * (3.0 * n.z * n.z - 1.0)
+                + shIrradiance[7] * (n.x * n.z) + shIrradiance[8] * (n.x * n.x - n.y * n.y);
+            return max(irradiance, vec3(0.0)) * environmentIntensity; // SH ringing can go below zero
+        }
+
+        vec3 EvaluateSpecularEnvironment(vec3 N, vec3 V, vec3 F, float roughness)
+        {
+            vec3 R = reflect(-V, N);
+            vec3 prefiltered = textureLod(prefilteredMap, R, roughness * prefilteredMaxLod).rgb * environmentIntensity;
+            vec2 brdf = texture(brdfLUT, vec2(max(dot(N, V), 0.0), roughness)).rg;
+            return prefiltered * (F * brdf.x + brdf.y);
+        }
+
         float DistributionGGX(vec3 N, vec3 H, float roughness)
         {
             float a      = roughness*roughness;
@@ -195,15 +482,13 @@ DemoIBL::DemoIBL(const DemoInputs& inputs)
                 Lo += (kD * albedo / PI + specular) * radiance * NdotL;  // note that we already multiplied the BRDF by the Fresnel (kS) so we won't multiply by kS again
             }
             
-            vec3 ambiant = vec3(0.03) * albedo * ao;
+            ///Environment lighting
+            vec3 kS = FresnelSchlickRoughness(max(dot(N, V), 0.0), F0, roughness);
+            vec3 kD = (vec3(1.0) - kS) * (1.0 - metallic);
+            vec3 ambiant = (kD * EvaluateIrradiance(N) * albedo + EvaluateSpecularEnvironment(N, V, kS, roughness)) * ao;
             vec3 color = ambiant + Lo;
-            
-            //HDR
-            color = color / (color + vec3(1.0));
-
-            //Gamma correction
-            color = pow(color,vec3(1.0/2.2));
 
+            // Linear radiance, tonemapped and encoded by the post pass
             fragColor = vec4(color,1);
         }
         )GLSL"
@@ -247,14 +532,19 @@ DemoIBL::DemoIBL(const DemoInputs& inputs)
         //Material
         uniform sampler2D albedoMap;
         uniform sampler2D normalMap;
-        uniform sampler2D metallicMap;
-        uniform sampler2D roughnessMap;
-        uniform sampler2D aoMap;
+        uniform sampler2D ormMap; // Occlusion, roughness, metallic
 
         //Lights
         uniform vec3 lightPositions;
         uniform vec3 lightColors;
 
+        //Environment (diffuse irradiance as order 3 SH, see sh::GetShaderCoefficients, and GGX prefiltered radiance)
+        uniform vec3 shIrradiance[9];
+        uniform samplerCube prefilteredMap;
+        uniform float prefilteredMaxLod;
+        uniform sampler2D brdfLUT; // Split sum scale and bias of F0 by NdotV and roughness
+        uniform float environmentIntensity;
+
         const float PI = 3.14159265359;
         
         // ----------------------------------------------------------------------------
@@ -264,7 +554,10 @@ DemoIBL::DemoIBL(const DemoInputs& inputs)
         // technique somewhere later in the normal mapping tutorial.
         vec3 getNormalFromMap()
         {
-            vec3 tangentNormal = texture(normalMap, vUV).xyz * 2.0 - 1.0;
+            // Normal maps are compressed as BC5 (xy only), rebuild z
+            vec3 tangentNormal;
+            tangentNormal.xy = texture(normalMap, vUV).xy * 2.0 - 1.0;
+            tangentNormal.z  = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
 
             vec3 Q1  = dFdx(vWorldPos);
             vec3 Q2  = dFdy(vWorldPos);
@@ -318,13 +611,36 @@ DemoIBL::DemoIBL(const DemoInputs& inputs)
         {
             return F0 + (1.0 - F0) * pow(max(1.0 - cosTheta, 0.0), 5.0);
         }
+        // ----------------------------------------------------------------------------
+        vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
+        {
+            return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(max(1.0 - cosTheta, 0.0), 5.0);
+        }
+        // ----------------------------------------------------------------------------
+        vec3 EvaluateIrradiance(vec3 n)
+        {
+            vec3 irradiance = shIrradiance[0]
+                + shIrradiance[1] * n.y + shIrradiance[2] * n.z + shIrradiance[3] * n.x
+                + shIrradiance[4] * (n.x * n.y) + shIrradiance[5] * (n.y * n.z) + shIrradiance[6] * (3.0 * n.z * n.z - 1.0)
+                + shIrradiance[7] * (n.x * n.z) + shIrradiance[8] * (n.x * n.x - n.y * n.y);
+            return max(irradiance, vec3(0.0)) * environmentIntensity; // SH ringing can go below zero
+        }
+
+        vec3 EvaluateSpecularEnvironment(vec3 N, vec3 V, vec3 F, float roughness)
+        {
+            vec3 R = reflect(-V, N);
+            vec3 prefiltered = textureLod(prefilteredMap, R, roughness * prefilteredMaxLod).rgb * environmentIntensity;
+            vec2 brdf = texture(brdfLUT, vec2(max(dot(N, V), 0.0), roughness)).rg;
+            return prefiltered * (F * brdf.x + brdf.y);
+        }
 
         void main()
         {
             vec3 albedo     = pow(texture(albedoMap, vUV).rgb, vec3(2.2));
-            float metallic  = texture(metallicMap, vUV).r;
-            float roughness = texture(roughnessMap, vUV).r;
-            float ao        = texture(aoMap, vUV).r;
+            vec3 orm        = texture(ormMap, vUV).rgb;
+            float ao        = orm.r;
+            float roughness = orm.g;
+            float metallic  = orm.b;
 
             vec3 N = getNormalFromMap();
             vec3 V = normalize(camPos - vWorldPos);
@@ -370,49 +686,100 @@ DemoIBL::DemoIBL(const DemoInputs& inputs)
             // add to outgoing radiance Lo
             Lo += (kD * albedo / PI + specular) * radiance * NdotL;  // note that we already multiplied the BRDF by the Fresnel (kS) so we won't multiply by kS again            
 
-            // ambient lighting (note that the next IBL tutorial will replace 
-            // this ambient lighting with environment lighting).
-            vec3 ambient = vec3(0.03) * albedo * ao;
+            // ambient lighting from the environment: SH irradiance and GGX prefiltered radiance
+            vec3 kSAmbient = fresnelSchlickRoughness(max(dot(N, V), 0.0), F0, roughness);
+            vec3 kDAmbient = (vec3(1.0) - kSAmbient) * (1.0 - metallic);
+            vec3 ambient = (kDAmbient * EvaluateIrradiance(N) * albedo + EvaluateSpecularEnvironment(N, V, kSAmbient, roughness)) * ao;
     
             vec3 color = ambient + Lo;
 
-            // HDR tonemapping
-            color = color / (color + vec3(1.0));
-            // gamma correct
-            color = pow(color, vec3(1.0/2.2)); 
-
+            // Linear radiance, tonemapped and encoded by the post pass
             fragColor = vec4(color, 1.0);
-            //fragColor = vec4(texture(aoMap, vUV).rgb, 1.0);
         }
         )GLSL"
     );
 
+    // Material maps are decoded concurrently (the masks are channel packed when the cache is built)
+    {
+        const char* files[] =
+        {
+            "media/Mat_Albedo.jpg",
+            "media/Mat_Normal.jpg",
+            "media/Mat_ORM",
+        };
+
+        GLuint textures[ARRAYSIZE(files)];
+        glGenTextures(ARRAYSIZE(textures), textures);
+        gl::UploadMaterialSet(ARRAYSIZE(files), textures, files);
+
+        pbrSphere.albedo = textures[0];
+        pbrSphere.normal = textures[1];
+        pbrSphere.orm    = textures[2];
+    }
+
+    // The skybox by default, any folder of faces, DDS cubemap or .hdr panorama otherwise
+    glGenTextures(1, &prefilteredTexture);
+    strcpy(environment, "media/skybox/");
+    LoadEnvironment();
+
+    brdf::Lut lut;
+    glGenTextures(1, &brdfLutTexture);
+    glBindTexture(GL_TEXTURE_2D, brdfLutTexture);
+    if (brdf::LoadOrGenerate(&lut))
     {
-        glGenTextures(1, &pbrSphere.albedo);
-        glBindTexture(GL_TEXTURE_2D, pbrSphere.albedo);
-        gl::UploadImage("media/Mat_Albedo.jpg");
-        gl::SetTextureDefaultParams();
-
-        glGenTextures(1, &pbrSphere.normal);
-        glBindTexture(GL_TEXTURE_2D, pbrSphere.normal);
-        gl::UploadImage("media/Mat_Normal.jpg");
-        gl::SetTextureDefaultParams();
-
-        glGenTextures(1, &pbrSphere.metallic);
-        glBindTexture(GL_TEXTURE_2D, pbrSphere.metallic);
-        gl::UploadImage("media/Mat_Metallic.jpg");
-        gl::SetTextureDefaultParams();
-
-        glGenTextures(1, &pbrSphere.roughness);
-        glBindTexture(GL_TEXTURE_2D, pbrSphere.roughness);
-        gl::UploadImage("media/Mat_Roughness.jpg");
-        gl::SetTextureDefaultParams();
-
-        glGenTextures(1, &pbrSphere.ao);
-        glBindTexture(GL_TEXTURE_2D, pbrSphere.ao);
-        gl::UploadImage("media/Mat_AO.jpg");
-        gl::SetTextureDefaultParams();
+        // RG16F, clamped and bilinear
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        gl::AllocateTexture2D(GL_RG16F, lut.size, lut.size, GL_RG, GL_HALF_FLOAT, lut.texels.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
+
+    sceneTarget.Generate((int)inputs.windowSize.x, (int)inputs.windowSize.y, post::ColorFormat::R11G11B10F);
+    tonemapper.Create();
+}
+
+// Diffuse (SH irradiance) and specular (GGX prefiltered) lighting from the probe, baked once (or by ibl-cook)
+void DemoIBL::LoadEnvironment()
+{
+    probe::Probe environmentProbe;
+    if (!probe::LoadOrBake(&environmentProbe, environment, probeSettings))
+    {
+        fprintf(stderr, "No environment probe, ambient lighting disabled\n");
+        sh::GetShaderCoefficients(sh::SH9(), shIrradiance);
+        return;
+    }
+
+    sh::GetShaderCoefficients(environmentProbe.irradiance, shIrradiance);
+    UploadProbe(environmentProbe, probe::GetProbeFilename(environment).c_str(), prefilteredTexture);
+    prefilteredLevelCount = environmentProbe.prefiltered.levelCount;
+    probe::Close(&environmentProbe);
+}
+
+void DemoIBL::BakeProbe(bool onGPU)
+{
+    auto start = std::chrono::steady_clock::now();
+    bool success;
+    if (onGPU)
+    {
+        env::Cubemap cubemap;
+        dds::Image prefiltered;
+        success = env::LoadCubemap(&cubemap, environment) && PrefilterCubemapGGX(cubemap, probeSettings.prefilter, &prefiltered);
+        if (success)
+        {
+            success = probe::Bake(environment, probeSettings, &cubemap, &prefiltered);
+            dds::Free(&prefiltered);
+        }
+    }
+    else
+    {
+        success = probe::Bake(environment, probeSettings);
+    }
+    bakeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (success)
+        LoadEnvironment();
 }
 
 DemoIBL::~DemoIBL()
@@ -420,27 +787,62 @@ DemoIBL::~DemoIBL()
     glDeleteProgram(basicPBR.id);
     glDeleteProgram(texturedPBR.id);
     glDeleteVertexArrays(1, &pbrSphere.VAO);
-    glDeleteBuffers(1, &pbrSphere.VBO);
-    glDeleteTextures(1, &pbrSphere.albedo);
-    glDeleteTextures(1, &pbrSphere.normal);
-    glDeleteTextures(1, &pbrSphere.metallic);
-    glDeleteTextures(1, &pbrSphere.roughness);
-    glDeleteTextures(1, &pbrSphere.ao);
+    gl::DeleteBuffers(1, &pbrSphere.VBO);
+    gl::DeleteTextures(1, &pbrSphere.albedo);
+    gl::DeleteTextures(1, &pbrSphere.normal);
+    gl::DeleteTextures(1, &pbrSphere.orm);
+    gl::DeleteTextures(1, &prefilteredTexture);
+    gl::DeleteTextures(1, &brdfLutTexture);
+    sceneTarget.Delete();
+    tonemapper.Delete();
 }
 
 void DemoIBL::UpdateAndRender(const DemoInputs& inputs)
 {
     glEnable(GL_DEPTH_TEST);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
     mainCamera.UpdateFreeFly(inputs.cameraInputs);
-    glClearColor(0.33, 0.33, 0.33, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glViewport(0, 0, (int)inputs.windowSize.x, (int)inputs.windowSize.y);
 
+    // Render to the HDR target, the previous framebuffer receives the tonemapped image
+    if ((int)inputs.windowSize.x != sceneTarget.width || (int)inputs.windowSize.y != sceneTarget.height)
+        sceneTarget.Resize((int)inputs.windowSize.x, (int)inputs.windowSize.y);
+    GLint previousFramebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneTarget.id);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.f); // Linear, about the former 0.33 gray once tonemapped and encoded
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
     static bool usePBRTexture = false;
 
     {
         ImGui::DragFloat3("Light pos", lights.position.e);
         ImGui::ColorEdit3("Light color", lights.color.e);
+        ImGui::SliderFloat("Exposure", &exposure, 0.05f, 8.f, "%.2f", ImGuiSliderFlags_Logarithmic);
+        post::ColorFormat format = sceneTarget.format;
+        if (post::EditColorFormat("Scene format", &format))
+        {
+            sceneTarget.Delete();
+            sceneTarget.Generate((int)inputs.windowSize.x, (int)inputs.windowSize.y, format);
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneTarget.id);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+        ImGui::SliderFloat("Environment intensity", &environmentIntensity, 0.f, 4.f);
+        ImGui::InputText("Environment", environment, sizeof(environment));
+        if (ImGui::Button("Load environment"))
+            LoadEnvironment();
+
+        ImGui::SliderInt("Prefilter samples", &probeSettings.prefilter.sampleCount, 1, 1024);
+        bool compressed = probeSettings.format == dds::Format::BC6H;
+        if (ImGui::Checkbox("BC6H probe", &compressed))
+            probeSettings.format = compressed ? dds::Format::BC6H : dds::Format::RGBA16F;
+        if (ImGui::Button("Bake on CPU"))
+            BakeProbe(false);
+        ImGui::SameLine();
+        if (ImGui::Button("Bake on GPU"))
+            BakeProbe(true);
+        if (bakeMilliseconds > 0.f)
+            ImGui::Text("Last bake: %.1f ms", bakeMilliseconds);
 
         static int e = 0;
         ImGui::RadioButton("Basic PBR", &e, 0);
@@ -462,14 +864,8 @@ void DemoIBL::UpdateAndRender(const DemoInputs& inputs)
             ImGui::Text("Normal");
             ImGui::Image((ImTextureID)(size_t)pbrSphere.normal, { 256, 256 });
 
-            ImGui::Text("Metallic");
-            ImGui::Image((ImTextureID)(size_t)pbrSphere.metallic, { 256, 256 });
-
-            ImGui::Text("Roughness");
-            ImGui::Image((ImTextureID)(size_t)pbrSphere.roughness, { 256, 256 });
-
-            ImGui::Text("Ambiant Occlusion");
-            ImGui::Image((ImTextureID)(size_t)pbrSphere.ao, { 256, 256 });
+            ImGui::Text("Occlusion / Roughness / Metallic");
+            ImGui::Image((ImTextureID)(size_t)pbrSphere.orm, { 256, 256 });
         }
     }
 
@@ -483,25 +879,28 @@ void DemoIBL::UpdateAndRender(const DemoInputs& inputs)
         glUniformMatrix4fv(glGetUniformLocation(usedProgram.id, "view"), 1, GL_FALSE, view.e);
 
         glUniform3f(glGetUniformLocation(usedProgram.id, "camPos"), mainCamera.position.x, mainCamera.position.y, mainCamera.position.z);
+        glUniform3fv(glGetUniformLocation(usedProgram.id, "shIrradiance"), SH_COEFFICIENT_COUNT, &shIrradiance[0][0]);
+        glUniform1f(glGetUniformLocation(usedProgram.id, "environmentIntensity"), environmentIntensity);
+        glUniform1i(glGetUniformLocation(usedProgram.id, "prefilteredMap"), 3);
+        glUniform1f(glGetUniformLocation(usedProgram.id, "prefilteredMaxLod"), (float)(prefilteredLevelCount - 1));
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, prefilteredTexture);
+        glUniform1i(glGetUniformLocation(usedProgram.id, "brdfLUT"), 4);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, brdfLutTexture);
 
         if (usePBRTexture)
         {
             glUniform1i(glGetUniformLocation(usedProgram.id, "albedoMap"), 0);
             glUniform1i(glGetUniformLocation(usedProgram.id, "normalMap"), 1);
-            glUniform1i(glGetUniformLocation(usedProgram.id, "metallicMap"), 2);
-            glUniform1i(glGetUniformLocation(usedProgram.id, "roughnessMap"), 3);
-            glUniform1i(glGetUniformLocation(usedProgram.id, "aoMap"), 4);
+            glUniform1i(glGetUniformLocation(usedProgram.id, "ormMap"), 2);
 
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, pbrSphere.albedo);
             glActiveTexture(GL_TEXTURE1);
             glBindTexture(GL_TEXTURE_2D, pbrSphere.normal);
             glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, pbrSphere.metallic);
-            glActiveTexture(GL_TEXTURE3);
-            glBindTexture(GL_TEXTURE_2D, pbrSphere.roughness);
-            glActiveTexture(GL_TEXTURE4);
-            glBindTexture(GL_TEXTURE_2D, pbrSphere.ao);
+            glBindTexture(GL_TEXTURE_2D, pbrSphere.orm);
         }
         else
         {
@@ -546,4 +945,7 @@ void DemoIBL::UpdateAndRender(const DemoInputs& inputs)
         glBindVertexArray(pbrSphere.VAO);
         glDrawArrays(GL_TRIANGLES, pbrSphere.mesh.start, pbrSphere.mesh.count);
     }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    tonemapper.Apply(sceneTarget.colorTexture, exposure);
 }
\ No newline at end of file
@@ -3,11 +3,15 @@
 #include "glad/glad.h"
 
 #include "mesh_builder.hpp"
+#include "postprocess.hpp"
 
 #include "demo.hpp"
 
 #include "demo_pbr.hpp"
 
+#include "probe.hpp"
+#include "sh.hpp"
+
 class DemoIBL : public Demo
 {
 public:
@@ -18,6 +22,8 @@ public:
     const char* Name() const final { return "IBL"; }
 
 private:
+    void LoadEnvironment();
+    void BakeProbe(bool onGPU);
 
     Camera mainCamera = {};
 
@@ -33,4 +39,20 @@ private:
         {0.f,0.f,10.f},{150.f,150.f,150.f},
     };
 
+    char environment[256] = {};
+    float shIrradiance[SH_COEFFICIENT_COUNT][3] = {}; // Premultiplied for the shader
+    float environmentIntensity = 1.f;
+
+    // Specular environment (GGX prefiltered, one roughness per level)
+    probe::BakeSettings probeSettings;
+    GLuint prefilteredTexture = 0;
+    int prefilteredLevelCount = 1;
+    GLuint brdfLutTexture = 0;
+    float bakeMilliseconds = 0.f;
+
+    // Objects output linear radiance, tonemapped once by the post pass
+    post::SceneTarget sceneTarget;
+    post::Tonemapper tonemapper;
+    float exposure = 1.f;
+
 };
\ No newline at end of file
@@ -5,11 +5,15 @@
 #include "calc.hpp"
 
 #include "gl_helpers.hpp"
+#include "vram_budget.hpp"
 #include "demo_mipmap.hpp"
 
 DemoMipmap::DemoMipmap(const DemoInputs& inputs)
     : demoFBO(inputs)
 {
+    // Levels are replaced below, they must not be streamed or reloaded afterwards
+    gl::FinishTextureStreaming(demoFBO.GetDiffuseTexture());
+    vram::Pin(vram::ResourceType::TEXTURE, demoFBO.GetDiffuseTexture());
     glBindTexture(GL_TEXTURE_2D, demoFBO.GetDiffuseTexture());
     
     // TODO: Remplacer le niveau 1 de mipmap par une texture unie
@@ -4,6 +4,7 @@
 
 #include "calc.hpp"
 #include "gl_helpers.hpp"
+#include "texture_atlas.hpp"
 
 #include "demo_normalmap.hpp"
 
@@ -17,6 +18,43 @@ struct Vertex
     float3 bitangent;
 };
 
+// Pages are never streamed (they are small and shared by many draws)
+// Cached pages can be evicted and read again, pages built at runtime stay resident
+static bool UploadAtlasPage(const atlas::Atlas& atlas, int page)
+{
+    TextureCacheEntry entry;
+    if (!atlas::LoadPageCacheEntry(&entry, atlas, page))
+        return false;
+
+    std::function<void()> reload;
+    if (page >= (int)atlas.pages.size() || atlas.pages[page].empty())
+    {
+        atlas::Atlas pageAtlas; // Only what is needed to find the page again
+        pageAtlas.name = atlas.name;
+        pageAtlas.settings = atlas.settings;
+        reload = [pageAtlas, page]() { UploadAtlasPage(pageAtlas, page); };
+    }
+
+    gl::UploadTexture(entry, reload);
+    gl::SetTextureDefaultParams();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return true;
+}
+
+// One texture per atlas page
+static void UploadAtlas(const atlas::Atlas& atlas, const GLuint* textures)
+{
+    GLint boundTexture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+    for (int page = 0; page < atlas.pageCount; ++page)
+    {
+        glBindTexture(GL_TEXTURE_2D, textures[page]);
+        UploadAtlasPage(atlas, page);
+    }
+    glBindTexture(GL_TEXTURE_2D, boundTexture);
+}
+
 DemoNormalMap::DemoNormalMap(const DemoInputs& inputs)
 {
     camera.position = { 0.f, 0.f, 2.f };
@@ -121,7 +159,7 @@ DemoNormalMap::DemoNormalMap(const DemoInputs& inputs)
         glGenBuffers(1, &vertexBuffer);
 
         glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+        gl::BufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
         free(vertices);
     }
 
@@ -198,6 +236,10 @@ DemoNormalMap::DemoNormalMap(const DemoInputs& inputs)
         uniform sampler2D albedoTexture;
         uniform sampler2D normalTexture;
 
+        // Region of the textures to sample (atlas), xy: offset, zw: scale
+        uniform vec4 albedoRect;
+        uniform vec4 normalRect;
+
         uniform vec3 lightPos;
         uniform vec3 viewPos;
 
@@ -209,10 +251,15 @@ DemoNormalMap::DemoNormalMap(const DemoInputs& inputs)
 
         void main()
         {
-            vec3 normal = texture(normalTexture, vUV).rgb;
-            normal = normalize(normal * 2.0 - 1.0);
+            // Normal maps are compressed as BC5 (xy only), rebuild z
+            vec2 albedoUV = albedoRect.xy + vUV * albedoRect.zw;
+            vec2 normalUV = normalRect.xy + vUV * normalRect.zw;
+
+            vec3 normal;
+            normal.xy = texture(normalTexture, normalUV).xy * 2.0 - 1.0;
+            normal.z  = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
 
-            vec3 albedo = texture(albedoTexture, vUV).rgb;
+            vec3 albedo = texture(albedoTexture, albedoUV).rgb;
 
             vec3 ambient = 0.1 * albedo;
 
@@ -229,7 +276,7 @@ DemoNormalMap::DemoNormalMap(const DemoInputs& inputs)
             fragColor = vec4(ambient + diffuse + specular, 1.0);            
 
             if (debugShowNormalMap)
-                fragColor = texture(normalTexture, vUV);
+                fragColor = texture(normalTexture, normalUV);
 
             if (debugShowGeometryNormals)
                 fragColor = vec4(normalize(normal), 1.0);
@@ -258,26 +305,35 @@ DemoNormalMap::DemoNormalMap(const DemoInputs& inputs)
     }
 
     {
-        glGenTextures(1, &whiteTexture);
-        glBindTexture(GL_TEXTURE_2D, whiteTexture);
-        gl::UploadColoredTexture(1.f, 1.f, 1.f, 1.f);
-        gl::SetTextureDefaultParams();
-    }
+        const unsigned char white[]  = { 255, 255, 255, 255 };
+        const unsigned char purple[] = { 128, 128, 255, 255 }; // Flat normal
 
-    {
-        glGenTextures(1, &purpleTexture);
-        glBindTexture(GL_TEXTURE_2D, purpleTexture);
-        gl::UploadColoredTexture(0.5f, 0.5f, 1.f, 1.f);
-        gl::SetTextureDefaultParams();
+        atlas::Image images[2];
+        images[0] = { "white", 1, 1, 4, white };
+        images[1] = { "purple", 1, 1, 4, purple };
+
+        // Linear and uncompressed: the flat normal must not go through BC1 endpoints nor sRGB decoding
+        atlas::Settings settings;
+        settings.pageSize = 64;
+        settings.linear = true;
+
+        atlas::Atlas colorAtlas;
+        if (atlas::Build(&colorAtlas, images, ARRAYSIZE(images), settings))
+        {
+            colorAtlas.name = "media/normalmap_constants";
+            glGenTextures(1, &colorAtlasTexture);
+            UploadAtlas(colorAtlas, &colorAtlasTexture);
+            whiteRect  = atlas::Find(colorAtlas, "white")->uvRect;
+            purpleRect = atlas::Find(colorAtlas, "purple")->uvRect;
+        }
     }
 }
 
 DemoNormalMap::~DemoNormalMap()
 {
-    glDeleteTextures(1, &purpleTexture);
-    glDeleteTextures(1, &whiteTexture);
-    glDeleteTextures(1, &normalTexture);
-    glDeleteTextures(1, &albedoTexture);
+    gl::DeleteTextures(1, &colorAtlasTexture);
+    gl::DeleteTextures(1, &normalTexture);
+    gl::DeleteTextures(1, &albedoTexture);
     glDeleteProgram(program);
 
 }
@@ -311,6 +367,8 @@ void DemoNormalMap::UpdateAndRender(const DemoInputs& inputs)
     glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, camera.position.e);
     glUniform1i(glGetUniformLocation(program, "albedoTexture"), 0);
     glUniform1i(glGetUniformLocation(program, "normalTexture"), 1);
+    glUniform4f(glGetUniformLocation(program, "albedoRect"), 0.f, 0.f, 1.f, 1.f);
+    glUniform4fv(glGetUniformLocation(program, "normalRect"), 1, disableNormalMap ? purpleRect.e : float4(0.f, 0.f, 1.f, 1.f).e);
     glUniform1i(glGetUniformLocation(program, "debugDisableLight"), 0);
     glUniform1i(glGetUniformLocation(program, "debugDisableNormalMap"), disableNormalMap);
     glUniform1i(glGetUniformLocation(program, "debugShowGeometryNormals"), debugMode == DebugMode::SHOW_GEO_NORMALS);
@@ -321,7 +379,7 @@ void DemoNormalMap::UpdateAndRender(const DemoInputs& inputs)
     glBindTexture(GL_TEXTURE_2D, albedoTexture);
 
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, disableNormalMap ? purpleTexture : normalTexture);
+    glBindTexture(GL_TEXTURE_2D, disableNormalMap ? colorAtlasTexture : normalTexture);
 
     glEnable(GL_DEPTH_TEST);
     glViewport(0, 0, (int)inputs.windowSize.x, (int)inputs.windowSize.y);
@@ -349,7 +407,8 @@ void DemoNormalMap::UpdateAndRender(const DemoInputs& inputs)
     {
         glUniform1i(glGetUniformLocation(program, "debugDisableLight"), 1);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, whiteTexture);
+        glBindTexture(GL_TEXTURE_2D, colorAtlasTexture);
+        glUniform4fv(glGetUniformLocation(program, "albedoRect"), 1, whiteRect.e);
         mat4 model = mat4Translate(lightPosition) * mat4Scale(0.05f);
         glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, model.e);
         glDrawArrays(GL_TRIANGLES, sphere.start, sphere.count);
@@ -4,6 +4,7 @@
 
 #include "demo.hpp"
 #include "mesh_builder.hpp"
+#include "types.hpp"
 
 class DemoNormalMap : public Demo
 {
@@ -22,8 +23,11 @@ private:
 
     GLuint albedoTexture = 0;
     GLuint normalTexture = 0;
-    GLuint whiteTexture = 0;
-    GLuint purpleTexture = 0;
+
+    // Constant colors share one atlas page
+    GLuint colorAtlasTexture = 0;
+    float4 whiteRect = {};
+    float4 purpleRect = {};
 
     float3 lightPosition = {};
 
@@ -7,6 +7,7 @@
 
 #include "types.hpp"
 #include "calc.hpp"
+#include "brdf_lut.hpp"
 #include "gl_helpers.hpp"
 
 constexpr int nrRows = 7;
@@ -45,7 +46,7 @@ DemoPBR::DemoPBR(const DemoInputs& inputs)
         // In VRAM
         glGenBuffers(1, &pbrSphere.VBO);
         glBindBuffer(GL_ARRAY_BUFFER, pbrSphere.VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+        gl::BufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 
         //free(vertices);
     }
@@ -108,6 +109,10 @@ DemoPBR::DemoPBR(const DemoInputs& inputs)
         uniform vec3 lightPositions[4];
         uniform vec3 lightColors[4];
 
+        //Uniform ambient environment (specular with the split sum scale and bias of F0)
+        uniform sampler2D brdfLUT;
+        const vec3 ambientColor = vec3(0.03);
+
         const float PI = 3.14159265359;
         
 
@@ -116,6 +121,11 @@ DemoPBR::DemoPBR(const DemoInputs& inputs)
             return F0 + (1.0 - F0) * pow(max(1.0 - cosTheta, 0.0), 5.0);
         }  
 
+        vec3 FresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
+        {
+            return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(max(1.0 - cosTheta, 0.0), 5.0);
+        }
+
         float DistributionGGX(vec3 N, vec3 H, float roughness)
         {
             float a      = roughness*roughness;
@@ -195,15 +205,15 @@ DemoPBR::DemoPBR(const DemoInputs& inputs)
                 Lo += (kD * albedo / PI + specular) * radiance * NdotL;  // note that we already multiplied the BRDF by the Fresnel (kS) so we won't multiply by kS again
             }
             
-            vec3 ambiant = vec3(0.03) * albedo * ao;
+            ///Ambient lighting
+            float NdotV = max(dot(N, V), 0.0);
+            vec3 kS = FresnelSchlickRoughness(NdotV, F0, roughness);
+            vec3 kD = (vec3(1.0) - kS) * (1.0 - metallic);
+            vec2 brdf = texture(brdfLUT, vec2(NdotV, roughness)).rg;
+            vec3 ambiant = ambientColor * (kD * albedo + kS * brdf.x + brdf.y) * ao;
             vec3 color = ambiant + Lo;
-            
-            //HDR
-            color = color / (color + vec3(1.0));
-
-            //Gamma correction
-            color = pow(color,vec3(1.0/2.2));
 
+            // Linear radiance, tonemapped and encoded by the post pass
             fragColor = vec4(color,1);
         }
         )GLSL"
@@ -247,14 +257,16 @@ DemoPBR::DemoPBR(const DemoInputs& inputs)
         //Material
         uniform sampler2D albedoMap;
         uniform sampler2D normalMap;
-        uniform sampler2D metallicMap;
-        uniform sampler2D roughnessMap;
-        uniform sampler2D aoMap;
+        uniform sampler2D ormMap; // Occlusion, roughness, metallic
 
         //Lights
         uniform vec3 lightPositions;
         uniform vec3 lightColors;
 
+        //Uniform ambient environment (specular with the split sum scale and bias of F0)
+        uniform sampler2D brdfLUT;
+        const vec3 ambientColor = vec3(0.03);
+
         const float PI = 3.14159265359;
         
         // ----------------------------------------------------------------------------
@@ -264,7 +276,10 @@ DemoPBR::DemoPBR(const DemoInputs& inputs)
         // technique somewhere later in the normal mapping tutorial.
         vec3 getNormalFromMap()
         {
-            vec3 tangentNormal = texture(normalMap, vUV).xyz * 2.0 - 1.0;
+            // Normal maps are compressed as BC5 (xy only), rebuild z
+            vec3 tangentNormal;
+            tangentNormal.xy = texture(normalMap, vUV).xy * 2.0 - 1.0;
+            tangentNormal.z  = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
 
             vec3 Q1  = dFdx(vWorldPos);
             vec3 Q2  = dFdy(vWorldPos);
@@ -318,13 +333,19 @@ DemoPBR::DemoPBR(const DemoInputs& inputs)
         {
             return F0 + (1.0 - F0) * pow(max(1.0 - cosTheta, 0.0), 5.0);
         }
+        // ----------------------------------------------------------------------------
+        vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
+        {
+            return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(max(1.0 - cosTheta, 0.0), 5.0);
+        }
 
         void main()
         {
             vec3 albedo     = pow(texture(albedoMap, vUV).rgb, vec3(2.2));
-            float metallic  = texture(metallicMap, vUV).r;
-            float roughness = texture(roughnessMap, vUV).r;
-            float ao        = texture(aoMap, vUV).r;
+            vec3 orm        = texture(ormMap, vUV).rgb;
+            float ao        = orm.r;
+            float roughness = orm.g;
+            float metallic  = orm.b;
 
             vec3 N = getNormalFromMap();
             vec3 V = normalize(camPos - vWorldPos);
@@ -370,49 +391,55 @@ DemoPBR::DemoPBR(const DemoInputs& inputs)
             // add to outgoing radiance Lo
             Lo += (kD * albedo / PI + specular) * radiance * NdotL;  // note that we already multiplied the BRDF by the Fresnel (kS) so we won't multiply by kS again            
 
-            // ambient lighting (note that the next IBL tutorial will replace 
-            // this ambient lighting with environment lighting).
-            vec3 ambient = vec3(0.03) * albedo * ao;
+            // ambient lighting (diffuse and specular of a uniform environment, see DemoIBL for real environment lighting)
+            float NdotV = max(dot(N, V), 0.0);
+            vec3 kSAmbient = fresnelSchlickRoughness(NdotV, F0, roughness);
+            vec3 kDAmbient = (vec3(1.0) - kSAmbient) * (1.0 - metallic);
+            vec2 brdf = texture(brdfLUT, vec2(NdotV, roughness)).rg;
+            vec3 ambient = ambientColor * (kDAmbient * albedo + kSAmbient * brdf.x + brdf.y) * ao;
     
             vec3 color = ambient + Lo;
 
-            // HDR tonemapping
-            color = color / (color + vec3(1.0));
-            // gamma correct
-            color = pow(color, vec3(1.0/2.2)); 
-
+            // Linear radiance, tonemapped and encoded by the post pass
             fragColor = vec4(color, 1.0);
-            //fragColor = vec4(texture(aoMap, vUV).rgb, 1.0);
         }
         )GLSL"
     );
 
+    // Material maps are decoded concurrently (the masks are channel packed when the cache is built)
     {
-        glGenTextures(1, &pbrSphere.albedo);
-        glBindTexture(GL_TEXTURE_2D, pbrSphere.albedo);
-        gl::UploadImage("media/Mat_Albedo.jpg");
-        gl::SetTextureDefaultParams();
-
-        glGenTextures(1, &pbrSphere.normal);
-        glBindTexture(GL_TEXTURE_2D, pbrSphere.normal);
-        gl::UploadImage("media/Mat_Normal.jpg");
-        gl::SetTextureDefaultParams();
-
-        glGenTextures(1, &pbrSphere.metallic);
-        glBindTexture(GL_TEXTURE_2D, pbrSphere.metallic);
-        gl::UploadImage("media/Mat_Metallic.jpg");
-        gl::SetTextureDefaultParams();
-
-        glGenTextures(1, &pbrSphere.roughness);
-        glBindTexture(GL_TEXTURE_2D, pbrSphere.roughness);
-        gl::UploadImage("media/Mat_Roughness.jpg");
-        gl::SetTextureDefaultParams();
-
-        glGenTextures(1, &pbrSphere.ao);
-        glBindTexture(GL_TEXTURE_2D, pbrSphere.ao);
-        gl::UploadImage("media/Mat_AO.jpg");
-        gl::SetTextureDefaultParams();
+        const char* files[] =
+        {
+            "media/Mat_Albedo.jpg",
+            "media/Mat_Normal.jpg",
+            "media/Mat_ORM",
+        };
+
+        GLuint textures[ARRAYSIZE(files)];
+        glGenTextures(ARRAYSIZE(textures), textures);
+        gl::UploadMaterialSet(ARRAYSIZE(files), textures, files);
+
+        pbrSphere.albedo = textures[0];
+        pbrSphere.normal = textures[1];
+        pbrSphere.orm    = textures[2];
     }
+
+    brdf::Lut lut;
+    glGenTextures(1, &brdfLutTexture);
+    glBindTexture(GL_TEXTURE_2D, brdfLutTexture);
+    if (brdf::LoadOrGenerate(&lut))
+    {
+        // RG16F, clamped and bilinear
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        gl::AllocateTexture2D(GL_RG16F, lut.size, lut.size, GL_RG, GL_HALF_FLOAT, lut.texels.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    sceneTarget.Generate((int)inputs.windowSize.x, (int)inputs.windowSize.y, post::ColorFormat::R11G11B10F);
+    tonemapper.Create();
 }
 
 DemoPBR::~DemoPBR()
@@ -420,27 +447,44 @@ DemoPBR::~DemoPBR()
     glDeleteProgram(basicPBR.id);
     glDeleteProgram(texturedPBR.id);
     glDeleteVertexArrays(1, &pbrSphere.VAO);
-    glDeleteBuffers(1, &pbrSphere.VBO);
-    glDeleteTextures(1, &pbrSphere.albedo);
-    glDeleteTextures(1, &pbrSphere.normal);
-    glDeleteTextures(1, &pbrSphere.metallic);
-    glDeleteTextures(1, &pbrSphere.roughness);
-    glDeleteTextures(1, &pbrSphere.ao);
+    gl::DeleteBuffers(1, &pbrSphere.VBO);
+    gl::DeleteTextures(1, &pbrSphere.albedo);
+    gl::DeleteTextures(1, &pbrSphere.normal);
+    gl::DeleteTextures(1, &pbrSphere.orm);
+    gl::DeleteTextures(1, &brdfLutTexture);
+    sceneTarget.Delete();
+    tonemapper.Delete();
 }
 
 void DemoPBR::UpdateAndRender(const DemoInputs& inputs)
 {
     glEnable(GL_DEPTH_TEST);
     mainCamera.UpdateFreeFly(inputs.cameraInputs);
-    glClearColor(0.33, 0.33, 0.33, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glViewport(0, 0, (int)inputs.windowSize.x, (int)inputs.windowSize.y);
 
+    // Render to the HDR target, the previous framebuffer receives the tonemapped image
+    if ((int)inputs.windowSize.x != sceneTarget.width || (int)inputs.windowSize.y != sceneTarget.height)
+        sceneTarget.Resize((int)inputs.windowSize.x, (int)inputs.windowSize.y);
+    GLint previousFramebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneTarget.id);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.f); // Linear, about the former 0.33 gray once tonemapped and encoded
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
     static bool usePBRTexture = false;
 
     {
         ImGui::DragFloat3("Light pos", lights.position.e);
         ImGui::ColorEdit3("Light color", lights.color.e);
+        ImGui::SliderFloat("Exposure", &exposure, 0.05f, 8.f, "%.2f", ImGuiSliderFlags_Logarithmic);
+        post::ColorFormat format = sceneTarget.format;
+        if (post::EditColorFormat("Scene format", &format))
+        {
+            sceneTarget.Delete();
+            sceneTarget.Generate((int)inputs.windowSize.x, (int)inputs.windowSize.y, format);
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneTarget.id);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
 
         static int e = 0;
         ImGui::RadioButton("Basic PBR", &e, 0);
@@ -462,14 +506,8 @@ void DemoPBR::UpdateAndRender(const DemoInputs& inputs)
             ImGui::Text("Normal");
             ImGui::Image((ImTextureID)(size_t)pbrSphere.normal, { 256, 256 });
 
-            ImGui::Text("Metallic");
-            ImGui::Image((ImTextureID)(size_t)pbrSphere.metallic, { 256, 256 });
-
-            ImGui::Text("Roughness");
-            ImGui::Image((ImTextureID)(size_t)pbrSphere.roughness, { 256, 256 });
-
-            ImGui::Text("Ambiant Occlusion");
-            ImGui::Image((ImTextureID)(size_t)pbrSphere.ao, { 256, 256 });
+            ImGui::Text("Occlusion / Roughness / Metallic");
+            ImGui::Image((ImTextureID)(size_t)pbrSphere.orm, { 256, 256 });
         }
     }
 
@@ -484,24 +522,22 @@ void DemoPBR::UpdateAndRender(const DemoInputs& inputs)
 
         glUniform3f(glGetUniformLocation(usedProgram.id,"camPos"), mainCamera.position.x, mainCamera.position.y, mainCamera.position.z);
 
+        glUniform1i(glGetUniformLocation(usedProgram.id, "brdfLUT"), 3);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, brdfLutTexture);
+
         if (usePBRTexture)
         {
             glUniform1i(glGetUniformLocation(usedProgram.id, "albedoMap"), 0);
             glUniform1i(glGetUniformLocation(usedProgram.id, "normalMap"), 1);
-            glUniform1i(glGetUniformLocation(usedProgram.id, "metallicMap"), 2);
-            glUniform1i(glGetUniformLocation(usedProgram.id, "roughnessMap"), 3);
-            glUniform1i(glGetUniformLocation(usedProgram.id, "aoMap"), 4);
+            glUniform1i(glGetUniformLocation(usedProgram.id, "ormMap"), 2);
 
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, pbrSphere.albedo);
             glActiveTexture(GL_TEXTURE1);
             glBindTexture(GL_TEXTURE_2D, pbrSphere.normal);
             glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, pbrSphere.metallic);
-            glActiveTexture(GL_TEXTURE3);
-            glBindTexture(GL_TEXTURE_2D, pbrSphere.roughness);
-            glActiveTexture(GL_TEXTURE4);
-            glBindTexture(GL_TEXTURE_2D, pbrSphere.ao);
+            glBindTexture(GL_TEXTURE_2D, pbrSphere.orm);
         }
         else
         {
@@ -546,4 +582,7 @@ void DemoPBR::UpdateAndRender(const DemoInputs& inputs)
         glBindVertexArray(pbrSphere.VAO);
         glDrawArrays(GL_TRIANGLES, pbrSphere.mesh.start, pbrSphere.mesh.count);
     }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    tonemapper.Apply(sceneTarget.colorTexture, exposure);
 }
\ No newline at end of file
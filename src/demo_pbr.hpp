@@ -3,6 +3,7 @@
 #include "glad/glad.h"
 
 #include "mesh_builder.hpp"
+#include "postprocess.hpp"
 
 #include "demo.hpp"
 
@@ -18,11 +19,9 @@ struct Object
 
     MeshSlice mesh {};
 
-    GLuint albedo    = 0;
-    GLuint normal    = 0;
-    GLuint metallic  = 0;
-    GLuint roughness = 0;
-    GLuint ao        = 0;
+    GLuint albedo = 0;
+    GLuint normal = 0;
+    GLuint orm    = 0; // Occlusion, roughness, metallic packed in r, g, b
 };
 
 struct Light
@@ -51,6 +50,13 @@ private:
 
     Program usedProgram;
 
+    GLuint brdfLutTexture = 0; // Split sum scale and bias (see brdf_lut.hpp)
+
+    // Objects output linear radiance, tonemapped once by the post pass
+    post::SceneTarget sceneTarget;
+    post::Tonemapper tonemapper;
+    float exposure = 1.f;
+
     Light lights = 
     {
         {0.f,0.f,10.f},{150.f,150.f,150.f},
@@ -45,7 +45,7 @@ DemoQuad::DemoQuad(const DemoInputs& inputs)
         glGenBuffers(1, &vertexBuffer);
 
         glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        gl::BufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
     }
 
     // Vertex layout
@@ -113,10 +113,10 @@ DemoQuad::DemoQuad(const DemoInputs& inputs)
 DemoQuad::~DemoQuad()
 {
     // Delete OpenGL objects
-    glDeleteTextures(1, &texture);
+    gl::DeleteTextures(1, &texture);
     glDeleteProgram(program);
     glDeleteVertexArrays(1, &vertexArrayObject);
-    glDeleteBuffers(1, &vertexBuffer);
+    gl::DeleteBuffers(1, &vertexBuffer);
 }
 
 void DemoQuad::UpdateAndRender(const DemoInputs& inputs)
@@ -2,14 +2,21 @@
 
 
 #include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <vector>
 #include <imgui.h>
 
 #include "types.hpp"
 #include "calc.hpp"
+#include "dds.hpp"
+#include "environment.hpp"
 #include "gl_helpers.hpp"
+#include "vram_budget.hpp"
 #include "demo_fbo.hpp"
 
+#define PROBE_CACHE_FILE "media/skybox_probe.cache"
+
 // Vertex format
 struct Vertex
 {
@@ -17,6 +24,82 @@ struct Vertex
     float3 normal;
 };
 
+// Everything is drawn as linear radiance to the scene target, exposed and tonemapped once by post::Tonemapper
+// HDR environments (panoramas, float DDS) are linear, folders of 8 bits faces are sRGB encoded
+static const char* environmentInput = R"GLSL(
+uniform bool linearColor;
+
+vec3 EnvironmentColor(vec3 color)
+{
+    return linearColor ? color : pow(color, vec3(2.2));
+}
+)GLSL";
+
+static GLuint CreateEnvironmentProgram(const char* vsStr, const char* fsStr)
+{
+    const char* fsStrs[] = { environmentInput, fsStr };
+    return gl::CreateProgram(1, &vsStr, ARRAYSIZE(fsStrs), fsStrs);
+}
+
+static const float3 objectColors[ORBIT_OBJECT_COUNT] =
+{
+    { 0.9f, 0.2f, 0.1f },
+    { 0.9f, 0.7f, 0.1f },
+    { 0.2f, 0.8f, 0.2f },
+    { 0.1f, 0.6f, 0.9f },
+    { 0.5f, 0.2f, 0.9f },
+    { 0.9f, 0.9f, 0.9f },
+};
+
+static const char* probeSliceNames[PROBE_SLICE_COUNT] = { "+X", "-X", "+Y", "-Y", "+Z", "-Z", "Mips" };
+
+// Camera at eye looking at a cubemap face: clip x/y follow the face s/t axes, so framebuffer row 0 is texel row 0
+static mat4 CubeFaceView(int face, float3 eye)
+{
+    const env::FaceAxes& axes = env::faceAxes[face];
+    float3 s = axes.s;
+    float3 t = axes.t;
+    float3 n = axes.n;
+    return
+    {
+        s.x, t.x, -n.x, 0.f,
+        s.y, t.y, -n.y, 0.f,
+        s.z, t.z, -n.z, 0.f,
+        -(s.x * eye.x + s.y * eye.y + s.z * eye.z),
+        -(t.x * eye.x + t.y * eye.y + t.z * eye.z),
+        n.x * eye.x + n.y * eye.y + n.z * eye.z,
+        1.f
+    };
+}
+
+// Folder of faces, DDS cubemap or .hdr panorama (see env::GetSourceType) to the bound cubemap, returns true for linear HDR colors
+static bool UploadEnvironment(const std::string& environment)
+{
+    env::SourceType type = env::GetSourceType(environment.c_str());
+    if (type == env::SourceType::FOLDER)
+    {
+        gl::UploadImageCubeMap(environment);
+        return false;
+    }
+
+    // Panoramas are projected once and reloaded from their cache
+    std::string cubemapFile = environment;
+    if (type == env::SourceType::EQUIRECT)
+    {
+        if (!env::CacheEquirectangular(environment.c_str()))
+            return false;
+        cubemapFile = env::GetEquirectCacheFilename(environment.c_str());
+    }
+    gl::UploadCubemap(cubemapFile.c_str());
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    return true;
+}
+
 DemoSkybox::DemoSkybox(const DemoInputs& inputs)
 {
     mainCamera.position = { 0,0,4.f };
@@ -41,7 +124,7 @@ DemoSkybox::DemoSkybox(const DemoInputs& inputs)
         // In VRAM
         glGenBuffers(1, &skyboxVBO);
         glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+        gl::BufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 
         free(vertices);
     }
@@ -78,7 +161,7 @@ DemoSkybox::DemoSkybox(const DemoInputs& inputs)
         // In VRAM
         glGenBuffers(1, &sphereVBO);
         glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+        gl::BufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 
         free(vertices);
     }
@@ -96,7 +179,7 @@ DemoSkybox::DemoSkybox(const DemoInputs& inputs)
     }
 
     // Skybox program
-    skyboxProgram = gl::CreateBasicProgram(
+    skyboxProgram = CreateEnvironmentProgram(
         // Vertex shader
         R"GLSL(
         layout(location = 0) in vec3 aPosition;
@@ -125,13 +208,13 @@ DemoSkybox::DemoSkybox(const DemoInputs& inputs)
 
         void main()
         {
-            fragColor = texture(skybox, textCoords);
+            fragColor = vec4(EnvironmentColor(texture(skybox, textCoords).rgb), 1.0);
         }
         )GLSL"
     );
 
     // Reflection
-    reflectionProgram = gl::CreateBasicProgram(
+    reflectionProgram = CreateEnvironmentProgram(
         // Vertex shader
         R"GLSL(
         layout(location = 0) in vec3 aPosition;    
@@ -167,13 +250,13 @@ DemoSkybox::DemoSkybox(const DemoInputs& inputs)
         {
             vec3 I = normalize(Position - cameraPos);
             vec3 R = reflect(I, normalize(Normal));
-            fragColor = vec4(texture(skybox, R).rgb, 1.0);
+            fragColor = vec4(EnvironmentColor(texture(skybox, R).rgb), 1.0);
         }
         )GLSL"
     );
 
     //Refraction
-    refractionProgram = gl::CreateBasicProgram(
+    refractionProgram = CreateEnvironmentProgram(
         // Vertex shader
         R"GLSL(
         layout(location = 0) in vec3 aPosition;    
@@ -211,36 +294,294 @@ DemoSkybox::DemoSkybox(const DemoInputs& inputs)
             float ratio = 1.00 / inRatio;
             vec3 I = normalize(Position - cameraPos);
             vec3 R = refract(I, normalize(Normal), ratio);
-            fragColor = vec4(texture(skybox, R).rgb, 1.0);
+            fragColor = vec4(EnvironmentColor(texture(skybox, R).rgb), 1.0);
+        }
+        )GLSL"
+    );
+
+    // Orbiting objects, flat colors with one directional light
+    objectProgram = gl::CreateBasicProgram(
+        // Vertex shader
+        R"GLSL(
+        layout(location = 0) in vec3 aPosition;
+        layout(location = 1) in vec3 aNormal;
+
+        out vec3 Normal;
+
+        uniform mat4 projection;
+        uniform mat4 view;
+        uniform mat4 model;
+
+        void main()
+        {
+            Normal = mat3(model) * aNormal;
+            gl_Position = projection * view * model * vec4(aPosition, 1.0);
+        }
+        )GLSL",
+
+        // Fragment shader
+        R"GLSL(
+        out vec4 fragColor;
+
+        in vec3 Normal;
+
+        uniform vec3 color;
+
+        void main()
+        {
+            float diffuse = max(dot(normalize(Normal), normalize(vec3(0.4, 1.0, 0.6))), 0.0);
+            fragColor = vec4(color * (0.25 + 0.75 * diffuse), 1.0);
         }
         )GLSL"
     );
 
+    strcpy(environment, "media/skybox/");
+    LoadEnvironment();
+    CreateReflectionProbe();
+
+    sceneTarget.Generate((int)inputs.windowSize.x, (int)inputs.windowSize.y, post::ColorFormat::R11G11B10F);
+    tonemapper.Create();
+}
+
+void DemoSkybox::CreateReflectionProbe()
+{
+    probeLevelCount = env::GetFullLevelCount(probeSize);
+
+    glGenTextures(1, &probeTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, probeTexture);
+    for (int level = 0; level < probeLevelCount; ++level)
+        for (int i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGBA16F, probeSize >> level, probeSize >> level, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, probeLevelCount - 1);
+    // Rendered to every frame, never evicted
+    vram::Track(vram::ResourceType::TEXTURE, probeTexture, dds::LevelSize(dds::Format::RGBA16F, probeSize, probeSize) * 6 * 4 / 3);
+
+    glGenRenderbuffers(1, &probeDepthbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, probeDepthbuffer);
+    gl::RenderbufferStorage(GL_DEPTH_COMPONENT24, probeSize, probeSize);
+
+    glGenFramebuffers(1, &probeFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, probeFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, probeDepthbuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X, probeTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        fprintf(stderr, "Reflection probe framebuffer incomplete\n");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    for (gl::GpuTimer& timer : probeTimers)
+        gl::CreateTimer(&timer);
+}
+
+void DemoSkybox::UpdateReflectionProbe()
+{
+    for (int i = 0; i < PROBE_SLICE_COUNT; ++i)
+        ++probeSliceAge[i];
+
+    // A frozen probe finishes its cycle at once so the cache holds faces and mips of the same frames
+    if (probeFrozen && nextProbeSlice == 0)
+    {
+        if (probeSavePending)
+        {
+            SaveProbeCache();
+            probeSavePending = false;
+        }
+        return;
+    }
+
+    // The first cycle is not time sliced, the probe starts complete
+    int budget = (probeFrozen || probeCycleCount == 0) ? PROBE_SLICE_COUNT : probeSlicesPerFrame;
+
+    GLint previousFramebuffer;
+    GLint previousViewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glEnable(GL_DEPTH_TEST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, probeFramebuffer);
+    glViewport(0, 0, probeSize, probeSize);
+    mat4 projection = mat4Perspective(calc::ToRadians(90.f), 1.f, 0.1f, 50.f);
+
+    for (int i = 0; i < budget; ++i)
+    {
+        int slice = nextProbeSlice;
+        gl::BeginTimer(&probeTimers[slice]);
+
+        if (slice < 6)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + slice, probeTexture, 0);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            mat4 view = CubeFaceView(slice, { 0.f, 0.f, 0.f });
+            DrawObjects(projection, view);
+            DrawSkybox(projection, view);
+        }
+        else
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, probeTexture);
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        }
+
+        gl::EndTimer(&probeTimers[slice]);
+        probeSliceAge[slice] = 0;
+
+        nextProbeSlice = (slice + 1) % PROBE_SLICE_COUNT;
+        if (nextProbeSlice == 0)
+        {
+            ++probeCycleCount;
+            break;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    if (!depthTest)
+        glDisable(GL_DEPTH_TEST);
+
+    if (probeFrozen && probeSavePending && nextProbeSlice == 0)
+    {
+        SaveProbeCache();
+        probeSavePending = false;
+    }
+}
+
+// RGBA16F DDS with every face and level (read back, waits for the GPU)
+bool DemoSkybox::SaveProbeCache()
+{
+    dds::Image image;
+    dds::Allocate(&image, dds::Format::RGBA16F, probeSize, probeSize, 6, probeLevelCount);
+
+    GLint previousCubemap;
+    glGetIntegerv(GL_TEXTURE_BINDING_CUBE_MAP, &previousCubemap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, probeTexture);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (int i = 0; i < 6; ++i)
+        for (int level = 0; level < probeLevelCount; ++level)
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGBA, GL_HALF_FLOAT, image.levels[i][level].data);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, (GLuint)previousCubemap);
+
+    bool saved = dds::Save(image, PROBE_CACHE_FILE);
+    if (saved)
+        printf("Reflection probe cached: %s\n", PROBE_CACHE_FILE);
+    dds::Free(&image);
+    return saved;
+}
+
+bool DemoSkybox::LoadProbeCache()
+{
+    dds::Image image;
+    if (!dds::Load(&image, PROBE_CACHE_FILE))
+        return false;
+
+    bool valid = image.format == dds::Format::RGBA16F && image.faceCount == 6
+        && image.width == probeSize && image.levelCount == probeLevelCount;
+    if (valid)
+    {
+        glBindTexture(GL_TEXTURE_CUBE_MAP, probeTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int i = 0; i < 6; ++i)
+            for (int level = 0; level < probeLevelCount; ++level)
+                glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, 0, 0, probeSize >> level, probeSize >> level, GL_RGBA, GL_HALF_FLOAT, image.levels[i][level].data);
+    }
+    else
+    {
+        fprintf(stderr, "Reflection probe cache does not match the probe (%s)\n", PROBE_CACHE_FILE);
+    }
+    dds::Free(&image);
+    return valid;
+}
+
+// Orbiting objects (the sphere is left out of its own probe)
+void DemoSkybox::DrawObjects(const mat4& projection, const mat4& view)
+{
+    glUseProgram(objectProgram);
+    glUniformMatrix4fv(glGetUniformLocation(objectProgram, "projection"), 1, GL_FALSE, projection.e);
+    glUniformMatrix4fv(glGetUniformLocation(objectProgram, "view"), 1, GL_FALSE, view.e);
+
+    glBindVertexArray(skyboxVAO);
+    for (int i = 0; i < ORBIT_OBJECT_COUNT; ++i)
+    {
+        glUniformMatrix4fv(glGetUniformLocation(objectProgram, "model"), 1, GL_FALSE, objectModels[i].e);
+        glUniform3f(glGetUniformLocation(objectProgram, "color"), objectColors[i].x, objectColors[i].y, objectColors[i].z);
+        glDrawArrays(GL_TRIANGLES, skybox.start, skybox.count);
+    }
+}
+
+void DemoSkybox::DrawSkybox(const mat4& projection, const mat4& view)
+{
+    glDepthFunc(GL_LEQUAL);
+    {
+        mat4 skyboxView = view;
+        mat4 model = mat4Scale(1.f);
+
+        skyboxView.e[12] = 0;
+        skyboxView.e[13] = 0;
+        skyboxView.e[14] = 0;
+
+        glUseProgram(skyboxProgram);
+        glUniformMatrix4fv(glGetUniformLocation(skyboxProgram, "projection"), 1, GL_FALSE, projection.e);
+        glUniformMatrix4fv(glGetUniformLocation(skyboxProgram, "view"), 1, GL_FALSE, skyboxView.e);
+        glUniformMatrix4fv(glGetUniformLocation(skyboxProgram, "model"), 1, GL_FALSE, model.e);
+        glUniform1i(glGetUniformLocation(skyboxProgram, "linearColor"), linearColor);
+
+        //glUniform1i(glGetUniformLocation(skyboxProgram, "skybox"), 0);
+    }
+
+    glBindVertexArray(skyboxVAO);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
+    glDrawArrays(GL_TRIANGLES, skybox.start, skybox.count); // Draw triangle
+    glDepthFunc(GL_LESS);
+}
+
+void DemoSkybox::LoadEnvironment()
+{
+    gl::DeleteTextures(1, &skyboxTexture);
     glGenTextures(1, &skyboxTexture);
     glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-    gl::UploadImageCubeMap("media/skybox/");
+    linearColor = UploadEnvironment(environment);
 }
 
 DemoSkybox::~DemoSkybox()
 {
     // Delete OpenGL objects
-    glDeleteTextures(1, &skyboxTexture);
+    sceneTarget.Delete();
+    tonemapper.Delete();
+    gl::DeleteTextures(1, &skyboxTexture);
+    for (gl::GpuTimer& timer : probeTimers)
+        gl::DeleteTimer(&timer);
+    glDeleteFramebuffers(1, &probeFramebuffer);
+    gl::DeleteRenderbuffers(1, &probeDepthbuffer);
+    gl::DeleteTextures(1, &probeTexture);
+    glDeleteProgram(objectProgram);
     glDeleteProgram(skyboxProgram);
     glDeleteProgram(reflectionProgram);
     glDeleteProgram(refractionProgram);
     glDeleteVertexArrays(1, &sphereVAO);
-    glDeleteBuffers(1, &sphereVBO);
+    gl::DeleteBuffers(1, &sphereVBO);
     glDeleteVertexArrays(1, &skyboxVAO);
-    glDeleteBuffers(1, &skyboxVBO);
+    gl::DeleteBuffers(1, &skyboxVBO);
 }
 
 void DemoSkybox::UpdateAndRender(const DemoInputs& inputs)
 {
     // Update camera
     mainCamera.UpdateFreeFly(inputs.cameraInputs);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, (int)inputs.windowSize.x, (int)inputs.windowSize.y);
-    glEnable(GL_DEPTH_TEST);
+
+    // Update orbiting objects
+    if (animate)
+        time += inputs.deltaTime;
+    for (int i = 0; i < ORBIT_OBJECT_COUNT; ++i)
+    {
+        float angle = time * 0.3f + i * calc::TAU / ORBIT_OBJECT_COUNT;
+        float3 position = { calc::Cos(angle) * 6.f, calc::Sin(angle * 2.f + i) * 1.5f, calc::Sin(angle) * 6.f };
+        objectModels[i] = mat4Translate(position) * mat4RotateY(angle * 3.f) * mat4Scale(0.6f);
+    }
 
     static float ratio = 1.f;
     {
@@ -263,13 +604,64 @@ void DemoSkybox::UpdateAndRender(const DemoInputs& inputs)
             programUsed = refractionProgram;
         }
         
+        // Folder of faces, DDS cubemap or .hdr panorama
+        ImGui::InputText("Environment", environment, sizeof(environment));
+        if (ImGui::Button("Load environment"))
+            LoadEnvironment();
+        ImGui::SliderFloat("Exposure", &exposure, 0.05f, 8.f, "%.2f", ImGuiSliderFlags_Logarithmic);
+        post::ColorFormat format = sceneTarget.format;
+        if (post::EditColorFormat("Scene format", &format))
+        {
+            sceneTarget.Delete();
+            sceneTarget.Generate((int)inputs.windowSize.x, (int)inputs.windowSize.y, format);
+        }
     }
 
+    if (ImGui::CollapsingHeader("Reflection probe", ImGuiTreeNodeFlags_DefaultOpen))
+    {
+        ImGui::Checkbox("Animate objects", &animate);
+        ImGui::Checkbox("Dynamic probe", &useProbe);
+        ImGui::SliderInt("Slices per frame", &probeSlicesPerFrame, 1, PROBE_SLICE_COUNT);
+        if (ImGui::Checkbox("Freeze and cache", &probeFrozen) && probeFrozen)
+            probeSavePending = true;
+        ImGui::SameLine();
+        if (ImGui::Button("Load cache") && LoadProbeCache())
+        {
+            probeFrozen = true;
+            probeSavePending = false;
+            nextProbeSlice = 0;
+        }
+
+        // A full update spreads over several frames, each face lags behind by its age
+        float cycleMilliseconds = 0.f;
+        for (int i = 0; i < PROBE_SLICE_COUNT; ++i)
+        {
+            ImGui::Text("%-4s %.3f ms (%d frames ago)", probeSliceNames[i], probeTimers[i].milliseconds, probeSliceAge[i]);
+            cycleMilliseconds += probeTimers[i].milliseconds;
+        }
+        int framesPerCycle = (PROBE_SLICE_COUNT + probeSlicesPerFrame - 1) / probeSlicesPerFrame;
+        ImGui::Text("Full update: %.3f ms over %d frames (%d cycles)", cycleMilliseconds, framesPerCycle, probeCycleCount);
+    }
+
+    if (useProbe)
+        UpdateReflectionProbe();
+
+    // Render to the HDR target, the previous framebuffer receives the tonemapped image
+    if ((int)inputs.windowSize.x != sceneTarget.width || (int)inputs.windowSize.y != sceneTarget.height)
+        sceneTarget.Resize((int)inputs.windowSize.x, (int)inputs.windowSize.y);
+    GLint previousFramebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneTarget.id);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glViewport(0, 0, (int)inputs.windowSize.x, (int)inputs.windowSize.y);
+    glEnable(GL_DEPTH_TEST);
+
+    mat4 projection = mat4Perspective(calc::ToRadians(60.f), inputs.windowSize.x / inputs.windowSize.y, 0.01f, 50.f);
+    mat4 view = mainCamera.GetViewMatrix();
+
     // Draw others
 
     {
-        mat4 projection = mat4Perspective(calc::ToRadians(60.f), inputs.windowSize.x / inputs.windowSize.y, 0.01f, 50.f);
-        mat4 view = mainCamera.GetViewMatrix();
         mat4 model = mat4Scale(1.f);
 
         glUseProgram(programUsed);
@@ -277,6 +669,8 @@ void DemoSkybox::UpdateAndRender(const DemoInputs& inputs)
         glUniformMatrix4fv(glGetUniformLocation(programUsed, "view"), 1, GL_FALSE, view.e);
         glUniformMatrix4fv(glGetUniformLocation(programUsed, "model"), 1, GL_FALSE, model.e);
         glUniform3f(glGetUniformLocation(programUsed, "cameraPos"),mainCamera.position.x,mainCamera.position.y,mainCamera.position.z);
+        // The probe holds linear radiance whatever the environment
+        glUniform1i(glGetUniformLocation(programUsed, "linearColor"), linearColor || useProbe);
         if(programUsed == refractionProgram)
         {
             glUniform1f(glGetUniformLocation(programUsed, "inRatio"),ratio);
@@ -285,34 +679,14 @@ void DemoSkybox::UpdateAndRender(const DemoInputs& inputs)
 
     glBindVertexArray(sphereVAO);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, useProbe ? probeTexture : skyboxTexture);
     glDrawArrays(GL_TRIANGLES, sphere.start, sphere.count);
 
+    DrawObjects(projection, view);
 
     // Draw Skybox
-    glDepthFunc(GL_LEQUAL);
-    {
-        mat4 projection = mat4Perspective(calc::ToRadians(60.f), inputs.windowSize.x / inputs.windowSize.y, 0.01f, 50.f);
-        mat4 view = mainCamera.GetViewMatrix();
-        mat4 model = mat4Scale(1.f);
-
-        view.e[12] = 0;
-        view.e[13] = 0;
-        view.e[14] = 0;
-
-        glUseProgram(skyboxProgram);
-        glUniformMatrix4fv(glGetUniformLocation(skyboxProgram, "projection"), 1, GL_FALSE, projection.e);
-        glUniformMatrix4fv(glGetUniformLocation(skyboxProgram, "view"), 1, GL_FALSE, view.e);
-        glUniformMatrix4fv(glGetUniformLocation(skyboxProgram, "model"), 1, GL_FALSE, model.e);
+    DrawSkybox(projection, view);
 
-        //glUniform1i(glGetUniformLocation(skyboxProgram, "skybox"), 0);
-    }
-
-    glBindVertexArray(skyboxVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-    glDrawArrays(GL_TRIANGLES, skybox.start, skybox.count); // Draw triangle
-    glDepthFunc(GL_LESS);
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    tonemapper.Apply(sceneTarget.colorTexture, exposure);
 }
-
-
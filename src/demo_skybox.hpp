@@ -1,9 +1,15 @@
 #include "glad/glad.h"
 
+#include "gl_helpers.hpp"
 #include "mesh_builder.hpp"
+#include "postprocess.hpp"
 
 #include "demo.hpp"
 
+// Time slices of a dynamic probe update: one per face, then one to rebuild the mips
+#define PROBE_SLICE_COUNT 7
+#define ORBIT_OBJECT_COUNT 6
+
 class DemoSkybox : public Demo
 {
 public:
@@ -14,6 +20,13 @@ public:
 	const char* Name() const final { return "Skybox & Reflection & Refraction"; }
 
 private:
+    void LoadEnvironment();
+    void CreateReflectionProbe();
+    void UpdateReflectionProbe();
+    bool SaveProbeCache();
+    bool LoadProbeCache();
+    void DrawObjects(const mat4& projection, const mat4& view);
+    void DrawSkybox(const mat4& projection, const mat4& view);
 
     Camera mainCamera = {};
 
@@ -24,11 +37,41 @@ private:
     GLuint sphereVAO = 0;
 
     GLuint skyboxTexture = 0;
+    char environment[256] = {};
+    bool linearColor = false; // HDR environment, 8 bits faces are decoded from sRGB by the shaders
+
+    // HDR rendering, tonemapped to the previous framebuffer
+    post::SceneTarget sceneTarget;
+    post::Tonemapper tonemapper;
+    float exposure = 1.f;
 
     GLuint skyboxProgram = 0;
     GLuint reflectionProgram = 0;
     GLuint refractionProgram = 0;
     GLuint programUsed = 0;
+    GLuint objectProgram = 0;
+
+    // Objects orbiting the sphere, only seen in its reflections through the dynamic probe
+    float time = 0.f;
+    bool animate = true;
+    mat4 objectModels[ORBIT_OBJECT_COUNT] = {};
+
+    // Dynamic reflection probe rendered from the sphere center, updated a few slices per frame
+    GLuint probeTexture = 0;
+    GLuint probeFramebuffer = 0;
+    GLuint probeDepthbuffer = 0;
+    int probeSize = 256;
+    int probeLevelCount = 0;
+    bool useProbe = true;
+    bool probeFrozen = false;      // No more updates, the last full cycle is cached to disk
+    bool probeSavePending = false;
+    int probeSlicesPerFrame = 1;
+    int nextProbeSlice = 0;
+    int probeCycleCount = 0;
+
+    // GPU time of each slice and frames since its last update
+    gl::GpuTimer probeTimers[PROBE_SLICE_COUNT];
+    int probeSliceAge[PROBE_SLICE_COUNT] = {};
 
     MeshSlice skybox = {};
     MeshSlice sphere = {};
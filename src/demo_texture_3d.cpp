@@ -42,7 +42,7 @@ DemoTexture3D::DemoTexture3D(const DemoInputs& inputs)
         glGenBuffers(1, &vertexBuffer);
 
         glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        gl::BufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
     }
 
     // Vertex layout
@@ -132,10 +132,10 @@ DemoTexture3D::DemoTexture3D(const DemoInputs& inputs)
 DemoTexture3D::~DemoTexture3D()
 {
     // Delete OpenGL objects
-    glDeleteTextures(1, &texture);
+    gl::DeleteTextures(1, &texture);
     glDeleteProgram(program);
     glDeleteVertexArrays(1, &vertexArrayObject);
-    glDeleteBuffers(1, &vertexBuffer);
+    gl::DeleteBuffers(1, &vertexBuffer);
 }
 
 void DemoTexture3D::UpdateAndRender(const DemoInputs& inputs)
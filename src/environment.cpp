@@ -0,0 +1,612 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENV_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <stb_image.h>
+
+#include "asset_archive.hpp"
+#include "calc.hpp"
+#include "dds.hpp"
+#include "jobs.hpp"
+#include "mip_generator.hpp"
+#include "environment.hpp"
+
+const char* const env::cubemapFaceFiles[6] =
+{
+    "right.jpg",
+    "left.jpg",
+    "top.jpg",
+    "bottom.jpg",
+    "back.jpg",
+    "front.jpg",
+};
+
+const env::FaceAxes env::faceAxes[6] =
+{
+    { {  0,  0, -1 }, { 0, -1,  0 }, {  1,  0,  0 } }, // +X
+    { {  0,  0,  1 }, { 0, -1,  0 }, { -1,  0,  0 } }, // -X
+    { {  1,  0,  0 }, { 0,  0,  1 }, {  0,  1,  0 } }, // +Y
+    { {  1,  0,  0 }, { 0,  0, -1 }, {  0, -1,  0 } }, // -Y
+    { {  1,  0,  0 }, { 0, -1,  0 }, {  0,  0,  1 } }, // +Z
+    { { -1,  0,  0 }, { 0, -1,  0 }, {  0,  0, -1 } }, // -Z
+};
+
+static bool HasExtension(const std::string& path, const char* extension)
+{
+    size_t length = strlen(extension);
+    if (path.size() < length)
+        return false;
+    for (size_t i = 0; i < length; ++i)
+        if (tolower((unsigned char)path[path.size() - length + i]) != extension[i])
+            return false;
+    return true;
+}
+
+env::SourceType env::GetSourceType(const char* environment)
+{
+    std::string name = environment;
+    if (HasExtension(name, ".dds"))
+        return SourceType::DDS;
+    if (HasExtension(name, ".hdr"))
+        return SourceType::EQUIRECT;
+    return SourceType::FOLDER;
+}
+
+static bool LoadCubemapFaces(env::Cubemap* cubemap, const std::string& folder)
+{
+    struct Face
+    {
+        int width = 0;
+        int height = 0;
+        unsigned char* rgba = nullptr;
+    };
+    Face faces[6];
+
+    // Same orientation as gl::UploadImageCubeMap (the flag is global, faces are not flipped)
+    stbi_set_flip_vertically_on_load(false);
+    jobs::ParallelFor(6, [&](int i)
+    {
+        std::string file = folder + env::cubemapFaceFiles[i];
+        int channels = 0;
+
+        const void* data;
+        size_t size;
+        if (archive::Find(file.c_str(), &data, &size))
+            faces[i].rgba = stbi_load_from_memory((const stbi_uc*)data, (int)size, &faces[i].width, &faces[i].height, &channels, 4);
+        else
+            faces[i].rgba = stbi_load(file.c_str(), &faces[i].width, &faces[i].height, &channels, 4);
+    });
+
+    bool success = true;
+    for (int i = 0; i < 6; ++i)
+    {
+        if (faces[i].rgba == nullptr || faces[i].width != faces[i].height || faces[i].width != faces[0].width)
+        {
+            fprintf(stderr, "Invalid cubemap face '%s%s'\n", folder.c_str(), env::cubemapFaceFiles[i]);
+            success = false;
+        }
+    }
+
+    if (success)
+    {
+        cubemap->size = faces[0].width;
+        jobs::ParallelFor(6, [&](int i)
+        {
+            size_t pixelCount = (size_t)cubemap->size * cubemap->size;
+            cubemap->faces[i].resize(pixelCount * 4);
+            mip::DecodeRGBA8(faces[i].rgba, pixelCount, mip::FLAG_SRGB, cubemap->faces[i].data());
+        });
+    }
+
+    for (Face& face : faces)
+        stbi_image_free(face.rgba);
+    return success;
+}
+
+static bool LoadDDS(dds::Image* image, const std::string& filename)
+{
+    const void* data;
+    size_t size;
+    if (archive::Find(filename.c_str(), &data, &size))
+        return dds::LoadFromMemory(image, data, size, filename.c_str());
+    return dds::Load(image, filename.c_str());
+}
+
+static bool LoadCubemapDDS(env::Cubemap* cubemap, const std::string& filename)
+{
+    dds::Image image;
+    if (!LoadDDS(&image, filename))
+        return false;
+
+    if (image.faceCount != 6 || image.width != image.height)
+    {
+        fprintf(stderr, "Not a cubemap: %s\n", filename.c_str());
+        dds::Free(&image);
+        return false;
+    }
+
+    cubemap->size = image.width;
+    jobs::ParallelFor(6, [&](int i)
+    {
+        cubemap->faces[i].resize((size_t)image.width * image.height * 4);
+        dds::DecodeLevel(image.format, image.levels[i][0], cubemap->faces[i].data());
+    });
+    dds::Free(&image);
+    return true;
+}
+
+bool env::LoadCubemap(Cubemap* cubemap, const char* environment)
+{
+    *cubemap = {};
+    switch (GetSourceType(environment))
+    {
+    case SourceType::FOLDER:   return LoadCubemapFaces(cubemap, environment);
+    case SourceType::DDS:      return LoadCubemapDDS(cubemap, environment);
+    case SourceType::EQUIRECT: return CacheEquirectangular(environment) && LoadCubemapDDS(cubemap, GetEquirectCacheFilename(environment));
+    }
+    return false;
+}
+
+// GGX prefiltering
+
+int env::GetPrefilterLevelCount(const PrefilterSettings& settings)
+{
+    int levelCount = 1;
+    while (levelCount < settings.levelCount && levelCount < DDS_MAX_LEVELS && (settings.size >> levelCount) > 0)
+        levelCount++;
+    return levelCount;
+}
+
+float env::GetPrefilterRoughness(int level, int levelCount)
+{
+    return levelCount > 1 ? (float)level / (levelCount - 1) : 0.f;
+}
+
+// The sample covers the solid angle 1 / (sampleCount * pdf), the lod where a source texel covers the same
+// solid angle (plus one, a bit blurrier hides the undersampling)
+float env::GetPrefilterSampleLod(float roughness, float NdotH, int sampleCount, int sourceSize)
+{
+    // pdf of the reflected direction when N = V = R: D(h) * NdotH / (4 * VdotH) = D(h) / 4
+    float a2 = roughness * roughness * roughness * roughness;
+    float d = NdotH * NdotH * (a2 - 1.f) + 1.f;
+    float pdf = a2 / ((calc::TAU / 2.f) * d * d) / 4.f;
+
+    float sampleSolidAngle = 1.f / (sampleCount * pdf + 0.0001f);
+    float texelSolidAngle  = 2.f * calc::TAU / (6.f * sourceSize * sourceSize);
+    return calc::Max(0.5f * log2f(sampleSolidAngle / texelSolidAngle) + 1.f, 0.f);
+}
+
+#ifdef ENV_USE_SSE2
+typedef __m128 Color;
+static inline Color ZeroColor() { return _mm_setzero_ps(); }
+static inline Color MulAdd(Color sum, const float* texel, float weight) { return _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(texel), _mm_set1_ps(weight))); }
+static inline void StoreColor(float* texel, Color color, float scale) { _mm_storeu_ps(texel, _mm_mul_ps(color, _mm_set1_ps(scale))); }
+#else
+struct Color { float e[4]; };
+static inline Color ZeroColor() { return {}; }
+static inline Color MulAdd(Color sum, const float* texel, float weight)
+{
+    for (int c = 0; c < 4; ++c)
+        sum.e[c] += texel[c] * weight;
+    return sum;
+}
+static inline void StoreColor(float* texel, Color color, float scale)
+{
+    for (int c = 0; c < 4; ++c)
+        texel[c] = color.e[c] * scale;
+}
+#endif
+
+static inline float Dot(float3 a, float3 b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static void GetFaceCoordinates(float3 direction, int* face, float* s, float* t)
+{
+    float x = fabsf(direction.x);
+    float y = fabsf(direction.y);
+    float z = fabsf(direction.z);
+    if (x >= y && x >= z)
+        *face = direction.x > 0.f ? 0 : 1;
+    else if (y >= z)
+        *face = direction.y > 0.f ? 2 : 3;
+    else
+        *face = direction.z > 0.f ? 4 : 5;
+
+    const env::FaceAxes& axes = env::faceAxes[*face];
+    float invMajor = 1.f / Dot(direction, axes.n);
+    *s = Dot(direction, axes.s) * invMajor;
+    *t = Dot(direction, axes.t) * invMajor;
+}
+
+// Source mips sampled by the prefilter (the finer ones are never sampled and not kept)
+struct SourceChain
+{
+    int baseLod = 0; // Lod of levels[0] relative to the source
+    std::vector<int> sizes;
+    std::vector<std::vector<float>> levels[6];
+};
+
+// 2x2 box filter of RGBA32F texels
+static void DownsampleImage(const float* src, int srcWidth, int srcHeight, float* dst, int dstWidth, int dstHeight)
+{
+    for (int y = 0; y < dstHeight; ++y)
+    {
+        const float* row0 = src + (size_t)calc::Min(y * 2, srcHeight - 1) * srcWidth * 4;
+        const float* row1 = src + (size_t)calc::Min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+        for (int x = 0; x < dstWidth; ++x)
+        {
+            int x0 = calc::Min(x * 2, srcWidth - 1) * 4;
+            int x1 = calc::Min(x * 2 + 1, srcWidth - 1) * 4;
+            float* texel = dst + ((size_t)y * dstWidth + x) * 4;
+            for (int c = 0; c < 4; ++c)
+                texel[c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+        }
+    }
+}
+
+static void BuildSourceChain(const env::Cubemap& source, int size, SourceChain* chain)
+{
+    chain->baseLod = 0;
+    while ((source.size >> (chain->baseLod + 1)) >= size)
+        chain->baseLod++;
+
+    for (int levelSize = source.size >> chain->baseLod; levelSize >= 1; levelSize /= 2)
+        chain->sizes.push_back(levelSize);
+
+    jobs::ParallelFor(6, [&](int face)
+    {
+        std::vector<std::vector<float>>& levels = chain->levels[face];
+        levels.resize(chain->sizes.size());
+
+        // Down to the base lod without keeping the intermediate levels
+        std::vector<float> current = source.faces[face];
+        int currentSize = source.size;
+        for (int lod = 0; lod < chain->baseLod; ++lod)
+        {
+            std::vector<float> next((size_t)(currentSize / 2) * (currentSize / 2) * 4);
+            DownsampleImage(current.data(), currentSize, currentSize, next.data(), currentSize / 2, currentSize / 2);
+            current.swap(next);
+            currentSize /= 2;
+        }
+        levels[0].swap(current);
+
+        for (size_t i = 1; i < levels.size(); ++i)
+        {
+            levels[i].resize((size_t)chain->sizes[i] * chain->sizes[i] * 4);
+            DownsampleImage(levels[i - 1].data(), chain->sizes[i - 1], chain->sizes[i - 1], levels[i].data(), chain->sizes[i], chain->sizes[i]);
+        }
+    });
+}
+
+static Color AccumulateBilinear(Color sum, const SourceChain& chain, int level, int face, float s, float t, float weight)
+{
+    int size = chain.sizes[level];
+    float x = calc::Clamp((s + 1.f) * 0.5f * size - 0.5f, 0.f, (float)(size - 1));
+    float y = calc::Clamp((t + 1.f) * 0.5f * size - 0.5f, 0.f, (float)(size - 1));
+    int x0 = (int)x;
+    int y0 = (int)y;
+    int x1 = calc::Min(x0 + 1, size - 1);
+    int y1 = calc::Min(y0 + 1, size - 1);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    const float* texels = chain.levels[face][level].data();
+    sum = MulAdd(sum, texels + ((size_t)y0 * size + x0) * 4, weight * (1.f - fx) * (1.f - fy));
+    sum = MulAdd(sum, texels + ((size_t)y0 * size + x1) * 4, weight * fx * (1.f - fy));
+    sum = MulAdd(sum, texels + ((size_t)y1 * size + x0) * 4, weight * (1.f - fx) * fy);
+    sum = MulAdd(sum, texels + ((size_t)y1 * size + x1) * 4, weight * fx * fy);
+    return sum;
+}
+
+// Reflected direction in the tangent space of N (z = N), with its NdotL weight and source lod
+struct PrefilterSample
+{
+    float3 direction;
+    float weight;
+    float lod;
+};
+
+static float RadicalInverse(uint32_t bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return bits * 2.3283064365386963e-10f;
+}
+
+// The same samples for every texel of a level (Hammersley points)
+static void GeneratePrefilterSamples(float roughness, int sampleCount, int sourceSize, float minLod, std::vector<PrefilterSample>* samples)
+{
+    if (roughness == 0.f)
+    {
+        samples->push_back({ float3(0.f, 0.f, 1.f), 1.f, minLod });
+        return;
+    }
+
+    float a = roughness * roughness;
+    for (int i = 0; i < sampleCount; ++i)
+    {
+        float u = (float)i / sampleCount;
+        float v = RadicalInverse((uint32_t)i);
+
+        float phi = calc::TAU * u;
+        float cosTheta = sqrtf((1.f - v) / (1.f + (a * a - 1.f) * v));
+        float sinTheta = sqrtf(1.f - cosTheta * cosTheta);
+        float3 h = { sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta };
+
+        // L = reflect(-V, H) with V = N
+        float3 l = h * (2.f * cosTheta) - float3(0.f, 0.f, 1.f);
+        if (l.z <= 0.f)
+            continue;
+
+        float lod = calc::Max(env::GetPrefilterSampleLod(roughness, cosTheta, sampleCount, sourceSize), minLod);
+        samples->push_back({ l, l.z, lod });
+    }
+}
+
+static void PrefilterRow(const SourceChain& chain, const std::vector<PrefilterSample>& samples, int face, int size, int y, float* row)
+{
+    const env::FaceAxes& axes = env::faceAxes[face];
+    float t = (y + 0.5f) * 2.f / size - 1.f;
+    int lastLevel = (int)chain.sizes.size() - 1;
+
+    for (int x = 0; x < size; ++x)
+    {
+        float s = (x + 0.5f) * 2.f / size - 1.f;
+        float3 n = v3Normalize(axes.s * s + axes.t * t + axes.n);
+        float3 up = fabsf(n.z) < 0.999f ? float3(0.f, 0.f, 1.f) : float3(1.f, 0.f, 0.f);
+        float3 tangent = v3Normalize(v3Cross(up, n));
+        float3 bitangent = v3Cross(n, tangent);
+
+        Color sum = ZeroColor();
+        float weightSum = 0.f;
+        for (const PrefilterSample& sample : samples)
+        {
+            float3 l = tangent * sample.direction.x + bitangent * sample.direction.y + n * sample.direction.z;
+            int sampleFace;
+            float sampleS, sampleT;
+            GetFaceCoordinates(l, &sampleFace, &sampleS, &sampleT);
+
+            // Trilinear
+            float level = calc::Clamp(sample.lod - chain.baseLod, 0.f, (float)lastLevel);
+            int level0 = (int)level;
+            int level1 = calc::Min(level0 + 1, lastLevel);
+            float blend = level - level0;
+            sum = AccumulateBilinear(sum, chain, level0, sampleFace, sampleS, sampleT, sample.weight * (1.f - blend));
+            if (blend > 0.f)
+                sum = AccumulateBilinear(sum, chain, level1, sampleFace, sampleS, sampleT, sample.weight * blend);
+            weightSum += sample.weight;
+        }
+        StoreColor(row + x * 4, sum, 1.f / weightSum);
+    }
+}
+
+bool env::PrefilterGGX(const Cubemap& source, const PrefilterSettings& settings, dds::Image* prefiltered)
+{
+    if (source.size <= 0 || settings.size <= 0 || (settings.size & (settings.size - 1)) != 0)
+    {
+        fprintf(stderr, "Invalid prefilter size %d (power of two expected)\n", settings.size);
+        return false;
+    }
+
+    int levelCount = GetPrefilterLevelCount(settings);
+    auto start = std::chrono::steady_clock::now();
+    SourceChain chain;
+    BuildSourceChain(source, settings.size, &chain);
+
+    std::vector<PrefilterSample> samples[DDS_MAX_LEVELS];
+    for (int level = 0; level < levelCount; ++level)
+    {
+        float minLod = log2f((float)source.size / (settings.size >> level));
+        GeneratePrefilterSamples(GetPrefilterRoughness(level, levelCount), settings.sampleCount, source.size, minLod, &samples[level]);
+    }
+
+    dds::Image image;
+    dds::Allocate(&image, dds::Format::RGBA32F, settings.size, settings.size, 6, levelCount);
+
+    // One job per row of every face and level
+    int firstRows[DDS_MAX_LEVELS + 1] = {};
+    for (int level = 0; level < levelCount; ++level)
+        firstRows[level + 1] = firstRows[level] + 6 * (settings.size >> level);
+
+    jobs::ParallelFor(firstRows[levelCount], [&](int index)
+    {
+        int level = 0;
+        while (index >= firstRows[level + 1])
+            level++;
+        int size = settings.size >> level;
+        int face = (index - firstRows[level]) / size;
+        int y = (index - firstRows[level]) % size;
+
+        float* row = (float*)image.levels[face][level].data + (size_t)y * size * 4;
+        PrefilterRow(chain, samples[level], face, size, y, row);
+    });
+
+    dds::Convert(image, dds::Format::RGBA16F, prefiltered);
+    dds::Free(&image);
+
+    float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Prefiltered GGX on CPU: %d levels from %d to %d, %d samples (%.1f ms on %d threads)\n",
+        levelCount, settings.size, settings.size >> (levelCount - 1), settings.sampleCount, milliseconds, jobs::ThreadCount());
+    return true;
+}
+
+// Mipmapped cubemaps
+
+int env::GetFullLevelCount(int size)
+{
+    int levelCount = 1;
+    while (levelCount < DDS_MAX_LEVELS && (size >> levelCount) > 0)
+        levelCount++;
+    return levelCount;
+}
+
+void env::BuildMipmappedCubemap(const Cubemap& cubemap, int size, dds::Image* image)
+{
+    int baseSize = cubemap.size;
+    while (baseSize > size)
+        baseSize /= 2;
+    int levelCount = GetFullLevelCount(baseSize);
+    dds::Allocate(image, dds::Format::RGBA32F, baseSize, baseSize, 6, levelCount);
+
+    // One job per face, the base level is box filtered down from the cubemap when larger
+    jobs::ParallelFor(6, [&](int face)
+    {
+        const float* current = cubemap.faces[face].data();
+        std::vector<float> filtered;
+        int currentSize = cubemap.size;
+        while (currentSize > baseSize)
+        {
+            std::vector<float> next((size_t)(currentSize / 2) * (currentSize / 2) * 4);
+            DownsampleImage(current, currentSize, currentSize, next.data(), currentSize / 2, currentSize / 2);
+            filtered.swap(next);
+            current = filtered.data();
+            currentSize /= 2;
+        }
+        memcpy(image->levels[face][0].data, current, image->levels[face][0].size);
+
+        for (int level = 1; level < levelCount; ++level)
+        {
+            const dds::Level& src = image->levels[face][level - 1];
+            const dds::Level& dst = image->levels[face][level];
+            DownsampleImage((const float*)src.data, src.width, src.height, (float*)dst.data, dst.width, dst.height);
+        }
+    });
+}
+
+// Equirectangular panoramas
+
+void env::ProjectEquirectangular(const float* rgba, int width, int height, int size, Cubemap* cubemap)
+{
+    // A face covers a quarter of the panorama width: keep at most 2 panorama texels per cube texel
+    std::vector<float> filtered;
+    while (width > 8 * size && height > 1)
+    {
+        std::vector<float> next((size_t)(width / 2) * (height / 2) * 4);
+        DownsampleImage(rgba, width, height, next.data(), width / 2, height / 2);
+        filtered.swap(next);
+        rgba = filtered.data();
+        width /= 2;
+        height /= 2;
+    }
+
+    cubemap->size = size;
+    for (std::vector<float>& face : cubemap->faces)
+        face.resize((size_t)size * size * 4);
+
+    jobs::ParallelFor(6 * size, [&](int index)
+    {
+        int face = index / size;
+        int y = index % size;
+        const FaceAxes& axes = faceAxes[face];
+        float t = (y + 0.5f) * 2.f / size - 1.f;
+        float* row = cubemap->faces[face].data() + (size_t)y * size * 4;
+
+        for (int x = 0; x < size; ++x)
+        {
+            float s = (x + 0.5f) * 2.f / size - 1.f;
+            float3 direction = v3Normalize(axes.s * s + axes.t * t + axes.n);
+
+            // Longitude from +X around +Y, latitude from the top row
+            float u = atan2f(direction.z, direction.x) / calc::TAU + 0.5f;
+            float v = acosf(calc::Clamp(direction.y, -1.f, 1.f)) / (calc::TAU / 2.f);
+            float px = u * width - 0.5f;
+            float py = calc::Clamp(v * height - 0.5f, 0.f, (float)(height - 1));
+
+            // Bilinear, wrapped horizontally
+            int x0 = (int)floorf(px);
+            int y0 = (int)py;
+            float fx = px - x0;
+            float fy = py - y0;
+            x0 = calc::Modulo(x0, width);
+            int x1 = (x0 + 1) % width;
+            int y1 = calc::Min(y0 + 1, height - 1);
+
+            Color sum = ZeroColor();
+            sum = MulAdd(sum, rgba + ((size_t)y0 * width + x0) * 4, (1.f - fx) * (1.f - fy));
+            sum = MulAdd(sum, rgba + ((size_t)y0 * width + x1) * 4, fx * (1.f - fy));
+            sum = MulAdd(sum, rgba + ((size_t)y1 * width + x0) * 4, (1.f - fx) * fy);
+            sum = MulAdd(sum, rgba + ((size_t)y1 * width + x1) * 4, fx * fy);
+            StoreColor(row + x * 4, sum, 1.f);
+        }
+    });
+}
+
+std::string env::GetEquirectCacheFilename(const char* panorama)
+{
+    return std::string(panorama) + ".cube.cache";
+}
+
+bool env::CacheEquirectangular(const char* panorama, const EquirectSettings& settings)
+{
+    if (settings.size <= 0 || (settings.size & (settings.size - 1)) != 0)
+    {
+        fprintf(stderr, "Invalid cubemap size %d (power of two expected)\n", settings.size);
+        return false;
+    }
+
+    int levelCount = GetFullLevelCount(settings.size);
+    std::string cacheFile = GetEquirectCacheFilename(panorama);
+    dds::Image cached;
+    if (LoadDDS(&cached, cacheFile))
+    {
+        bool valid = cached.format == settings.format && cached.faceCount == 6 && cached.width == settings.size
+            && cached.levelCount == levelCount;
+        dds::Free(&cached);
+        if (valid)
+            return true;
+    }
+
+    // Rows top to bottom (the flag is global)
+    stbi_set_flip_vertically_on_load(false);
+    int width, height, channels;
+    float* pixels;
+    const void* data;
+    size_t size;
+    if (archive::Find(panorama, &data, &size))
+        pixels = stbi_loadf_from_memory((const stbi_uc*)data, (int)size, &width, &height, &channels, 4);
+    else
+        pixels = stbi_loadf(panorama, &width, &height, &channels, 4);
+    if (pixels == nullptr)
+    {
+        fprintf(stderr, "Cannot load panorama %s\n", panorama);
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Cubemap cubemap;
+    ProjectEquirectangular(pixels, width, height, settings.size, &cubemap);
+    stbi_image_free(pixels);
+
+    dds::Image image;
+    BuildMipmappedCubemap(cubemap, settings.size, &image);
+
+    bool success;
+    if (settings.format == dds::Format::RGBA32F)
+    {
+        success = dds::Save(image, cacheFile.c_str());
+    }
+    else
+    {
+        dds::Image converted;
+        dds::Convert(image, settings.format, &converted);
+        success = dds::Save(converted, cacheFile.c_str());
+        dds::Free(&converted);
+    }
+    dds::Free(&image);
+
+    float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Panorama converted: %s (%dx%d to 6x%dx%d %s, %d levels, %.1f ms on %d threads)\n", panorama, width, height,
+        settings.size, settings.size, dds::FormatName(settings.format), levelCount, milliseconds, jobs::ThreadCount());
+    return success;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "dds.hpp"
+#include "types.hpp"
+
+// CPU side of image based lighting
+// An environment is a folder of 6 LDR faces (see cubemapFaceFiles), a DDS cubemap or an HDR equirectangular panorama
+namespace env
+{
+    enum class SourceType
+    {
+        FOLDER,  // Ends with a separator
+        DDS,
+        EQUIRECT, // .hdr (loaded with stbi_loadf)
+    };
+    SourceType GetSourceType(const char* environment);
+
+    // Face files of a cubemap folder, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+    extern const char* const cubemapFaceFiles[6];
+
+    // Direction of the texel (s, t) in [-1, 1] of a face: s * axes.s + t * axes.t + axes.n (GL cubemap conventions)
+    struct FaceAxes
+    {
+        float3 s;
+        float3 t;
+        float3 n;
+    };
+    extern const FaceAxes faceAxes[6];
+
+    // Linear RGBA32F faces, rows in upload order
+    struct Cubemap
+    {
+        int size = 0;
+        std::vector<float> faces[6];
+    };
+
+    // Base level of the environment (LDR faces are converted from sRGB, panoramas go through their cube cache)
+    bool LoadCubemap(Cubemap* cubemap, const char* environment);
+
+    // RGBA32F cubemap with a full mip chain, the base level halved down to at most size
+    int GetFullLevelCount(int size);
+    void BuildMipmappedCubemap(const Cubemap& cubemap, int size, dds::Image* image);
+
+    // Panoramas are resampled into a cubemap with a full mip chain, cached as a DDS next to them
+    struct EquirectSettings
+    {
+        int size = 512; // Power of two
+        dds::Format format = dds::Format::RGBA16F;
+    };
+
+    // Bilinear resampling (SSE2, one job per face row) of the panorama, first box filtered down to at most
+    // 2 texels per cube texel. Rows of the panorama are top to bottom, its center looks towards +X
+    void ProjectEquirectangular(const float* rgba, int width, int height, int size, Cubemap* cubemap);
+
+    std::string GetEquirectCacheFilename(const char* panorama);
+    bool CacheEquirectangular(const char* panorama, const EquirectSettings& settings = {}); // True when the cache is valid or saved now
+
+    // GGX prefiltered radiance for the split sum specular: level i is filtered for roughness i / (levelCount - 1)
+    // Importance sampled with the sample lod picked from its pdf (mip filtered sampling of the source)
+    struct PrefilterSettings
+    {
+        int size        = 128;
+        int levelCount  = 6;
+        int sampleCount = 64; // Per texel (levels above 0)
+    };
+
+    int GetPrefilterLevelCount(const PrefilterSettings& settings); // levelCount limited by the size
+    float GetPrefilterRoughness(int level, int levelCount);
+    float GetPrefilterSampleLod(float roughness, float NdotH, int sampleCount, int sourceSize); // Source lod of a sample
+
+    // CPU baker (SSE2 filtering, one job per face row of every level), RGBA16F result
+    bool PrefilterGGX(const Cubemap& source, const PrefilterSettings& settings, dds::Image* prefiltered);
+}
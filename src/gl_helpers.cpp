@@ -1,7 +1,8 @@
 
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
-#include <fstream>
 #include <vector>
 
 #include <stb_perlin.h>
@@ -9,48 +10,439 @@
 
 #include "types.hpp"
 #include "calc.hpp"
+#include "asset_archive.hpp"
 #include "gl_helpers.hpp"
+#include "dds.hpp"
+#include "environment.hpp"
+#include "jobs.hpp"
+#include "texture_compression.hpp"
+#include "texture_cache.hpp"
+#include "vram_budget.hpp"
+
+bool gl::HasExtension(const char* name)
+{
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
 
-// Implement dumb caching to avoid decompressing textures
-static bool LoadTextureFromCache(void** data, const char* filename, int* width, int* height, int* channels, bool linear)
+static bool IsCompressedFormatSupported(GLenum internalFormat)
 {
-    std::string cachedFile = filename;
-    cachedFile += linear ? ".texf" : ".tex";
-    cachedFile += ".cache";
+    switch (internalFormat)
+    {
+    case GL_COMPRESSED_RED_RGTC1:
+    case GL_COMPRESSED_RG_RGTC2:
+        return true; // Core since OpenGL 3.0
 
-    FILE* file = fopen(cachedFile.c_str(), "rb");
-    if (file == nullptr)
-        return false;
+    default:
+    {
+        static bool hasS3TC = gl::HasExtension("GL_EXT_texture_compression_s3tc");
+        return hasS3TC;
+    }
+    }
+}
+
+// Estimated GPU size of a pixel (drivers pad 3 components formats)
+static size_t GetPixelBytes(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+    case GL_RED:
+    case GL_R8:                 return 1;
+    case GL_RG:
+    case GL_RG8:
+    case GL_R16F:               return 2;
+    case GL_RGB16F:
+    case GL_RGBA16F:
+    case GL_RG32F:              return 8;
+    case GL_RGB32F:
+    case GL_RGBA32F:            return 16;
+    default:                    return 4; // RGB(A)8, R32F, RG16F, R11F_G11F_B10F, depth formats...
+    }
+}
 
-    size_t dataSize = 0;
-    fread(&dataSize, sizeof(size_t), 1, file);
-    fread(width,     sizeof(int), 1, file);
-    fread(height,    sizeof(int), 1, file);
-    fread(channels,  sizeof(int), 1, file);
-    *data = malloc(dataSize);
-    fread(*data, 1, dataSize, file);
-    fclose(file);
+static void CancelTextureStreaming(GLuint texture);
 
-    printf("Texture loaded from cache: %s (%d bytes)\n", filename, (int)dataSize);
+// Evicted textures keep a 1x1 black level (complete, can still be sampled), the other levels are released
+static void EvictTexture(GLenum target, GLuint texture)
+{
+    if (target == GL_TEXTURE_2D)
+        CancelTextureStreaming(texture);
 
-    return true;
+    GLint boundTexture = 0;
+    glGetIntegerv(target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_BINDING_CUBE_MAP : GL_TEXTURE_BINDING_2D, &boundTexture);
+    glBindTexture(target, texture);
+
+    const unsigned char black[4] = { 0, 0, 0, 255 };
+    int faceCount = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+    for (int face = 0; face < faceCount; ++face)
+    {
+        GLenum faceTarget = (target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+        glTexImage2D(faceTarget, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, black);
+        for (int level = 1; level < TEX_CACHE_MAX_LEVELS; ++level)
+            glTexImage2D(faceTarget, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameterf(target, GL_TEXTURE_MIN_LOD, -1000.f); // GL default
+
+    glBindTexture(target, boundTexture);
+}
+
+// Textures loaded from files can be evicted, they are reloaded by calling the same upload function
+static void TrackLoadedTexture(GLenum target, size_t bytes, const std::function<void()>& upload)
+{
+    GLenum binding = (target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_BINDING_CUBE_MAP : GL_TEXTURE_BINDING_2D;
+    GLint texture = 0;
+    glGetIntegerv(binding, &texture);
+
+    auto evict = [target, texture]() { EvictTexture(target, (GLuint)texture); };
+    auto reload = [target, binding, texture, upload]()
+    {
+        GLint boundTexture = 0;
+        glGetIntegerv(binding, &boundTexture);
+        glBindTexture(target, (GLuint)texture);
+        upload();
+        glBindTexture(target, (GLuint)boundTexture);
+    };
+    vram::Track(vram::ResourceType::TEXTURE, (GLuint)texture, bytes, evict, reload);
 }
 
-static void SaveTextureToCache(const void* data, size_t dataSize, const char* filename, int width, int height, int channels, bool linear)
+// How the levels of a cache entry are given to GL
+struct TextureUploadFormat
+{
+    bool compressed;
+    bool decompress; // Compressed format not supported, blocks are decoded to RGBA8 on CPU
+    bc::Format blockFormat;
+    GLenum decodedFormat;
+};
+
+static TextureUploadFormat GetUploadFormat(const TextureCacheEntry& texture)
 {
-    std::string cachedFile = filename;
-    cachedFile += linear ? ".texf" : ".tex";
-    cachedFile += ".cache";
+    TextureUploadFormat format = {};
+    format.compressed = (texture.flags & TEX_CACHE_FLAG_COMPRESSED) != 0;
+    format.blockFormat = bc::Format::BC1;
+    if (format.compressed)
+        GetBlockFormat(texture.internalFormat, &format.blockFormat);
 
-    FILE* file = fopen(cachedFile.c_str(), "wb");
-    fwrite(&dataSize, sizeof(size_t), 1, file);
-    fwrite(&width,    sizeof(int), 1, file);
-    fwrite(&height,   sizeof(int), 1, file);
-    fwrite(&channels, sizeof(int), 1, file);
-    fwrite(data, 1, dataSize, file);
-    fclose(file);
+    format.decompress = format.compressed && !IsCompressedFormatSupported(texture.internalFormat);
+    if (format.decompress)
+        printf("Compressed format %s not supported, decompressing on CPU\n", bc::FormatName(format.blockFormat));
 
-    printf("Texture saved to cache: %s (%d bytes)\n", filename, (int)dataSize);
+    switch (format.blockFormat)
+    {
+    case bc::Format::BC4:          format.decodedFormat = GL_RED;  break;
+    case bc::Format::BC5:          format.decodedFormat = GL_RG;   break;
+    case bc::Format::BC1:          format.decodedFormat = GL_RGB;  break;
+    case bc::Format::BC3: default: format.decodedFormat = GL_RGBA; break;
+    }
+    return format;
+}
+
+// Rows are uploaded by groups of 4 for block compressed levels
+static int GetRowGroupSize(const TextureUploadFormat& format)
+{
+    return format.compressed ? 4 : 1;
+}
+
+static size_t GetRowGroupBytes(const TextureUploadFormat& format, const TextureLevel& level)
+{
+    int groupSize = GetRowGroupSize(format);
+    return level.size / ((level.height + groupSize - 1) / groupSize);
+}
+
+// Specify a whole level of the bound GL_TEXTURE_2D (without data, the level is only allocated)
+static void SpecifyTextureLevel(const TextureCacheEntry& texture, const TextureUploadFormat& format, int level, bool withData, std::vector<unsigned char>& decoded)
+{
+    const TextureLevel& textureLevel = texture.levels[level];
+    if (format.decompress)
+    {
+        const void* pixels = nullptr;
+        if (withData)
+        {
+            decoded.resize((size_t)textureLevel.width * textureLevel.height * 4);
+            bc::Decompress(format.blockFormat, textureLevel.data, textureLevel.width, textureLevel.height, decoded.data());
+            pixels = decoded.data();
+        }
+        glTexImage2D(GL_TEXTURE_2D, level, format.decodedFormat, textureLevel.width, textureLevel.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    }
+    else if (format.compressed)
+    {
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, textureLevel.width, textureLevel.height, 0, (GLsizei)textureLevel.size, withData ? textureLevel.data : nullptr);
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, textureLevel.width, textureLevel.height, 0, texture.format, texture.type, withData ? textureLevel.data : nullptr);
+    }
+}
+
+// Upload rows [y, y + rowCount) of an allocated level (y is a multiple of the row group size)
+static void UpdateTextureRows(const TextureCacheEntry& texture, const TextureUploadFormat& format, int level, int y, int rowCount, std::vector<unsigned char>& decoded)
+{
+    const TextureLevel& textureLevel = texture.levels[level];
+    const unsigned char* rows = (const unsigned char*)textureLevel.data + (size_t)(y / GetRowGroupSize(format)) * GetRowGroupBytes(format, textureLevel);
+    if (format.decompress)
+    {
+        decoded.resize((size_t)textureLevel.width * rowCount * 4);
+        bc::Decompress(format.blockFormat, rows, textureLevel.width, rowCount, decoded.data());
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, y, textureLevel.width, rowCount, GL_RGBA, GL_UNSIGNED_BYTE, decoded.data());
+    }
+    else if (format.compressed)
+    {
+        int groupCount = (rowCount + 3) / 4;
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, y, textureLevel.width, rowCount, texture.internalFormat, (GLsizei)(groupCount * GetRowGroupBytes(format, textureLevel)), rows);
+    }
+    else
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, y, textureLevel.width, rowCount, texture.format, texture.type, rows);
+    }
+}
+
+static void SetTextureCacheParams(const TextureCacheEntry& texture)
+{
+    if (texture.levelCount > 1)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levelCount - 1);
+
+    // Single channel textures are seen as grey, normal maps z is set to 1 (shaders should reconstruct it)
+    if (texture.flags & TEX_CACHE_FLAG_GRAYSCALE)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+    }
+    if (texture.flags & TEX_CACHE_FLAG_NORMAL_MAP)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_ONE);
+    }
+}
+
+// Upload all levels of a cache entry to the bound GL_TEXTURE_2D
+static void UploadTextureCacheEntry(const TextureCacheEntry& texture)
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    TextureUploadFormat format = GetUploadFormat(texture);
+    std::vector<unsigned char> decoded;
+    for (int level = 0; level < texture.levelCount; ++level)
+        SpecifyTextureLevel(texture, format, level, true, decoded);
+
+    SetTextureCacheParams(texture);
+}
+
+// Streamed textures: all levels are allocated, the smallest ones are uploaded at once,
+// the largest ones are uploaded over the next frames (GL_TEXTURE_BASE_LEVEL is the finest complete level)
+#define STREAM_INITIAL_BYTES (64 * 1024) // Smallest levels uploaded at creation
+#define STREAM_LOD_FADE      0.125f      // GL_TEXTURE_MIN_LOD decrease per frame after a new level (avoids popping)
+
+struct StreamedTexture
+{
+    GLuint texture;
+    TextureCacheEntry entry;
+    TextureUploadFormat format;
+    int level;    // Level being uploaded, levels above are complete (-1 when done)
+    int row;      // Next row of this level
+    float minLod;
+};
+
+static bool textureStreaming = false;
+static std::vector<StreamedTexture> streamedTextures;
+
+// Takes ownership of the entry
+static void StartTextureStreaming(TextureCacheEntry& texture)
+{
+    StreamedTexture streamed = {};
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, (GLint*)&streamed.texture);
+    streamed.entry  = texture;
+    streamed.format = GetUploadFormat(texture);
+    texture = {};
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // Smallest levels first
+    std::vector<unsigned char> decoded;
+    size_t initialBytes = 0;
+    streamed.level = streamed.entry.levelCount - 1;
+    for (int level = streamed.entry.levelCount - 1; level >= 0; --level)
+    {
+        initialBytes += streamed.entry.levels[level].size;
+        bool upload = level == streamed.entry.levelCount - 1 || initialBytes <= STREAM_INITIAL_BYTES;
+        SpecifyTextureLevel(streamed.entry, streamed.format, level, upload, decoded);
+        if (upload)
+            streamed.level = level - 1;
+    }
+
+    SetTextureCacheParams(streamed.entry);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, streamed.level + 1);
+
+    if (streamed.level < 0)
+        FreeTextureCacheEntry(&streamed.entry);
+    else
+        streamedTextures.push_back(streamed);
+}
+
+static void CancelTextureStreaming(GLuint texture)
+{
+    for (size_t i = 0; i < streamedTextures.size(); ++i)
+    {
+        if (streamedTextures[i].texture == texture)
+        {
+            FreeTextureCacheEntry(&streamedTextures[i].entry);
+            streamedTextures.erase(streamedTextures.begin() + i);
+            return;
+        }
+    }
+}
+
+void gl::SetTextureStreaming(bool enabled)
+{
+    textureStreaming = enabled;
+}
+
+size_t gl::UpdateTextureStreaming(size_t byteBudget)
+{
+    if (streamedTextures.empty())
+        return 0;
+
+    GLint boundTexture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // Fade in the levels completed during the previous frames
+    for (StreamedTexture& streamed : streamedTextures)
+    {
+        if (streamed.minLod > 0.f)
+        {
+            streamed.minLod = calc::Max(streamed.minLod - STREAM_LOD_FADE, 0.f);
+            glBindTexture(GL_TEXTURE_2D, streamed.texture);
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, streamed.minLod);
+        }
+    }
+
+    std::vector<unsigned char> decoded;
+    while (byteBudget > 0)
+    {
+        // Smallest pending level first, so that all textures sharpen together
+        StreamedTexture* next = nullptr;
+        for (StreamedTexture& streamed : streamedTextures)
+        {
+            if (streamed.level < 0)
+                continue;
+            if (next == nullptr || streamed.entry.levels[streamed.level].size < next->entry.levels[next->level].size)
+                next = &streamed;
+        }
+        if (next == nullptr)
+            break;
+
+        // As many rows as the budget allows (at least one group, so that uploads always progress)
+        const TextureLevel& level = next->entry.levels[next->level];
+        int groupSize = GetRowGroupSize(next->format);
+        size_t groupBytes = GetRowGroupBytes(next->format, level);
+        int groupCount = (int)calc::Max(byteBudget / groupBytes, (size_t)1);
+        int rowCount = calc::Min(groupCount * groupSize, level.height - next->row);
+
+        glBindTexture(GL_TEXTURE_2D, next->texture);
+        UpdateTextureRows(next->entry, next->format, next->level, next->row, rowCount, decoded);
+        next->row += rowCount;
+
+        size_t uploadedBytes = (size_t)((rowCount + groupSize - 1) / groupSize) * groupBytes;
+        byteBudget -= calc::Min(uploadedBytes, byteBudget);
+
+        if (next->row >= level.height)
+        {
+            // Level complete, sample it (starting from the previous level's detail)
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, next->level);
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, 1.f);
+            next->minLod = 1.f;
+            next->row = 0;
+            next->level--;
+            if (next->level < 0)
+                FreeTextureCacheEntry(&next->entry);
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, boundTexture);
+
+    // Remove finished textures and count what is left
+    size_t pendingBytes = 0;
+    for (size_t i = 0; i < streamedTextures.size();)
+    {
+        StreamedTexture& streamed = streamedTextures[i];
+        if (streamed.level < 0 && streamed.minLod == 0.f)
+        {
+            FreeTextureCacheEntry(&streamed.entry);
+            streamedTextures.erase(streamedTextures.begin() + i);
+            continue;
+        }
+
+        for (int level = 0; level <= streamed.level; ++level)
+            pendingBytes += streamed.entry.levels[level].size;
+        if (streamed.level >= 0)
+            pendingBytes -= (size_t)(streamed.row / GetRowGroupSize(streamed.format)) * GetRowGroupBytes(streamed.format, streamed.entry.levels[streamed.level]);
+        ++i;
+    }
+    return pendingBytes;
+}
+
+void gl::FinishTextureStreaming(GLuint texture)
+{
+    for (size_t i = 0; i < streamedTextures.size(); ++i)
+    {
+        StreamedTexture& streamed = streamedTextures[i];
+        if (streamed.texture != texture)
+            continue;
+
+        GLint boundTexture = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        std::vector<unsigned char> decoded;
+        for (int level = streamed.level; level >= 0; --level)
+            SpecifyTextureLevel(streamed.entry, streamed.format, level, true, decoded);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, -1000.f); // GL default
+
+        glBindTexture(GL_TEXTURE_2D, boundTexture);
+        FreeTextureCacheEntry(&streamed.entry);
+        streamedTextures.erase(streamedTextures.begin() + i);
+        return;
+    }
+}
+
+void gl::ReleaseTextureStreaming()
+{
+    for (StreamedTexture& streamed : streamedTextures)
+        FreeTextureCacheEntry(&streamed.entry);
+    streamedTextures.clear();
+}
+
+void gl::DeleteTextures(int count, const GLuint* textures)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        CancelTextureStreaming(textures[i]);
+        vram::Untrack(vram::ResourceType::TEXTURE, textures[i]);
+    }
+    glDeleteTextures(count, textures);
+}
+
+void gl::DeleteBuffers(int count, const GLuint* buffers)
+{
+    for (int i = 0; i < count; ++i)
+        vram::Untrack(vram::ResourceType::BUFFER, buffers[i]);
+    glDeleteBuffers(count, buffers);
+}
+
+void gl::DeleteRenderbuffers(int count, const GLuint* renderbuffers)
+{
+    for (int i = 0; i < count; ++i)
+        vram::Untrack(vram::ResourceType::RENDERBUFFER, renderbuffers[i]);
+    glDeleteRenderbuffers(count, renderbuffers);
 }
 
 GLuint gl::CreateShader(GLenum type, int sourceCount, const char** sources)
@@ -131,80 +523,162 @@ void gl::UploadPerlinNoise(int width, int height, float z, float lacunarity, flo
     }
 #endif
     glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, pixels.data());
+
+    GLint texture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    vram::Track(vram::ResourceType::TEXTURE, (GLuint)texture, (size_t)width * height * 4);
 }
 
-void gl::UploadImage(const char* file, bool linear)
+// Decode an image from the asset archive when it is packed there, from the loose file otherwise
+// GPU size of all levels, streamed or not (CPU decoded blocks are RGBA8)
+static size_t GetTextureCacheEntryBytes(const TextureCacheEntry& texture)
 {
-    int width    = 0;
-    int height   = 0;
-    int channels = 0;
-
-    stbi_set_flip_vertically_on_load(1);
-    void* colors;
-
-    if (!LoadTextureFromCache(&colors, file, &width, &height, &channels, linear))
+    bool decompress = (texture.flags & TEX_CACHE_FLAG_COMPRESSED) && !IsCompressedFormatSupported(texture.internalFormat);
+    size_t bytes = 0;
+    for (int level = 0; level < texture.levelCount; ++level)
     {
-        if (linear)
-            colors = stbi_loadf(file, &width, &height, &channels, 0);
+        const TextureLevel& textureLevel = texture.levels[level];
+        if (decompress)
+            bytes += (size_t)textureLevel.width * textureLevel.height * 4;
+        else if (texture.flags & TEX_CACHE_FLAG_COMPRESSED)
+            bytes += textureLevel.size;
         else
-            colors = stbi_load(file, &width, &height, &channels, 0);
+            bytes += (size_t)textureLevel.width * textureLevel.height * GetPixelBytes(texture.internalFormat);
+    }
+    return bytes;
+}
 
-        if (colors == nullptr)
-            fprintf(stderr, "Failed to load image '%s'\n", file);
-        else
-            printf("Load image '%s' (%dx%d %d channels)\n", file, width, height, channels);
+// Upload a loaded texture to the bound GL_TEXTURE_2D (the texture entry is released)
+static void UploadLoadedTexture(TextureCacheEntry& texture, const char* file, bool linear)
+{
+    std::string filename = file;
+    TrackLoadedTexture(GL_TEXTURE_2D, GetTextureCacheEntryBytes(texture), [filename, linear]() { gl::UploadImage(filename.c_str(), linear); });
 
-        int byteSize = width * height * channels * (linear ? sizeof(float) : sizeof(char));
-        SaveTextureToCache(colors, byteSize, file, width, height, channels, linear);
+    if (textureStreaming && texture.levelCount > 1)
+    {
+        StartTextureStreaming(texture);
+        return;
     }
 
-    GLenum format;
-    switch (channels)
+    UploadTextureCacheEntry(texture);
+    FreeTextureCacheEntry(&texture);
+}
+
+void gl::UploadImage(const char* file, bool linear)
+{
+    stbi_set_flip_vertically_on_load(1);
+
+    TextureCacheEntry texture = {};
+    if (LoadTextureCacheEntry(&texture, file, linear))
+        UploadLoadedTexture(texture, file, linear);
+}
+
+void gl::UploadTexture(TextureCacheEntry& texture, const std::function<void()>& reload)
+{
+    size_t bytes = GetTextureCacheEntryBytes(texture);
+    if (reload)
+    {
+        TrackLoadedTexture(GL_TEXTURE_2D, bytes, reload);
+    }
+    else
     {
-    case 1:          format = GL_RED;  break;
-    case 2:          format = GL_RG;   break;
-    case 3:          format = GL_RGB;  break;
-    case 4: default: format = GL_RGBA; break;
+        GLint boundTexture = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+        vram::Track(vram::ResourceType::TEXTURE, (GLuint)boundTexture, bytes);
     }
 
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, linear ? GL_FLOAT : GL_UNSIGNED_BYTE, colors);
+    UploadTextureCacheEntry(texture);
+    FreeTextureCacheEntry(&texture);
+}
+
+void gl::UploadMaterialSet(int count, const GLuint* textures, const char* const* files, bool linear)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Decode (or read from cache) concurrently
+    std::vector<TextureCacheEntry> entries(count);
+    std::vector<unsigned char> loaded(count);
+    std::vector<float> loadMilliseconds(count);
+    stbi_set_flip_vertically_on_load(1);
+    jobs::ParallelFor(count, [&](int i)
+    {
+        auto loadStart = std::chrono::steady_clock::now();
+        loaded[i] = LoadTextureCacheEntry(&entries[i], files[i], linear);
+        loadMilliseconds[i] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+    });
+    float decodeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // Upload in one pass
+    GLint boundTexture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+    for (int i = 0; i < count; ++i)
+    {
+        if (!loaded[i])
+            continue;
 
-    stbi_image_free(colors);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        UploadLoadedTexture(entries[i], files[i], linear);
+        SetTextureDefaultParams();
+    }
+    glBindTexture(GL_TEXTURE_2D, boundTexture);
+
+    // The serial path loads the textures one after the other
+    float serialMilliseconds = 0.f;
+    for (float milliseconds : loadMilliseconds)
+        serialMilliseconds += milliseconds;
+    float totalMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Material set loaded: %d textures in %.1f ms (decode %.1f ms on %d threads, %.1f ms serial)\n",
+        count, totalMilliseconds, decodeMilliseconds, jobs::ThreadCount(), serialMilliseconds);
 }
 
 void gl::UploadImageCubeMap(const std::string& folderPath)
 {
-    const std::string faces[6] =
+    struct Face
     {
-        "right.jpg",
-        "left.jpg",
-        "top.jpg",
-        "bottom.jpg",
-        "back.jpg",
-        "front.jpg"
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        unsigned char* colors = nullptr;
+        float milliseconds = 0.f;
     };
+    Face decodedFaces[6];
 
-    int width = 0;
-    int height = 0;
-    int channels = 0;
-
-    for (size_t i = 0; i < 6; i++)
+    // Decode the faces concurrently
+    auto start = std::chrono::steady_clock::now();
+    stbi_set_flip_vertically_on_load(false);
+    jobs::ParallelFor(6, [&](int i)
     {
-        std::string curFile = (folderPath + faces[i]);
-        stbi_set_flip_vertically_on_load(false);
-        unsigned char* colors = stbi_load(curFile.c_str(), &width, &height, &channels, 0);
-        if (colors == nullptr)
+        auto faceStart = std::chrono::steady_clock::now();
+        Face& face = decodedFaces[i];
+        std::string curFile = (folderPath + env::cubemapFaceFiles[i]);
+        face.colors = (unsigned char*)LoadImagePixels(curFile.c_str(), false, &face.width, &face.height, &face.channels);
+        if (face.colors == nullptr)
             fprintf(stderr, "Failed to load image '%s'\n", curFile.c_str());
         else
-            printf("Load image '%s' (%dx%d %d channels)\n", curFile.c_str(), width, height, channels);
+            printf("Load image '%s' (%dx%d %d channels)\n", curFile.c_str(), face.width, face.height, face.channels);
+        face.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - faceStart).count();
+    });
+    float decodeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-        GLenum format = (channels == 3) ? GL_RGB : GL_RGBA;
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, colors);
+    // Upload in one pass
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    float serialMilliseconds = 0.f;
+    for (int i = 0; i < 6; i++)
+    {
+        Face& face = decodedFaces[i];
+        GLenum format = (face.channels == 3) ? GL_RGB : GL_RGBA;
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, face.width, face.height, 0, format, GL_UNSIGNED_BYTE, face.colors);
 
-        stbi_image_free(colors);
+        stbi_image_free(face.colors);
+        serialMilliseconds += face.milliseconds;
     }
 
+    TrackLoadedTexture(GL_TEXTURE_CUBE_MAP, (size_t)decodedFaces[0].width * decodedFaces[0].height * 4 * 6, [folderPath]() { gl::UploadImageCubeMap(folderPath); });
+
+    float totalMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Cubemap loaded: %s (6 faces in %.1f ms, decode %.1f ms on %d threads, %.1f ms serial)\n",
+        folderPath.c_str(), totalMilliseconds, decodeMilliseconds, jobs::ThreadCount(), serialMilliseconds);
+
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -216,6 +690,97 @@ void gl::UploadColoredTexture(float r, float g, float b, float a)
 {
     float4 colors = { r, g, b, a };
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_FLOAT, colors.e);
+
+    GLint texture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    vram::Track(vram::ResourceType::TEXTURE, (GLuint)texture, 4);
+}
+
+void gl::AllocateTexture2D(GLenum internalFormat, int width, int height, GLenum format, GLenum type, const void* data)
+{
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, data);
+
+    GLint texture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    vram::Track(vram::ResourceType::TEXTURE, (GLuint)texture, (size_t)width * height * GetPixelBytes(internalFormat));
+}
+
+void gl::BufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+    glBufferData(target, size, data, usage);
+
+    GLenum binding;
+    switch (target)
+    {
+    case GL_ARRAY_BUFFER:         binding = GL_ARRAY_BUFFER_BINDING;         break;
+    case GL_ELEMENT_ARRAY_BUFFER: binding = GL_ELEMENT_ARRAY_BUFFER_BINDING; break;
+    case GL_UNIFORM_BUFFER:       binding = GL_UNIFORM_BUFFER_BINDING;       break;
+    case GL_PIXEL_PACK_BUFFER:    binding = GL_PIXEL_PACK_BUFFER_BINDING;    break;
+    case GL_PIXEL_UNPACK_BUFFER:  binding = GL_PIXEL_UNPACK_BUFFER_BINDING;  break;
+    case GL_COPY_READ_BUFFER:     binding = GL_COPY_READ_BUFFER;             break; // Targets are their own binding
+    case GL_COPY_WRITE_BUFFER:    binding = GL_COPY_WRITE_BUFFER;            break;
+    case GL_TEXTURE_BUFFER:       binding = GL_TEXTURE_BUFFER;               break;
+    default:                      return;
+    }
+
+    GLint buffer = 0;
+    glGetIntegerv(binding, &buffer);
+    vram::Track(vram::ResourceType::BUFFER, (GLuint)buffer, (size_t)size);
+}
+
+void gl::RenderbufferStorage(GLenum internalFormat, int width, int height)
+{
+    glRenderbufferStorage(GL_RENDERBUFFER, internalFormat, width, height);
+
+    GLint renderbuffer = 0;
+    glGetIntegerv(GL_RENDERBUFFER_BINDING, &renderbuffer);
+    vram::Track(vram::ResourceType::RENDERBUFFER, (GLuint)renderbuffer, (size_t)width * height * GetPixelBytes(internalFormat));
+}
+
+void gl::CreateTimer(GpuTimer* timer)
+{
+    glGenQueries(ARRAYSIZE(timer->queries), timer->queries);
+}
+
+void gl::DeleteTimer(GpuTimer* timer)
+{
+    glDeleteQueries(ARRAYSIZE(timer->queries), timer->queries);
+    *timer = {};
+}
+
+void gl::BeginTimer(GpuTimer* timer)
+{
+    const int queryCount = ARRAYSIZE(timer->queries);
+
+    // Oldest results first
+    while (timer->readCount < timer->issuedCount)
+    {
+        GLuint query = timer->queries[timer->readCount % queryCount];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        timer->milliseconds = nanoseconds / 1000000.f;
+        ++timer->readCount;
+    }
+
+    // All queries in flight: this range is not timed
+    timer->running = timer->issuedCount - timer->readCount < queryCount;
+    if (timer->running)
+        glBeginQuery(GL_TIME_ELAPSED, timer->queries[timer->issuedCount % queryCount]);
+}
+
+void gl::EndTimer(GpuTimer* timer)
+{
+    if (!timer->running)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    ++timer->issuedCount;
+    timer->running = false;
 }
 
 void gl::SetTextureDefaultParams(bool genMipmap)
@@ -223,7 +788,11 @@ void gl::SetTextureDefaultParams(bool genMipmap)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     if (genMipmap)
     {
-        glGenerateMipmap(GL_TEXTURE_2D);
+        // Cached textures come with their mip chain
+        GLint level1Width = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 1, GL_TEXTURE_WIDTH, &level1Width);
+        if (level1Width == 0)
+            glGenerateMipmap(GL_TEXTURE_2D);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     }
     else
@@ -235,95 +804,146 @@ void gl::SetTextureDefaultParams(bool genMipmap)
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16.f);
 }
 
-// TODO: Move dds specific stuff somewhere else
-#define DDS_SURFACE_FLAGS_CUBEMAP 0x00000008 // DDSCAPS_COMPLEX
+// Same as dds::Load, but reads from the asset archive when the file is packed there
+static bool LoadDDS(dds::Image* image, const char* filename)
+{
+    const void* data;
+    size_t size;
+    if (archive::Find(filename, &data, &size))
+        return dds::LoadFromMemory(image, data, size, filename);
 
-#define DDS_CUBEMAP_POSITIVEX 0x00000600 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_POSITIVEX
-#define DDS_CUBEMAP_NEGATIVEX 0x00000a00 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_NEGATIVEX
-#define DDS_CUBEMAP_POSITIVEY 0x00001200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_POSITIVEY
-#define DDS_CUBEMAP_NEGATIVEY 0x00002200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_NEGATIVEY
-#define DDS_CUBEMAP_POSITIVEZ 0x00004200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_POSITIVEZ
-#define DDS_CUBEMAP_NEGATIVEZ 0x00008200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_NEGATIVEZ
+    return dds::Load(image, filename);
+}
 
-#define DDS_CUBEMAP_ALLFACES ( DDS_CUBEMAP_POSITIVEX | DDS_CUBEMAP_NEGATIVEX |\
-                               DDS_CUBEMAP_POSITIVEY | DDS_CUBEMAP_NEGATIVEY |\
-                               DDS_CUBEMAP_POSITIVEZ | DDS_CUBEMAP_NEGATIVEZ )
+static bool HasBPTC()
+{
+    static bool hasBPTC = gl::HasExtension("GL_ARB_texture_compression_bptc");
+    return hasBPTC;
+}
 
-struct DDSPixelFormat
+// Float cubemaps are converted once to a smaller format (BC6H if supported, RGBA16F otherwise) and cached on disk
+static bool LoadCubemapFromCache(dds::Image* image, const char* filename)
 {
-    uint32_t size;
-    uint32_t flags;
-    uint32_t fourCC;
-    uint32_t rgbBitCount;
-    uint32_t rBitMask;
-    uint32_t gBitMask;
-    uint32_t bBitMask;
-    uint32_t aBitMask;
-};
+    dds::Format cacheFormat = HasBPTC() ? dds::Format::BC6H : dds::Format::RGBA16F;
+    std::string cacheFile = std::string(filename) + (HasBPTC() ? ".bc6h.cache" : ".rgba16f.cache");
 
-struct DDSHeader
-{
-    uint32_t       size;
-    uint32_t       flags;
-    uint32_t       height;
-    uint32_t       width;
-    uint32_t       pitchOrLinearSize;
-    uint32_t       depth;
-    uint32_t       mipMapCount;
-    uint32_t       reserved1[11];
-    DDSPixelFormat pixelFormat;
-    uint32_t       caps;
-    uint32_t       caps2;
-    uint32_t       caps3;
-    uint32_t       caps4;
-    uint32_t       reserved2;
-};
+    if (LoadDDS(image, cacheFile.c_str()))
+    {
+        if (image->format == cacheFormat && image->faceCount == 6)
+        {
+            printf("Cubemap loaded from cache: %s (%s)\n", filename, dds::FormatName(image->format));
+            return true;
+        }
+        dds::Free(image);
+    }
 
-void gl::UploadCubemap(const char* filename)
-{
-    std::ifstream file(filename, std::ios::binary);
+    dds::Image source;
+    if (!LoadDDS(&source, filename))
+        return false;
 
-    // Parse magic number
-    char magic[4] = {};
-    file.read((char*)&magic, sizeof(uint32_t));
-    if (strncmp(magic, "DDS ", 4) != 0)
+    if (source.format != dds::Format::RGBA32F || source.faceCount != 6)
     {
-        fprintf(stderr, "Not a dds file\n");
-        return;
+        // Nothing to convert
+        *image = source;
+        return true;
     }
 
-    // Parse header
-    DDSHeader header = {};
-    file.read((char*)&header, sizeof(DDSHeader));
-    file.seekg(header.size - sizeof(DDSHeader), std::ios_base::cur); // Jump to data
+    auto start = std::chrono::steady_clock::now();
+    dds::Convert(source, cacheFormat, image);
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+    size_t pixelCount = 0;
+    for (int level = 0; level < source.levelCount; ++level)
+        pixelCount += (size_t)source.levels[0][level].width * source.levels[0][level].height * 6;
+
+    // Measure quality of the first face
+    const dds::Level& baseLevel = image->levels[0][0];
+    std::vector<float> decoded((size_t)baseLevel.width * baseLevel.height * 4);
+    dds::DecodeLevel(image->format, baseLevel, decoded.data());
+    float psnr = bc::ComputePSNRHDR((const float*)source.levels[0][0].data, decoded.data(), baseLevel.width, baseLevel.height);
+
+    printf("Cubemap converted: %s (%s, %d levels, %.1f ms, %.1f Mpixels/s, PSNR-HDR %.2f dB)\n",
+        filename, dds::FormatName(image->format), image->levelCount, seconds * 1000.f, pixelCount / (seconds * 1000000.f), psnr);
+
+    dds::Save(*image, cacheFile.c_str());
+    dds::Free(&source);
+    return true;
+}
+
+void gl::UploadCubemap(const char* filename)
+{
+    dds::Image image;
+    if (!LoadCubemapFromCache(&image, filename))
+        return;
+
+    std::string cubemapFile = filename;
+    UploadCubemap(image, [cubemapFile]() { gl::UploadCubemap(cubemapFile.c_str()); });
+    dds::Free(&image);
+}
 
+void gl::UploadCubemap(const dds::Image& source, const std::function<void()>& reload)
+{
     // Abort loading if the texture is not a cubemap...
-    if ((header.caps  & DDS_SURFACE_FLAGS_CUBEMAP) == 0 || 
-        (header.caps2 & DDS_CUBEMAP_ALLFACES)      == 0)
+    if (source.faceCount != 6)
     {
         fprintf(stderr, "Not a cubemap or not complete\n");
         return;
     }
 
-    // Abort if the format is not supported
-    if (header.pixelFormat.rgbBitCount != 128)
+    // BC6H files without hardware support
+    dds::Image decoded;
+    if (source.format == dds::Format::BC6H && !HasBPTC())
     {
-        fprintf(stderr, "Only 128 bits (4 floats) textures supported\n");
-        return;
+        printf("Compressed format BC6H not supported, decompressing on CPU\n");
+        dds::Convert(source, dds::Format::RGBA16F, &decoded);
     }
+    const dds::Image& image = decoded.memory ? decoded : source;
 
-    // Parse each cubemap face and each texture level and upload them to GPU
-    std::vector<float4> buffer(header.width * header.height); // Buffer size for level 0
+    // Upload each cubemap face and each texture level to GPU
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     for (int i = 0; i < 6; ++i)
     {
-        for (uint32_t level = 0; level <= header.mipMapCount; ++level)
+        for (int level = 0; level < image.levelCount; ++level)
         {
-            int width  = header.width  >> level;
-            int height = header.height >> level;
+            const dds::Level& faceLevel = image.levels[i][level];
+            GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + i;
+            switch (image.format)
+            {
+            case dds::Format::RGBA32F:
+                glTexImage2D(target, level, GL_RGBA32F, faceLevel.width, faceLevel.height, 0, GL_RGBA, GL_FLOAT, faceLevel.data);
+                break;
+            case dds::Format::RGBA16F:
+                glTexImage2D(target, level, GL_RGBA16F, faceLevel.width, faceLevel.height, 0, GL_RGBA, GL_HALF_FLOAT, faceLevel.data);
+                break;
+            case dds::Format::R11G11B10F:
+                glTexImage2D(target, level, GL_R11F_G11F_B10F, faceLevel.width, faceLevel.height, 0, GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, faceLevel.data);
+                break;
+            case dds::Format::BC6H:
+                glCompressedTexImage2D(target, level, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB, faceLevel.width, faceLevel.height, 0, (GLsizei)faceLevel.size, faceLevel.data);
+                break;
+            default:
+                break;
+            }
+        }
+    }
 
-            file.read((char*)buffer.data(), width * height * sizeof(float4));
+    if (image.levelCount > 1)
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, image.levelCount - 1);
 
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, buffer.data());
-        }
+    size_t bytes = 0;
+    for (int i = 0; i < 6; ++i)
+        for (int level = 0; level < image.levelCount; ++level)
+            bytes += image.levels[i][level].size;
+    if (reload)
+    {
+        TrackLoadedTexture(GL_TEXTURE_CUBE_MAP, bytes, reload);
     }
+    else
+    {
+        GLint texture = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_CUBE_MAP, &texture);
+        vram::Track(vram::ResourceType::TEXTURE, (GLuint)texture, bytes);
+    }
+
+    dds::Free(&decoded);
 }
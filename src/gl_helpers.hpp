@@ -2,18 +2,80 @@
 
 
 #include <glad/glad.h>
+#include <functional>
 #include <string>
 
+// Extensions not exposed by the glad loader
+#ifndef GL_EXT_texture_compression_s3tc
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+#ifndef GL_ARB_texture_compression_bptc
+#define GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT_ARB   0x8E8E
+#define GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB 0x8E8F
+#endif
+
+
+struct TextureCacheEntry;
+
+namespace dds
+{
+    struct Image;
+}
 
 namespace gl
 {
+    bool HasExtension(const char* name);
     GLuint CreateShader(GLenum type, int sourceCount, const char** sources);
     GLuint CreateBasicProgram(const char* vsStr, const char* fsStr);
     GLuint CreateProgram(int vsStrsCount, const char** vsStrs, int fsStrsCount, const char** fsStrs);
     void UploadPerlinNoise(int width, int height, float z, float lacunarity = 2.f, float gain = 0.5f, float offset = 1.f, int octaves = 6);
     void UploadImageCubeMap(const std::string& folderPath);
     void UploadImage(const char* file, bool linear = false);
+    // Decode several images concurrently, then upload each to its texture (with default params)
+    void UploadMaterialSet(int count, const GLuint* textures, const char* const* files, bool linear = false);
+    // All levels of a texture cache entry to the bound GL_TEXTURE_2D, never streamed (the entry is released)
+    // Evicted textures are restored with reload, never evicted without it
+    void UploadTexture(TextureCacheEntry& texture, const std::function<void()>& reload = nullptr);
     void UploadColoredTexture(float r, float g, float b, float a);
     void UploadCubemap(const char* filename);
+    // Faces and levels given to GL straight from memory (only BC6H without hardware support is decoded first)
+    // Evicted cubemaps are restored with reload, never evicted without it
+    void UploadCubemap(const dds::Image& image, const std::function<void()>& reload = nullptr);
     void SetTextureDefaultParams(bool genMipmap = true);
+
+    // Allocations accounted in the GPU memory budget (see vram_budget.hpp), on the bound object
+    void AllocateTexture2D(GLenum internalFormat, int width, int height, GLenum format, GLenum type, const void* data = nullptr);
+    void BufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+    void RenderbufferStorage(GLenum internalFormat, int width, int height);
+
+    // GPU time of the commands between BeginTimer and EndTimer (GL_TIME_ELAPSED queries, timers cannot be nested)
+    // Results are read when available a few frames later, the CPU never waits for them
+    struct GpuTimer
+    {
+        GLuint queries[4] = {};
+        int issuedCount = 0;
+        int readCount = 0;
+        bool running = false;
+        float milliseconds = 0.f; // Last result
+    };
+    void CreateTimer(GpuTimer* timer);
+    void DeleteTimer(GpuTimer* timer);
+    void BeginTimer(GpuTimer* timer);
+    void EndTimer(GpuTimer* timer);
+
+    // When enabled, UploadImage only uploads the smallest mips, the others are uploaded by UpdateTextureStreaming
+    void SetTextureStreaming(bool enabled);
+    size_t UpdateTextureStreaming(size_t byteBudget); // Call once per frame, returns the bytes left to upload
+    void FinishTextureStreaming(GLuint texture);      // Upload the missing levels of a texture now
+    void ReleaseTextureStreaming();
+
+    // glDelete* for every object given to the gl:: helpers: GL reuses deleted names, the pending streamed levels
+    // and the budget tracking of a deleted object must not reach the next object created with the same name
+    void DeleteTextures(int count, const GLuint* textures);
+    void DeleteBuffers(int count, const GLuint* buffers);
+    void DeleteRenderbuffers(int count, const GLuint* renderbuffers);
 }
\ No newline at end of file
@@ -0,0 +1,645 @@
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <stb_image.h>
+
+#include "asset_archive.hpp"
+#include "calc.hpp"
+#include "jobs.hpp"
+#include "light_clusters.hpp"
+#include "sh.hpp"
+#include "vram_budget.hpp"
+#include "irradiance_volume.hpp"
+
+#define VOLUME_MAX_RESOLUTION 64
+#define VOLUME_LEAF_SIZE      4
+#define VOLUME_RAY_EPSILON    1e-3f
+
+static float Dot(float3 a, float3 b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// Bounding volume hierarchy
+
+struct BVHNode
+{
+    float3 boundsMin;
+    float3 boundsMax;
+    int first; // First triangle of a leaf, second child of an inner node (the first one follows its parent)
+    int count; // 0 for inner nodes
+};
+
+struct Triangle
+{
+    float3 v0;
+    float3 edge1;
+    float3 edge2;
+    int index; // In the scene
+};
+
+struct BVH
+{
+    std::vector<BVHNode> nodes;
+    std::vector<Triangle> triangles;
+};
+
+struct Hit
+{
+    float t;
+    float u;
+    float v;
+    int triangle;
+};
+
+static int BuildNode(BVH* bvh, std::vector<int>& order, const std::vector<float3>& centroids, int first, int count)
+{
+    int nodeIndex = (int)bvh->nodes.size();
+    bvh->nodes.push_back({});
+
+    BVHNode node;
+    node.boundsMin = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+    node.boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    float3 centroidMin = node.boundsMin;
+    float3 centroidMax = node.boundsMax;
+    for (int i = first; i < first + count; ++i)
+    {
+        const Triangle& triangle = bvh->triangles[order[i]];
+        float3 vertices[3] = { triangle.v0, triangle.v0 + triangle.edge1, triangle.v0 + triangle.edge2 };
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (float3 vertex : vertices)
+            {
+                node.boundsMin.e[axis] = calc::Min(node.boundsMin.e[axis], vertex.e[axis]);
+                node.boundsMax.e[axis] = calc::Max(node.boundsMax.e[axis], vertex.e[axis]);
+            }
+            centroidMin.e[axis] = calc::Min(centroidMin.e[axis], centroids[order[i]].e[axis]);
+            centroidMax.e[axis] = calc::Max(centroidMax.e[axis], centroids[order[i]].e[axis]);
+        }
+    }
+
+    if (count <= VOLUME_LEAF_SIZE)
+    {
+        node.first = first;
+        node.count = count;
+        bvh->nodes[nodeIndex] = node;
+        return nodeIndex;
+    }
+
+    // Median split along the longest axis of the centroids
+    float3 extent = centroidMax - centroidMin;
+    int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+    int half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+        [&](int a, int b) { return centroids[a].e[axis] < centroids[b].e[axis]; });
+
+    BuildNode(bvh, order, centroids, first, half);
+    node.first = BuildNode(bvh, order, centroids, first + half, count - half);
+    node.count = 0;
+    bvh->nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+static void BuildBVH(BVH* bvh, const std::vector<float3>& positions)
+{
+    int triangleCount = (int)positions.size() / 3;
+    std::vector<Triangle> triangles(triangleCount);
+    std::vector<float3> centroids(triangleCount);
+    std::vector<int> order(triangleCount);
+    for (int i = 0; i < triangleCount; ++i)
+    {
+        const float3* vertices = &positions[i * 3];
+        triangles[i] = { vertices[0], vertices[1] - vertices[0], vertices[2] - vertices[0], i };
+        centroids[i] = (vertices[0] + vertices[1] + vertices[2]) / 3.f;
+        order[i] = i;
+    }
+
+    bvh->triangles = triangles;
+    bvh->nodes.clear();
+    bvh->nodes.reserve(triangleCount * 2);
+    if (triangleCount > 0)
+        BuildNode(bvh, order, centroids, 0, triangleCount);
+
+    // Leaves index the reordered triangles
+    for (int i = 0; i < triangleCount; ++i)
+        bvh->triangles[i] = triangles[order[i]];
+}
+
+static bool IntersectBounds(const BVHNode& node, float3 origin, float3 inverseDirection, float tMax)
+{
+    float tNear = 0.f;
+    float tFar = tMax;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float t0 = (node.boundsMin.e[axis] - origin.e[axis]) * inverseDirection.e[axis];
+        float t1 = (node.boundsMax.e[axis] - origin.e[axis]) * inverseDirection.e[axis];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tNear = calc::Max(tNear, t0);
+        tFar = calc::Min(tFar, t1);
+    }
+    return tNear <= tFar;
+}
+
+// Moller-Trumbore, both faces
+static bool IntersectTriangle(const Triangle& triangle, float3 origin, float3 direction, float tMax, Hit* hit)
+{
+    float3 p = v3Cross(direction, triangle.edge2);
+    float determinant = Dot(triangle.edge1, p);
+    if (fabsf(determinant) < 1e-12f)
+        return false;
+
+    float inverseDeterminant = 1.f / determinant;
+    float3 s = origin - triangle.v0;
+    float u = Dot(s, p) * inverseDeterminant;
+    if (u < 0.f || u > 1.f)
+        return false;
+
+    float3 q = v3Cross(s, triangle.edge1);
+    float v = Dot(direction, q) * inverseDeterminant;
+    if (v < 0.f || u + v > 1.f)
+        return false;
+
+    float t = Dot(triangle.edge2, q) * inverseDeterminant;
+    if (t <= VOLUME_RAY_EPSILON || t >= tMax)
+        return false;
+
+    *hit = { t, u, v, triangle.index };
+    return true;
+}
+
+// Closest hit, or any hit when only the occlusion matters
+static bool Intersect(const BVH& bvh, float3 origin, float3 direction, float tMax, bool anyHit, Hit* hit)
+{
+    if (bvh.nodes.empty())
+        return false;
+
+    float3 inverseDirection = { 1.f / direction.x, 1.f / direction.y, 1.f / direction.z };
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    bool found = false;
+    while (stackSize > 0)
+    {
+        const BVHNode& node = bvh.nodes[stack[--stackSize]];
+        if (!IntersectBounds(node, origin, inverseDirection, tMax))
+            continue;
+
+        if (node.count == 0)
+        {
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = (int)(&node - bvh.nodes.data()) + 1;
+            continue;
+        }
+
+        for (int i = node.first; i < node.first + node.count; ++i)
+        {
+            if (IntersectTriangle(bvh.triangles[i], origin, direction, tMax, hit))
+            {
+                found = true;
+                tMax = hit->t;
+                if (anyHit)
+                    return true;
+            }
+        }
+    }
+    return found;
+}
+
+// Scene textures
+
+struct Texture
+{
+    int width = 0;
+    int height = 0;
+    std::vector<float3> texels; // Linear
+};
+
+static bool LoadTexture(Texture* texture, const char* filename)
+{
+    if (filename == nullptr)
+        return false;
+
+    // Rows top to bottom (the flag is global)
+    stbi_set_flip_vertically_on_load(false);
+    int channels;
+    unsigned char* pixels;
+    const void* data;
+    size_t size;
+    if (archive::Find(filename, &data, &size))
+        pixels = stbi_load_from_memory((const stbi_uc*)data, (int)size, &texture->width, &texture->height, &channels, 3);
+    else
+        pixels = stbi_load(filename, &texture->width, &texture->height, &channels, 3);
+    if (pixels == nullptr)
+    {
+        fprintf(stderr, "Cannot load %s for the irradiance volume\n", filename);
+        return false;
+    }
+
+    // Same decoding as stbi_loadf
+    float toLinear[256];
+    for (int i = 0; i < 256; ++i)
+        toLinear[i] = powf(i / 255.f, 2.2f);
+
+    size_t texelCount = (size_t)texture->width * texture->height;
+    texture->texels.resize(texelCount);
+    for (size_t i = 0; i < texelCount; ++i)
+        texture->texels[i] = { toLinear[pixels[i * 3 + 0]], toLinear[pixels[i * 3 + 1]], toLinear[pixels[i * 3 + 2]] };
+    stbi_image_free(pixels);
+    return true;
+}
+
+// Nearest texel, uv origin at the bottom left (GL convention)
+static float3 SampleTexture(const Texture& texture, float2 uv, float3 fallback)
+{
+    if (texture.texels.empty())
+        return fallback;
+
+    int x = calc::Modulo((int)floorf(uv.u * texture.width), texture.width);
+    int y = calc::Modulo((int)floorf((1.f - uv.v) * texture.height), texture.height);
+    return texture.texels[(size_t)y * texture.width + x];
+}
+
+// Baking
+
+struct BakeContext
+{
+    const volume::Scene* scene;
+    const volume::Lighting* lighting;
+    BVH bvh;
+    Texture diffuse;
+    Texture emissive;
+};
+
+// Radiance leaving the hit toward the probe: the tavern shader lighting, with shadows
+static float3 ShadeHit(const BakeContext& context, float3 origin, float3 direction, const Hit& hit)
+{
+    const volume::Scene& scene = *context.scene;
+    const volume::Lighting& lighting = *context.lighting;
+    float3 position = origin + direction * hit.t;
+
+    const float3* vertices = &scene.positions[hit.triangle * 3];
+    float3 normal = v3Normalize(v3Cross(vertices[1] - vertices[0], vertices[2] - vertices[0]));
+    if (Dot(normal, direction) > 0.f)
+        normal = -normal;
+    float3 shadowOrigin = position + normal * VOLUME_RAY_EPSILON * 10.f;
+
+    float3 lightDiffuse = { 0.f, 0.f, 0.f };
+    Hit shadowHit;
+    float moonCosine = Dot(lighting.moonDirection, normal);
+    if (moonCosine > 0.f && !Intersect(context.bvh, shadowOrigin, lighting.moonDirection, FLT_MAX, true, &shadowHit))
+        lightDiffuse += lighting.moonColor * moonCosine;
+
+    for (int i = 0; i < lighting.candleCount; ++i)
+    {
+        float3 toCandle = lighting.candlePositions[i] - position;
+        float distance2 = Dot(toCandle, toCandle);
+        float attenuation = clusters::GetLightAttenuation(1.f, lighting.candleQuadAttenuation, lighting.lightCutoff, distance2);
+        if (attenuation <= 0.f)
+            continue;
+
+        float distance = calc::Sqrt(distance2);
+        float3 candleDirection = toCandle / distance;
+        float cosine = Dot(candleDirection, normal);
+        if (cosine <= 0.f || Intersect(context.bvh, shadowOrigin, candleDirection, distance, true, &shadowHit))
+            continue;
+
+        lightDiffuse += lighting.candleColor * (attenuation * cosine);
+    }
+
+    float2 uv;
+    if (scene.uvs.size() == scene.positions.size())
+    {
+        const float2* uvs = &scene.uvs[hit.triangle * 3];
+        uv = uvs[0] * (1.f - hit.u - hit.v) + uvs[1] * hit.u + uvs[2] * hit.v;
+    }
+    else
+    {
+        uv = { 0.f, 0.f };
+    }
+
+    float3 albedo = SampleTexture(context.diffuse, uv, { 0.5f, 0.5f, 0.5f });
+    float3 emissive = SampleTexture(context.emissive, uv, { 0.f, 0.f, 0.f });
+    return albedo * lightDiffuse + emissive;
+}
+
+// Fibonacci sphere, same directions for every probe
+static void GenerateRayDirections(int rayCount, std::vector<float3>* directions)
+{
+    directions->resize(rayCount);
+    const float goldenAngle = calc::TAU * (1.f - 1.f / 1.61803398875f);
+    for (int i = 0; i < rayCount; ++i)
+    {
+        float y = 1.f - (i + 0.5f) * 2.f / rayCount;
+        float radius = calc::Sqrt(calc::Max(0.f, 1.f - y * y));
+        float phi = goldenAngle * i;
+        (*directions)[i] = { cosf(phi) * radius, y, sinf(phi) * radius };
+    }
+}
+
+// Most rays from a probe inside a wall see back faces
+static bool BakeProbe(const BakeContext& context, float3 position, const std::vector<float3>& directions, sh::SH9* irradiance)
+{
+    sh::SH9 radiance;
+    float weight = 2.f * calc::TAU / directions.size();
+    int backFaceCount = 0;
+    for (float3 direction : directions)
+    {
+        float3 sample;
+        Hit hit;
+        if (Intersect(context.bvh, position, direction, FLT_MAX, false, &hit))
+        {
+            const float3* vertices = &context.scene->positions[hit.triangle * 3];
+            float3 normal = v3Cross(vertices[1] - vertices[0], vertices[2] - vertices[0]);
+            if (Dot(normal, direction) > 0.f)
+                backFaceCount++;
+            sample = ShadeHit(context, position, direction, hit);
+        }
+        else
+        {
+            sample = context.lighting->skyColor;
+        }
+
+        float basis[SH_COEFFICIENT_COUNT];
+        sh::EvaluateBasis(direction, basis);
+        for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+            for (int c = 0; c < 3; ++c)
+                radiance.coefs[k][c] += sample.e[c] * basis[k] * weight;
+    }
+
+    *irradiance = sh::ConvolveLambert(radiance);
+    return backFaceCount * 4 < (int)directions.size();
+}
+
+bool volume::Bake(Volume* volume, const Scene& scene, const Lighting& lighting, const BakeSettings& settings)
+{
+    if (scene.positions.empty() || scene.positions.size() % 3 != 0 || settings.probeSpacing <= 0.f || settings.rayCount <= 0)
+    {
+        fprintf(stderr, "Invalid irradiance volume bake inputs\n");
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    BakeContext context;
+    context.scene = &scene;
+    context.lighting = &lighting;
+    BuildBVH(&context.bvh, scene.positions);
+    LoadTexture(&context.diffuse, scene.diffuseTexture);
+    LoadTexture(&context.emissive, scene.emissiveTexture);
+
+    // Probes on the scene bounds, a spacing of at most probeSpacing
+    *volume = Volume();
+    volume->boundsMin = scene.positions[0];
+    volume->boundsMax = scene.positions[0];
+    for (float3 position : scene.positions)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            volume->boundsMin.e[axis] = calc::Min(volume->boundsMin.e[axis], position.e[axis]);
+            volume->boundsMax.e[axis] = calc::Max(volume->boundsMax.e[axis], position.e[axis]);
+        }
+    }
+
+    float3 spacing;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float extent = volume->boundsMax.e[axis] - volume->boundsMin.e[axis];
+        int resolution = (int)ceilf(extent / settings.probeSpacing) + 1;
+        volume->resolution[axis] = calc::Clamp(resolution, 2, VOLUME_MAX_RESOLUTION);
+        spacing.e[axis] = extent / (volume->resolution[axis] - 1);
+    }
+
+    int resolutionX = volume->resolution[0];
+    int resolutionY = volume->resolution[1];
+    int resolutionZ = volume->resolution[2];
+    int probeCount = resolutionX * resolutionY * resolutionZ;
+    std::vector<sh::SH9> probes(probeCount);
+    std::vector<unsigned char> valid(probeCount);
+
+    std::vector<float3> directions;
+    GenerateRayDirections(settings.rayCount, &directions);
+
+    jobs::ParallelFor(resolutionZ, [&](int z)
+    {
+        for (int y = 0; y < resolutionY; ++y)
+        {
+            for (int x = 0; x < resolutionX; ++x)
+            {
+                int index = (z * resolutionY + y) * resolutionX + x;
+                float3 position = volume->boundsMin + float3(x * spacing.x, y * spacing.y, z * spacing.z);
+                valid[index] = BakeProbe(context, position, directions, &probes[index]);
+            }
+        }
+    });
+
+    // Probes inside geometry would darken their surroundings: replaced by the average of their valid neighbours
+    for (int i = 0; i < probeCount; ++i)
+        volume->invalidProbeCount += valid[i] ? 0 : 1;
+
+    for (int iteration = 0; iteration < VOLUME_MAX_RESOLUTION; ++iteration)
+    {
+        std::vector<unsigned char> filled = valid;
+        bool changed = false;
+        for (int z = 0; z < resolutionZ; ++z)
+        {
+            for (int y = 0; y < resolutionY; ++y)
+            {
+                for (int x = 0; x < resolutionX; ++x)
+                {
+                    int index = (z * resolutionY + y) * resolutionX + x;
+                    if (valid[index])
+                        continue;
+
+                    const int offsets[6][3] = { {-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1} };
+                    sh::SH9 sum;
+                    int count = 0;
+                    for (const int* offset : offsets)
+                    {
+                        int nx = x + offset[0], ny = y + offset[1], nz = z + offset[2];
+                        if (nx < 0 || ny < 0 || nz < 0 || nx >= resolutionX || ny >= resolutionY || nz >= resolutionZ)
+                            continue;
+                        int neighbour = (nz * resolutionY + ny) * resolutionX + nx;
+                        if (!valid[neighbour])
+                            continue;
+                        for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+                            for (int c = 0; c < 3; ++c)
+                                sum.coefs[k][c] += probes[neighbour].coefs[k][c];
+                        count++;
+                    }
+
+                    if (count == 0)
+                        continue;
+                    for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+                        for (int c = 0; c < 3; ++c)
+                            probes[index].coefs[k][c] = sum.coefs[k][c] / count;
+                    filled[index] = 1;
+                    changed = true;
+                }
+            }
+        }
+        valid.swap(filled);
+        if (!changed)
+            break;
+    }
+
+    // L1 is enough for slowly varying indirect light and fits one RGBA texel per color channel
+    for (int c = 0; c < 3; ++c)
+        volume->coefficients[c].resize((size_t)probeCount * 4);
+    for (int i = 0; i < probeCount; ++i)
+    {
+        float coefs[SH_COEFFICIENT_COUNT][3];
+        sh::GetShaderCoefficients(probes[i], coefs);
+        for (int c = 0; c < 3; ++c)
+            for (int k = 0; k < 4; ++k)
+                volume->coefficients[c][(size_t)i * 4 + k] = calc::FloatToHalf(coefs[k][c]);
+    }
+
+    float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    volume->bakeMilliseconds = milliseconds;
+    printf("Irradiance volume baked: %dx%dx%d probes (%d inside geometry), %d triangles, %d rays per probe (%.1f ms on %d threads)\n",
+        resolutionX, resolutionY, resolutionZ, volume->invalidProbeCount, (int)scene.positions.size() / 3, settings.rayCount,
+        milliseconds, jobs::ThreadCount());
+    return true;
+}
+
+uint32_t volume::GetBakeKey(const Scene& scene, const Lighting& lighting, const BakeSettings& settings)
+{
+    std::vector<unsigned char> bytes;
+    auto append = [&bytes](const void* data, size_t size)
+    {
+        bytes.insert(bytes.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+    };
+
+    uint32_t triangleCount = (uint32_t)scene.positions.size() / 3;
+    append(&triangleCount, sizeof(triangleCount));
+    append(&lighting.skyColor, sizeof(float3));
+    append(&lighting.moonDirection, sizeof(float3));
+    append(&lighting.moonColor, sizeof(float3));
+    append(&lighting.candleColor, sizeof(float3));
+    append(&lighting.candleQuadAttenuation, sizeof(float));
+    append(&lighting.lightCutoff, sizeof(float));
+    append(lighting.candlePositions, lighting.candleCount * sizeof(float3));
+    append(&settings.probeSpacing, sizeof(float));
+    append(&settings.rayCount, sizeof(int));
+    return archive::Checksum(bytes.data(), bytes.size());
+}
+
+struct VolumeHeader
+{
+    uint32_t version;
+    uint32_t key;
+    float boundsMin[3];
+    float boundsMax[3];
+    int32_t resolution[3];
+    int32_t invalidProbeCount;
+};
+
+bool volume::Save(const Volume& volume, const char* filename, uint32_t key)
+{
+    FILE* file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Cannot write irradiance volume cache %s\n", filename);
+        return false;
+    }
+
+    VolumeHeader header = { IRRADIANCE_VOLUME_CACHE_VERSION, key };
+    memcpy(header.boundsMin, volume.boundsMin.e, sizeof(header.boundsMin));
+    memcpy(header.boundsMax, volume.boundsMax.e, sizeof(header.boundsMax));
+    memcpy(header.resolution, volume.resolution, sizeof(header.resolution));
+    header.invalidProbeCount = volume.invalidProbeCount;
+    fwrite(&header, sizeof(header), 1, file);
+    for (int c = 0; c < 3; ++c)
+        fwrite(volume.coefficients[c].data(), sizeof(uint16_t), volume.coefficients[c].size(), file);
+    fclose(file);
+    return true;
+}
+
+bool volume::Load(Volume* volume, const char* filename, uint32_t key)
+{
+    std::vector<unsigned char> data;
+    const void* archiveData;
+    size_t archiveSize;
+    if (archive::Find(filename, &archiveData, &archiveSize))
+    {
+        data.assign((const unsigned char*)archiveData, (const unsigned char*)archiveData + archiveSize);
+    }
+    else
+    {
+        FILE* file = fopen(filename, "rb");
+        if (file == nullptr)
+            return false;
+        fseek(file, 0, SEEK_END);
+        data.resize((size_t)ftell(file));
+        fseek(file, 0, SEEK_SET);
+        size_t readSize = fread(data.data(), 1, data.size(), file);
+        fclose(file);
+        if (readSize != data.size())
+            return false;
+    }
+
+    VolumeHeader header;
+    if (data.size() < sizeof(header))
+        return false;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.version != IRRADIANCE_VOLUME_CACHE_VERSION || header.key != key)
+        return false;
+
+    for (int axis = 0; axis < 3; ++axis)
+        if (header.resolution[axis] < 2 || header.resolution[axis] > VOLUME_MAX_RESOLUTION)
+            return false;
+
+    size_t channelCount = (size_t)header.resolution[0] * header.resolution[1] * header.resolution[2] * 4;
+    if (data.size() != sizeof(header) + 3 * channelCount * sizeof(uint16_t))
+        return false;
+
+    *volume = Volume();
+    memcpy(volume->boundsMin.e, header.boundsMin, sizeof(header.boundsMin));
+    memcpy(volume->boundsMax.e, header.boundsMax, sizeof(header.boundsMax));
+    memcpy(volume->resolution, header.resolution, sizeof(header.resolution));
+    volume->invalidProbeCount = header.invalidProbeCount;
+    for (int c = 0; c < 3; ++c)
+    {
+        volume->coefficients[c].resize(channelCount);
+        memcpy(volume->coefficients[c].data(), data.data() + sizeof(header) + c * channelCount * sizeof(uint16_t), channelCount * sizeof(uint16_t));
+    }
+    return true;
+}
+
+bool volume::LoadOrBake(Volume* volume, const char* filename, const Scene& scene, const Lighting& lighting, const BakeSettings& settings)
+{
+    uint32_t key = GetBakeKey(scene, lighting, settings);
+    if (Load(volume, filename, key))
+    {
+        printf("Irradiance volume loaded from cache: %s\n", filename);
+        return true;
+    }
+
+    if (!Bake(volume, scene, lighting, settings))
+        return false;
+    Save(*volume, filename, key);
+    return true;
+}
+
+void volume::Upload(const Volume& volume, const GLuint textures[3])
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int c = 0; c < 3; ++c)
+    {
+        glBindTexture(GL_TEXTURE_3D, textures[c]);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, volume.resolution[0], volume.resolution[1], volume.resolution[2], 0,
+            GL_RGBA, GL_HALF_FLOAT, volume.coefficients[c].data());
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        vram::Track(vram::ResourceType::TEXTURE, textures[c], volume.coefficients[c].size() * sizeof(uint16_t));
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "types.hpp"
+
+#define IRRADIANCE_VOLUME_CACHE_VERSION 1
+
+// Static diffuse lighting of a scene: a grid of probes over its bounds, each storing the irradiance it receives
+// (one bounce of the direct lights, emissive surfaces and sky) as L1 SH, sampled trilinearly by the shader
+namespace volume
+{
+    // Triangle list, diffuse/emissive textures decoded like gl::UploadImage(file, true)
+    struct Scene
+    {
+        std::vector<float3> positions; // 3 per triangle
+        std::vector<float2> uvs;
+        const char* diffuseTexture  = nullptr;
+        const char* emissiveTexture = nullptr;
+    };
+
+    // Lights of the tavern shader (DemoFBO), same defaults
+    struct Lighting
+    {
+        float3 skyColor      = { 0.0103f, 0.0225f, 0.0605f }; // Rays leaving the scene (a quarter of the moon)
+        float3 moonDirection = { -0.7071f, 0.5657f, 0.4243f };
+        float3 moonColor     = { 0.0410f, 0.0900f, 0.2420f };
+        float3 candleColor   = { 1.0000f, 1.0000f, 0.0711f };
+        float candleQuadAttenuation = 1.f;
+        float lightCutoff = 0.02f; // Candles fade out like in the shader (see clusters::GetLightAttenuation)
+        const float3* candlePositions = nullptr;
+        int candleCount = 0;
+    };
+
+    struct BakeSettings
+    {
+        float probeSpacing = 0.5f; // World units (at most 64 probes per axis)
+        int rayCount       = 128;  // Per probe, shadow rays are cast from each hit
+    };
+
+    struct Volume
+    {
+        float3 boundsMin = { 0.f, 0.f, 0.f }; // First and last probes
+        float3 boundsMax = { 0.f, 0.f, 0.f };
+        int resolution[3] = {};
+        int invalidProbeCount = 0; // Inside geometry, filled from their neighbours
+        float bakeMilliseconds = 0.f; // 0 when loaded from the cache
+
+        // RGBA16F per color channel, x fastest: L1 coefficients premultiplied like sh::GetShaderCoefficients
+        // (the shader only computes dot(coefficients, vec4(1, n.y, n.z, n.x)))
+        std::vector<uint16_t> coefficients[3];
+    };
+
+    // One job per probe z slice, rays cast against a BVH of the scene
+    bool Bake(Volume* volume, const Scene& scene, const Lighting& lighting, const BakeSettings& settings = {});
+
+    // Identifies the bake inputs in the cache
+    uint32_t GetBakeKey(const Scene& scene, const Lighting& lighting, const BakeSettings& settings);
+
+    bool Save(const Volume& volume, const char* filename, uint32_t key);
+    bool Load(Volume* volume, const char* filename, uint32_t key);
+
+    // Cache first, baked and cached otherwise
+    bool LoadOrBake(Volume* volume, const char* filename, const Scene& scene, const Lighting& lighting, const BakeSettings& settings = {});
+
+    // One RGBA16F 3D texture per color channel, clamped and trilinear
+    void Upload(const Volume& volume, const GLuint textures[3]);
+}
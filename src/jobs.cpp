@@ -0,0 +1,150 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "jobs.hpp"
+
+// Set on worker threads and while the calling thread executes a job
+static thread_local bool insideJob = false;
+
+// Persistent worker threads, woken up for each ParallelFor
+struct ThreadPool
+{
+    ThreadPool()
+    {
+        int threadCount = (int)std::thread::hardware_concurrency();
+        if (threadCount < 1)
+            threadCount = 1;
+
+        for (int i = 0; i < threadCount - 1; ++i)
+            workers.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wakeCondition.notify_all();
+
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    // Grab indices until the job is exhausted
+    void RunJob()
+    {
+        bool wasInsideJob = insideJob;
+        insideJob = true;
+
+        int index;
+        while ((index = nextIndex.fetch_add(1)) < count.load())
+        {
+            (*func)(index);
+            doneCount.fetch_add(1);
+        }
+
+        insideJob = wasInsideJob;
+    }
+
+    void WorkerLoop()
+    {
+        insideJob = true;
+
+        unsigned int seenGeneration = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeCondition.wait(lock, [&] { return quit || generation != seenGeneration; });
+                if (quit)
+                    return;
+
+                // Woken too late, the job is already finished and released
+                seenGeneration = generation;
+                if (func == nullptr)
+                    continue;
+                activeWorkers++;
+            }
+
+            RunJob();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                activeWorkers--;
+            }
+            doneCondition.notify_all();
+        }
+    }
+
+    void ParallelFor(int jobCount, const std::function<void(int)>& jobFunc)
+    {
+        // Only one ParallelFor at a time can use the workers
+        std::lock_guard<std::mutex> submitLock(submitMutex);
+
+        // Counters are reset while no worker runs, and before the new generation makes them visible
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            doneCondition.wait(lock, [&] { return activeWorkers == 0; });
+            nextIndex = 0;
+            doneCount = 0;
+            count = jobCount;
+            func  = &jobFunc;
+            generation++;
+        }
+        wakeCondition.notify_all();
+
+        // Calling thread takes part in the work
+        RunJob();
+
+        // Wait for all indices to be processed and for workers to release the job
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [&] { return doneCount.load() == count.load() && activeWorkers == 0; });
+        func = nullptr;
+    }
+
+    std::vector<std::thread> workers;
+
+    std::mutex submitMutex;
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+
+    const std::function<void(int)>* func = nullptr;
+    std::atomic<int> count = 0;
+    std::atomic<int> nextIndex = 0;
+    std::atomic<int> doneCount = 0;
+    unsigned int generation = 0;
+    int activeWorkers = 0;
+    bool quit = false;
+};
+
+static ThreadPool& GetThreadPool()
+{
+    static ThreadPool threadPool;
+    return threadPool;
+}
+
+int jobs::ThreadCount()
+{
+    return (int)GetThreadPool().workers.size() + 1;
+}
+
+void jobs::ParallelFor(int count, const std::function<void(int index)>& func)
+{
+    if (count <= 0)
+        return;
+
+    // Run serially when there is nothing to share or when already inside a job (avoid deadlocks)
+    if (count == 1 || insideJob || ThreadCount() == 1)
+    {
+        for (int i = 0; i < count; ++i)
+            func(i);
+        return;
+    }
+
+    GetThreadPool().ParallelFor(count, func);
+}
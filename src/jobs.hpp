@@ -0,0 +1,13 @@
+#pragma once
+
+#include <functional>
+
+namespace jobs
+{
+    // Number of threads running ParallelFor jobs (workers + calling thread)
+    int ThreadCount();
+
+    // Call func(i) for each i in [0, count) on all threads and wait for completion
+    // Nested calls (ParallelFor inside a job) run serially on the calling thread
+    void ParallelFor(int count, const std::function<void(int index)>& func);
+}
@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CLUSTERS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "calc.hpp"
+#include "jobs.hpp"
+#include "light_clusters.hpp"
+
+const char* clusters::attenuationShader = R"GLSL(
+float GetLightAttenuation(float intensity, float quadAttenuation, float cutoff, float distance2)
+{
+    if (intensity <= cutoff || quadAttenuation <= 0.0 || cutoff <= 0.0)
+        return 0.0;
+    float radius2 = (intensity / cutoff - 1.0) / quadAttenuation;
+    float window = clamp(1.0 - (distance2 * distance2) / (radius2 * radius2), 0.0, 1.0);
+    return intensity / (1.0 + quadAttenuation * distance2) * window * window;
+}
+)GLSL";
+
+// View space spheres, padded to a multiple of 4 with spheres that never intersect
+struct ViewLights
+{
+    int count = 0;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> depth; // Positive in front of the camera
+    std::vector<float> radiusSq;
+    std::vector<uint32_t> index;
+
+    void Add(float lx, float ly, float ldepth, float lradiusSq, uint32_t lindex)
+    {
+        x.push_back(lx);
+        y.push_back(ly);
+        depth.push_back(ldepth);
+        radiusSq.push_back(lradiusSq);
+        index.push_back(lindex);
+        ++count;
+    }
+
+    void Clear()
+    {
+        count = 0;
+        x.clear();
+        y.clear();
+        depth.clear();
+        radiusSq.clear();
+        index.clear();
+    }
+
+    void Pad()
+    {
+        while (x.size() % 4)
+        {
+            x.push_back(0.f);
+            y.push_back(0.f);
+            depth.push_back(0.f);
+            radiusSq.push_back(-1.f);
+            index.push_back(0);
+        }
+    }
+};
+
+// Froxel bounding box in view space (depth positive)
+struct ClusterBox
+{
+    float minX, maxX;
+    float minY, maxY;
+    float minDepth, maxDepth;
+};
+
+static float Square(float v) { return v * v; }
+
+// Squared distance from the sphere centers to the box against their squared radius
+static void CullLights(const ClusterBox& box, const ViewLights& lights, std::vector<uint32_t>* indices)
+{
+    int i = 0;
+#ifdef CLUSTERS_USE_SSE2
+    {
+        const __m128 zero     = _mm_setzero_ps();
+        const __m128 minX     = _mm_set1_ps(box.minX);
+        const __m128 maxX     = _mm_set1_ps(box.maxX);
+        const __m128 minY     = _mm_set1_ps(box.minY);
+        const __m128 maxY     = _mm_set1_ps(box.maxY);
+        const __m128 minDepth = _mm_set1_ps(box.minDepth);
+        const __m128 maxDepth = _mm_set1_ps(box.maxDepth);
+
+        int paddedCount = (int)lights.x.size();
+        for (; i < paddedCount; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(&lights.x[i]);
+            __m128 y = _mm_loadu_ps(&lights.y[i]);
+            __m128 d = _mm_loadu_ps(&lights.depth[i]);
+
+            __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minX, x), zero), _mm_max_ps(_mm_sub_ps(x, maxX), zero));
+            __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minY, y), zero), _mm_max_ps(_mm_sub_ps(y, maxY), zero));
+            __m128 dd = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minDepth, d), zero), _mm_max_ps(_mm_sub_ps(d, maxDepth), zero));
+            __m128 distanceSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dd, dd));
+
+            int mask = _mm_movemask_ps(_mm_cmple_ps(distanceSq, _mm_loadu_ps(&lights.radiusSq[i])));
+            for (int lane = 0; mask && lane < 4; ++lane)
+                if (mask & (1 << lane))
+                    indices->push_back(lights.index[i + lane]);
+        }
+    }
+#endif
+    for (; i < lights.count; ++i)
+    {
+        float dx = std::max(box.minX - lights.x[i], 0.f) + std::max(lights.x[i] - box.maxX, 0.f);
+        float dy = std::max(box.minY - lights.y[i], 0.f) + std::max(lights.y[i] - box.maxY, 0.f);
+        float dd = std::max(box.minDepth - lights.depth[i], 0.f) + std::max(lights.depth[i] - box.maxDepth, 0.f);
+        if (dx * dx + dy * dy + dd * dd <= lights.radiusSq[i])
+            indices->push_back(lights.index[i]);
+    }
+}
+
+float clusters::GetLightRadius(float intensity, float quadAttenuation, float cutoff)
+{
+    if (intensity <= cutoff || quadAttenuation <= 0.f || cutoff <= 0.f)
+        return 0.f;
+    return sqrtf((intensity / cutoff - 1.f) / quadAttenuation);
+}
+
+float clusters::GetLightAttenuation(float intensity, float quadAttenuation, float cutoff, float distance2)
+{
+    // Same guard as GetLightRadius and attenuationShader: lights culled here are never shaded
+    if (intensity <= cutoff || quadAttenuation <= 0.f || cutoff <= 0.f)
+        return 0.f;
+    float radius2 = (intensity / cutoff - 1.f) / quadAttenuation;
+    float window = calc::Clamp(1.f - (distance2 * distance2) / (radius2 * radius2), 0.f, 1.f);
+    return intensity / (1.f + quadAttenuation * distance2) * window * window;
+}
+
+float2 clusters::GetSliceScaleBias(const Grid& grid)
+{
+    float scale = grid.settings.slices / logf(grid.far / grid.near);
+    return { scale, -logf(grid.near) * scale };
+}
+
+void clusters::Build(Grid* grid, const GridSettings& settings, const mat4& projection, const mat4& view, const Light* lights, int lightCount)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Perspective terms: x_ndc = p00 * x / depth, z_ndc = (a * z + b) / depth
+    float p00 = projection.c[0].e[0];
+    float p11 = projection.c[1].e[1];
+    float a   = projection.c[2].e[2];
+    float b   = projection.c[3].e[2];
+
+    grid->settings = settings;
+    grid->near = b / (a - 1.f);
+    grid->far  = b / (a + 1.f);
+    int clusterCount = settings.tilesX * settings.tilesY * settings.slices;
+    grid->ranges.assign(clusterCount * 2, 0);
+    grid->sliceIndices.resize(settings.slices);
+
+    // To view space, lights out of the depth range are dropped
+    ViewLights viewLights;
+    for (int i = 0; i < lightCount; ++i)
+    {
+        const Light& light = lights[i];
+        if (light.radius <= 0.f)
+            continue;
+
+        float4 position = view * float4(light.position.x, light.position.y, light.position.z, 1.f);
+        float depth = -position.z;
+        if (depth + light.radius < grid->near || depth - light.radius > grid->far)
+            continue;
+        viewLights.Add(position.x, position.y, depth, Square(light.radius), (uint32_t)i);
+    }
+
+    float depthRatio = grid->far / grid->near;
+    jobs::ParallelFor(settings.slices, [&](int slice)
+    {
+        ClusterBox box;
+        box.minDepth = grid->near * powf(depthRatio, (float)slice / settings.slices);
+        box.maxDepth = grid->near * powf(depthRatio, (float)(slice + 1) / settings.slices);
+
+        // Lights touching the slice first, most of them are rejected here
+        ViewLights sliceLights;
+        for (int i = 0; i < viewLights.count; ++i)
+        {
+            float radius = sqrtf(viewLights.radiusSq[i]);
+            if (viewLights.depth[i] + radius >= box.minDepth && viewLights.depth[i] - radius <= box.maxDepth)
+                sliceLights.Add(viewLights.x[i], viewLights.y[i], viewLights.depth[i], viewLights.radiusSq[i], viewLights.index[i]);
+        }
+
+        std::vector<uint32_t>& indices = grid->sliceIndices[slice];
+        indices.clear();
+        ViewLights rowLights;
+        for (int tileY = 0; tileY < settings.tilesY; ++tileY)
+        {
+            // Tile edges are planes through the eye, the box spans them at both ends of the slice
+            float ndcY0 = -1.f + 2.f * tileY / settings.tilesY;
+            float ndcY1 = -1.f + 2.f * (tileY + 1) / settings.tilesY;
+            box.minY = std::min(ndcY0 * box.minDepth, ndcY0 * box.maxDepth) / p11;
+            box.maxY = std::max(ndcY1 * box.minDepth, ndcY1 * box.maxDepth) / p11;
+
+            // Then the lights touching the row of tiles
+            rowLights.Clear();
+            for (int i = 0; i < sliceLights.count; ++i)
+            {
+                float dy = std::max(box.minY - sliceLights.y[i], 0.f) + std::max(sliceLights.y[i] - box.maxY, 0.f);
+                float dd = std::max(box.minDepth - sliceLights.depth[i], 0.f) + std::max(sliceLights.depth[i] - box.maxDepth, 0.f);
+                if (dy * dy + dd * dd <= sliceLights.radiusSq[i])
+                    rowLights.Add(sliceLights.x[i], sliceLights.y[i], sliceLights.depth[i], sliceLights.radiusSq[i], sliceLights.index[i]);
+            }
+            rowLights.Pad();
+
+            for (int tileX = 0; tileX < settings.tilesX; ++tileX)
+            {
+                float ndcX0 = -1.f + 2.f * tileX / settings.tilesX;
+                float ndcX1 = -1.f + 2.f * (tileX + 1) / settings.tilesX;
+                box.minX = std::min(ndcX0 * box.minDepth, ndcX0 * box.maxDepth) / p00;
+                box.maxX = std::max(ndcX1 * box.minDepth, ndcX1 * box.maxDepth) / p00;
+
+                // Offsets are relative to the slice until the lists are concatenated
+                int cluster = (slice * settings.tilesY + tileY) * settings.tilesX + tileX;
+                uint32_t offset = (uint32_t)indices.size();
+                CullLights(box, rowLights, &indices);
+                grid->ranges[cluster * 2 + 0] = offset;
+                grid->ranges[cluster * 2 + 1] = (uint32_t)indices.size() - offset;
+            }
+        }
+    });
+
+    grid->lightIndices.clear();
+    grid->maxClusterLightCount = 0;
+    int sliceClusterCount = settings.tilesX * settings.tilesY;
+    for (int slice = 0; slice < settings.slices; ++slice)
+    {
+        uint32_t sliceOffset = (uint32_t)grid->lightIndices.size();
+        for (int i = slice * sliceClusterCount; i < (slice + 1) * sliceClusterCount; ++i)
+        {
+            grid->ranges[i * 2 + 0] += sliceOffset;
+            grid->maxClusterLightCount = std::max(grid->maxClusterLightCount, (int)grid->ranges[i * 2 + 1]);
+        }
+        grid->lightIndices.insert(grid->lightIndices.end(), grid->sliceIndices[slice].begin(), grid->sliceIndices[slice].end());
+    }
+
+    grid->buildMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "types.hpp"
+
+// Clustered forward shading: the view frustum is split in froxels (screen tiles x exponential depth slices)
+// and each one keeps the list of the point lights whose sphere of influence touches it
+namespace clusters
+{
+    struct GridSettings
+    {
+        int tilesX = 16;
+        int tilesY = 9;
+        int slices = 24; // Depth slice s starts at near * (far / near)^(s / slices)
+    };
+
+    // World space sphere of influence
+    struct Light
+    {
+        float3 position;
+        float radius;
+    };
+
+    struct Grid
+    {
+        GridSettings settings;
+        float near = 0.f;
+        float far  = 0.f;
+
+        // Offset and count in lightIndices of each cluster (x fastest, then y, then slice), uploaded as RG32UI
+        std::vector<uint32_t> ranges;
+        std::vector<uint32_t> lightIndices;
+
+        int maxClusterLightCount = 0;
+        float buildMilliseconds = 0.f;
+
+        std::vector<std::vector<uint32_t>> sliceIndices; // Filled by each slice job, then concatenated
+    };
+
+    // Distance where intensity / (1 + quadAttenuation * d^2) falls to cutoff (the shader fades lights out there)
+    float GetLightRadius(float intensity, float quadAttenuation, float cutoff);
+
+    // intensity / (1 + quadAttenuation * d^2), windowed to reach 0 at GetLightRadius (0 for lights at or below the cutoff)
+    float GetLightAttenuation(float intensity, float quadAttenuation, float cutoff, float distance2);
+
+    // GLSL: float GetLightAttenuation(float intensity, float quadAttenuation, float cutoff, float distance2), same as above
+    extern const char* attenuationShader;
+
+    // Slice of a view space depth as computed by the shader: floor(log(depth) * scale + bias)
+    float2 GetSliceScaleBias(const Grid& grid);
+
+    // One job per depth slice, lights are tested 4 at a time against the bounding box of each froxel (SSE2)
+    // Near and far are read from the perspective projection
+    void Build(Grid* grid, const GridSettings& settings, const mat4& projection, const mat4& view, const Light* lights, int lightCount);
+}
@@ -0,0 +1,333 @@
+#include <cstdint>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "jobs.hpp"
+#include "lz.hpp"
+
+#define LZ_HASH_BITS    14
+#define LZ_MIN_MATCH    4
+#define LZ_MAX_OFFSET   65535
+#define LZ_LAST_LITERALS 5  // The block always ends with literals (LZ4 rule)
+#define LZ_MATCH_MARGIN 12  // No match starts in the last bytes of a block (LZ4 rule)
+
+#define LZ_CHUNK_SIZE   (256 * 1024)
+#define LZ_CHUNK_STORED 0x80000000u // Chunk size flag: stored without compression
+
+static uint32_t Read32(const unsigned char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(uint32_t));
+    return value;
+}
+
+static uint64_t Read64(const unsigned char* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(uint64_t));
+    return value;
+}
+
+static uint32_t Hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static int CountTrailingZeros(uint64_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (int)index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+// Number of equal bytes at a and b, stopping at limit (a < b < limit)
+static size_t CountMatch(const unsigned char* a, const unsigned char* b, const unsigned char* limit)
+{
+    const unsigned char* start = b;
+    while (b + 8 <= limit)
+    {
+        uint64_t diff = Read64(a) ^ Read64(b);
+        if (diff != 0)
+            return (size_t)(b - start) + CountTrailingZeros(diff) / 8; // Little endian
+        a += 8;
+        b += 8;
+    }
+    while (b < limit && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return (size_t)(b - start);
+}
+
+static unsigned char* WriteLength(unsigned char* op, size_t length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+size_t lz::CompressBound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+size_t lz::CompressBlock(const void* src, size_t srcSize, void* dst, size_t dstCapacity)
+{
+    if (dstCapacity < CompressBound(srcSize))
+        return 0;
+
+    const unsigned char* input = (const unsigned char*)src;
+    const unsigned char* inputEnd = input + srcSize;
+    unsigned char* op = (unsigned char*)dst;
+
+    const unsigned char* anchor = input;
+    if (srcSize > LZ_MATCH_MARGIN)
+    {
+        const unsigned char* matchLimit  = inputEnd - LZ_LAST_LITERALS;
+        const unsigned char* searchLimit = inputEnd - LZ_MATCH_MARGIN;
+
+        uint32_t table[1 << LZ_HASH_BITS] = {};
+        const unsigned char* ip = input;
+        while (ip < searchLimit)
+        {
+            uint32_t sequence = Read32(ip);
+            uint32_t hash = Hash(sequence);
+            const unsigned char* candidate = input + table[hash];
+            table[hash] = (uint32_t)(ip - input);
+
+            if (candidate >= ip || ip - candidate > LZ_MAX_OFFSET || Read32(candidate) != sequence)
+            {
+                // Skip faster in incompressible data
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            // Extend backwards then forwards
+            while (ip > anchor && candidate > input && ip[-1] == candidate[-1])
+            {
+                ip--;
+                candidate--;
+            }
+            size_t matchLength = LZ_MIN_MATCH + CountMatch(candidate + LZ_MIN_MATCH, ip + LZ_MIN_MATCH, matchLimit);
+
+            // Sequence: token, literals, offset, match length
+            size_t literalLength = (size_t)(ip - anchor);
+            unsigned char* token = op++;
+            *token = (unsigned char)((literalLength >= 15 ? 15 : literalLength) << 4);
+            if (literalLength >= 15)
+                op = WriteLength(op, literalLength - 15);
+            memcpy(op, anchor, literalLength);
+            op += literalLength;
+
+            uint16_t offset = (uint16_t)(ip - candidate);
+            memcpy(op, &offset, sizeof(uint16_t));
+            op += sizeof(uint16_t);
+
+            size_t extraLength = matchLength - LZ_MIN_MATCH;
+            *token |= (unsigned char)(extraLength >= 15 ? 15 : extraLength);
+            if (extraLength >= 15)
+                op = WriteLength(op, extraLength - 15);
+
+            ip += matchLength;
+            anchor = ip;
+
+            if (ip < searchLimit)
+                table[Hash(Read32(ip - 2))] = (uint32_t)(ip - 2 - input);
+        }
+    }
+
+    // Last literals
+    size_t literalLength = (size_t)(inputEnd - anchor);
+    *op++ = (unsigned char)((literalLength >= 15 ? 15 : literalLength) << 4);
+    if (literalLength >= 15)
+        op = WriteLength(op, literalLength - 15);
+    memcpy(op, anchor, literalLength);
+    op += literalLength;
+
+    return (size_t)(op - (unsigned char*)dst);
+}
+
+bool lz::DecompressBlock(const void* src, size_t srcSize, void* dst, size_t dstSize)
+{
+    const unsigned char* ip = (const unsigned char*)src;
+    const unsigned char* ipEnd = ip + srcSize;
+    unsigned char* output = (unsigned char*)dst;
+    unsigned char* op = output;
+    unsigned char* opEnd = output + dstSize;
+
+    while (ip < ipEnd)
+    {
+        unsigned int token = *ip++;
+
+        // Literals
+        size_t literalLength = token >> 4;
+        if (literalLength == 15)
+        {
+            unsigned char extra;
+            do
+            {
+                if (ip >= ipEnd)
+                    return false;
+                extra = *ip++;
+                literalLength += extra;
+            } while (extra == 255);
+        }
+        if (literalLength > (size_t)(ipEnd - ip) || literalLength > (size_t)(opEnd - op))
+            return false;
+        if (literalLength <= 16 && ipEnd - ip >= 16 && opEnd - op >= 16)
+            memcpy(op, ip, 16); // Fixed size copy, the extra bytes are overwritten later
+        else
+            memcpy(op, ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+
+        // Last sequence has no match
+        if (ip == ipEnd)
+            break;
+
+        // Match
+        if (ipEnd - ip < 2)
+            return false;
+        uint16_t offset;
+        memcpy(&offset, ip, sizeof(uint16_t));
+        ip += sizeof(uint16_t);
+        if (offset == 0 || offset > op - output)
+            return false;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15)
+        {
+            unsigned char extra;
+            do
+            {
+                if (ip >= ipEnd)
+                    return false;
+                extra = *ip++;
+                matchLength += extra;
+            } while (extra == 255);
+        }
+        matchLength += LZ_MIN_MATCH;
+        if (matchLength > (size_t)(opEnd - op))
+            return false;
+
+        // Overlapping copy, 8 bytes at a time when the offset allows it
+        // (may write up to 7 bytes past the match, overwritten by the next sequence)
+        const unsigned char* match = op - offset;
+        unsigned char* matchEnd = op + matchLength;
+        if (offset >= 8 && opEnd - matchEnd >= 8)
+        {
+            do
+            {
+                memcpy(op, match, 8);
+                op += 8;
+                match += 8;
+            } while (op < matchEnd);
+            op = matchEnd;
+        }
+        else if (offset == 1)
+        {
+            memset(op, *match, matchLength);
+            op = matchEnd;
+        }
+        else
+        {
+            while (op < matchEnd)
+                *op++ = *match++;
+        }
+    }
+
+    return op == opEnd;
+}
+
+// Stream layout: chunk count, chunk sizes (compressed, LZ_CHUNK_STORED flag), chunk data
+std::vector<unsigned char> lz::Compress(const void* src, size_t size)
+{
+    uint32_t chunkCount = (uint32_t)((size + LZ_CHUNK_SIZE - 1) / LZ_CHUNK_SIZE);
+
+    std::vector<std::vector<unsigned char>> chunks(chunkCount);
+    jobs::ParallelFor((int)chunkCount, [&](int chunk)
+    {
+        const unsigned char* chunkSrc = (const unsigned char*)src + (size_t)chunk * LZ_CHUNK_SIZE;
+        size_t chunkSize = (chunk + 1 == (int)chunkCount) ? size - (size_t)chunk * LZ_CHUNK_SIZE : LZ_CHUNK_SIZE;
+
+        std::vector<unsigned char>& compressed = chunks[chunk];
+        compressed.resize(CompressBound(chunkSize));
+        compressed.resize(CompressBlock(chunkSrc, chunkSize, compressed.data(), compressed.size()));
+        if (compressed.size() >= chunkSize)
+            compressed.assign(chunkSrc, chunkSrc + chunkSize);
+    });
+
+    std::vector<unsigned char> stream(sizeof(uint32_t) * (1 + chunkCount));
+    memcpy(stream.data(), &chunkCount, sizeof(uint32_t));
+    for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        size_t chunkSize = (chunk + 1 == chunkCount) ? size - (size_t)chunk * LZ_CHUNK_SIZE : LZ_CHUNK_SIZE;
+        uint32_t compressedSize = (uint32_t)chunks[chunk].size();
+        if (compressedSize == chunkSize)
+            compressedSize |= LZ_CHUNK_STORED;
+
+        memcpy(stream.data() + sizeof(uint32_t) * (1 + chunk), &compressedSize, sizeof(uint32_t));
+        stream.insert(stream.end(), chunks[chunk].begin(), chunks[chunk].end());
+    }
+    return stream;
+}
+
+bool lz::Decompress(const void* stream, size_t streamSize, void* dst, size_t dstSize)
+{
+    const unsigned char* bytes = (const unsigned char*)stream;
+
+    uint32_t chunkCount = 0;
+    if (streamSize >= sizeof(uint32_t))
+        memcpy(&chunkCount, bytes, sizeof(uint32_t));
+    if (chunkCount != (dstSize + LZ_CHUNK_SIZE - 1) / LZ_CHUNK_SIZE || streamSize < sizeof(uint32_t) * (1 + (size_t)chunkCount))
+        return false;
+
+    // Chunk offsets in the stream
+    std::vector<size_t> offsets(chunkCount + 1);
+    std::vector<uint32_t> sizes(chunkCount);
+    offsets[0] = sizeof(uint32_t) * (1 + (size_t)chunkCount);
+    for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        memcpy(&sizes[chunk], bytes + sizeof(uint32_t) * (1 + chunk), sizeof(uint32_t));
+        offsets[chunk + 1] = offsets[chunk] + (sizes[chunk] & ~LZ_CHUNK_STORED);
+    }
+    if (offsets[chunkCount] > streamSize)
+        return false;
+
+    std::vector<unsigned char> chunkValid(chunkCount);
+    jobs::ParallelFor((int)chunkCount, [&](int chunk)
+    {
+        unsigned char* chunkDst = (unsigned char*)dst + (size_t)chunk * LZ_CHUNK_SIZE;
+        size_t chunkSize = (chunk + 1 == (int)chunkCount) ? dstSize - (size_t)chunk * LZ_CHUNK_SIZE : LZ_CHUNK_SIZE;
+        const unsigned char* chunkSrc = bytes + offsets[chunk];
+        size_t compressedSize = sizes[chunk] & ~LZ_CHUNK_STORED;
+
+        if (sizes[chunk] & LZ_CHUNK_STORED)
+        {
+            chunkValid[chunk] = compressedSize == chunkSize;
+            if (chunkValid[chunk])
+                memcpy(chunkDst, chunkSrc, chunkSize);
+        }
+        else
+        {
+            chunkValid[chunk] = DecompressBlock(chunkSrc, compressedSize, chunkDst, chunkSize);
+        }
+    });
+
+    for (unsigned char valid : chunkValid)
+        if (!valid)
+            return false;
+    return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Fast LZ77 codec (LZ4 block format) for cache payloads
+// Streams are split in independent chunks, compressed and decompressed in parallel
+namespace lz
+{
+    // Single block, returns the compressed size (0 if dst is too small)
+    size_t CompressBound(size_t size);
+    size_t CompressBlock(const void* src, size_t srcSize, void* dst, size_t dstCapacity);
+    bool DecompressBlock(const void* src, size_t srcSize, void* dst, size_t dstSize);
+
+    // Chunked stream (incompressible chunks are stored as is)
+    std::vector<unsigned char> Compress(const void* src, size_t size);
+    bool Decompress(const void* stream, size_t streamSize, void* dst, size_t dstSize);
+}
@@ -1,4 +1,5 @@
 
+#include <chrono>
 #include <cstdio>
 #include <vector>
 
@@ -23,6 +24,9 @@
 
 #include "types.hpp"
 #include "calc.hpp"
+#include "asset_archive.hpp"
+#include "gl_helpers.hpp"
+#include "vram_budget.hpp"
 #include "demo_fbo.hpp"
 #include "demo_quad.hpp"
 #include "demo_mipmap.hpp"
@@ -103,6 +107,7 @@ int main(int argc, char* argv[])
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_SRGB_CAPABLE, GLFW_TRUE); // Post passes encode with GL_FRAMEBUFFER_SRGB
     GLFWwindow* window = glfwCreateWindow(initWidth, initHeight, "IBL", nullptr, nullptr);
     if (window == nullptr)
     {
@@ -145,31 +150,50 @@ int main(int argc, char* argv[])
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 330");
 
+    // Assets are read from the packed archive when it exists, from loose files otherwise
+    archive::Open(ARCHIVE_DEFAULT_FILE);
+#ifndef NDEBUG
+    // Debug builds check every payload once
+    if (archive::IsOpen() && !archive::Verify())
+        archive::Close();
+#endif
+
+    // Only the smallest mips are uploaded at creation, the others stream in during the first frames
+    gl::SetTextureStreaming(true);
+    int streamingBudgetKB = 4096;
+    auto startTime = std::chrono::steady_clock::now();
+
     // Init demo
     DemoInputs demoInputs = {};
     demoInputs.windowSize.x = (float)initWidth;
     demoInputs.windowSize.y = (float)initHeight;
 
+    // GPU resources are owned by the demo that creates them (demo index, see vram_budget.hpp)
     int demoId = 7;
     std::vector<Demo*> demos;
-    demos.push_back(new DemoQuad(demoInputs));
-    demos.push_back(new DemoFBO(demoInputs));
-    demos.push_back(new DemoMipmap(demoInputs));
-    demos.push_back(new DemoTexture3D(demoInputs));
-    demos.push_back(new DemoNormalMap(demoInputs));
+    vram::SetOwner((int)demos.size()); demos.push_back(new DemoQuad(demoInputs));
+    vram::SetOwner((int)demos.size()); demos.push_back(new DemoFBO(demoInputs));
+    vram::SetOwner((int)demos.size()); demos.push_back(new DemoMipmap(demoInputs));
+    vram::SetOwner((int)demos.size()); demos.push_back(new DemoTexture3D(demoInputs));
+    vram::SetOwner((int)demos.size()); demos.push_back(new DemoNormalMap(demoInputs));
     // TODO: Here, add other demos
-    demos.push_back(new DemoSkybox(demoInputs));
-    demos.push_back(new DemoPBR(demoInputs));
-    demos.push_back(new DemoIBL(demoInputs));
+    vram::SetOwner((int)demos.size()); demos.push_back(new DemoSkybox(demoInputs));
+    vram::SetOwner((int)demos.size()); demos.push_back(new DemoPBR(demoInputs));
+    vram::SetOwner((int)demos.size()); demos.push_back(new DemoIBL(demoInputs));
     //demos.push_back(new DemoBloom(demoInputs));
 
 #ifdef USE_PAUL_DLL
     // Load some demo from dll
+    vram::SetOwner(-1);
     HMODULE paulDemoLib = loadDemosInDll(demos, "ibl-paul.dll", demoInputs);
 #endif
 
+    printf("Demos created in %.1f ms\n", std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+
     // Various main loop variables
     bool showDemoWindow = false;
+    bool showMemoryWindow = false;
+    bool streamingDone = false;
     bool mouseCaptured = false;
     double prevMouseX = 0.0;
     double prevMouseY = 0.0;
@@ -203,6 +227,36 @@ int main(int argc, char* argv[])
         if (showDemoWindow)
             ImGui::ShowDemoWindow(&showDemoWindow);
 
+        // GPU memory residency (evicts/reloads before the demo renders)
+        vram::Update(demoId);
+        ImGui::SameLine();
+        ImGui::Checkbox("GPU memory", &showMemoryWindow);
+        if (showMemoryWindow)
+        {
+            std::vector<const char*> demoNames;
+            for (Demo* demo : demos)
+                demoNames.push_back(demo->Name());
+
+            ImGui::Begin("GPU memory", &showMemoryWindow);
+            vram::ShowPanel(demoNames.data(), (int)demoNames.size());
+            ImGui::End();
+        }
+
+        // Upload the next texture mips
+        {
+            size_t pendingBytes = gl::UpdateTextureStreaming((size_t)streamingBudgetKB * 1024);
+            if (pendingBytes > 0)
+            {
+                ImGui::SliderInt("Streaming budget (KB/frame)", &streamingBudgetKB, 64, 65536, "%d", ImGuiSliderFlags_Logarithmic);
+                ImGui::Text("Streaming textures: %.1f MB left", pendingBytes / (1024.f * 1024.f));
+            }
+            else if (!streamingDone)
+            {
+                streamingDone = true;
+                printf("Textures streamed in %.1f ms\n", std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+            }
+        }
+
         // Mouse capture (Mouse right click to enable, escape key to disable)
         {
             if (ImGui::IsKeyPressed(GLFW_KEY_ESCAPE) && mouseCaptured)
@@ -248,8 +302,10 @@ int main(int argc, char* argv[])
     }
 
     // Cleanup
+    gl::ReleaseTextureStreaming();
     for (Demo* demo : demos)
         delete demo;
+    archive::Close();
 
 #ifdef USE_PAUL_DLL
     FreeLibrary(paulDemoLib);
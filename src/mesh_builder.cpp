@@ -3,11 +3,13 @@
 
 #include <tiny_obj_loader.h>
 
+#include "asset_archive.hpp"
 #include "calc.hpp"
+#include "lz.hpp"
 
 #include "mesh_builder.hpp"
 
-#define OBJ_CACHE_VERSION 1
+#define OBJ_CACHE_VERSION 2
 
 struct FullVertex
 {
@@ -308,120 +310,225 @@ static bool LoadObjFromCache(std::vector<FullVertex>& mesh, const char* filename
     if (file == nullptr)
         return false;
 
-    size_t version;
-    fread(&version, sizeof(size_t), 1, file);
-    if (version != OBJ_CACHE_VERSION)
+    size_t header[3] = {}; // Version, vertex count, compressed size (0 when stored raw)
+    fread(header, sizeof(header), 1, file);
+    if (header[0] != OBJ_CACHE_VERSION)
     {
         printf("Cached version mismatch for %s, reload...\n", filename);
+        fclose(file);
         return false;
     }
 
-    size_t vertexCount = 0;
-    fread(&vertexCount, sizeof(size_t), 1, file);
+    size_t vertexCount = header[1];
     mesh.resize(vertexCount);
-    fread(mesh.data(), sizeof(FullVertex), vertexCount, file);
+    bool success;
+    if (header[2] == 0)
+    {
+        success = fread(mesh.data(), sizeof(FullVertex), vertexCount, file) == vertexCount;
+    }
+    else
+    {
+        std::vector<unsigned char> compressed(header[2]);
+        success = fread(compressed.data(), 1, compressed.size(), file) == compressed.size() &&
+                  lz::Decompress(compressed.data(), compressed.size(), mesh.data(), vertexCount * sizeof(FullVertex));
+    }
     fclose(file);
 
+    if (!success)
+    {
+        fprintf(stderr, "Corrupted model cache for %s\n", filename);
+        return false;
+    }
+
     printf("Model loaded from cache: %s (%d vertices)\n", filename, (int)vertexCount);
 
     return true;
 }
 
+// Same content as the cache file, read in place from the asset archive (compressed vertices are decompressed in storage)
+static bool LoadObjFromArchive(const FullVertex** vertices, int* vertexCount, std::vector<FullVertex>& storage, const char* filename)
+{
+    std::string cachedFile = filename;
+    cachedFile += ".cache";
+
+    const void* data;
+    size_t size;
+    if (!archive::Find(cachedFile.c_str(), &data, &size))
+        return false;
+
+    size_t header[3] = {}; // Version, vertex count, compressed size (0 when stored raw)
+    if (size >= sizeof(header))
+        memcpy(header, data, sizeof(header));
+    size_t payloadSize = header[2] != 0 ? header[2] : header[1] * sizeof(FullVertex);
+    if (header[0] != OBJ_CACHE_VERSION || sizeof(header) + payloadSize > size)
+    {
+        printf("Archived version mismatch for %s, reload...\n", filename);
+        return false;
+    }
+
+    const unsigned char* payload = (const unsigned char*)data + sizeof(header);
+    if (header[2] == 0)
+    {
+        *vertices = (const FullVertex*)payload;
+    }
+    else
+    {
+        storage.resize(header[1]);
+        if (!lz::Decompress(payload, payloadSize, storage.data(), header[1] * sizeof(FullVertex)))
+        {
+            fprintf(stderr, "Corrupted archived model %s\n", filename);
+            return false;
+        }
+        *vertices = storage.data();
+    }
+    *vertexCount = (int)header[1];
+
+    printf("Model loaded from archive: %s (%d vertices)\n", filename, *vertexCount);
+
+    return true;
+}
+
 static void SaveObjToCache(const std::vector<FullVertex>& mesh, const char* filename)
 {
     std::string cachedFile = filename;
     cachedFile += ".cache";
 
     FILE* file = fopen(cachedFile.c_str(), "wb");
-    size_t version = OBJ_CACHE_VERSION;
-    fwrite(&version, sizeof(size_t), 1, file);
-    size_t vertexCount = mesh.size();
-    fwrite(&vertexCount, sizeof(size_t), 1, file);
-    fwrite(&mesh[0], sizeof(FullVertex), vertexCount, file);
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Cannot write model cache %s\n", cachedFile.c_str());
+        return;
+    }
+
+    // Compressed vertices, only kept when it saves enough to pay for the decompression
+    size_t rawSize = mesh.size() * sizeof(FullVertex);
+    std::vector<unsigned char> compressed = lz::Compress(mesh.data(), rawSize);
+    bool useCompressed = compressed.size() < rawSize - rawSize / 16;
+
+    size_t header[3] = { OBJ_CACHE_VERSION, mesh.size(), useCompressed ? compressed.size() : 0 };
+    fwrite(header, sizeof(header), 1, file);
+    if (useCompressed)
+        fwrite(compressed.data(), 1, compressed.size(), file);
+    else
+        fwrite(mesh.data(), sizeof(FullVertex), mesh.size(), file);
     fclose(file);
 
-    printf("Model saved to cache: %s (%d vertices)\n", filename, (int)vertexCount);
+    printf("Model saved to cache: %s (%d vertices, %d bytes on disk)\n", filename, (int)mesh.size(), (int)(useCompressed ? compressed.size() : rawSize));
 }
 
-MeshSlice MeshBuilder::LoadObj(int* startIndex, const char* objFile, const char* mtlDir, float scale)
+static bool ParseObj(std::vector<FullVertex>& vertices, const char* objFile, const char* mtlDir)
 {
-    std::vector<FullVertex> vertices;
-    if (!LoadObjFromCache(vertices, objFile))
-    {
-        tinyobj::attrib_t attrib;
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::string warning;
-        std::string error;
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warning;
+    std::string error;
 
-        bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, objFile, mtlDir, true);
-        if (!warning.empty())
-            printf("%s\n", warning.c_str());
+    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, objFile, mtlDir, true);
+    if (!warning.empty())
+        printf("%s\n", warning.c_str());
 
-        if (!error.empty())
-            fprintf(stderr, "%s\n", error.c_str());
+    if (!error.empty())
+        fprintf(stderr, "%s\n", error.c_str());
 
-        if (!ret)
-            return { 0, 0 };
+    if (!ret)
+        return false;
 
-        // TODO: Precompute total vertex count to prealloc
+    // TODO: Precompute total vertex count to prealloc
 
-        // Loop over shapes
-        for (size_t s = 0; s < shapes.size(); s++)
+    // Loop over shapes
+    for (size_t s = 0; s < shapes.size(); s++)
+    {
+        // Loop over faces(polygon)
+        size_t index_offset = 0;
+        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
         {
-            // Loop over faces(polygon)
-            size_t index_offset = 0;
-            for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
+            int fv = shapes[s].mesh.num_face_vertices[f];
+
+            // Loop over vertices in the face.
+            for (int v = 0; v < fv; v++)
             {
-                int fv = shapes[s].mesh.num_face_vertices[f];
+                // access to vertex
+                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+
+                FullVertex vert = {};
+
+                vert.position.x = attrib.vertices[3 * idx.vertex_index + 0];
+                vert.position.y = attrib.vertices[3 * idx.vertex_index + 1];
+                vert.position.z = attrib.vertices[3 * idx.vertex_index + 2];
+
+                if (!attrib.normals.empty())
+                {
+                    vert.normal.x = attrib.normals[3 * idx.normal_index + 0];
+                    vert.normal.y = attrib.normals[3 * idx.normal_index + 1];
+                    vert.normal.z = attrib.normals[3 * idx.normal_index + 2];
+                }
 
-                // Loop over vertices in the face.
-                for (int v = 0; v < fv; v++)
+                if (!attrib.texcoords.empty())
                 {
-                    // access to vertex
-                    tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-
-                    FullVertex vert = {};
-
-                    vert.position.x = attrib.vertices[3 * idx.vertex_index + 0];
-                    vert.position.y = attrib.vertices[3 * idx.vertex_index + 1];
-                    vert.position.z = attrib.vertices[3 * idx.vertex_index + 2];
-
-                    if (!attrib.normals.empty())
-                    {
-                        vert.normal.x = attrib.normals[3 * idx.normal_index + 0];
-                        vert.normal.y = attrib.normals[3 * idx.normal_index + 1];
-                        vert.normal.z = attrib.normals[3 * idx.normal_index + 2];
-                    }
-
-                    if (!attrib.texcoords.empty())
-                    {
-                        vert.uv.u = attrib.texcoords[2 * idx.texcoord_index + 0];
-                        vert.uv.v = attrib.texcoords[2 * idx.texcoord_index + 1];
-                    }
-
-                    // Optional: vertex colors
-                    if (!attrib.colors.empty())
-                    {
-                        vert.color.r = attrib.colors[3 * idx.vertex_index + 0];
-                        vert.color.g = attrib.colors[3 * idx.vertex_index + 1];
-                        vert.color.b = attrib.colors[3 * idx.vertex_index + 2];
-                    }
-
-                    vertices.push_back(vert);
+                    vert.uv.u = attrib.texcoords[2 * idx.texcoord_index + 0];
+                    vert.uv.v = attrib.texcoords[2 * idx.texcoord_index + 1];
                 }
-                index_offset += fv;
+
+                // Optional: vertex colors
+                if (!attrib.colors.empty())
+                {
+                    vert.color.r = attrib.colors[3 * idx.vertex_index + 0];
+                    vert.color.g = attrib.colors[3 * idx.vertex_index + 1];
+                    vert.color.b = attrib.colors[3 * idx.vertex_index + 2];
+                }
+
+                vertices.push_back(vert);
             }
+            index_offset += fv;
         }
+    }
+
+    return true;
+}
+
+MeshSlice MeshBuilder::LoadObj(int* startIndex, const char* objFile, const char* mtlDir, float scale)
+{
+    std::vector<FullVertex> vertices;
+    const FullVertex* srcVertices = nullptr;
+    int count = 0;
+    if (LoadObjFromArchive(&srcVertices, &count, vertices, objFile))
+    {
+        // Vertices are used in place (or decompressed in vertices)
+    }
+    else if (!LoadObjFromCache(vertices, objFile))
+    {
+        if (!ParseObj(vertices, objFile, mtlDir))
+            return { 0, 0 };
 
         SaveObjToCache(vertices, objFile);
     }
 
-    for (FullVertex& vertex : vertices)
-        vertex.position *= scale;
+    if (srcVertices == nullptr)
+    {
+        srcVertices = vertices.data();
+        count = (int)vertices.size();
+    }
 
-    int count = (int)vertices.size();
-    ConvertVertices(GetDst(startIndex, count), vertices.data(), count, descriptor);
+    unsigned char* dst = (unsigned char*)GetDst(startIndex, count);
+    ConvertVertices(dst, srcVertices, count, descriptor);
+
+    // Scale converted positions (archived vertices are read-only)
+    for (int i = 0; i < count; ++i)
+    {
+        float3* position = (float3*)(dst + i * descriptor.size + descriptor.positionOffset);
+        *position *= scale;
+    }
 
     return { *vertexCount - count, count };
 }
+
+bool CookObj(const char* objFile, const char* mtlDir)
+{
+    std::vector<FullVertex> vertices;
+    if (!ParseObj(vertices, objFile, mtlDir))
+        return false;
+
+    SaveObjToCache(vertices, objFile);
+    return true;
+}
@@ -44,4 +44,7 @@ private:
     void* Grow(int count);
 
     MeshSlice GenIcosphereFace(int* index, float3 a, float3 b, float3 c, int depth);
-};
\ No newline at end of file
+};
+
+// Parse an .obj file and write its cache (used by the asset cooker)
+bool CookObj(const char* objFile, const char* mtlDir);
@@ -0,0 +1,386 @@
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX code is compiled whatever the build flags and only run when the CPU supports it
+#if defined(MIP_USE_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define MIP_USE_AVX
+#include <immintrin.h>
+#endif
+
+#include "calc.hpp"
+#include "jobs.hpp"
+#include "mip_generator.hpp"
+
+// Kernels are expressed in destination texels
+static const float KAISER_WIDTH = 3.f;
+static const float KAISER_ALPHA = 4.f;
+static const float LANCZOS_WIDTH = 3.f;
+
+static float Sinc(float x)
+{
+    if (fabsf(x) < 1e-5f)
+        return 1.f;
+    x *= calc::TAU * 0.5f;
+    return sinf(x) / x;
+}
+
+// Modified Bessel function of the first kind (order 0)
+static float Bessel0(float x)
+{
+    float sum = 1.f;
+    float term = 1.f;
+    for (int k = 1; k < 32 && term > sum * 1e-8f; ++k)
+    {
+        float t = x / (2.f * k);
+        term *= t * t;
+        sum += term;
+    }
+    return sum;
+}
+
+static float FilterRadius(mip::Filter filter)
+{
+    switch (filter)
+    {
+    case mip::Filter::KAISER:  return KAISER_WIDTH;
+    case mip::Filter::LANCZOS: return LANCZOS_WIDTH;
+    case mip::Filter::BOX: default: return 0.5f;
+    }
+}
+
+static float EvaluateFilter(mip::Filter filter, float x)
+{
+    x = fabsf(x);
+    switch (filter)
+    {
+    case mip::Filter::KAISER:
+    {
+        if (x >= KAISER_WIDTH)
+            return 0.f;
+        float t = x / KAISER_WIDTH;
+        return Sinc(x) * Bessel0(KAISER_ALPHA * sqrtf(1.f - t * t)) / Bessel0(KAISER_ALPHA);
+    }
+    case mip::Filter::LANCZOS:
+        return (x < LANCZOS_WIDTH) ? Sinc(x) * Sinc(x / LANCZOS_WIDTH) : 0.f;
+
+    case mip::Filter::BOX:
+    default:
+        if (x < 0.5f)  return 1.f;
+        if (x == 0.5f) return 0.5f;
+        return 0.f;
+    }
+}
+
+// Source texels and weights contributing to each destination texel of a row or column
+struct FilterTaps
+{
+    int count = 0; // Taps per destination texel
+    std::vector<int>   indices;
+    std::vector<float> weights;
+};
+
+static FilterTaps ComputeFilterTaps(mip::Filter filter, int srcSize, int dstSize)
+{
+    FilterTaps taps;
+    if (srcSize == dstSize)
+    {
+        // Nothing to filter along this axis (1 texel wide levels)
+        taps.count = 1;
+        for (int i = 0; i < dstSize; ++i)
+        {
+            taps.indices.push_back(i);
+            taps.weights.push_back(1.f);
+        }
+        return taps;
+    }
+
+    float scale = (float)srcSize / dstSize;
+    float radius = FilterRadius(filter) * scale;
+    taps.count = (int)ceilf(radius * 2.f) + 1;
+    taps.indices.resize((size_t)dstSize * taps.count);
+    taps.weights.resize((size_t)dstSize * taps.count);
+
+    for (int i = 0; i < dstSize; ++i)
+    {
+        float center = (i + 0.5f) * scale; // In source texels (edge at 0)
+        int first = (int)floorf(center - radius);
+
+        float sum = 0.f;
+        for (int k = 0; k < taps.count; ++k)
+        {
+            int srcIndex = first + k;
+            float weight = EvaluateFilter(filter, (srcIndex + 0.5f - center) / scale);
+
+            // Clamp to edge
+            taps.indices[i * taps.count + k] = calc::Clamp(srcIndex, 0, srcSize - 1);
+            taps.weights[i * taps.count + k] = weight;
+            sum += weight;
+        }
+
+        for (int k = 0; k < taps.count; ++k)
+            taps.weights[i * taps.count + k] /= sum;
+    }
+    return taps;
+}
+
+// Filter along x, one RGBA texel at a time
+static void FilterRow(const FilterTaps& taps, const float* src, float* dst, int dstWidth)
+{
+    for (int x = 0; x < dstWidth; ++x)
+    {
+        const int*   indices = &taps.indices[(size_t)x * taps.count];
+        const float* weights = &taps.weights[(size_t)x * taps.count];
+#ifdef MIP_USE_SSE2
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < taps.count; ++k)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src + indices[k] * 4), _mm_set1_ps(weights[k])));
+        _mm_storeu_ps(dst + x * 4, sum);
+#else
+        float sum[4] = {};
+        for (int k = 0; k < taps.count; ++k)
+            for (int c = 0; c < 4; ++c)
+                sum[c] += src[indices[k] * 4 + c] * weights[k];
+        memcpy(dst + x * 4, sum, sizeof(sum));
+#endif
+    }
+}
+
+#if defined(MIP_USE_AVX)
+static bool HasAVX()
+{
+    static bool hasAVX = __builtin_cpu_supports("avx");
+    return hasAVX;
+}
+
+// Same sums as the scalar path (multiply then add, no FMA), returns the number of floats filtered
+__attribute__((target("avx")))
+static int FilterColumnAVX(const float* const* rows, const float* weights, int rowCount, float* dst, int floatCount)
+{
+    int i = 0;
+    for (; i + 8 <= floatCount; i += 8)
+    {
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < rowCount; ++k)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + i), _mm256_set1_ps(weights[k])));
+        _mm256_storeu_ps(dst + i, sum);
+    }
+    return i;
+}
+#endif
+
+// Filter along y, whole rows at a time (floatCount floats per row)
+static void FilterColumn(const float* const* rows, const float* weights, int rowCount, float* dst, int floatCount)
+{
+    int i = 0;
+#if defined(MIP_USE_AVX)
+    if (HasAVX())
+        i = FilterColumnAVX(rows, weights, rowCount, dst, floatCount);
+#endif
+#if defined(MIP_USE_SSE2)
+    for (; i + 4 <= floatCount; i += 4)
+    {
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < rowCount; ++k)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(weights[k])));
+        _mm_storeu_ps(dst + i, sum);
+    }
+#endif
+    for (; i < floatCount; ++i)
+    {
+        float sum = 0.f;
+        for (int k = 0; k < rowCount; ++k)
+            sum += rows[k][i] * weights[k];
+        dst[i] = sum;
+    }
+}
+
+// Negative lobes (Kaiser, Lanczos) undershoot next to bright texels, keep colors and HDR values positive
+static void ClampNegativeRow(float* values, int floatCount)
+{
+    for (int i = 0; i < floatCount; ++i)
+        values[i] = calc::Max(values[i], 0.f);
+}
+
+static void RenormalizeRow(float* rgba, int width)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        float* n = rgba + x * 4;
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length > 1e-6f)
+        {
+            n[0] /= length;
+            n[1] /= length;
+            n[2] /= length;
+        }
+        else
+        {
+            n[0] = 0.f;
+            n[1] = 0.f;
+            n[2] = 1.f;
+        }
+    }
+}
+
+// sRGB decoding table, and decision thresholds to encode back with exact rounding
+struct SRGBTables
+{
+    SRGBTables()
+    {
+        for (int i = 0; i < 256; ++i)
+            toLinear[i] = ToLinear(i / 255.f);
+        for (int i = 0; i < 255; ++i)
+            thresholds[i] = ToLinear((i + 0.5f) / 255.f);
+    }
+
+    static float ToLinear(float c)
+    {
+        return (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    unsigned char Encode(float linear) const
+    {
+        int index = 0;
+        for (int step = 128; step > 0; step /= 2)
+            if (index + step <= 255 && linear >= thresholds[index + step - 1])
+                index += step;
+        return (unsigned char)index;
+    }
+
+    float toLinear[256];
+    float thresholds[255];
+};
+
+static const SRGBTables& GetSRGBTables()
+{
+    static SRGBTables tables;
+    return tables;
+}
+
+const char* mip::FilterName(Filter filter)
+{
+    switch (filter)
+    {
+    case Filter::BOX:     return "box";
+    case Filter::KAISER:  return "kaiser";
+    case Filter::LANCZOS: return "lanczos";
+    default:              return "unknown";
+    }
+}
+
+int mip::LevelCount(int width, int height)
+{
+    int levelCount = 1;
+    while (width > 1 || height > 1)
+    {
+        width  = calc::Max(width  / 2, 1);
+        height = calc::Max(height / 2, 1);
+        levelCount++;
+    }
+    return levelCount;
+}
+
+int mip::LevelSize(int size, int level)
+{
+    return calc::Max(size >> level, 1);
+}
+
+// Conversions are split in chunks of pixels processed in parallel
+static const size_t CONVERT_CHUNK_PIXELS = 64 * 1024;
+
+void mip::DecodeRGBA8(const unsigned char* rgba, size_t pixelCount, uint32_t flags, float* dst)
+{
+    const SRGBTables& srgb = GetSRGBTables();
+    int chunkCount = (int)((pixelCount + CONVERT_CHUNK_PIXELS - 1) / CONVERT_CHUNK_PIXELS);
+    jobs::ParallelFor(chunkCount, [&](int chunk)
+    {
+        size_t begin = chunk * CONVERT_CHUNK_PIXELS * 4;
+        size_t end   = calc::Min((chunk + 1) * CONVERT_CHUNK_PIXELS, pixelCount) * 4;
+        for (size_t i = begin; i < end; ++i)
+        {
+            bool isAlpha = (i & 3) == 3;
+            if (isAlpha)
+                dst[i] = rgba[i] / 255.f;
+            else if (flags & FLAG_NORMAL_MAP)
+                dst[i] = rgba[i] / 127.5f - 1.f;
+            else if (flags & FLAG_SRGB)
+                dst[i] = srgb.toLinear[rgba[i]];
+            else
+                dst[i] = rgba[i] / 255.f;
+        }
+    });
+}
+
+void mip::EncodeRGBA8(const float* src, size_t pixelCount, uint32_t flags, unsigned char* rgba)
+{
+    const SRGBTables& srgb = GetSRGBTables();
+    int chunkCount = (int)((pixelCount + CONVERT_CHUNK_PIXELS - 1) / CONVERT_CHUNK_PIXELS);
+    jobs::ParallelFor(chunkCount, [&](int chunk)
+    {
+        size_t begin = chunk * CONVERT_CHUNK_PIXELS * 4;
+        size_t end   = calc::Min((chunk + 1) * CONVERT_CHUNK_PIXELS, pixelCount) * 4;
+        for (size_t i = begin; i < end; ++i)
+        {
+            bool isAlpha = (i & 3) == 3;
+            float value = src[i];
+            if (!isAlpha && (flags & FLAG_NORMAL_MAP))
+                value = value * 0.5f + 0.5f;
+
+            if (!isAlpha && (flags & FLAG_SRGB))
+                rgba[i] = srgb.Encode(value);
+            else
+                rgba[i] = (unsigned char)(calc::Clamp(value, 0.f, 1.f) * 255.f + 0.5f);
+        }
+    });
+}
+
+// Rows are grouped so that a job filters at least this many destination texels: the small levels of a chain
+// run as a single job on the calling thread instead of waking up the workers twice per level
+static const int DOWNSAMPLE_JOB_TEXELS = 16 * 1024;
+
+static int GetRowsPerJob(int rowWidth)
+{
+    return calc::Max(DOWNSAMPLE_JOB_TEXELS / calc::Max(rowWidth, 1), 1);
+}
+
+void mip::Downsample(Filter filter, uint32_t flags, const float* src, int srcWidth, int srcHeight, float* dst, int dstWidth, int dstHeight)
+{
+    FilterTaps tapsX = ComputeFilterTaps(filter, srcWidth, dstWidth);
+    FilterTaps tapsY = ComputeFilterTaps(filter, srcHeight, dstHeight);
+    int rowsPerJob = GetRowsPerJob(dstWidth);
+
+    // Horizontal pass on all source rows
+    std::vector<float> horizontal((size_t)dstWidth * srcHeight * 4);
+    jobs::ParallelFor((srcHeight + rowsPerJob - 1) / rowsPerJob, [&](int job)
+    {
+        int endY = calc::Min((job + 1) * rowsPerJob, srcHeight);
+        for (int y = job * rowsPerJob; y < endY; ++y)
+            FilterRow(tapsX, src + (size_t)y * srcWidth * 4, horizontal.data() + (size_t)y * dstWidth * 4, dstWidth);
+    });
+
+    // Vertical pass
+    jobs::ParallelFor((dstHeight + rowsPerJob - 1) / rowsPerJob, [&](int job)
+    {
+        std::vector<const float*> rows(tapsY.count);
+        int endY = calc::Min((job + 1) * rowsPerJob, dstHeight);
+        for (int y = job * rowsPerJob; y < endY; ++y)
+        {
+            for (int k = 0; k < tapsY.count; ++k)
+                rows[k] = horizontal.data() + (size_t)tapsY.indices[(size_t)y * tapsY.count + k] * dstWidth * 4;
+
+            float* dstRow = dst + (size_t)y * dstWidth * 4;
+            FilterColumn(rows.data(), &tapsY.weights[(size_t)y * tapsY.count], tapsY.count, dstRow, dstWidth * 4);
+
+            if (flags & FLAG_NORMAL_MAP)
+                RenormalizeRow(dstRow, dstWidth);
+            else
+                ClampNegativeRow(dstRow, dstWidth * 4);
+        }
+    });
+}
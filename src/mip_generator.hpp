@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CPU mip chain generation (RGBA32F working format)
+namespace mip
+{
+    enum class Filter : int
+    {
+        BOX,     // 2x2 average
+        KAISER,  // Kaiser windowed sinc (3 texels wide)
+        LANCZOS, // Lanczos 3
+    };
+
+    enum Flags
+    {
+        FLAG_SRGB       = 1 << 0, // RGB is sRGB encoded, filtered in linear space (alpha is always linear)
+        FLAG_NORMAL_MAP = 1 << 1, // RGB is a unorm encoded normal, renormalized after filtering
+    };
+
+    const char* FilterName(Filter filter);
+
+    // Number of levels down to 1x1
+    int LevelCount(int width, int height);
+
+    // Size of a level (halved and rounded down, at least 1)
+    int LevelSize(int size, int level);
+
+    // RGBA8 <-> RGBA32F working format ([0, 1] range, or [-1, 1] for normal maps)
+    void DecodeRGBA8(const unsigned char* rgba, size_t pixelCount, uint32_t flags, float* dst);
+    void EncodeRGBA8(const float* src, size_t pixelCount, uint32_t flags, unsigned char* rgba);
+
+    // Compute the next level of a RGBA32F image (groups of rows are filtered in parallel, small levels in one job)
+    // Results are clamped to >= 0, except normal maps which are renormalized
+    void Downsample(Filter filter, uint32_t flags, const float* src, int srcWidth, int srcHeight, float* dst, int dstWidth, int dstHeight);
+}
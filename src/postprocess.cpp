@@ -0,0 +1,521 @@
+#include <cassert>
+#include <cmath>
+
+#include <imgui.h>
+
+#include "types.hpp"
+#include "gl_helpers.hpp"
+#include "vram_budget.hpp"
+
+#include "postprocess.hpp"
+
+const char* post::fullscreenVertexShader = R"GLSL(
+out vec2 vUV;
+
+void main()
+{
+    // Fullscreen triangle
+    vUV = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(vUV * 2.0 - 1.0, 0.0, 1.0);
+}
+)GLSL";
+
+const char* post::tonemapShader = R"GLSL(
+vec3 Tonemap(vec3 color, float exposure)
+{
+    color *= exposure;
+    return color / (color + vec3(1.0));
+}
+)GLSL";
+
+const char* post::autoExposureShader = R"GLSL(
+uniform sampler2D adaptedLuminanceTexture;
+
+float GetAutoExposure()
+{
+    return 0.18 / texelFetch(adaptedLuminanceTexture, ivec2(0), 0).r;
+}
+)GLSL";
+
+const char* post::FormatName(ColorFormat format)
+{
+    switch (format)
+    {
+    case ColorFormat::RGBA8:      return "RGBA8";
+    case ColorFormat::R11G11B10F: return "R11G11B10F";
+    case ColorFormat::RGBA16F:    return "RGBA16F";
+    default:                      return "Unknown";
+    }
+}
+
+GLenum post::GetInternalFormat(ColorFormat format)
+{
+    switch (format)
+    {
+    case ColorFormat::RGBA8:      return GL_RGBA8;
+    case ColorFormat::R11G11B10F: return GL_R11F_G11F_B10F;
+    case ColorFormat::RGBA16F:    return GL_RGBA16F;
+    default:                      return GL_RGBA8;
+    }
+}
+
+bool post::EditColorFormat(const char* label, ColorFormat* format)
+{
+    int index = (int)*format;
+    if (!ImGui::Combo(label, &index, "RGBA8\0R11G11B10F\0RGBA16F\0"))
+        return false;
+    *format = (ColorFormat)index;
+    return true;
+}
+
+void post::SceneTarget::Generate(int width, int height, ColorFormat format)
+{
+    this->format = format;
+
+    glGenTextures(1, &colorTexture);
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &depthRenderbuffer);
+    Resize(width, height);
+
+    glGenFramebuffers(1, &id);
+    glBindFramebuffer(GL_FRAMEBUFFER, id);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    assert(status == GL_FRAMEBUFFER_COMPLETE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void post::SceneTarget::Resize(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    gl::AllocateTexture2D(GetInternalFormat(format), width, height, GL_RGBA, GL_FLOAT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+    gl::RenderbufferStorage(GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+void post::SceneTarget::Delete()
+{
+    glDeleteFramebuffers(1, &id);
+    gl::DeleteTextures(1, &colorTexture);
+    gl::DeleteRenderbuffers(1, &depthRenderbuffer);
+    *this = {};
+}
+
+void post::Tonemapper::Create()
+{
+    const char* fragmentShaders[] = {
+        tonemapShader,
+        R"GLSL(
+        in vec2 vUV;
+        out vec4 fragColor;
+
+        uniform sampler2D colorTexture;
+        uniform float exposure;
+
+        void main()
+        {
+            fragColor = vec4(Tonemap(texture(colorTexture, vUV).rgb, exposure), 1.0);
+        }
+        )GLSL"
+    };
+
+    program = gl::CreateProgram(1, &fullscreenVertexShader, ARRAYSIZE(fragmentShaders), fragmentShaders);
+    glGenVertexArrays(1, &vertexArray);
+}
+
+void post::Tonemapper::Delete()
+{
+    glDeleteProgram(program);
+    glDeleteVertexArrays(1, &vertexArray);
+    *this = {};
+}
+
+void post::Tonemapper::Apply(GLuint colorTexture, float exposure) const
+{
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_FRAMEBUFFER_SRGB);
+
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "colorTexture"), 0);
+    glUniform1f(glGetUniformLocation(program, "exposure"), exposure);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glBindVertexArray(vertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glDisable(GL_FRAMEBUFFER_SRGB);
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+}
+
+void post::Bloom::Create()
+{
+    // Weighted sum of 13 bilinear taps: a 4x4 box at the center and four overlapping 2x2 boxes (36 texels)
+    // With karisAverage (first level), the five boxes are weighted by 1 / (1 + luma) to keep fireflies from flickering
+    downsampleProgram = gl::CreateBasicProgram(fullscreenVertexShader, R"GLSL(
+        in vec2 vUV;
+        out vec4 fragColor;
+
+        uniform sampler2D sourceTexture;
+        uniform vec2 sourceTexelSize;
+        uniform bool karisAverage;
+
+        vec3 Tap(float x, float y) { return texture(sourceTexture, vUV + vec2(x, y) * sourceTexelSize).rgb; }
+
+        float KarisWeight(vec3 box) { return 1.0 / (1.0 + dot(box, vec3(0.2126, 0.7152, 0.0722))); }
+
+        void main()
+        {
+            vec3 a = Tap(-2.0,  2.0), b = Tap(0.0,  2.0), c = Tap(2.0,  2.0);
+            vec3 d = Tap(-2.0,  0.0), e = Tap(0.0,  0.0), f = Tap(2.0,  0.0);
+            vec3 g = Tap(-2.0, -2.0), h = Tap(0.0, -2.0), i = Tap(2.0, -2.0);
+            vec3 j = Tap(-1.0,  1.0), k = Tap(1.0,  1.0);
+            vec3 l = Tap(-1.0, -1.0), m = Tap(1.0, -1.0);
+
+            vec3 center      = (j + k + l + m) * 0.25;
+            vec3 topLeft     = (a + b + d + e) * 0.25;
+            vec3 topRight    = (b + c + e + f) * 0.25;
+            vec3 bottomLeft  = (d + e + g + h) * 0.25;
+            vec3 bottomRight = (e + f + h + i) * 0.25;
+
+            vec3 color;
+            if (karisAverage)
+            {
+                float wc  = KarisWeight(center) * 0.5;
+                float wtl = KarisWeight(topLeft) * 0.125;
+                float wtr = KarisWeight(topRight) * 0.125;
+                float wbl = KarisWeight(bottomLeft) * 0.125;
+                float wbr = KarisWeight(bottomRight) * 0.125;
+                color = (center * wc + topLeft * wtl + topRight * wtr + bottomLeft * wbl + bottomRight * wbr) / (wc + wtl + wtr + wbl + wbr);
+            }
+            else
+            {
+                color = center * 0.5 + (topLeft + topRight + bottomLeft + bottomRight) * 0.125;
+            }
+            fragColor = vec4(color, 1.0);
+        }
+        )GLSL");
+
+    // 3x3 tent, additively blended over the downsampled level
+    upsampleProgram = gl::CreateBasicProgram(fullscreenVertexShader, R"GLSL(
+        in vec2 vUV;
+        out vec4 fragColor;
+
+        uniform sampler2D sourceTexture;
+        uniform vec2 filterRadius; // In uv
+
+        vec3 Tap(float x, float y) { return texture(sourceTexture, vUV + vec2(x, y) * filterRadius).rgb; }
+
+        void main()
+        {
+            vec3 color = Tap(0.0, 0.0) * 4.0;
+            color += (Tap(0.0, 1.0) + Tap(-1.0, 0.0) + Tap(1.0, 0.0) + Tap(0.0, -1.0)) * 2.0;
+            color += Tap(-1.0, 1.0) + Tap(1.0, 1.0) + Tap(-1.0, -1.0) + Tap(1.0, -1.0);
+            fragColor = vec4(color / 16.0, 1.0);
+        }
+        )GLSL");
+
+    glGenVertexArrays(1, &vertexArray);
+    gl::CreateTimer(&timer);
+}
+
+void post::Bloom::Delete()
+{
+    DeleteLevels();
+    glDeleteProgram(downsampleProgram);
+    glDeleteProgram(upsampleProgram);
+    glDeleteVertexArrays(1, &vertexArray);
+    gl::DeleteTimer(&timer);
+    *this = {};
+}
+
+void post::Bloom::DeleteLevels()
+{
+    gl::DeleteTextures(allocatedLevelCount, textures);
+    glDeleteFramebuffers(allocatedLevelCount, framebuffers);
+    allocatedLevelCount = 0;
+}
+
+void post::Bloom::Resize(int sourceWidth, int sourceHeight)
+{
+    DeleteLevels();
+
+    this->sourceWidth = sourceWidth;
+    this->sourceHeight = sourceHeight;
+    allocatedLevelCount = levelCount < 1 ? 1 : (levelCount > BLOOM_MAX_LEVEL_COUNT ? BLOOM_MAX_LEVEL_COUNT : levelCount);
+
+    glGenTextures(allocatedLevelCount, textures);
+    glGenFramebuffers(allocatedLevelCount, framebuffers);
+    int width = sourceWidth;
+    int height = sourceHeight;
+    for (int i = 0; i < allocatedLevelCount; ++i)
+    {
+        width  = width  > 1 ? width  / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        widths[i] = width;
+        heights[i] = height;
+
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        gl::AllocateTexture2D(GL_R11F_G11F_B10F, width, height, GL_RGB, GL_FLOAT);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        assert(status == GL_FRAMEBUFFER_COMPLETE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+GLuint post::Bloom::Apply(GLuint sourceTexture)
+{
+    if (allocatedLevelCount != levelCount)
+        Resize(sourceWidth, sourceHeight);
+
+    gl::BeginTimer(&timer);
+    Render(sourceTexture);
+    gl::EndTimer(&timer);
+    return textures[0];
+}
+
+void post::Bloom::Render(GLuint sourceTexture)
+{
+    GLint previousFramebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    glBindVertexArray(vertexArray);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Down the chain: source -> level 0 -> ... -> last level
+    glUseProgram(downsampleProgram);
+    glUniform1i(glGetUniformLocation(downsampleProgram, "sourceTexture"), 0);
+    for (int i = 0; i < allocatedLevelCount; ++i)
+    {
+        int readWidth  = i == 0 ? sourceWidth  : widths[i - 1];
+        int readHeight = i == 0 ? sourceHeight : heights[i - 1];
+        glUniform2f(glGetUniformLocation(downsampleProgram, "sourceTexelSize"), 1.f / readWidth, 1.f / readHeight);
+        glUniform1i(glGetUniformLocation(downsampleProgram, "karisAverage"), i == 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+        glViewport(0, 0, widths[i], heights[i]);
+        glBindTexture(GL_TEXTURE_2D, i == 0 ? sourceTexture : textures[i - 1]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    // Back up: each level receives the blurred sum of the smaller ones
+    glUseProgram(upsampleProgram);
+    glUniform1i(glGetUniformLocation(upsampleProgram, "sourceTexture"), 0);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    for (int i = allocatedLevelCount - 1; i > 0; --i)
+    {
+        glUniform2f(glGetUniformLocation(upsampleProgram, "filterRadius"), filterRadius / widths[i], filterRadius / heights[i]);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i - 1]);
+        glViewport(0, 0, widths[i - 1], heights[i - 1]);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glDisable(GL_BLEND);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+}
+
+void post::AutoExposure::Create()
+{
+    luminanceProgram = gl::CreateBasicProgram(fullscreenVertexShader, R"GLSL(
+        in vec2 vUV;
+        out vec4 fragColor;
+
+        uniform sampler2D colorTexture;
+
+        void main()
+        {
+            float luminance = dot(texture(colorTexture, vUV).rgb, vec3(0.2126, 0.7152, 0.0722));
+            fragColor = vec4(log2(max(luminance, 1e-4)));
+        }
+        )GLSL");
+
+    adaptationProgram = gl::CreateBasicProgram(fullscreenVertexShader, R"GLSL(
+        out vec4 fragColor;
+
+        uniform sampler2D luminanceTexture;
+        uniform int lastLevel;
+        uniform sampler2D previousTexture;
+        uniform float blend;
+        uniform vec2 luminanceRange;
+
+        void main()
+        {
+            float average = clamp(exp2(texelFetch(luminanceTexture, ivec2(0), lastLevel).r), luminanceRange.x, luminanceRange.y);
+            float previous = texelFetch(previousTexture, ivec2(0), 0).r;
+
+            // On reset the previous value is not read at all (mix would keep a NaN or Inf from it)
+            fragColor = vec4(blend >= 1.0 ? average : mix(previous, average, blend));
+        }
+        )GLSL");
+
+    // Sampled bilinearly from the scene, the mean of the 1x1 level is what matters
+    const int luminanceSize = 256;
+    luminanceLevelCount = 9;
+    glGenTextures(1, &luminanceTexture);
+    glBindTexture(GL_TEXTURE_2D, luminanceTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, luminanceLevelCount - 1);
+    for (int level = 0; level < luminanceLevelCount; ++level)
+        glTexImage2D(GL_TEXTURE_2D, level, GL_R16F, luminanceSize >> level, luminanceSize >> level, 0, GL_RED, GL_FLOAT, nullptr);
+    vram::Track(vram::ResourceType::TEXTURE, luminanceTexture, (size_t)luminanceSize * luminanceSize * 2 * 4 / 3);
+
+    glGenFramebuffers(1, &luminanceFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, luminanceFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, luminanceTexture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    assert(status == GL_FRAMEBUFFER_COMPLETE);
+
+    // Start from middle gray, sampling them before the first Apply gives a neutral exposure
+    const float middleGray = 0.18f;
+    glGenTextures(2, adaptedTextures);
+    glGenFramebuffers(2, adaptedFramebuffers);
+    for (int i = 0; i < 2; ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D, adaptedTextures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        gl::AllocateTexture2D(GL_R32F, 1, 1, GL_RED, GL_FLOAT);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RED, GL_FLOAT, &middleGray);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, adaptedFramebuffers[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, adaptedTextures[i], 0);
+        status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        assert(status == GL_FRAMEBUFFER_COMPLETE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenVertexArrays(1, &vertexArray);
+    gl::CreateTimer(&timer);
+}
+
+void post::AutoExposure::Delete()
+{
+    gl::DeleteTextures(1, &luminanceTexture);
+    glDeleteFramebuffers(1, &luminanceFramebuffer);
+    gl::DeleteTextures(2, adaptedTextures);
+    glDeleteFramebuffers(2, adaptedFramebuffers);
+    glDeleteProgram(luminanceProgram);
+    glDeleteProgram(adaptationProgram);
+    glDeleteVertexArrays(1, &vertexArray);
+    gl::DeleteTimer(&timer);
+    *this = {};
+}
+
+GLuint post::AutoExposure::Apply(GLuint colorTexture, float deltaTime)
+{
+    GLint previousFramebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    gl::BeginTimer(&timer);
+    glBindVertexArray(vertexArray);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Log luminance, averaged down to 1x1
+    glUseProgram(luminanceProgram);
+    glUniform1i(glGetUniformLocation(luminanceProgram, "colorTexture"), 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, luminanceFramebuffer);
+    glViewport(0, 0, 256, 256);
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindTexture(GL_TEXTURE_2D, luminanceTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    // Blend with last frame's value, frame rate independent
+    int previous = current;
+    current = 1 - current;
+    glUseProgram(adaptationProgram);
+    glUniform1i(glGetUniformLocation(adaptationProgram, "luminanceTexture"), 0);
+    glUniform1i(glGetUniformLocation(adaptationProgram, "lastLevel"), luminanceLevelCount - 1);
+    glUniform1i(glGetUniformLocation(adaptationProgram, "previousTexture"), 1);
+    glUniform1f(glGetUniformLocation(adaptationProgram, "blend"), reset ? 1.f : 1.f - expf(-adaptationSpeed * deltaTime));
+    glUniform2f(glGetUniformLocation(adaptationProgram, "luminanceRange"), minLuminance, maxLuminance);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, adaptedTextures[previous]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindFramebuffer(GL_FRAMEBUFFER, adaptedFramebuffers[current]);
+    glViewport(0, 0, 1, 1);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    gl::EndTimer(&timer);
+    reset = false;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+
+    return adaptedTextures[current];
+}
+
+float post::MeasureBloom(const Bloom& bloom, int sourceWidth, int sourceHeight, int iterationCount)
+{
+    // The content does not change the cost, the source is left undefined
+    GLuint sourceTexture;
+    glGenTextures(1, &sourceTexture);
+    glBindTexture(GL_TEXTURE_2D, sourceTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, sourceWidth, sourceHeight, 0, GL_RGB, GL_FLOAT, nullptr);
+
+    // Shares the programs, owns its levels
+    Bloom chain;
+    chain.levelCount = bloom.levelCount;
+    chain.filterRadius = bloom.filterRadius;
+    chain.downsampleProgram = bloom.downsampleProgram;
+    chain.upsampleProgram = bloom.upsampleProgram;
+    chain.vertexArray = bloom.vertexArray;
+    chain.Resize(sourceWidth, sourceHeight);
+    chain.Render(sourceTexture); // Warm up
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    for (int i = 0; i < iterationCount; ++i)
+        chain.Render(sourceTexture);
+    glEndQuery(GL_TIME_ELAPSED);
+
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+    glDeleteQueries(1, &query);
+
+    chain.DeleteLevels();
+    gl::DeleteTextures(1, &sourceTexture);
+    return (float)(nanoseconds / 1e6 / iterationCount);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "gl_helpers.hpp"
+
+#define BLOOM_MAX_LEVEL_COUNT 8
+
+// HDR scene rendering: objects output linear radiance to a float target, tonemapping and output encoding
+// are done once per pixel by a post pass drawn with GL_FRAMEBUFFER_SRGB enabled
+namespace post
+{
+    enum class ColorFormat : int
+    {
+        RGBA8,      // LDR, clamped to [0, 1]
+        R11G11B10F, // 4 bytes per pixel, no alpha
+        RGBA16F,    // 8 bytes per pixel
+    };
+
+    const char* FormatName(ColorFormat format);
+    GLenum GetInternalFormat(ColorFormat format);
+
+    // ImGui combo, returns true when the format changed (targets must then be generated again)
+    bool EditColorFormat(const char* label, ColorFormat* format);
+
+    // GLSL: fullscreen triangle (draw 3 vertices without attributes), outputs vUV
+    extern const char* fullscreenVertexShader;
+
+    // GLSL: vec3 Tonemap(vec3 color, float exposure), exposure then Reinhard, linear result
+    extern const char* tonemapShader;
+
+    // GLSL: float GetAutoExposure(), middle gray over the adapted luminance (uniform sampler2D adaptedLuminanceTexture)
+    extern const char* autoExposureShader;
+
+    // One color texture and a depth renderbuffer
+    struct SceneTarget
+    {
+        void Generate(int width, int height, ColorFormat format);
+        void Resize(int width, int height);
+        void Delete();
+
+        int width = 0;
+        int height = 0;
+        ColorFormat format = ColorFormat::R11G11B10F;
+
+        GLuint id = 0;
+        GLuint colorTexture = 0;
+        GLuint depthRenderbuffer = 0;
+    };
+
+    // Fullscreen triangle tonemapping a scene color texture to the bound framebuffer
+    struct Tonemapper
+    {
+        void Create();
+        void Delete();
+        void Apply(GLuint colorTexture, float exposure) const;
+
+        GLuint program = 0;
+        GLuint vertexArray = 0;
+    };
+
+    // Progressive bloom (Jimenez, Next Generation Post Processing in Call of Duty: Advanced Warfare):
+    // 13-tap downsamples from the half resolution level, then 3x3 tent upsamples added back up the chain
+    struct Bloom
+    {
+        void Create();
+        void Delete();
+        void Resize(int sourceWidth, int sourceHeight); // Levels are half the source resolution and below
+        GLuint Apply(GLuint sourceTexture);               // Timed Render, returns the half resolution bloom texture
+        void Render(GLuint sourceTexture);
+        void DeleteLevels();
+
+        int levelCount = 6;       // Chain length, at most BLOOM_MAX_LEVEL_COUNT
+        float filterRadius = 1.f; // Tent radius in texels of the level being upsampled
+
+        int sourceWidth = 0;
+        int sourceHeight = 0;
+        int allocatedLevelCount = 0;
+        int widths[BLOOM_MAX_LEVEL_COUNT] = {};
+        int heights[BLOOM_MAX_LEVEL_COUNT] = {};
+        GLuint textures[BLOOM_MAX_LEVEL_COUNT] = {};
+        GLuint framebuffers[BLOOM_MAX_LEVEL_COUNT] = {};
+
+        GLuint downsampleProgram = 0;
+        GLuint upsampleProgram = 0;
+        GLuint vertexArray = 0;
+        gl::GpuTimer timer;
+    };
+
+    // Average scene luminance adapted over time, kept on the GPU (no readback):
+    // log luminance at 256x256 reduced to 1x1 by the mip chain (geometric mean), then blended into a 1x1 target
+    struct AutoExposure
+    {
+        void Create();
+        void Delete();
+        GLuint Apply(GLuint colorTexture, float deltaTime); // Returns the 1x1 R32F adapted luminance texture
+
+        float adaptationSpeed = 1.5f; // Per second, the gap to the measured luminance closes by 1 - exp(-speed * dt)
+        float minLuminance = 0.02f;
+        float maxLuminance = 16.f;
+        bool reset = true;            // Next measure is taken as is
+
+        GLuint luminanceTexture = 0;
+        GLuint luminanceFramebuffer = 0;
+        int luminanceLevelCount = 0;
+        GLuint adaptedTextures[2] = {}; // Previous and current, swapped each frame
+        GLuint adaptedFramebuffers[2] = {};
+        int current = 0;
+
+        GLuint luminanceProgram = 0;
+        GLuint adaptationProgram = 0;
+        GLuint vertexArray = 0;
+        gl::GpuTimer timer;
+    };
+
+    // GPU time of one bloom chain on a sourceWidth x sourceHeight source with the programs and settings of bloom
+    // Stalls until the result is available
+    float MeasureBloom(const Bloom& bloom, int sourceWidth, int sourceHeight, int iterationCount);
+}
@@ -0,0 +1,260 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "calc.hpp"
+#include "jobs.hpp"
+#include "probe.hpp"
+
+#define PROBE_MAGIC     0x52504249 // "IBPR"
+#define PROBE_ALIGNMENT 256        // Payload alignment (same as the asset archive)
+
+struct ProbeHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t alignment;
+    uint32_t format;             // dds::Format of the prefiltered cubemap
+    uint32_t prefilterSize;
+    uint32_t prefilterLevelCount;
+    uint32_t prefilterSampleCount;
+    uint32_t chunkCount;         // 6 * prefilterLevelCount
+    float irradiance[SH_COEFFICIENT_COUNT][3];
+};
+
+// Level by level in each face (GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order)
+struct ProbeChunk
+{
+    uint64_t offset; // From the start of the file
+    uint64_t size;
+};
+
+static size_t AlignOffset(size_t offset)
+{
+    return (offset + PROBE_ALIGNMENT - 1) & ~(size_t)(PROBE_ALIGNMENT - 1);
+}
+
+std::string probe::GetProbeFilename(const char* environment)
+{
+    bool folder = env::GetSourceType(environment) == env::SourceType::FOLDER;
+    return std::string(environment) + (folder ? "environment.probe" : ".probe");
+}
+
+static bool Save(const char* filename, const ProbeHeader& header, const dds::Image& image)
+{
+    std::vector<ProbeChunk> chunks;
+    size_t offset = AlignOffset(sizeof(ProbeHeader) + header.chunkCount * sizeof(ProbeChunk));
+    for (int face = 0; face < 6; ++face)
+    {
+        for (int level = 0; level < image.levelCount; ++level)
+        {
+            size_t size = image.levels[face][level].size;
+            chunks.push_back({ offset, size });
+            offset = AlignOffset(offset + size);
+        }
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Cannot write probe %s\n", filename);
+        return false;
+    }
+
+    static const unsigned char padding[PROBE_ALIGNMENT] = {};
+    size_t written = fwrite(&header, 1, sizeof(header), file);
+    written += fwrite(chunks.data(), 1, chunks.size() * sizeof(ProbeChunk), file);
+
+    int chunk = 0;
+    for (int face = 0; face < 6; ++face)
+    {
+        for (int level = 0; level < image.levelCount; ++level)
+        {
+            if (chunks[chunk].offset - written < PROBE_ALIGNMENT)
+                written += fwrite(padding, 1, (size_t)chunks[chunk].offset - written, file);
+            const dds::Level& faceLevel = image.levels[face][level];
+            written += fwrite(faceLevel.data, 1, faceLevel.size, file);
+            chunk++;
+        }
+    }
+    fclose(file);
+
+    if (written != chunks.back().offset + chunks.back().size)
+    {
+        fprintf(stderr, "Cannot write probe %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+bool probe::Bake(const char* environment, const BakeSettings& settings, const env::Cubemap* cubemap, const dds::Image* prefilteredMap)
+{
+    if (settings.format != dds::Format::RGBA16F && settings.format != dds::Format::BC6H)
+    {
+        fprintf(stderr, "Unsupported probe format %s\n", dds::FormatName(settings.format));
+        return false;
+    }
+
+    env::Cubemap loaded;
+    if (cubemap == nullptr)
+    {
+        if (!env::LoadCubemap(&loaded, environment))
+            return false;
+        cubemap = &loaded;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    const float* faces[6];
+    for (int i = 0; i < 6; ++i)
+        faces[i] = cubemap->faces[i].data();
+    sh::SH9 irradiance = sh::ConvolveLambert(sh::ProjectCubemap(faces, cubemap->size));
+
+    dds::Image prefiltered;
+    if (prefilteredMap)
+        dds::Convert(*prefilteredMap, settings.format, &prefiltered);
+    else if (!env::PrefilterGGX(*cubemap, settings.prefilter, &prefiltered))
+        return false;
+
+    // The prefiltered map is RGBA16F already
+    if (settings.format != prefiltered.format)
+    {
+        dds::Image converted;
+        dds::Convert(prefiltered, settings.format, &converted);
+        dds::Free(&prefiltered);
+        prefiltered = converted;
+    }
+
+    ProbeHeader header = {};
+    header.magic                 = PROBE_MAGIC;
+    header.version               = PROBE_VERSION;
+    header.alignment             = PROBE_ALIGNMENT;
+    header.format                = (uint32_t)settings.format;
+    header.prefilterSize         = (uint32_t)prefiltered.width;
+    header.prefilterLevelCount   = (uint32_t)prefiltered.levelCount;
+    header.prefilterSampleCount  = (uint32_t)settings.prefilter.sampleCount;
+    header.chunkCount            = (uint32_t)(6 * prefiltered.levelCount);
+    memcpy(header.irradiance, irradiance.coefs, sizeof(header.irradiance));
+
+    std::string filename = GetProbeFilename(environment);
+    bool success = Save(filename.c_str(), header, prefiltered);
+    dds::Free(&prefiltered);
+
+    float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (success)
+        printf("Probe baked: %s (%s, prefiltered 6x%dx%d, %.1f ms on %d threads)\n", filename.c_str(),
+            dds::FormatName(settings.format), header.prefilterSize, header.prefilterSize, milliseconds, jobs::ThreadCount());
+    return success;
+}
+
+// Levels of one cubemap, pointing inside the file
+// The chunk table follows the header without 8 bytes alignment, chunks are copied out before being read
+static bool MapCubemap(dds::Image* image, dds::Format format, int size, int levelCount, const unsigned char* chunkTable,
+    const unsigned char* data, size_t dataSize)
+{
+    *image = dds::Image();
+    image->format     = format;
+    image->width      = size;
+    image->height     = size;
+    image->faceCount  = 6;
+    image->levelCount = levelCount;
+    for (int face = 0; face < 6; ++face)
+    {
+        for (int level = 0; level < levelCount; ++level)
+        {
+            ProbeChunk chunk;
+            memcpy(&chunk, chunkTable + (size_t)(face * levelCount + level) * sizeof(ProbeChunk), sizeof(chunk));
+            dds::Level& faceLevel = image->levels[face][level];
+            faceLevel.width  = calc::Max(size >> level, 1);
+            faceLevel.height = faceLevel.width;
+            faceLevel.size   = (size_t)chunk.size;
+            faceLevel.data   = (void*)(data + chunk.offset);
+            if (chunk.offset > dataSize || chunk.size > dataSize - chunk.offset || chunk.size != dds::LevelSize(format, faceLevel.width, faceLevel.height))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool probe::Load(Probe* probe, const char* filename)
+{
+    *probe = Probe();
+
+    // Packed probes are read in place, loose ones mapped
+    const void* archiveData;
+    size_t archiveSize;
+    const unsigned char* data;
+    size_t size;
+    if (archive::Find(filename, &archiveData, &archiveSize))
+    {
+        data = (const unsigned char*)archiveData;
+        size = archiveSize;
+    }
+    else
+    {
+        if (!archive::MapFile(filename, &probe->file))
+        {
+            archive::UnmapFile(&probe->file);
+            return false;
+        }
+        data = probe->file.data;
+        size = probe->file.size;
+    }
+
+    ProbeHeader header = {};
+    if (size >= sizeof(header))
+        memcpy(&header, data, sizeof(header));
+
+    bool valid = header.magic == PROBE_MAGIC && header.version == PROBE_VERSION && header.alignment == PROBE_ALIGNMENT
+        && (header.format == (uint32_t)dds::Format::RGBA16F || header.format == (uint32_t)dds::Format::BC6H)
+        && header.prefilterLevelCount > 0 && header.prefilterLevelCount <= DDS_MAX_LEVELS
+        && header.chunkCount == 6 * header.prefilterLevelCount
+        && size >= sizeof(header) + header.chunkCount * sizeof(ProbeChunk);
+
+    if (valid)
+    {
+        dds::Format format = (dds::Format)header.format;
+        valid = MapCubemap(&probe->prefiltered, format, header.prefilterSize, header.prefilterLevelCount, data + sizeof(header), data, size);
+    }
+
+    if (!valid)
+    {
+        fprintf(stderr, "Invalid probe %s\n", filename);
+        Close(probe);
+        return false;
+    }
+
+    memcpy(probe->irradiance.coefs, header.irradiance, sizeof(header.irradiance));
+    probe->prefilterSampleCount = header.prefilterSampleCount;
+    return true;
+}
+
+void probe::Close(Probe* probe)
+{
+    archive::UnmapFile(&probe->file);
+    *probe = Probe();
+}
+
+bool probe::IsValid(const Probe& probe, const BakeSettings& settings)
+{
+    return probe.prefiltered.format == settings.format
+        && probe.prefiltered.width == settings.prefilter.size
+        && probe.prefiltered.levelCount == env::GetPrefilterLevelCount(settings.prefilter)
+        && probe.prefilterSampleCount == settings.prefilter.sampleCount;
+}
+
+bool probe::LoadOrBake(Probe* probe, const char* environment, const BakeSettings& settings)
+{
+    std::string filename = GetProbeFilename(environment);
+    if (Load(probe, filename.c_str()))
+    {
+        if (IsValid(*probe, settings))
+        {
+            printf("Probe loaded: %s\n", filename.c_str());
+            return true;
+        }
+        Close(probe);
+    }
+
+    return Bake(environment, settings) && Load(probe, filename.c_str());
+}
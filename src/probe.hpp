@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+
+#include "asset_archive.hpp"
+#include "dds.hpp"
+#include "environment.hpp"
+#include "sh.hpp"
+
+#define PROBE_VERSION 2
+
+// Environment probe file: all the image based lighting data of one environment, read with a single mapping
+// Header (settings, irradiance SH), chunk table, then aligned payloads: the GGX prefiltered cubemap,
+// face by face and level by level, ready to be given to GL as is (see DemoIBL)
+namespace probe
+{
+    struct BakeSettings
+    {
+        dds::Format format = dds::Format::RGBA16F; // Of the prefiltered cubemap, RGBA16F or BC6H
+        env::PrefilterSettings prefilter;
+    };
+
+    // Levels point inside the mapped file (or the asset archive) until Close
+    struct Probe
+    {
+        sh::SH9 irradiance; // sh::ConvolveLambert applied
+        dds::Image prefiltered;
+        int prefilterSampleCount = 0;
+        archive::MappedFile file;
+    };
+
+    // Next to the environment ("environment.probe" in folders)
+    std::string GetProbeFilename(const char* environment);
+
+    // Projects, prefilters (env::PrefilterGGX unless given, from the GPU prefilter of DemoIBL for instance) and converts,
+    // from the cubemap when already loaded
+    bool Bake(const char* environment, const BakeSettings& settings = {}, const env::Cubemap* cubemap = nullptr,
+        const dds::Image* prefiltered = nullptr);
+
+    bool Load(Probe* probe, const char* filename);
+    void Close(Probe* probe);
+    bool IsValid(const Probe& probe, const BakeSettings& settings); // Baked with these settings
+
+    // Probe file first, baked and saved otherwise
+    bool LoadOrBake(Probe* probe, const char* environment, const BakeSettings& settings = {});
+}
@@ -0,0 +1,247 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SH_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "asset_archive.hpp"
+#include "calc.hpp"
+#include "environment.hpp"
+#include "jobs.hpp"
+#include "sh.hpp"
+
+#define SH_CACHE_VERSION 1
+
+// Basis constants
+static const float K0 = 0.282095f; // 1 / (2 sqrt(pi))
+static const float K1 = 0.488603f; // sqrt(3 / (4 pi))
+static const float K2 = 1.092548f; // sqrt(15 / (4 pi))
+static const float K6 = 0.315392f; // sqrt(5 / (16 pi))
+static const float K8 = 0.546274f; // sqrt(15 / (16 pi))
+
+void sh::EvaluateBasis(float3 d, float basis[SH_COEFFICIENT_COUNT])
+{
+    basis[0] = K0;
+    basis[1] = K1 * d.y;
+    basis[2] = K1 * d.z;
+    basis[3] = K1 * d.x;
+    basis[4] = K2 * d.x * d.y;
+    basis[5] = K2 * d.y * d.z;
+    basis[6] = K6 * (3.f * d.z * d.z - 1.f);
+    basis[7] = K2 * d.x * d.z;
+    basis[8] = K8 * (d.x * d.x - d.y * d.y);
+}
+
+struct RowSums
+{
+    double coefs[SH_COEFFICIENT_COUNT][3];
+    double weight;
+};
+
+// Texel solid angle is proportional to 1 / (1 + s^2 + t^2)^(3/2), normalized once all faces are summed
+static void ProjectRow(const float* row, int size, float t, const env::FaceAxes& axes, RowSums* sums)
+{
+    float texelSize = 2.f / size;
+    float coefs[SH_COEFFICIENT_COUNT][3] = {};
+    float weightSum = 0.f;
+
+    int x = 0;
+#ifdef SH_USE_SSE2
+    {
+        __m128 accR[SH_COEFFICIENT_COUNT], accG[SH_COEFFICIENT_COUNT], accB[SH_COEFFICIENT_COUNT];
+        for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+            accR[k] = accG[k] = accB[k] = _mm_setzero_ps();
+        __m128 accW = _mm_setzero_ps();
+
+        const __m128 one  = _mm_set1_ps(1.f);
+        const __m128 tt   = _mm_set1_ps(t);
+        const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 baseX = _mm_add_ps(_mm_mul_ps(tt, _mm_set1_ps(axes.t.x)), _mm_set1_ps(axes.n.x));
+        const __m128 baseY = _mm_add_ps(_mm_mul_ps(tt, _mm_set1_ps(axes.t.y)), _mm_set1_ps(axes.n.y));
+        const __m128 baseZ = _mm_add_ps(_mm_mul_ps(tt, _mm_set1_ps(axes.t.z)), _mm_set1_ps(axes.n.z));
+        for (; x + 4 <= size; x += 4)
+        {
+            // 4 texels: directions and weights
+            __m128 s = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), lane), _mm_set1_ps(texelSize)), one);
+            __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(one, _mm_add_ps(_mm_mul_ps(s, s), _mm_mul_ps(tt, tt)))));
+            __m128 dx = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(s, _mm_set1_ps(axes.s.x)), baseX), invLength);
+            __m128 dy = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(s, _mm_set1_ps(axes.s.y)), baseY), invLength);
+            __m128 dz = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(s, _mm_set1_ps(axes.s.z)), baseZ), invLength);
+            __m128 weight = _mm_mul_ps(invLength, _mm_mul_ps(invLength, invLength));
+
+            __m128 basis[SH_COEFFICIENT_COUNT];
+            basis[0] = _mm_set1_ps(K0);
+            basis[1] = _mm_mul_ps(_mm_set1_ps(K1), dy);
+            basis[2] = _mm_mul_ps(_mm_set1_ps(K1), dz);
+            basis[3] = _mm_mul_ps(_mm_set1_ps(K1), dx);
+            basis[4] = _mm_mul_ps(_mm_set1_ps(K2), _mm_mul_ps(dx, dy));
+            basis[5] = _mm_mul_ps(_mm_set1_ps(K2), _mm_mul_ps(dy, dz));
+            basis[6] = _mm_mul_ps(_mm_set1_ps(K6), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.f), _mm_mul_ps(dz, dz)), one));
+            basis[7] = _mm_mul_ps(_mm_set1_ps(K2), _mm_mul_ps(dx, dz));
+            basis[8] = _mm_mul_ps(_mm_set1_ps(K8), _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+
+            // RGBA texels to R, G, B vectors
+            __m128 r = _mm_loadu_ps(row + (x + 0) * 4);
+            __m128 g = _mm_loadu_ps(row + (x + 1) * 4);
+            __m128 b = _mm_loadu_ps(row + (x + 2) * 4);
+            __m128 a = _mm_loadu_ps(row + (x + 3) * 4);
+            _MM_TRANSPOSE4_PS(r, g, b, a);
+
+            for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+            {
+                __m128 weightedBasis = _mm_mul_ps(basis[k], weight);
+                accR[k] = _mm_add_ps(accR[k], _mm_mul_ps(weightedBasis, r));
+                accG[k] = _mm_add_ps(accG[k], _mm_mul_ps(weightedBasis, g));
+                accB[k] = _mm_add_ps(accB[k], _mm_mul_ps(weightedBasis, b));
+            }
+            accW = _mm_add_ps(accW, weight);
+        }
+
+        float lanes[4];
+        for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+        {
+            _mm_storeu_ps(lanes, accR[k]); coefs[k][0] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+            _mm_storeu_ps(lanes, accG[k]); coefs[k][1] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+            _mm_storeu_ps(lanes, accB[k]); coefs[k][2] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        }
+        _mm_storeu_ps(lanes, accW);
+        weightSum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#endif
+    for (; x < size; ++x)
+    {
+        float s = (x + 0.5f) * texelSize - 1.f;
+        float invLength = 1.f / sqrtf(1.f + s * s + t * t);
+        float3 direction = {
+            (s * axes.s.x + t * axes.t.x + axes.n.x) * invLength,
+            (s * axes.s.y + t * axes.t.y + axes.n.y) * invLength,
+            (s * axes.s.z + t * axes.t.z + axes.n.z) * invLength };
+        float weight = invLength * invLength * invLength;
+
+        float basis[SH_COEFFICIENT_COUNT];
+        sh::EvaluateBasis(direction, basis);
+        for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+            for (int c = 0; c < 3; ++c)
+                coefs[k][c] += basis[k] * weight * row[x * 4 + c];
+        weightSum += weight;
+    }
+
+    for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+        for (int c = 0; c < 3; ++c)
+            sums->coefs[k][c] = coefs[k][c];
+    sums->weight = weightSum;
+}
+
+sh::SH9 sh::ProjectCubemap(const float* const faces[6], int size)
+{
+    // One job per row, rows are summed in a fixed order
+    std::vector<RowSums> rows((size_t)6 * size);
+    jobs::ParallelFor(6 * size, [&](int index)
+    {
+        int face = index / size;
+        int y = index % size;
+        float t = (y + 0.5f) * (2.f / size) - 1.f;
+        ProjectRow(faces[face] + (size_t)y * size * 4, size, t, env::faceAxes[face], &rows[index]);
+    });
+
+    double coefs[SH_COEFFICIENT_COUNT][3] = {};
+    double weightSum = 0.0;
+    for (const RowSums& row : rows)
+    {
+        for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+            for (int c = 0; c < 3; ++c)
+                coefs[k][c] += row.coefs[k][c];
+        weightSum += row.weight;
+    }
+
+    // Weights sum to the area of the sphere
+    SH9 sh;
+    double scale = 4.0 * 3.14159265358979 / weightSum;
+    for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+        for (int c = 0; c < 3; ++c)
+            sh.coefs[k][c] = (float)(coefs[k][c] * scale);
+    return sh;
+}
+
+sh::SH9 sh::ConvolveLambert(const SH9& radiance)
+{
+    // Clamped cosine lobe bands (pi, 2pi/3, pi/4) divided by pi
+    const float bands[SH_COEFFICIENT_COUNT] = { 1.f, 2.f / 3.f, 2.f / 3.f, 2.f / 3.f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+
+    SH9 irradiance;
+    for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+        for (int c = 0; c < 3; ++c)
+            irradiance.coefs[k][c] = radiance.coefs[k][c] * bands[k];
+    return irradiance;
+}
+
+float3 sh::Evaluate(const SH9& sh, float3 direction)
+{
+    float basis[SH_COEFFICIENT_COUNT];
+    EvaluateBasis(direction, basis);
+
+    float3 value = { 0.f, 0.f, 0.f };
+    for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+        value = value + float3(sh.coefs[k][0], sh.coefs[k][1], sh.coefs[k][2]) * basis[k];
+    return value;
+}
+
+void sh::GetShaderCoefficients(const SH9& sh, float coefs[SH_COEFFICIENT_COUNT][3])
+{
+    const float constants[SH_COEFFICIENT_COUNT] = { K0, K1, K1, K1, K2, K2, K6, K2, K8 };
+    for (int k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+        for (int c = 0; c < 3; ++c)
+            coefs[k][c] = sh.coefs[k][c] * constants[k];
+}
+
+bool sh::Save(const SH9& sh, const char* filename)
+{
+    FILE* file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Cannot write SH cache %s\n", filename);
+        return false;
+    }
+
+    uint32_t version = SH_CACHE_VERSION;
+    fwrite(&version, sizeof(version), 1, file);
+    fwrite(sh.coefs, sizeof(sh.coefs), 1, file);
+    fclose(file);
+    return true;
+}
+
+bool sh::Load(SH9* sh, const char* filename)
+{
+    unsigned char data[sizeof(uint32_t) + sizeof(sh->coefs)];
+
+    const void* archiveData;
+    size_t archiveSize;
+    if (archive::Find(filename, &archiveData, &archiveSize))
+    {
+        if (archiveSize != sizeof(data))
+            return false;
+        memcpy(data, archiveData, sizeof(data));
+    }
+    else
+    {
+        FILE* file = fopen(filename, "rb");
+        if (file == nullptr)
+            return false;
+        size_t readSize = fread(data, 1, sizeof(data), file);
+        fclose(file);
+        if (readSize != sizeof(data))
+            return false;
+    }
+
+    uint32_t version;
+    memcpy(&version, data, sizeof(version));
+    if (version != SH_CACHE_VERSION)
+        return false;
+
+    memcpy(sh->coefs, data + sizeof(version), sizeof(sh->coefs));
+    return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "types.hpp"
+
+#define SH_COEFFICIENT_COUNT 9
+
+// Order 3 real spherical harmonics (bands 0 to 2) of RGB functions on the sphere
+namespace sh
+{
+    struct SH9
+    {
+        float coefs[SH_COEFFICIENT_COUNT][3] = {};
+    };
+
+    // Basis functions for a normalized direction
+    void EvaluateBasis(float3 direction, float basis[SH_COEFFICIENT_COUNT]);
+
+    // Solid angle weighted projection of a cubemap: faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order,
+    // size x size RGBA32F texels with rows in upload order (deterministic for any thread count)
+    SH9 ProjectCubemap(const float* const faces[6], int size);
+
+    // Convolution with the clamped cosine lobe, divided by pi:
+    // evaluating the result in direction n gives the radiance leaving a white Lambertian surface of normal n
+    SH9 ConvolveLambert(const SH9& radiance);
+
+    float3 Evaluate(const SH9& sh, float3 direction);
+
+    // Coefficients premultiplied by the basis constants, the shader only multiplies them by
+    // 1, y, z, x, xy, yz, 3z^2 - 1, xz, x^2 - y^2
+    void GetShaderCoefficients(const SH9& sh, float coefs[SH_COEFFICIENT_COUNT][3]);
+
+    // Small binary cache (version + coefficients), read from the asset archive when packed there
+    bool Save(const SH9& sh, const char* filename);
+    bool Load(SH9* sh, const char* filename);
+}
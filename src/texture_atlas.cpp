@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+#include <stb_image.h>
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#define STBRP_STATIC // imgui has its own static copy
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "../third_party/src/imstb_rectpack.h"
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#include "asset_archive.hpp"
+#include "calc.hpp"
+#include "jobs.hpp"
+#include "texture_atlas.hpp"
+
+// Cells are aligned on one BC block of the coarsest level: no block mixes two images at any level
+static int GetCellUnit(const atlas::Settings& settings)
+{
+    return 4 << (settings.levelCount - 1);
+}
+
+// Gutter in base level texels, images start on a texel of every level
+static int GetBaseGutter(const atlas::Settings& settings)
+{
+    return settings.gutter << (settings.levelCount - 1);
+}
+
+static int AlignUp(int value, int unit)
+{
+    return (value + unit - 1) / unit * unit;
+}
+
+// Copy the image and extend its edges in the gutter around it (same as GL_CLAMP_TO_EDGE)
+static void CopyToCell(std::vector<unsigned char>& page, int pageSize, const atlas::Image& image, int cellX, int cellY, int cellWidth, int cellHeight, int gutter)
+{
+    for (int y = 0; y < cellHeight; ++y)
+    {
+        int srcY = calc::Clamp(y - gutter, 0, image.height - 1);
+        unsigned char* dst = page.data() + ((size_t)(cellY + y) * pageSize + cellX) * 4;
+        for (int x = 0; x < cellWidth; ++x, dst += 4)
+        {
+            int srcX = calc::Clamp(x - gutter, 0, image.width - 1);
+            const unsigned char* src = image.pixels + ((size_t)srcY * image.width + srcX) * image.channels;
+            switch (image.channels)
+            {
+            case 1:  dst[0] = dst[1] = dst[2] = src[0]; dst[3] = 255; break;
+            case 2:  dst[0] = dst[1] = dst[2] = src[0]; dst[3] = src[1]; break; // Grey + alpha
+            case 3:  dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = 255; break;
+            default: memcpy(dst, src, 4); break;
+            }
+        }
+    }
+}
+
+static void SetUVRect(atlas::Region* region, int pageSize)
+{
+    region->uvRect = float4(
+        (float)region->x / pageSize, (float)region->y / pageSize,
+        (float)region->width / pageSize, (float)region->height / pageSize);
+}
+
+bool atlas::Build(Atlas* atlas, const Image* images, int imageCount, const Settings& settings)
+{
+    *atlas = {};
+    atlas->settings = settings;
+    atlas->regions.resize(imageCount);
+
+    // Pack cells in units, positions are then aligned for free
+    int unit = GetCellUnit(settings);
+    int gutter = GetBaseGutter(settings);
+    int pageUnits = settings.pageSize / unit;
+
+    std::vector<stbrp_rect> pending(imageCount);
+    for (int i = 0; i < imageCount; ++i)
+    {
+        pending[i] = {};
+        pending[i].id = i;
+        pending[i].w  = (stbrp_coord)(AlignUp(images[i].width + 2 * gutter, unit) / unit);
+        pending[i].h  = (stbrp_coord)(AlignUp(images[i].height + 2 * gutter, unit) / unit);
+        if (pending[i].w > pageUnits || pending[i].h > pageUnits)
+        {
+            fprintf(stderr, "Atlas image '%s' (%dx%d) does not fit in a %d texels page\n",
+                images[i].name.c_str(), images[i].width, images[i].height, settings.pageSize);
+            return false;
+        }
+    }
+
+    // Fill pages one after the other with what is left
+    std::vector<stbrp_node> nodes(pageUnits);
+    while (!pending.empty())
+    {
+        // Unused texels are opaque black (opaque images can then use BC1)
+        int page = atlas->pageCount++;
+        atlas->pages.emplace_back((size_t)settings.pageSize * settings.pageSize * 4, 0);
+        for (size_t i = 3; i < atlas->pages[page].size(); i += 4)
+            atlas->pages[page][i] = 255;
+
+        stbrp_context context;
+        stbrp_init_target(&context, pageUnits, pageUnits, nodes.data(), (int)nodes.size());
+        stbrp_pack_rects(&context, pending.data(), (int)pending.size());
+
+        std::vector<stbrp_rect> left;
+        for (const stbrp_rect& rect : pending)
+        {
+            if (!rect.was_packed)
+            {
+                left.push_back(rect);
+                continue;
+            }
+
+            const Image& image = images[rect.id];
+            Region& region = atlas->regions[rect.id];
+            region.name   = image.name;
+            region.page   = page;
+            region.x      = rect.x * unit + gutter;
+            region.y      = rect.y * unit + gutter;
+            region.width  = image.width;
+            region.height = image.height;
+            SetUVRect(&region, settings.pageSize);
+
+            CopyToCell(atlas->pages[page], settings.pageSize, image, rect.x * unit, rect.y * unit, rect.w * unit, rect.h * unit, gutter);
+        }
+        pending.swap(left);
+    }
+
+    printf("Atlas built: %d images in %d page(s) of %dx%d (%d levels, %d texels gutter)\n",
+        imageCount, atlas->pageCount, settings.pageSize, settings.pageSize, settings.levelCount, gutter);
+    return true;
+}
+
+// Atlases built from a folder are named after it
+static std::string GetFolderName(const char* folder)
+{
+    std::string name = folder;
+    while (!name.empty() && (name.back() == '/' || name.back() == '\\'))
+        name.pop_back();
+    return name;
+}
+
+bool atlas::BuildFromFolder(Atlas* atlas, const char* folder, const Settings& settings)
+{
+    std::vector<std::string> files;
+    std::error_code error;
+    for (const auto& file : std::filesystem::directory_iterator(folder, error))
+    {
+        std::string extension = file.path().extension().generic_string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+        if (file.is_regular_file() && (extension == ".png" || extension == ".jpg" || extension == ".tga"))
+            files.push_back(file.path().generic_string());
+    }
+    if (error)
+    {
+        fprintf(stderr, "Cannot read atlas folder %s: %s\n", folder, error.message().c_str());
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+
+    // Decode concurrently
+    std::vector<Image> images(files.size());
+    jobs::ParallelFor((int)files.size(), [&](int i)
+    {
+        Image& image = images[i];
+        image.name = std::filesystem::path(files[i]).filename().generic_string();
+        image.pixels = stbi_load(files[i].c_str(), &image.width, &image.height, &image.channels, 0);
+    });
+
+    bool success = !images.empty();
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        if (images[i].pixels == nullptr)
+        {
+            fprintf(stderr, "Failed to load image '%s'\n", files[i].c_str());
+            success = false;
+        }
+    }
+
+    if (success)
+    {
+        success = Build(atlas, images.data(), (int)images.size(), settings);
+        atlas->name = GetFolderName(folder);
+    }
+
+    for (Image& image : images)
+        stbi_image_free((void*)image.pixels);
+    return success;
+}
+
+bool atlas::Load(Atlas* atlas, const char* folder, const Settings& settings)
+{
+    std::string name = GetFolderName(folder);
+    if (LoadFromCache(atlas, name.c_str()))
+    {
+        printf("Atlas loaded from cache: %s (%d images, %d page(s))\n", name.c_str(), (int)atlas->regions.size(), atlas->pageCount);
+        return true;
+    }
+
+    if (!BuildFromFolder(atlas, folder, settings) || !SaveToCache(*atlas))
+        return false;
+    atlas->pages.clear();
+    return true;
+}
+
+const atlas::Region* atlas::Find(const Atlas& atlas, const char* name)
+{
+    for (const Region& region : atlas.regions)
+        if (region.name == name)
+            return &region;
+    return nullptr;
+}
+
+std::string atlas::GetPageName(const Atlas& atlas, int page)
+{
+    return atlas.name + ".page" + std::to_string(page);
+}
+
+bool atlas::BuildPageCacheEntry(TextureCacheEntry* entry, const Atlas& atlas, int page)
+{
+    if (page >= (int)atlas.pages.size() || atlas.pages[page].empty())
+        return false;
+
+    // Box filter: each texel of a level only covers texels of the same cell
+    std::string pageName = GetPageName(atlas, page);
+    int pageSize = atlas.settings.pageSize;
+    bool built = atlas.settings.linear
+        ? BuildUncompressedCacheEntry(entry, atlas.pages[page].data(), pageSize, pageSize, 4, pageName.c_str(), mip::Filter::BOX)
+        : BuildTextureCacheEntry(entry, atlas.pages[page].data(), pageSize, pageSize, 4, false, pageName.c_str(), mip::Filter::BOX);
+    if (!built)
+        return false;
+
+    // Coarser levels would mix neighbor cells
+    entry->levelCount = calc::Min(entry->levelCount, atlas.settings.levelCount);
+    return true;
+}
+
+bool atlas::LoadPageCacheEntry(TextureCacheEntry* entry, const Atlas& atlas, int page)
+{
+    std::string pageName = GetPageName(atlas, page);
+    bool inMemory = page < (int)atlas.pages.size() && !atlas.pages[page].empty();
+    if (!(inMemory ? BuildPageCacheEntry(entry, atlas, page) : LoadTextureFromCache(entry, pageName.c_str(), false)))
+    {
+        fprintf(stderr, "Cannot load atlas page %s\n", pageName.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string atlas::GetCacheFilename(const char* name)
+{
+    return std::string(name) + ".atlas.cache";
+}
+
+// Layout: version, settings (page size, level count, gutter, linear), page count, region count, then each region (page, x, y, width, height, name length, name)
+bool atlas::SaveToCache(const Atlas& atlas)
+{
+    std::string cachedFile = GetCacheFilename(atlas.name.c_str());
+    FILE* file = fopen(cachedFile.c_str(), "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Cannot write atlas cache %s\n", cachedFile.c_str());
+        return false;
+    }
+
+    uint32_t header[7] = { ATLAS_CACHE_VERSION, (uint32_t)atlas.settings.pageSize, (uint32_t)atlas.settings.levelCount,
+                           (uint32_t)atlas.settings.gutter, (uint32_t)atlas.settings.linear, (uint32_t)atlas.pageCount, (uint32_t)atlas.regions.size() };
+    fwrite(header, sizeof(header), 1, file);
+    for (const Region& region : atlas.regions)
+    {
+        uint32_t values[6] = { (uint32_t)region.page, (uint32_t)region.x, (uint32_t)region.y,
+                               (uint32_t)region.width, (uint32_t)region.height, (uint32_t)region.name.size() };
+        fwrite(values, sizeof(values), 1, file);
+        fwrite(region.name.data(), 1, region.name.size(), file);
+    }
+    fclose(file);
+
+    // Pages
+    bool success = true;
+    for (int page = 0; page < atlas.pageCount && success; ++page)
+    {
+        TextureCacheEntry entry;
+        success = BuildPageCacheEntry(&entry, atlas, page);
+        if (success)
+            SaveTextureToCache(entry, GetPageName(atlas, page).c_str(), false);
+        FreeTextureCacheEntry(&entry);
+    }
+    return success;
+}
+
+static bool ReadAtlasCache(atlas::Atlas* atlas, const unsigned char* data, size_t size)
+{
+    const unsigned char* end = data + size;
+
+    uint32_t header[7];
+    if (size < sizeof(header))
+        return false;
+    memcpy(header, data, sizeof(header));
+    data += sizeof(header);
+    if (header[0] != ATLAS_CACHE_VERSION)
+        return false;
+
+    atlas->settings.pageSize   = (int)header[1];
+    atlas->settings.levelCount = (int)header[2];
+    atlas->settings.gutter     = (int)header[3];
+    atlas->settings.linear     = header[4] != 0;
+    atlas->pageCount           = (int)header[5];
+    atlas->regions.resize(header[6]);
+
+    for (atlas::Region& region : atlas->regions)
+    {
+        uint32_t values[6];
+        if ((size_t)(end - data) < sizeof(values))
+            return false;
+        memcpy(values, data, sizeof(values));
+        data += sizeof(values);
+        if ((size_t)(end - data) < values[5] || (int)values[0] >= atlas->pageCount)
+            return false;
+
+        region.page   = (int)values[0];
+        region.x      = (int)values[1];
+        region.y      = (int)values[2];
+        region.width  = (int)values[3];
+        region.height = (int)values[4];
+        region.name.assign((const char*)data, values[5]);
+        data += values[5];
+        SetUVRect(&region, atlas->settings.pageSize);
+    }
+    return true;
+}
+
+bool atlas::LoadFromCache(Atlas* atlas, const char* name)
+{
+    *atlas = {};
+    atlas->name = name;
+    std::string cachedFile = GetCacheFilename(name);
+
+    const void* archiveData;
+    size_t archiveSize;
+    if (archive::Find(cachedFile.c_str(), &archiveData, &archiveSize))
+        return ReadAtlasCache(atlas, (const unsigned char*)archiveData, archiveSize);
+
+    FILE* file = fopen(cachedFile.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    std::vector<unsigned char> data;
+    unsigned char buffer[4096];
+    size_t readSize;
+    while ((readSize = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + readSize);
+    fclose(file);
+
+    if (!ReadAtlasCache(atlas, data.data(), data.size()))
+    {
+        fprintf(stderr, "Invalid atlas cache %s\n", cachedFile.c_str());
+        *atlas = {};
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "texture_cache.hpp"
+#include "types.hpp"
+
+#define ATLAS_CACHE_VERSION 2
+#define ATLAS_FOLDER "media/atlas/" // Each sub folder is an atlas (cooked by ibl-cook)
+
+// Texture atlas: small images packed in shared pages, so that draws using them share one texture bind
+// Images are placed in cells aligned on the BC blocks of the coarsest mip and surrounded by a gutter of their
+// edge texels, so that neither bilinear filtering, mips nor block compression bleed between images
+namespace atlas
+{
+    struct Settings
+    {
+        int pageSize   = 1024;
+        int levelCount = 4; // Mip levels of the pages
+        int gutter     = 1; // Texels of edge color around each image, at every level
+        bool linear    = false; // Data such as normals: pages are not sRGB and stay uncompressed (exact texels)
+    };
+
+    struct Image
+    {
+        std::string name;
+        int width    = 0;
+        int height   = 0;
+        int channels = 0;
+        const unsigned char* pixels = nullptr; // 8 bits, rows bottom to top (GL order)
+    };
+
+    struct Region
+    {
+        std::string name;
+        int page = 0;
+        int x = 0; // Texels in the page (image only, without the gutter)
+        int y = 0;
+        int width  = 0;
+        int height = 0;
+        float4 uvRect = {}; // xy: uv offset, zw: uv scale (uv in page = xy + uv * zw)
+    };
+
+    struct Atlas
+    {
+        std::string name; // Cache name (empty when built at runtime only)
+        Settings settings;
+        int pageCount = 0;
+        std::vector<std::vector<unsigned char>> pages; // RGBA8 texels of each page (empty when loaded from the cache)
+        std::vector<Region> regions; // One per image, in input order
+    };
+
+    // Pack the images (copied in the pages), false if an image does not fit in a page
+    bool Build(Atlas* atlas, const Image* images, int imageCount, const Settings& settings = {});
+
+    // Build from the images of a folder, sorted by name (the caller sets the stb_image vertical flip)
+    bool BuildFromFolder(Atlas* atlas, const char* folder, const Settings& settings = {});
+
+    // Cached atlas, or built from the folder and cached now (pages are then read back from their caches)
+    bool Load(Atlas* atlas, const char* folder, const Settings& settings = {});
+
+    const Region* Find(const Atlas& atlas, const char* name);
+
+    // Page texture (box filtered mips, limited to settings.levelCount, block compressed unless linear)
+    std::string GetPageName(const Atlas& atlas, int page);
+    bool BuildPageCacheEntry(TextureCacheEntry* entry, const Atlas& atlas, int page);
+    bool LoadPageCacheEntry(TextureCacheEntry* entry, const Atlas& atlas, int page); // Built when in memory, read from its cache otherwise
+
+    // Regions in <name>.atlas.cache, pages in texture caches (see GetPageName)
+    std::string GetCacheFilename(const char* name);
+    bool SaveToCache(const Atlas& atlas);
+    bool LoadFromCache(Atlas* atlas, const char* name);
+}
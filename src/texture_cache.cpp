@@ -0,0 +1,712 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+
+#include <stb_image.h>
+
+#include "asset_archive.hpp"
+#include "calc.hpp"
+#include "jobs.hpp"
+#include "gl_helpers.hpp"
+#include "lz.hpp"
+#include "mip_generator.hpp"
+#include "texture_compression.hpp"
+#include "texture_cache.hpp"
+
+// On disk header, written after the version number
+struct TextureCacheHeader
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t flags;
+    uint32_t internalFormat;
+    uint32_t format;
+    uint32_t type;
+    uint32_t mipFilter;
+    uint32_t levelCount;
+    uint32_t levelSizes[TEX_CACHE_MAX_LEVELS];
+    uint32_t payloadSize; // Size of the level data on disk (lz stream size with TEX_CACHE_FLAG_LZ)
+    uint32_t reserved[4]; // Level data starts 128 bytes after the beginning of the file
+};
+
+static std::string GetCacheFilename(const char* filename, bool linear)
+{
+    std::string cachedFile = filename;
+    cachedFile += linear ? ".texf" : ".tex";
+    cachedFile += ".cache";
+    return cachedFile;
+}
+
+// Naming convention of normal maps in media/ (Mat_Normal.jpg, xxx_2K_Normal.jpg)
+static bool IsNormalMapFile(const char* filename)
+{
+    const char* basename = filename;
+    for (const char* c = filename; *c; ++c)
+        if (*c == '/' || *c == '\\')
+            basename = c + 1;
+
+    std::string lower = basename;
+    for (char& c : lower)
+        c = (char)tolower((unsigned char)c);
+
+    return lower.find("normal") != std::string::npos;
+}
+
+static GLenum GetPixelFormat(int channels)
+{
+    switch (channels)
+    {
+    case 1:          return GL_RED;
+    case 2:          return GL_RG;
+    case 3:          return GL_RGB;
+    case 4: default: return GL_RGBA;
+    }
+}
+
+static int GetLevelCount(int width, int height)
+{
+    return calc::Min(mip::LevelCount(width, height), TEX_CACHE_MAX_LEVELS);
+}
+
+// Expand any 8 bits image to RGBA8 (layout expected by the block compressor)
+static std::vector<unsigned char> ExpandToRGBA(const unsigned char* pixels, int width, int height, int channels)
+{
+    size_t pixelCount = (size_t)width * height;
+    std::vector<unsigned char> rgba(pixelCount * 4);
+    for (size_t i = 0; i < pixelCount; ++i)
+    {
+        const unsigned char* src = pixels + i * channels;
+        unsigned char* dst = rgba.data() + i * 4;
+        switch (channels)
+        {
+        case 1:  dst[0] = dst[1] = dst[2] = src[0]; dst[3] = 255; break;
+        case 2:  dst[0] = src[0]; dst[1] = src[1]; dst[2] = 0; dst[3] = 255; break;
+        case 3:  dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = 255; break;
+        default: memcpy(dst, src, 4); break;
+        }
+    }
+    return rgba;
+}
+
+static bool IsGrayscale(const std::vector<unsigned char>& rgba)
+{
+    const int tolerance = 2; // Jpeg chroma noise
+    for (size_t i = 0; i < rgba.size(); i += 4)
+    {
+        if (abs(rgba[i + 0] - rgba[i + 1]) > tolerance || abs(rgba[i + 0] - rgba[i + 2]) > tolerance)
+            return false;
+    }
+    return true;
+}
+
+static bool HasAlpha(const std::vector<unsigned char>& rgba)
+{
+    for (size_t i = 3; i < rgba.size(); i += 4)
+        if (rgba[i] != 255)
+            return true;
+    return false;
+}
+
+bool GetBlockFormat(uint32_t internalFormat, bc::Format* format)
+{
+    switch (internalFormat)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:  *format = bc::Format::BC1; return true;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: *format = bc::Format::BC3; return true;
+    case GL_COMPRESSED_RED_RGTC1:          *format = bc::Format::BC4; return true;
+    case GL_COMPRESSED_RG_RGTC2:           *format = bc::Format::BC5; return true;
+    default: return false;
+    }
+}
+
+static GLenum GetCompressedInternalFormat(bc::Format format)
+{
+    switch (format)
+    {
+    case bc::Format::BC1:          return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case bc::Format::BC3:          return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case bc::Format::BC4:          return GL_COMPRESSED_RED_RGTC1;
+    case bc::Format::BC5: default: return GL_COMPRESSED_RG_RGTC2;
+    }
+}
+
+static bool BuildCompressedEntry(TextureCacheEntry* entry, const unsigned char* pixels, int width, int height, int channels, const char* filename, mip::Filter mipFilter)
+{
+    std::vector<unsigned char> rgba = ExpandToRGBA(pixels, width, height, channels);
+
+    // Choose block format
+    bc::Format blockFormat;
+    if (IsNormalMapFile(filename) && channels >= 3)
+    {
+        blockFormat = bc::Format::BC5;
+        entry->flags |= TEX_CACHE_FLAG_NORMAL_MAP;
+    }
+    else if (channels == 2)
+    {
+        blockFormat = bc::Format::BC5;
+    }
+    else if (channels == 4 && HasAlpha(rgba))
+    {
+        blockFormat = bc::Format::BC3; // Before the grayscale test, BC4 would drop the alpha
+    }
+    else if (channels == 1 || IsGrayscale(rgba))
+    {
+        blockFormat = bc::Format::BC4;
+        entry->flags |= TEX_CACHE_FLAG_GRAYSCALE;
+    }
+    else
+    {
+        blockFormat = bc::Format::BC1;
+    }
+
+    entry->flags |= TEX_CACHE_FLAG_COMPRESSED;
+    entry->internalFormat = GetCompressedInternalFormat(blockFormat);
+    entry->format = 0;
+    entry->type = 0;
+    entry->levelCount = GetLevelCount(width, height);
+
+    // Allocate the whole compressed mip chain at once
+    size_t totalSize = 0;
+    for (int level = 0; level < entry->levelCount; ++level)
+        totalSize += bc::CompressedSize(blockFormat, calc::Max(width >> level, 1), calc::Max(height >> level, 1));
+    entry->memory = malloc(totalSize);
+
+    // Color textures are filtered in linear space, normal maps are renormalized
+    uint32_t mipFlags = 0;
+    if (entry->flags & TEX_CACHE_FLAG_NORMAL_MAP)
+    {
+        mipFlags |= mip::FLAG_NORMAL_MAP;
+    }
+    else if (blockFormat == bc::Format::BC1 || blockFormat == bc::Format::BC3)
+    {
+        mipFlags |= mip::FLAG_SRGB;
+        entry->flags |= TEX_CACHE_FLAG_SRGB;
+    }
+    entry->mipFilter = mipFilter;
+
+    std::vector<float> levelPixels((size_t)width * height * 4);
+    std::vector<float> nextLevelPixels;
+    mip::DecodeRGBA8(rgba.data(), (size_t)width * height, mipFlags, levelPixels.data());
+
+    float mipSeconds = 0.f;
+    float compressSeconds = 0.f;
+    size_t offset = 0;
+    size_t pixelCount = 0;
+    for (int level = 0; level < entry->levelCount; ++level)
+    {
+        int levelWidth  = mip::LevelSize(width,  level);
+        int levelHeight = mip::LevelSize(height, level);
+        if (level > 0)
+        {
+            // Each level is filtered from the previous one in float
+            auto mipStart = std::chrono::steady_clock::now();
+            nextLevelPixels.resize((size_t)levelWidth * levelHeight * 4);
+            mip::Downsample(mipFilter, mipFlags, levelPixels.data(), mip::LevelSize(width, level - 1), mip::LevelSize(height, level - 1), nextLevelPixels.data(), levelWidth, levelHeight);
+            levelPixels.swap(nextLevelPixels);
+
+            rgba.resize((size_t)levelWidth * levelHeight * 4);
+            mip::EncodeRGBA8(levelPixels.data(), (size_t)levelWidth * levelHeight, mipFlags, rgba.data());
+            mipSeconds += std::chrono::duration<float>(std::chrono::steady_clock::now() - mipStart).count();
+        }
+
+        auto compressStart = std::chrono::steady_clock::now();
+        TextureLevel& dstLevel = entry->levels[level];
+        dstLevel.width  = levelWidth;
+        dstLevel.height = levelHeight;
+        dstLevel.size   = bc::CompressedSize(blockFormat, levelWidth, levelHeight);
+        dstLevel.data   = (unsigned char*)entry->memory + offset;
+        bc::Compress(blockFormat, rgba.data(), levelWidth, levelHeight, (unsigned char*)entry->memory + offset);
+        compressSeconds += std::chrono::duration<float>(std::chrono::steady_clock::now() - compressStart).count();
+
+        offset += dstLevel.size;
+        pixelCount += (size_t)levelWidth * levelHeight;
+    }
+
+    // Measure quality of the base level
+    std::vector<unsigned char> reference = ExpandToRGBA(pixels, width, height, channels);
+    std::vector<unsigned char> decoded(reference.size());
+    bc::Decompress(blockFormat, entry->levels[0].data, width, height, decoded.data());
+    float psnr = bc::ComputePSNR(blockFormat, reference.data(), decoded.data(), width, height);
+
+    printf("Texture compressed: %s (%s, %d levels, %s mips %.1f ms, compression %.1f ms, %.1f Mpixels/s, PSNR %.2f dB)\n",
+        filename, bc::FormatName(blockFormat), entry->levelCount, mip::FilterName(mipFilter), mipSeconds * 1000.f,
+        compressSeconds * 1000.f, pixelCount / (compressSeconds * 1000000.f), psnr);
+
+    return true;
+}
+
+// Float images are mipmapped in RGBA32F and stored uncompressed with their source channels
+static bool BuildFloatEntry(TextureCacheEntry* entry, const float* pixels, int width, int height, int channels, const char* filename, mip::Filter mipFilter)
+{
+    entry->internalFormat = GetPixelFormat(channels);
+    entry->format         = GetPixelFormat(channels);
+    entry->type           = GL_FLOAT;
+    entry->mipFilter      = mipFilter;
+    entry->levelCount     = GetLevelCount(width, height);
+
+    size_t totalSize = 0;
+    for (int level = 0; level < entry->levelCount; ++level)
+        totalSize += (size_t)mip::LevelSize(width, level) * mip::LevelSize(height, level) * channels * sizeof(float);
+    entry->memory = malloc(totalSize);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<float> levelPixels((size_t)width * height * 4);
+    std::vector<float> nextLevelPixels;
+    for (size_t i = 0; i < (size_t)width * height; ++i)
+    {
+        float* dst = levelPixels.data() + i * 4;
+        dst[0] = dst[1] = dst[2] = 0.f;
+        dst[3] = 1.f;
+        memcpy(dst, pixels + i * channels, channels * sizeof(float));
+    }
+
+    size_t offset = 0;
+    for (int level = 0; level < entry->levelCount; ++level)
+    {
+        int levelWidth  = mip::LevelSize(width,  level);
+        int levelHeight = mip::LevelSize(height, level);
+        if (level > 0)
+        {
+            nextLevelPixels.resize((size_t)levelWidth * levelHeight * 4);
+            mip::Downsample(mipFilter, 0, levelPixels.data(), mip::LevelSize(width, level - 1), mip::LevelSize(height, level - 1), nextLevelPixels.data(), levelWidth, levelHeight);
+            levelPixels.swap(nextLevelPixels);
+        }
+
+        TextureLevel& dstLevel = entry->levels[level];
+        dstLevel.width  = levelWidth;
+        dstLevel.height = levelHeight;
+        dstLevel.size   = (size_t)levelWidth * levelHeight * channels * sizeof(float);
+        dstLevel.data   = (unsigned char*)entry->memory + offset;
+
+        float* dst = (float*)((unsigned char*)entry->memory + offset);
+        for (size_t i = 0; i < (size_t)levelWidth * levelHeight; ++i)
+            memcpy(dst + i * channels, levelPixels.data() + i * 4, channels * sizeof(float));
+
+        offset += dstLevel.size;
+    }
+
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    printf("Texture mipmapped: %s (%d levels, %s mips %.1f ms)\n", filename, entry->levelCount, mip::FilterName(mipFilter), seconds * 1000.f);
+
+    return true;
+}
+
+bool BuildUncompressedCacheEntry(TextureCacheEntry* entry, const unsigned char* pixels, int width, int height, int channels, const char* filename, mip::Filter mipFilter)
+{
+    const GLenum internalFormats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+
+    *entry = {};
+    entry->width          = width;
+    entry->height         = height;
+    entry->channels       = channels;
+    entry->internalFormat = internalFormats[channels - 1];
+    entry->format         = GetPixelFormat(channels);
+    entry->type           = GL_UNSIGNED_BYTE;
+    entry->mipFilter      = mipFilter;
+    entry->levelCount     = GetLevelCount(width, height);
+
+    size_t totalSize = 0;
+    for (int level = 0; level < entry->levelCount; ++level)
+        totalSize += (size_t)mip::LevelSize(width, level) * mip::LevelSize(height, level) * channels;
+    entry->memory = malloc(totalSize);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<unsigned char> rgba = ExpandToRGBA(pixels, width, height, channels);
+    std::vector<float> levelPixels((size_t)width * height * 4);
+    std::vector<float> nextLevelPixels;
+    mip::DecodeRGBA8(rgba.data(), (size_t)width * height, 0, levelPixels.data());
+
+    size_t offset = 0;
+    for (int level = 0; level < entry->levelCount; ++level)
+    {
+        int levelWidth  = mip::LevelSize(width,  level);
+        int levelHeight = mip::LevelSize(height, level);
+        if (level > 0)
+        {
+            nextLevelPixels.resize((size_t)levelWidth * levelHeight * 4);
+            mip::Downsample(mipFilter, 0, levelPixels.data(), mip::LevelSize(width, level - 1), mip::LevelSize(height, level - 1), nextLevelPixels.data(), levelWidth, levelHeight);
+            levelPixels.swap(nextLevelPixels);
+
+            rgba.resize((size_t)levelWidth * levelHeight * 4);
+            mip::EncodeRGBA8(levelPixels.data(), (size_t)levelWidth * levelHeight, 0, rgba.data());
+        }
+
+        TextureLevel& dstLevel = entry->levels[level];
+        dstLevel.width  = levelWidth;
+        dstLevel.height = levelHeight;
+        dstLevel.size   = (size_t)levelWidth * levelHeight * channels;
+        dstLevel.data   = (unsigned char*)entry->memory + offset;
+
+        unsigned char* dst = (unsigned char*)entry->memory + offset;
+        for (size_t i = 0; i < (size_t)levelWidth * levelHeight; ++i)
+            memcpy(dst + i * channels, rgba.data() + i * 4, channels);
+
+        offset += dstLevel.size;
+    }
+
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    printf("Texture mipmapped: %s (%d channels 8 bits, %d levels, %s mips %.1f ms)\n", filename, channels, entry->levelCount, mip::FilterName(mipFilter), seconds * 1000.f);
+
+    return true;
+}
+
+bool BuildTextureCacheEntry(TextureCacheEntry* entry, const void* pixels, int width, int height, int channels, bool linear, const char* filename, mip::Filter mipFilter)
+{
+    *entry = {};
+    entry->width    = width;
+    entry->height   = height;
+    entry->channels = channels;
+
+    if (linear)
+        return BuildFloatEntry(entry, (const float*)pixels, width, height, channels, filename, mipFilter);
+    else
+        return BuildCompressedEntry(entry, (const unsigned char*)pixels, width, height, channels, filename, mipFilter);
+}
+
+// Occlusion, roughness, metallic in r, g, b (glTF layout): one fetch instead of three
+static const ChannelPackedTexture channelPackedTextures[] =
+{
+    { "media/Mat_ORM", { "media/Mat_AO.jpg", "media/Mat_Roughness.jpg", "media/Mat_Metallic.jpg" } },
+};
+
+const ChannelPackedTexture* FindChannelPackedTexture(const char* name)
+{
+    for (const ChannelPackedTexture& texture : channelPackedTextures)
+        if (strcmp(texture.name, name) == 0)
+            return &texture;
+    return nullptr;
+}
+
+int GetChannelPackedTextures(const ChannelPackedTexture** textures)
+{
+    *textures = channelPackedTextures;
+    return (int)(sizeof(channelPackedTextures) / sizeof(channelPackedTextures[0]));
+}
+
+bool BuildChannelPackedCacheEntry(TextureCacheEntry* entry, const ChannelPackedTexture& texture, mip::Filter mipFilter)
+{
+    struct Mask
+    {
+        unsigned char* pixels = nullptr;
+        int width    = 0;
+        int height   = 0;
+        int channels = 0;
+    };
+
+    // Decode the sources concurrently, packed archive first
+    Mask masks[3];
+    jobs::ParallelFor(3, [&](int channel)
+    {
+        Mask& mask = masks[channel];
+        const char* source = texture.sources[channel];
+        if (source == nullptr)
+            return;
+
+        mask.pixels = (unsigned char*)LoadImagePixels(source, false, &mask.width, &mask.height, &mask.channels);
+    });
+
+    // All sources must have the same size
+    bool success = true;
+    int width  = 0;
+    int height = 0;
+    for (int channel = 0; channel < 3; ++channel)
+    {
+        const Mask& mask = masks[channel];
+        if (texture.sources[channel] == nullptr)
+            continue;
+
+        if (mask.pixels == nullptr)
+        {
+            fprintf(stderr, "Failed to load image '%s'\n", texture.sources[channel]);
+            success = false;
+        }
+        else if (width == 0)
+        {
+            width  = mask.width;
+            height = mask.height;
+        }
+        else if (mask.width != width || mask.height != height)
+        {
+            fprintf(stderr, "Cannot pack '%s' in %s: %dx%d instead of %dx%d\n", texture.sources[channel], texture.name, mask.width, mask.height, width, height);
+            success = false;
+        }
+    }
+
+    if (success && width > 0)
+    {
+        size_t pixelCount = (size_t)width * height;
+        std::vector<unsigned char> rgb(pixelCount * 3, 255);
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            const Mask& mask = masks[channel];
+            if (mask.pixels == nullptr)
+                continue;
+            for (size_t i = 0; i < pixelCount; ++i)
+                rgb[i * 3 + channel] = mask.pixels[i * mask.channels];
+        }
+
+        printf("Channel packed texture: %s (%dx%d)\n", texture.name, width, height);
+        // BC1 endpoints and indices are shared by the three channels, an edge in one mask would bleed into the others
+        success = BuildUncompressedCacheEntry(entry, rgb.data(), width, height, 3, texture.name, mipFilter);
+        entry->flags |= TEX_CACHE_FLAG_PACKED;
+    }
+    else
+    {
+        success = false;
+    }
+
+    for (Mask& mask : masks)
+        stbi_image_free(mask.pixels);
+    return success;
+}
+
+void FreeTextureCacheEntry(TextureCacheEntry* entry)
+{
+    free(entry->memory);
+    *entry = {};
+}
+
+// Parse a cache file loaded in memory, levels point inside data
+// Compressed payloads are decompressed in entry->memory
+static bool ReadTextureCache(TextureCacheEntry* entry, const unsigned char* data, size_t size, const char* filename)
+{
+    size_t version = 0;
+    if (size >= sizeof(size_t))
+        memcpy(&version, data, sizeof(size_t));
+    if (version != TEX_CACHE_VERSION)
+    {
+        printf("Cached version mismatch for %s, reload...\n", filename);
+        return false;
+    }
+
+    TextureCacheHeader header = {};
+    if (size >= sizeof(size_t) + sizeof(TextureCacheHeader))
+        memcpy(&header, data + sizeof(size_t), sizeof(TextureCacheHeader));
+    if (header.levelCount == 0 || header.levelCount > TEX_CACHE_MAX_LEVELS)
+    {
+        fprintf(stderr, "Invalid texture cache for %s\n", filename);
+        return false;
+    }
+
+    size_t dataOffset = sizeof(size_t) + sizeof(TextureCacheHeader);
+    size_t dataSize = 0;
+    for (uint32_t level = 0; level < header.levelCount; ++level)
+        dataSize += header.levelSizes[level];
+
+    size_t payloadSize = (header.flags & TEX_CACHE_FLAG_LZ) ? header.payloadSize : dataSize;
+    if (dataOffset + payloadSize > size)
+    {
+        fprintf(stderr, "Truncated texture cache for %s\n", filename);
+        return false;
+    }
+
+    *entry = {};
+    const unsigned char* levelData = data + dataOffset;
+    if (header.flags & TEX_CACHE_FLAG_LZ)
+    {
+        entry->memory = malloc(dataSize > 0 ? dataSize : 1);
+        if (!lz::Decompress(data + dataOffset, payloadSize, entry->memory, dataSize))
+        {
+            fprintf(stderr, "Corrupted texture cache for %s\n", filename);
+            FreeTextureCacheEntry(entry);
+            return false;
+        }
+        levelData = (const unsigned char*)entry->memory;
+    }
+
+    entry->width          = (int)header.width;
+    entry->height         = (int)header.height;
+    entry->channels       = (int)header.channels;
+    entry->flags          = header.flags & ~TEX_CACHE_FLAG_LZ;
+    entry->internalFormat = header.internalFormat;
+    entry->format         = header.format;
+    entry->type           = header.type;
+    entry->mipFilter      = (mip::Filter)header.mipFilter;
+    entry->levelCount     = (int)header.levelCount;
+
+    size_t offset = 0;
+    for (int level = 0; level < entry->levelCount; ++level)
+    {
+        TextureLevel& dstLevel = entry->levels[level];
+        dstLevel.width  = calc::Max(entry->width  >> level, 1);
+        dstLevel.height = calc::Max(entry->height >> level, 1);
+        dstLevel.size   = header.levelSizes[level];
+        dstLevel.data   = levelData + offset;
+        offset += dstLevel.size;
+    }
+
+    return true;
+}
+
+// Implement dumb caching to avoid decompressing textures
+bool LoadTextureFromCache(TextureCacheEntry* entry, const char* filename, bool linear)
+{
+    std::string cachedFile = GetCacheFilename(filename, linear);
+
+    // Packed archive first (no copy unless the payload is compressed)
+    const void* archiveData;
+    size_t archiveSize;
+    if (archive::Find(cachedFile.c_str(), &archiveData, &archiveSize))
+    {
+        if (ReadTextureCache(entry, (const unsigned char*)archiveData, archiveSize, filename))
+        {
+            printf("Texture loaded from archive: %s (%d bytes)\n", filename, (int)archiveSize);
+            return true;
+        }
+    }
+
+    FILE* file = fopen(cachedFile.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    // Single read of the whole file
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    void* memory = malloc(fileSize > 0 ? fileSize : 1);
+    size_t readSize = fread(memory, 1, fileSize > 0 ? fileSize : 0, file);
+    fclose(file);
+
+    if (!ReadTextureCache(entry, (const unsigned char*)memory, readSize, filename))
+    {
+        free(memory);
+        return false;
+    }
+
+    // Keep the file data unless the levels were decompressed in their own buffer
+    if (entry->memory)
+        free(memory);
+    else
+        entry->memory = memory;
+
+    printf("Texture loaded from cache: %s (%d bytes)\n", filename, (int)readSize);
+
+    return true;
+}
+
+void SaveTextureToCache(const TextureCacheEntry& entry, const char* filename, bool linear, bool compress)
+{
+    std::string cachedFile = GetCacheFilename(filename, linear);
+
+    FILE* file = fopen(cachedFile.c_str(), "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Cannot write texture cache %s\n", cachedFile.c_str());
+        return;
+    }
+
+    TextureCacheHeader header = {};
+    header.width          = (uint32_t)entry.width;
+    header.height         = (uint32_t)entry.height;
+    header.channels       = (uint32_t)entry.channels;
+    header.flags          = entry.flags;
+    header.internalFormat = entry.internalFormat;
+    header.format         = entry.format;
+    header.type           = entry.type;
+    header.mipFilter      = (uint32_t)entry.mipFilter;
+    header.levelCount     = (uint32_t)entry.levelCount;
+
+    size_t dataSize = 0;
+    for (int level = 0; level < entry.levelCount; ++level)
+    {
+        header.levelSizes[level] = (uint32_t)entry.levels[level].size;
+        dataSize += entry.levels[level].size;
+    }
+    header.payloadSize = (uint32_t)dataSize;
+
+    // Compressed payload, only kept when it saves enough to pay for the decompression
+    std::vector<unsigned char> compressed;
+    if (compress)
+    {
+        std::vector<unsigned char> payload;
+        payload.reserve(dataSize);
+        for (int level = 0; level < entry.levelCount; ++level)
+        {
+            const unsigned char* levelData = (const unsigned char*)entry.levels[level].data;
+            payload.insert(payload.end(), levelData, levelData + entry.levels[level].size);
+        }
+
+        compressed = lz::Compress(payload.data(), payload.size());
+        if (compressed.size() < dataSize - dataSize / 16)
+        {
+            header.flags |= TEX_CACHE_FLAG_LZ;
+            header.payloadSize = (uint32_t)compressed.size();
+        }
+    }
+
+    size_t version = TEX_CACHE_VERSION;
+    fwrite(&version, sizeof(size_t), 1, file);
+    fwrite(&header, sizeof(TextureCacheHeader), 1, file);
+    if (header.flags & TEX_CACHE_FLAG_LZ)
+    {
+        fwrite(compressed.data(), 1, compressed.size(), file);
+    }
+    else
+    {
+        for (int level = 0; level < entry.levelCount; ++level)
+            fwrite(entry.levels[level].data, 1, entry.levels[level].size, file);
+    }
+    fclose(file);
+
+    printf("Texture saved to cache: %s (%d bytes, %d bytes on disk)\n", filename, (int)dataSize, (int)header.payloadSize);
+}
+
+void* LoadImagePixels(const char* file, bool linear, int* width, int* height, int* channels)
+{
+    const void* data;
+    size_t size;
+    if (archive::Find(file, &data, &size))
+    {
+        if (linear)
+            return stbi_loadf_from_memory((const stbi_uc*)data, (int)size, width, height, channels, 0);
+        else
+            return stbi_load_from_memory((const stbi_uc*)data, (int)size, width, height, channels, 0);
+    }
+
+    if (linear)
+        return stbi_loadf(file, width, height, channels, 0);
+    else
+        return stbi_load(file, width, height, channels, 0);
+}
+
+bool LoadTextureCacheEntry(TextureCacheEntry* texture, const char* file, bool linear)
+{
+    if (LoadTextureFromCache(texture, file, linear))
+        return true;
+
+    // Channel packed textures have no file of their own, they are built from their sources
+    if (const ChannelPackedTexture* packed = FindChannelPackedTexture(file))
+    {
+        if (!BuildChannelPackedCacheEntry(texture, *packed))
+            return false;
+        SaveTextureToCache(*texture, file, linear);
+        return true;
+    }
+
+    int width    = 0;
+    int height   = 0;
+    int channels = 0;
+    void* colors = LoadImagePixels(file, linear, &width, &height, &channels);
+
+    if (colors == nullptr)
+    {
+        fprintf(stderr, "Failed to load image '%s'\n", file);
+        return false;
+    }
+
+    printf("Load image '%s' (%dx%d %d channels)\n", file, width, height, channels);
+
+    BuildTextureCacheEntry(texture, colors, width, height, channels, linear, file);
+    stbi_image_free(colors);
+
+    SaveTextureToCache(*texture, file, linear);
+    return true;
+}
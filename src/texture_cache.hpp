@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mip_generator.hpp"
+#include "texture_compression.hpp"
+
+#define TEX_CACHE_VERSION 7
+#define TEX_CACHE_MAX_LEVELS 16
+
+enum TextureCacheFlags
+{
+    TEX_CACHE_FLAG_COMPRESSED = 1 << 0, // Levels are BCn blocks (upload with glCompressedTexImage2D)
+    TEX_CACHE_FLAG_GRAYSCALE  = 1 << 1, // Single channel stored in red, to be swizzled to rgb
+    TEX_CACHE_FLAG_NORMAL_MAP = 1 << 2, // Only xy stored, z has to be reconstructed
+    TEX_CACHE_FLAG_SRGB       = 1 << 3, // sRGB color data (mipmaps were filtered in linear space)
+    TEX_CACHE_FLAG_LZ         = 1 << 4, // On disk only: level data is an lz stream
+    TEX_CACHE_FLAG_PACKED     = 1 << 5, // Independent linear masks in r, g, b (see ChannelPackedTexture)
+};
+
+struct TextureLevel
+{
+    int width;
+    int height;
+    size_t size;
+    const void* data;
+};
+
+// Texture ready to be uploaded (all mip levels, GL formats already chosen)
+struct TextureCacheEntry
+{
+    int width    = 0;
+    int height   = 0;
+    int channels = 0; // Channels of the source image
+
+    uint32_t flags          = 0;
+    uint32_t internalFormat = 0; // GL internal format
+    uint32_t format         = 0; // GL pixel format (uncompressed only)
+    uint32_t type           = 0; // GL pixel type (uncompressed only)
+
+    mip::Filter mipFilter = mip::Filter::KAISER;
+    int levelCount = 0;
+    TextureLevel levels[TEX_CACHE_MAX_LEVELS] = {};
+
+    void* memory = nullptr; // Storage of the level data (owned, null when levels point in the asset archive)
+};
+
+// Build the cache entry from decoded pixels with its full mip chain (8 bits images are also block compressed)
+bool BuildTextureCacheEntry(TextureCacheEntry* entry, const void* pixels, int width, int height, int channels, bool linear, const char* filename, mip::Filter mipFilter = mip::Filter::KAISER);
+void FreeTextureCacheEntry(TextureCacheEntry* entry);
+
+// 8 bits linear data (masks, normals) kept exact: uncompressed, mipmapped in linear space
+bool BuildUncompressedCacheEntry(TextureCacheEntry* entry, const unsigned char* pixels, int width, int height, int channels, const char* filename, mip::Filter mipFilter = mip::Filter::KAISER);
+
+// Texture built at cache time from grayscale masks, one per channel (only its cache exists on disk)
+struct ChannelPackedTexture
+{
+    const char* name;       // Name given to gl::UploadImage and the cache
+    const char* sources[3]; // Images stored in r, g, b (first channel, missing images are white)
+};
+
+const ChannelPackedTexture* FindChannelPackedTexture(const char* name);
+int GetChannelPackedTextures(const ChannelPackedTexture** textures);
+
+// Decode the sources (the caller sets the stb_image vertical flip) and build the uncompressed RGB8 entry, data is not sRGB
+bool BuildChannelPackedCacheEntry(TextureCacheEntry* entry, const ChannelPackedTexture& texture, mip::Filter mipFilter = mip::Filter::KAISER);
+
+// Block format matching a compressed GL internal format
+bool GetBlockFormat(uint32_t internalFormat, bc::Format* format);
+
+bool LoadTextureFromCache(TextureCacheEntry* entry, const char* filename, bool linear);
+void SaveTextureToCache(const TextureCacheEntry& entry, const char* filename, bool linear, bool compress = true);
+
+// Decode an image from the asset archive, or from its file otherwise (8 bits, float when linear, free with stbi_image_free)
+void* LoadImagePixels(const char* filename, bool linear, int* width, int* height, int* channels);
+
+// Cached texture, channel packed texture built from its sources, or image decoded, and cached now
+// No GL calls, can run on worker threads (the caller sets the stb_image vertical flip)
+bool LoadTextureCacheEntry(TextureCacheEntry* entry, const char* filename, bool linear);
@@ -0,0 +1,969 @@
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BC_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "calc.hpp"
+#include "jobs.hpp"
+#include "texture_compression.hpp"
+
+// Block of 4x4 pixels stored as structure of arrays (4 pixels per SIMD register)
+struct PixelBlock
+{
+    alignas(16) float r[16];
+    alignas(16) float g[16];
+    alignas(16) float b[16];
+    alignas(16) float a[16];
+};
+
+static void LoadBlock(PixelBlock* block, const unsigned char* rgba, int width, int height, int blockX, int blockY)
+{
+    for (int y = 0; y < 4; ++y)
+    {
+        // Clamp to edge for partial blocks
+        int py = calc::Min(blockY * 4 + y, height - 1);
+        for (int x = 0; x < 4; ++x)
+        {
+            int px = calc::Min(blockX * 4 + x, width - 1);
+            const unsigned char* pixel = rgba + ((size_t)py * width + px) * 4;
+
+            int i = y * 4 + x;
+            block->r[i] = pixel[0];
+            block->g[i] = pixel[1];
+            block->b[i] = pixel[2];
+            block->a[i] = pixel[3];
+        }
+    }
+}
+
+static void StoreBlock(const unsigned char texels[16][4], unsigned char* rgba, int width, int height, int blockX, int blockY)
+{
+    for (int y = 0; y < 4; ++y)
+    {
+        int py = blockY * 4 + y;
+        if (py >= height)
+            break;
+
+        for (int x = 0; x < 4; ++x)
+        {
+            int px = blockX * 4 + x;
+            if (px >= width)
+                break;
+
+            memcpy(rgba + ((size_t)py * width + px) * 4, texels[y * 4 + x], 4);
+        }
+    }
+}
+
+// =============================================
+// BC1 color block
+// =============================================
+static uint16_t PackRGB565(const float color[3])
+{
+    int r = (int)(calc::Clamp(color[0], 0.f, 255.f) * (31.f / 255.f) + 0.5f);
+    int g = (int)(calc::Clamp(color[1], 0.f, 255.f) * (63.f / 255.f) + 0.5f);
+    int b = (int)(calc::Clamp(color[2], 0.f, 255.f) * (31.f / 255.f) + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void UnpackRGB565(uint16_t packed, int color[3])
+{
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5)  & 63;
+    int b = (packed >> 0)  & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// 4 colors palette (color0 > color1 mode)
+static void BuildColorPalette(uint16_t c0, uint16_t c1, float palette[4][3])
+{
+    int e0[3];
+    int e1[3];
+    UnpackRGB565(c0, e0);
+    UnpackRGB565(c1, e1);
+    for (int c = 0; c < 3; ++c)
+    {
+        palette[0][c] = (float)e0[c];
+        palette[1][c] = (float)e1[c];
+        palette[2][c] = (float)((2 * e0[c] + e1[c]) / 3);
+        palette[3][c] = (float)((e0[c] + 2 * e1[c]) / 3);
+    }
+}
+
+// Find nearest palette entry for each pixel, returns the squared error of the block
+static float SelectColorIndices(const PixelBlock& block, const float (*palette)[3], int paletteSize, uint8_t indices[16])
+{
+#ifdef BC_USE_SSE2
+    __m128 totalError = _mm_setzero_ps();
+    for (int i = 0; i < 16; i += 4)
+    {
+        __m128 r = _mm_load_ps(block.r + i);
+        __m128 g = _mm_load_ps(block.g + i);
+        __m128 b = _mm_load_ps(block.b + i);
+
+        __m128  bestError = _mm_set1_ps(FLT_MAX);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int p = 0; p < paletteSize; ++p)
+        {
+            __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[p][0]));
+            __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[p][1]));
+            __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[p][2]));
+            __m128 error = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(error, bestError));
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, bestIndex));
+            bestError = _mm_min_ps(error, bestError);
+        }
+        totalError = _mm_add_ps(totalError, bestError);
+
+        alignas(16) int32_t bestIndices[4];
+        _mm_store_si128((__m128i*)bestIndices, bestIndex);
+        for (int k = 0; k < 4; ++k)
+            indices[i + k] = (uint8_t)bestIndices[k];
+    }
+
+    alignas(16) float errors[4];
+    _mm_store_ps(errors, totalError);
+    return errors[0] + errors[1] + errors[2] + errors[3];
+#else
+    float totalError = 0.f;
+    for (int i = 0; i < 16; ++i)
+    {
+        float bestError = FLT_MAX;
+        for (int p = 0; p < paletteSize; ++p)
+        {
+            float dr = block.r[i] - palette[p][0];
+            float dg = block.g[i] - palette[p][1];
+            float db = block.b[i] - palette[p][2];
+            float error = dr * dr + dg * dg + db * db;
+            if (error < bestError)
+            {
+                bestError = error;
+                indices[i] = (uint8_t)p;
+            }
+        }
+        totalError += bestError;
+    }
+    return totalError;
+#endif
+}
+
+// Initial endpoints: extreme pixels along the principal axis of the block
+static void FindPrincipalEndpoints(const PixelBlock& block, float end0[3], float end1[3])
+{
+    // Mean color
+    float mean[3] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        mean[0] += block.r[i];
+        mean[1] += block.g[i];
+        mean[2] += block.b[i];
+    }
+    for (int c = 0; c < 3; ++c)
+        mean[c] /= 16.f;
+
+    // Covariance matrix (symmetric)
+    float cov[6] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        float r = block.r[i] - mean[0];
+        float g = block.g[i] - mean[1];
+        float b = block.b[i] - mean[2];
+        cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+        cov[3] += g * g; cov[4] += g * b;
+        cov[5] += b * b;
+    }
+
+    // Principal axis with power iterations
+    float axis[3] = { 1.f, 1.f, 1.f };
+    for (int iteration = 0; iteration < 4; ++iteration)
+    {
+        float x = axis[0] * cov[0] + axis[1] * cov[1] + axis[2] * cov[2];
+        float y = axis[0] * cov[1] + axis[1] * cov[3] + axis[2] * cov[4];
+        float z = axis[0] * cov[2] + axis[1] * cov[4] + axis[2] * cov[5];
+        float norm = calc::Max(fabsf(x), calc::Max(fabsf(y), fabsf(z)));
+        if (norm < 1e-6f)
+        {
+            // Flat block: luminance axis
+            axis[0] = 0.299f; axis[1] = 0.587f; axis[2] = 0.114f;
+            break;
+        }
+        axis[0] = x / norm;
+        axis[1] = y / norm;
+        axis[2] = z / norm;
+    }
+
+    int minIndex = 0;
+    int maxIndex = 0;
+    float minDot = FLT_MAX;
+    float maxDot = -FLT_MAX;
+    for (int i = 0; i < 16; ++i)
+    {
+        float d = block.r[i] * axis[0] + block.g[i] * axis[1] + block.b[i] * axis[2];
+        if (d < minDot) { minDot = d; minIndex = i; }
+        if (d > maxDot) { maxDot = d; maxIndex = i; }
+    }
+
+    end0[0] = block.r[maxIndex]; end0[1] = block.g[maxIndex]; end0[2] = block.b[maxIndex];
+    end1[0] = block.r[minIndex]; end1[1] = block.g[minIndex]; end1[2] = block.b[minIndex];
+}
+
+// Least squares endpoints for fixed indices, end0Weights gives the weight of end0 for each index
+static bool RefineEndpoints(const PixelBlock& block, const uint8_t indices[16], const float* end0Weights, float maxValue, float end0[3], float end1[3])
+{
+    float aa = 0.f, bb = 0.f, ab = 0.f;
+    float ax[3] = {};
+    float bx[3] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        float a = end0Weights[indices[i]];
+        float b = 1.f - a;
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+
+        ax[0] += a * block.r[i]; ax[1] += a * block.g[i]; ax[2] += a * block.b[i];
+        bx[0] += b * block.r[i]; bx[1] += b * block.g[i]; bx[2] += b * block.b[i];
+    }
+
+    float det = aa * bb - ab * ab;
+    if (fabsf(det) < 1e-6f)
+        return false;
+
+    float invDet = 1.f / det;
+    for (int c = 0; c < 3; ++c)
+    {
+        end0[c] = calc::Clamp((ax[c] * bb - bx[c] * ab) * invDet, 0.f, maxValue);
+        end1[c] = calc::Clamp((bx[c] * aa - ax[c] * ab) * invDet, 0.f, maxValue);
+    }
+    return true;
+}
+
+// Quantize endpoints, order them for the 4 colors mode and select indices
+static float FitColorEndpoints(const PixelBlock& block, const float end0[3], const float end1[3], uint16_t* c0, uint16_t* c1, uint8_t indices[16])
+{
+    *c0 = PackRGB565(end0);
+    *c1 = PackRGB565(end1);
+    if (*c0 < *c1)
+    {
+        uint16_t tmp = *c0;
+        *c0 = *c1;
+        *c1 = tmp;
+    }
+
+    float palette[4][3];
+    BuildColorPalette(*c0, *c1, palette);
+    float error = SelectColorIndices(block, palette, 4, indices);
+
+    // Equal endpoints switch the decoder to 3 colors mode where index 3 is black, only use index 0
+    if (*c0 == *c1)
+    {
+        memset(indices, 0, 16);
+        error = 0.f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float dr = block.r[i] - palette[0][0];
+            float dg = block.g[i] - palette[0][1];
+            float db = block.b[i] - palette[0][2];
+            error += dr * dr + dg * dg + db * db;
+        }
+    }
+
+    return error;
+}
+
+static void EncodeColorBlock(const PixelBlock& block, unsigned char* dst)
+{
+    const float color0Weights[4] = { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+
+    float end0[3];
+    float end1[3];
+    FindPrincipalEndpoints(block, end0, end1);
+
+    uint16_t c0, c1;
+    uint8_t indices[16];
+    float error = FitColorEndpoints(block, end0, end1, &c0, &c1, indices);
+
+    // Refine endpoints with least squares and keep the best result
+    for (int iteration = 0; iteration < 2 && error > 0.f; ++iteration)
+    {
+        float refined0[3];
+        float refined1[3];
+        if (!RefineEndpoints(block, indices, color0Weights, 255.f, refined0, refined1))
+            break;
+
+        uint16_t refinedC0, refinedC1;
+        uint8_t refinedIndices[16];
+        float refinedError = FitColorEndpoints(block, refined0, refined1, &refinedC0, &refinedC1, refinedIndices);
+        if (refinedError >= error)
+            break;
+
+        error = refinedError;
+        c0 = refinedC0;
+        c1 = refinedC1;
+        memcpy(indices, refinedIndices, 16);
+    }
+
+    uint32_t packedIndices = 0;
+    for (int i = 0; i < 16; ++i)
+        packedIndices |= (uint32_t)indices[i] << (i * 2);
+
+    dst[0] = (unsigned char)(c0 & 0xFF);
+    dst[1] = (unsigned char)(c0 >> 8);
+    dst[2] = (unsigned char)(c1 & 0xFF);
+    dst[3] = (unsigned char)(c1 >> 8);
+    memcpy(dst + 4, &packedIndices, 4); // Little endian
+}
+
+static void DecodeColorBlock(const unsigned char* src, unsigned char texels[16][4], bool allowThreeColors)
+{
+    uint16_t c0 = (uint16_t)(src[0] | (src[1] << 8));
+    uint16_t c1 = (uint16_t)(src[2] | (src[3] << 8));
+    uint32_t packedIndices;
+    memcpy(&packedIndices, src + 4, 4);
+
+    int e0[3];
+    int e1[3];
+    UnpackRGB565(c0, e0);
+    UnpackRGB565(c1, e1);
+
+    unsigned char palette[4][4];
+    for (int c = 0; c < 3; ++c)
+    {
+        palette[0][c] = (unsigned char)e0[c];
+        palette[1][c] = (unsigned char)e1[c];
+        if (c0 > c1 || !allowThreeColors)
+        {
+            palette[2][c] = (unsigned char)((2 * e0[c] + e1[c]) / 3);
+            palette[3][c] = (unsigned char)((e0[c] + 2 * e1[c]) / 3);
+        }
+        else
+        {
+            palette[2][c] = (unsigned char)((e0[c] + e1[c]) / 2);
+            palette[3][c] = 0;
+        }
+    }
+    palette[0][3] = palette[1][3] = palette[2][3] = 255;
+    palette[3][3] = (c0 > c1 || !allowThreeColors) ? 255 : 0;
+
+    for (int i = 0; i < 16; ++i)
+        memcpy(texels[i], palette[(packedIndices >> (i * 2)) & 3], 4);
+}
+
+// =============================================
+// BC4 single channel block
+// =============================================
+static void EncodeChannelBlock(const float values[16], unsigned char* dst)
+{
+    float minValue;
+    float maxValue;
+#ifdef BC_USE_SSE2
+    {
+        __m128 v0 = _mm_load_ps(values + 0);
+        __m128 v1 = _mm_load_ps(values + 4);
+        __m128 v2 = _mm_load_ps(values + 8);
+        __m128 v3 = _mm_load_ps(values + 12);
+        __m128 vMin = _mm_min_ps(_mm_min_ps(v0, v1), _mm_min_ps(v2, v3));
+        __m128 vMax = _mm_max_ps(_mm_max_ps(v0, v1), _mm_max_ps(v2, v3));
+        vMin = _mm_min_ps(vMin, _mm_shuffle_ps(vMin, vMin, _MM_SHUFFLE(1, 0, 3, 2)));
+        vMin = _mm_min_ps(vMin, _mm_shuffle_ps(vMin, vMin, _MM_SHUFFLE(2, 3, 0, 1)));
+        vMax = _mm_max_ps(vMax, _mm_shuffle_ps(vMax, vMax, _MM_SHUFFLE(1, 0, 3, 2)));
+        vMax = _mm_max_ps(vMax, _mm_shuffle_ps(vMax, vMax, _MM_SHUFFLE(2, 3, 0, 1)));
+        minValue = _mm_cvtss_f32(vMin);
+        maxValue = _mm_cvtss_f32(vMax);
+    }
+#else
+    minValue = values[0];
+    maxValue = values[0];
+    for (int i = 1; i < 16; ++i)
+    {
+        minValue = calc::Min(minValue, values[i]);
+        maxValue = calc::Max(maxValue, values[i]);
+    }
+#endif
+
+    int e0 = (int)(maxValue + 0.5f);
+    int e1 = (int)(minValue + 0.5f);
+    dst[0] = (unsigned char)e0;
+    dst[1] = (unsigned char)e1;
+    memset(dst + 2, 0, 6);
+    if (e0 == e1)
+        return;
+
+    // e0 > e1: 8 values mode, palette is evenly spaced from e0 (index 0) to e1 (index 1)
+    // Position k in [0, 7] along the ramp maps to index 0, 2, 3, 4, 5, 6, 7, 1
+    uint8_t indices[16];
+    float scale = 7.f / (float)(e0 - e1);
+#ifdef BC_USE_SSE2
+    for (int i = 0; i < 16; i += 4)
+    {
+        __m128 position = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps((float)e0), _mm_load_ps(values + i)), _mm_set1_ps(scale));
+        __m128i k = _mm_cvtps_epi32(position); // Round to nearest
+        alignas(16) int32_t ks[4];
+        _mm_store_si128((__m128i*)ks, k);
+        for (int j = 0; j < 4; ++j)
+        {
+            int kj = calc::Clamp(ks[j], 0, 7);
+            indices[i + j] = (uint8_t)(kj == 0 ? 0 : (kj == 7 ? 1 : kj + 1));
+        }
+    }
+#else
+    for (int i = 0; i < 16; ++i)
+    {
+        int k = calc::Clamp((int)lrintf(((float)e0 - values[i]) * scale), 0, 7);
+        indices[i] = (uint8_t)(k == 0 ? 0 : (k == 7 ? 1 : k + 1));
+    }
+#endif
+
+    uint64_t packedIndices = 0;
+    for (int i = 0; i < 16; ++i)
+        packedIndices |= (uint64_t)indices[i] << (i * 3);
+
+    for (int i = 0; i < 6; ++i)
+        dst[2 + i] = (unsigned char)(packedIndices >> (i * 8));
+}
+
+static void DecodeChannelBlock(const unsigned char* src, unsigned char texels[16][4], int channel)
+{
+    int e0 = src[0];
+    int e1 = src[1];
+
+    unsigned char palette[8];
+    palette[0] = (unsigned char)e0;
+    palette[1] = (unsigned char)e1;
+    if (e0 > e1)
+    {
+        for (int i = 2; i < 8; ++i)
+            palette[i] = (unsigned char)(((8 - i) * e0 + (i - 1) * e1) / 7);
+    }
+    else
+    {
+        for (int i = 2; i < 6; ++i)
+            palette[i] = (unsigned char)(((6 - i) * e0 + (i - 1) * e1) / 5);
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    uint64_t packedIndices = 0;
+    for (int i = 0; i < 6; ++i)
+        packedIndices |= (uint64_t)src[2 + i] << (i * 8);
+
+    for (int i = 0; i < 16; ++i)
+        texels[i][channel] = palette[(packedIndices >> (i * 3)) & 7];
+}
+
+// =============================================
+// BC6H block (encoded with mode 11: one region, 10 bits endpoints, 4 bits indices; every mode is decoded)
+// Endpoints and pixels are handled as half float bit patterns, which is close to a log scale
+// =============================================
+static const int bc6hWeights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+static const int bc6hWeights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 }; // Two region modes
+
+static const int BC6H_MODE_11 = 0x03;
+static const int BC6H_MAX_HALF = 0x7BFF; // Largest finite half
+
+// Endpoints of the header: w and x are the first region, y and z the second one
+enum BC6HField : uint8_t { BC6H_END, RW, GW, BW, RX, GX, BX, RY, GY, BY, RZ, GZ, BZ };
+
+// Bits field[high:low] of an endpoint, read from low to high (reversed when high < low)
+struct BC6HBits
+{
+    uint8_t field;
+    uint8_t high;
+    uint8_t low;
+};
+
+struct BC6HMode
+{
+    int mode;          // As read: 2 bits for the first two modes, 5 bits otherwise
+    int regionCount;
+    bool transformed;  // Other endpoints are signed deltas from w
+    int endpointBits;
+    int deltaBits[3];
+    BC6HBits header[24];
+};
+
+// Header layouts in bit order after the mode (D3D11 functional spec, BC6H format)
+static const BC6HMode bc6hModes[] =
+{
+    { 0x00, 2, true, 10, { 5, 5, 5 }, { {GY,4,4}, {BY,4,4}, {BZ,4,4}, {RW,9,0}, {GW,9,0}, {BW,9,0}, {RX,4,0}, {GZ,4,4}, {GY,3,0}, {GX,4,0},
+        {BZ,0,0}, {GZ,3,0}, {BX,4,0}, {BZ,1,1}, {BY,3,0}, {RY,4,0}, {BZ,2,2}, {RZ,4,0}, {BZ,3,3} } },
+    { 0x01, 2, true, 7, { 6, 6, 6 }, { {GY,5,5}, {GZ,4,4}, {GZ,5,5}, {RW,6,0}, {BZ,0,0}, {BZ,1,1}, {BY,4,4}, {GW,6,0}, {BY,5,5}, {BZ,2,2},
+        {GY,4,4}, {BW,6,0}, {BZ,3,3}, {BZ,5,5}, {BZ,4,4}, {RX,5,0}, {GY,3,0}, {GX,5,0}, {GZ,3,0}, {BX,5,0}, {BY,3,0}, {RY,5,0}, {RZ,5,0} } },
+    { 0x02, 2, true, 11, { 5, 4, 4 }, { {RW,9,0}, {GW,9,0}, {BW,9,0}, {RX,4,0}, {RW,10,10}, {GY,3,0}, {GX,3,0}, {GW,10,10}, {BZ,0,0},
+        {GZ,3,0}, {BX,3,0}, {BW,10,10}, {BZ,1,1}, {BY,3,0}, {RY,4,0}, {BZ,2,2}, {RZ,4,0}, {BZ,3,3} } },
+    { 0x06, 2, true, 11, { 4, 5, 4 }, { {RW,9,0}, {GW,9,0}, {BW,9,0}, {RX,3,0}, {RW,10,10}, {GZ,4,4}, {GY,3,0}, {GX,4,0}, {GW,10,10},
+        {GZ,3,0}, {BX,3,0}, {BW,10,10}, {BZ,1,1}, {BY,3,0}, {RY,3,0}, {BZ,0,0}, {BZ,2,2}, {RZ,3,0}, {GY,4,4}, {BZ,3,3} } },
+    { 0x0A, 2, true, 11, { 4, 4, 5 }, { {RW,9,0}, {GW,9,0}, {BW,9,0}, {RX,3,0}, {RW,10,10}, {BY,4,4}, {GY,3,0}, {GX,3,0}, {GW,10,10},
+        {BZ,0,0}, {GZ,3,0}, {BX,4,0}, {BW,10,10}, {BY,3,0}, {RY,3,0}, {BZ,1,1}, {BZ,2,2}, {RZ,3,0}, {BZ,4,4}, {BZ,3,3} } },
+    { 0x0E, 2, true, 9, { 5, 5, 5 }, { {RW,8,0}, {BY,4,4}, {GW,8,0}, {GY,4,4}, {BW,8,0}, {BZ,4,4}, {RX,4,0}, {GZ,4,4}, {GY,3,0}, {GX,4,0},
+        {BZ,0,0}, {GZ,3,0}, {BX,4,0}, {BZ,1,1}, {BY,3,0}, {RY,4,0}, {BZ,2,2}, {RZ,4,0}, {BZ,3,3} } },
+    { 0x12, 2, true, 8, { 6, 5, 5 }, { {RW,7,0}, {GZ,4,4}, {BY,4,4}, {GW,7,0}, {BZ,2,2}, {GY,4,4}, {BW,7,0}, {BZ,3,3}, {BZ,4,4}, {RX,5,0},
+        {GY,3,0}, {GX,4,0}, {BZ,0,0}, {GZ,3,0}, {BX,4,0}, {BZ,1,1}, {BY,3,0}, {RY,5,0}, {RZ,5,0} } },
+    { 0x16, 2, true, 8, { 5, 6, 5 }, { {RW,7,0}, {BZ,0,0}, {BY,4,4}, {GW,7,0}, {GY,5,5}, {GY,4,4}, {BW,7,0}, {GZ,5,5}, {BZ,4,4}, {RX,4,0},
+        {GZ,4,4}, {GY,3,0}, {GX,5,0}, {GZ,3,0}, {BX,4,0}, {BZ,1,1}, {BY,3,0}, {RY,4,0}, {BZ,2,2}, {RZ,4,0}, {BZ,3,3} } },
+    { 0x1A, 2, true, 8, { 5, 5, 6 }, { {RW,7,0}, {BZ,1,1}, {BY,4,4}, {GW,7,0}, {BY,5,5}, {GY,4,4}, {BW,7,0}, {BZ,5,5}, {BZ,4,4}, {RX,4,0},
+        {GZ,4,4}, {GY,3,0}, {GX,4,0}, {BZ,0,0}, {GZ,3,0}, {BX,5,0}, {BY,3,0}, {RY,4,0}, {BZ,2,2}, {RZ,4,0}, {BZ,3,3} } },
+    { 0x1E, 2, false, 6, { 6, 6, 6 }, { {RW,5,0}, {GZ,4,4}, {BZ,0,0}, {BZ,1,1}, {BY,4,4}, {GW,5,0}, {GY,5,5}, {BY,5,5}, {BZ,2,2},
+        {GY,4,4}, {BW,5,0}, {GZ,5,5}, {BZ,3,3}, {BZ,5,5}, {BZ,4,4}, {RX,5,0}, {GY,3,0}, {GX,5,0}, {GZ,3,0}, {BX,5,0}, {BY,3,0}, {RY,5,0}, {RZ,5,0} } },
+    { 0x03, 1, false, 10, { 10, 10, 10 }, { {RW,9,0}, {GW,9,0}, {BW,9,0}, {RX,9,0}, {GX,9,0}, {BX,9,0} } },
+    { 0x07, 1, true, 11, { 9, 9, 9 }, { {RW,9,0}, {GW,9,0}, {BW,9,0}, {RX,8,0}, {RW,10,10}, {GX,8,0}, {GW,10,10}, {BX,8,0}, {BW,10,10} } },
+    { 0x0B, 1, true, 12, { 8, 8, 8 }, { {RW,9,0}, {GW,9,0}, {BW,9,0}, {RX,7,0}, {RW,10,11}, {GX,7,0}, {GW,10,11}, {BX,7,0}, {BW,10,11} } },
+    { 0x0F, 1, true, 16, { 4, 4, 4 }, { {RW,9,0}, {GW,9,0}, {BW,9,0}, {RX,3,0}, {RW,10,15}, {GX,3,0}, {GW,10,15}, {BX,3,0}, {BW,10,15} } },
+};
+
+// Two region shapes (the first 32 of BC7): bit i set when pixel i is in the second region, and its anchor pixel
+static const uint16_t bc6hPartitions[32] =
+{
+    0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+    0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE, 0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+};
+static const uint8_t bc6hAnchors[32] =
+{
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2,
+};
+
+struct BlockBits
+{
+    uint64_t bits[2] = {};
+    int position = 0;
+
+    void Write(uint32_t value, int count)
+    {
+        for (int i = 0; i < count; ++i, ++position)
+            if ((value >> i) & 1)
+                bits[position >> 6] |= 1ull << (position & 63);
+    }
+
+    uint32_t Read(int count)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < count; ++i, ++position)
+            value |= (uint32_t)((bits[position >> 6] >> (position & 63)) & 1) << i;
+        return value;
+    }
+};
+
+// Endpoint of the given bit count to 16 bits
+static int UnquantizeBC6H(int value, int bits)
+{
+    if (bits >= 15 || value == 0)
+        return value;
+    if (value == (1 << bits) - 1)
+        return 0xFFFF;
+    return ((value << 16) + 0x8000) >> bits;
+}
+
+static int InterpolateBC6H(int unquantized0, int unquantized1, int weight)
+{
+    int value = (unquantized0 * (64 - weight) + unquantized1 * weight + 32) >> 6;
+    return (value * 31) >> 6; // Final unquantize to half bits
+}
+
+// Nearest 10 bits endpoint for a half value
+static int QuantizeBC6H(float halfBits)
+{
+    int estimate = calc::Clamp((int)((halfBits - 15.5f) / 31.f + 0.5f), 0, 1023);
+
+    int best = estimate;
+    float bestError = FLT_MAX;
+    for (int candidate = calc::Max(estimate - 1, 0); candidate <= calc::Min(estimate + 1, 1023); ++candidate)
+    {
+        float error = fabsf((float)((UnquantizeBC6H(candidate, 10) * 31) >> 6) - halfBits);
+        if (error < bestError)
+        {
+            bestError = error;
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+static void LoadBlockHalf(PixelBlock* block, const float* rgba, int width, int height, int blockX, int blockY)
+{
+    for (int y = 0; y < 4; ++y)
+    {
+        int py = calc::Min(blockY * 4 + y, height - 1);
+        for (int x = 0; x < 4; ++x)
+        {
+            int px = calc::Min(blockX * 4 + x, width - 1);
+            const float* pixel = rgba + ((size_t)py * width + px) * 4;
+
+            float* channels[3] = { block->r, block->g, block->b };
+            for (int c = 0; c < 3; ++c)
+            {
+                float value = pixel[c] > 0.f ? pixel[c] : 0.f; // Unsigned format (also removes NaNs)
+                channels[c][y * 4 + x] = (float)calc::Min((int)calc::FloatToHalf(value), BC6H_MAX_HALF);
+            }
+            block->a[y * 4 + x] = 0.f;
+        }
+    }
+}
+
+static float FitBC6HEndpoints(const PixelBlock& block, const float end0[3], const float end1[3], int quantized0[3], int quantized1[3], uint8_t indices[16])
+{
+    float palette[16][3];
+    for (int c = 0; c < 3; ++c)
+    {
+        quantized0[c] = QuantizeBC6H(end0[c]);
+        quantized1[c] = QuantizeBC6H(end1[c]);
+
+        int unquantized0 = UnquantizeBC6H(quantized0[c], 10);
+        int unquantized1 = UnquantizeBC6H(quantized1[c], 10);
+        for (int i = 0; i < 16; ++i)
+            palette[i][c] = (float)InterpolateBC6H(unquantized0, unquantized1, bc6hWeights[i]);
+    }
+
+    return SelectColorIndices(block, palette, 16, indices);
+}
+
+static void EncodeBC6HBlock(const PixelBlock& block, unsigned char* dst)
+{
+    float end0Weights[16];
+    for (int i = 0; i < 16; ++i)
+        end0Weights[i] = 1.f - bc6hWeights[i] / 64.f;
+
+    float end0[3];
+    float end1[3];
+    FindPrincipalEndpoints(block, end0, end1);
+
+    int quantized0[3];
+    int quantized1[3];
+    uint8_t indices[16];
+    float error = FitBC6HEndpoints(block, end0, end1, quantized0, quantized1, indices);
+
+    for (int iteration = 0; iteration < 2 && error > 0.f; ++iteration)
+    {
+        float refined0[3];
+        float refined1[3];
+        if (!RefineEndpoints(block, indices, end0Weights, (float)BC6H_MAX_HALF, refined0, refined1))
+            break;
+
+        int refinedQuantized0[3];
+        int refinedQuantized1[3];
+        uint8_t refinedIndices[16];
+        float refinedError = FitBC6HEndpoints(block, refined0, refined1, refinedQuantized0, refinedQuantized1, refinedIndices);
+        if (refinedError >= error)
+            break;
+
+        error = refinedError;
+        memcpy(quantized0, refinedQuantized0, sizeof(quantized0));
+        memcpy(quantized1, refinedQuantized1, sizeof(quantized1));
+        memcpy(indices, refinedIndices, 16);
+    }
+
+    // Anchor index (pixel 0) is stored with 3 bits, its high bit must be 0: swap endpoints if needed
+    if (indices[0] & 8)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            int tmp = quantized0[c];
+            quantized0[c] = quantized1[c];
+            quantized1[c] = tmp;
+        }
+        for (int i = 0; i < 16; ++i)
+            indices[i] = (uint8_t)(15 - indices[i]);
+    }
+
+    BlockBits bits;
+    bits.Write(BC6H_MODE_11, 5);
+    for (int c = 0; c < 3; ++c)
+        bits.Write((uint32_t)quantized0[c], 10);
+    for (int c = 0; c < 3; ++c)
+        bits.Write((uint32_t)quantized1[c], 10);
+    bits.Write(indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        bits.Write(indices[i], 4);
+
+    memcpy(dst, bits.bits, 16); // Little endian
+}
+
+static void DecodeBC6HBlock(const unsigned char* src, float texels[16][4])
+{
+    BlockBits bits;
+    memcpy(bits.bits, src, 16);
+
+    int mode = (int)bits.Read(2);
+    if (mode > 1)
+        mode |= (int)bits.Read(3) << 2;
+
+    const BC6HMode* modeInfo = nullptr;
+    for (const BC6HMode& candidate : bc6hModes)
+        if (candidate.mode == mode)
+            modeInfo = &candidate;
+
+    // Reserved modes decode to black, like the hardware
+    if (modeInfo == nullptr)
+    {
+        for (int i = 0; i < 16; ++i)
+            texels[i][0] = texels[i][1] = texels[i][2] = 0.f;
+        return;
+    }
+
+    int endpoints[12] = {}; // RW to BZ
+    for (const BC6HBits& field : modeInfo->header)
+    {
+        if (field.field == BC6H_END)
+            break;
+        int step = field.high >= field.low ? 1 : -1;
+        for (int bit = field.low; ; bit += step)
+        {
+            endpoints[field.field - RW] |= (int)bits.Read(1) << bit;
+            if (bit == field.high)
+                break;
+        }
+    }
+
+    int partition = modeInfo->regionCount == 2 ? (int)bits.Read(5) : 0;
+    int endpointCount = modeInfo->regionCount * 2;
+    int endpointMask = (1 << modeInfo->endpointBits) - 1;
+    int unquantized[4][3];
+    for (int e = 0; e < endpointCount; ++e)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            int value = endpoints[e * 3 + c];
+            if (e > 0 && modeInfo->transformed)
+            {
+                int deltaBits = modeInfo->deltaBits[c];
+                if (value & (1 << (deltaBits - 1)))
+                    value -= 1 << deltaBits;
+                value = (endpoints[c] + value) & endpointMask;
+            }
+            unquantized[e][c] = UnquantizeBC6H(value, modeInfo->endpointBits);
+        }
+    }
+
+    // The anchor pixel of each region stores its index without the high bit (always 0)
+    int indexBits = modeInfo->regionCount == 2 ? 3 : 4;
+    const int* weights = modeInfo->regionCount == 2 ? bc6hWeights3 : bc6hWeights;
+    int anchor = modeInfo->regionCount == 2 ? bc6hAnchors[partition] : 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        int region = (bc6hPartitions[partition] >> i) & 1;
+        if (modeInfo->regionCount == 1)
+            region = 0;
+
+        int index = (int)bits.Read(i == 0 || i == anchor ? indexBits - 1 : indexBits);
+        for (int c = 0; c < 3; ++c)
+        {
+            int value = InterpolateBC6H(unquantized[region * 2][c], unquantized[region * 2 + 1][c], weights[index]);
+            texels[i][c] = calc::HalfToFloat((uint16_t)value);
+        }
+    }
+}
+
+// =============================================
+// Public API
+// =============================================
+const char* bc::FormatName(Format format)
+{
+    switch (format)
+    {
+    case Format::BC1:  return "BC1";
+    case Format::BC3:  return "BC3";
+    case Format::BC4:  return "BC4";
+    case Format::BC5:  return "BC5";
+    case Format::BC6H: return "BC6H";
+    default:           return "Unknown";
+    }
+}
+
+int bc::BlockBytes(Format format)
+{
+    return (format == Format::BC1 || format == Format::BC4) ? 8 : 16;
+}
+
+size_t bc::CompressedSize(Format format, int width, int height)
+{
+    size_t blocksX = (size_t)(width  + 3) / 4;
+    size_t blocksY = (size_t)(height + 3) / 4;
+    return blocksX * blocksY * BlockBytes(format);
+}
+
+void bc::Compress(Format format, const unsigned char* rgba, int width, int height, void* dst)
+{
+    int blocksX = (width  + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    int blockBytes = BlockBytes(format);
+
+    jobs::ParallelFor(blocksY, [&](int blockY)
+    {
+        unsigned char* dstRow = (unsigned char*)dst + (size_t)blockY * blocksX * blockBytes;
+        for (int blockX = 0; blockX < blocksX; ++blockX)
+        {
+            PixelBlock block;
+            LoadBlock(&block, rgba, width, height, blockX, blockY);
+
+            unsigned char* dstBlock = dstRow + (size_t)blockX * blockBytes;
+            switch (format)
+            {
+            case Format::BC1:
+                EncodeColorBlock(block, dstBlock);
+                break;
+            case Format::BC3:
+                EncodeChannelBlock(block.a, dstBlock);
+                EncodeColorBlock(block, dstBlock + 8);
+                break;
+            case Format::BC4:
+                EncodeChannelBlock(block.r, dstBlock);
+                break;
+            case Format::BC5:
+                EncodeChannelBlock(block.r, dstBlock);
+                EncodeChannelBlock(block.g, dstBlock + 8);
+                break;
+            case Format::BC6H:
+                break; // Float input, see CompressBC6H
+            }
+        }
+    });
+}
+
+void bc::Decompress(Format format, const void* src, int width, int height, unsigned char* rgba)
+{
+    int blocksX = (width  + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    int blockBytes = BlockBytes(format);
+
+    jobs::ParallelFor(blocksY, [&](int blockY)
+    {
+        const unsigned char* srcRow = (const unsigned char*)src + (size_t)blockY * blocksX * blockBytes;
+        for (int blockX = 0; blockX < blocksX; ++blockX)
+        {
+            const unsigned char* srcBlock = srcRow + (size_t)blockX * blockBytes;
+
+            unsigned char texels[16][4];
+            for (int i = 0; i < 16; ++i)
+            {
+                texels[i][0] = texels[i][1] = texels[i][2] = 0;
+                texels[i][3] = 255;
+            }
+
+            switch (format)
+            {
+            case Format::BC1:
+                DecodeColorBlock(srcBlock, texels, true);
+                break;
+            case Format::BC3:
+                DecodeColorBlock(srcBlock + 8, texels, false);
+                DecodeChannelBlock(srcBlock, texels, 3);
+                break;
+            case Format::BC4:
+                DecodeChannelBlock(srcBlock, texels, 0);
+                break;
+            case Format::BC5:
+                DecodeChannelBlock(srcBlock, texels, 0);
+                DecodeChannelBlock(srcBlock + 8, texels, 1);
+                break;
+            case Format::BC6H:
+                break; // Float output, see DecompressBC6H
+            }
+
+            StoreBlock(texels, rgba, width, height, blockX, blockY);
+        }
+    });
+}
+
+float bc::ComputePSNR(Format format, const unsigned char* reference, const unsigned char* decoded, int width, int height)
+{
+    int channelCount;
+    switch (format)
+    {
+    case Format::BC1: channelCount = 3; break;
+    case Format::BC3: channelCount = 4; break;
+    case Format::BC6H: channelCount = 3; break;
+    case Format::BC4: channelCount = 1; break;
+    case Format::BC5: default: channelCount = 2; break;
+    }
+
+    double squaredError = 0.0;
+    size_t pixelCount = (size_t)width * height;
+    for (size_t i = 0; i < pixelCount; ++i)
+    {
+        for (int c = 0; c < channelCount; ++c)
+        {
+            double diff = (double)reference[i * 4 + c] - (double)decoded[i * 4 + c];
+            squaredError += diff * diff;
+        }
+    }
+
+    double mse = squaredError / (double)(pixelCount * channelCount);
+    if (mse <= 0.0)
+        return 99.f; // Lossless
+
+    return (float)(10.0 * log10(255.0 * 255.0 / mse));
+}
+
+void bc::CompressBC6H(const float* rgba, int width, int height, void* dst)
+{
+    int blocksX = (width  + 3) / 4;
+    int blocksY = (height + 3) / 4;
+
+    jobs::ParallelFor(blocksY, [&](int blockY)
+    {
+        unsigned char* dstRow = (unsigned char*)dst + (size_t)blockY * blocksX * 16;
+        for (int blockX = 0; blockX < blocksX; ++blockX)
+        {
+            PixelBlock block;
+            LoadBlockHalf(&block, rgba, width, height, blockX, blockY);
+            EncodeBC6HBlock(block, dstRow + (size_t)blockX * 16);
+        }
+    });
+}
+
+void bc::DecompressBC6H(const void* src, int width, int height, float* rgba)
+{
+    int blocksX = (width  + 3) / 4;
+    int blocksY = (height + 3) / 4;
+
+    jobs::ParallelFor(blocksY, [&](int blockY)
+    {
+        const unsigned char* srcRow = (const unsigned char*)src + (size_t)blockY * blocksX * 16;
+        for (int blockX = 0; blockX < blocksX; ++blockX)
+        {
+            float texels[16][4];
+            DecodeBC6HBlock(srcRow + (size_t)blockX * 16, texels);
+
+            for (int y = 0; y < 4 && blockY * 4 + y < height; ++y)
+            {
+                for (int x = 0; x < 4 && blockX * 4 + x < width; ++x)
+                {
+                    float* pixel = rgba + ((size_t)(blockY * 4 + y) * width + blockX * 4 + x) * 4;
+                    pixel[0] = texels[y * 4 + x][0];
+                    pixel[1] = texels[y * 4 + x][1];
+                    pixel[2] = texels[y * 4 + x][2];
+                    pixel[3] = 1.f;
+                }
+            }
+        }
+    });
+}
+
+float bc::ComputePSNRHDR(const float* reference, const float* decoded, int width, int height)
+{
+    double squaredError = 0.0;
+    size_t pixelCount = (size_t)width * height;
+    for (size_t i = 0; i < pixelCount; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            double a = calc::Max(reference[i * 4 + c], 0.f);
+            double b = calc::Max(decoded[i * 4 + c], 0.f);
+            double diff = a / (1.0 + a) - b / (1.0 + b);
+            squaredError += diff * diff;
+        }
+    }
+
+    double mse = squaredError / (double)(pixelCount * 3);
+    if (mse <= 0.0)
+        return 99.f;
+
+    return (float)(10.0 * log10(1.0 / mse));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+
+// CPU block compression (BCn / S3TC / RGTC / BPTC)
+namespace bc
+{
+    enum class Format : int
+    {
+        BC1,  // RGB,  4 bpp (DXT1)
+        BC3,  // RGBA, 8 bpp (DXT5: BC1 color + BC4 alpha)
+        BC4,  // R,    4 bpp (RGTC1)
+        BC5,  // RG,   8 bpp (RGTC2: two BC4 blocks)
+        BC6H, // RGB half floats, 8 bpp (BPTC unsigned float, float input: see CompressBC6H)
+    };
+
+    const char* FormatName(Format format);
+    int BlockBytes(Format format);
+    size_t CompressedSize(Format format, int width, int height);
+
+    // Compress a RGBA8 image (block rows are encoded in parallel)
+    void Compress(Format format, const unsigned char* rgba, int width, int height, void* dst);
+
+    // Decompress to RGBA8 (unused channels are set to 0, alpha to 255)
+    void Decompress(Format format, const void* src, int width, int height, unsigned char* rgba);
+
+    // Compress/decompress RGBA32F pixels to BC6H (unsigned, alpha is dropped)
+    // Only the single region mode with 10 bits endpoints is produced and decoded
+    void CompressBC6H(const float* rgba, int width, int height, void* dst);
+    void DecompressBC6H(const void* src, int width, int height, float* rgba);
+
+    // Peak signal to noise ratio (in dB) over the channels stored by the format
+    float ComputePSNR(Format format, const unsigned char* reference, const unsigned char* decoded, int width, int height);
+
+    // Same for HDR RGB images, computed after a x / (1 + x) tonemap
+    float ComputePSNRHDR(const float* reference, const float* decoded, int width, int height);
+}
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include <imgui.h>
+
+#include "vram_budget.hpp"
+
+#define VRAM_DEFAULT_BUDGET (256 * 1024 * 1024)
+
+struct Resource
+{
+    vram::ResourceType type;
+    GLuint name;
+    int owner;
+    size_t bytes;
+    std::function<void()> evict;
+    std::function<void()> reload;
+
+    bool resident = true;
+    bool pinned = false;
+    int lastUsedFrame = 0;
+};
+
+static std::vector<Resource> resources;
+static int currentOwner = -1;
+static int frame = 0;
+static size_t budget = VRAM_DEFAULT_BUDGET;
+static int evictionCount = 0;
+static int reloadCount = 0;
+
+static const char* ResourceTypeName(vram::ResourceType type)
+{
+    switch (type)
+    {
+    case vram::ResourceType::TEXTURE:      return "texture";
+    case vram::ResourceType::BUFFER:       return "buffer";
+    case vram::ResourceType::RENDERBUFFER: return "renderbuffer";
+    default:                               return "unknown";
+    }
+}
+
+static Resource* FindResource(vram::ResourceType type, GLuint name)
+{
+    for (Resource& resource : resources)
+        if (resource.type == type && resource.name == name)
+            return &resource;
+    return nullptr;
+}
+
+void vram::SetOwner(int owner)
+{
+    currentOwner = owner;
+}
+
+void vram::Track(ResourceType type, GLuint name, size_t bytes, std::function<void()> evict, std::function<void()> reload)
+{
+    if (name == 0)
+        return;
+
+    // Storage respecified (resize, reload...): the resource keeps its owner
+    Resource* resource = FindResource(type, name);
+    if (resource == nullptr)
+    {
+        resources.push_back({ type, name, currentOwner });
+        resource = &resources.back();
+    }
+
+    resource->bytes         = bytes;
+    resource->evict         = std::move(evict);
+    resource->reload        = std::move(reload);
+    resource->resident      = true;
+    resource->lastUsedFrame = frame;
+}
+
+void vram::Untrack(ResourceType type, GLuint name)
+{
+    resources.erase(std::remove_if(resources.begin(), resources.end(),
+        [&](const Resource& r) { return r.type == type && r.name == name; }), resources.end());
+}
+
+void vram::Pin(ResourceType type, GLuint name)
+{
+    if (Resource* resource = FindResource(type, name))
+        resource->pinned = true;
+}
+
+void vram::Update(int activeOwner)
+{
+    frame++;
+    currentOwner = activeOwner; // Resources created while rendering belong to the active owner
+
+    // Reload what the active owner needs (reload functions track the resource again)
+    for (size_t i = 0; i < resources.size(); ++i)
+    {
+        if (resources[i].owner != activeOwner)
+            continue;
+
+        resources[i].lastUsedFrame = frame;
+        if (!resources[i].resident)
+        {
+            std::function<void()> reload = resources[i].reload; // Copy, Track replaces it
+            reload();
+            resources[i].resident = true;
+            reloadCount++;
+        }
+    }
+
+    // Evict least recently used resources of inactive owners
+    size_t residentBytes = GetResidentBytes();
+    if (residentBytes <= budget)
+        return;
+
+    std::vector<Resource*> candidates;
+    for (Resource& resource : resources)
+    {
+        if (resource.resident && !resource.pinned && resource.owner >= 0 && resource.owner != activeOwner && resource.evict)
+            candidates.push_back(&resource);
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Resource* a, const Resource* b) { return a->lastUsedFrame < b->lastUsedFrame; });
+
+    for (Resource* resource : candidates)
+    {
+        if (residentBytes <= budget)
+            break;
+
+        resource->evict();
+        resource->resident = false;
+        residentBytes -= resource->bytes;
+        evictionCount++;
+    }
+}
+
+void vram::SetBudget(size_t bytes)
+{
+    budget = bytes;
+}
+
+size_t vram::GetResidentBytes()
+{
+    size_t bytes = 0;
+    for (const Resource& resource : resources)
+        bytes += resource.resident ? resource.bytes : 0;
+    return bytes;
+}
+
+void vram::ShowPanel(const char* const* ownerNames, int ownerCount)
+{
+    const float MB = 1024.f * 1024.f;
+
+    int budgetMB = (int)(budget / (1024 * 1024));
+    if (ImGui::SliderInt("Budget (MB)", &budgetMB, 16, 4096, "%d", ImGuiSliderFlags_Logarithmic))
+        budget = (size_t)budgetMB * 1024 * 1024;
+
+    size_t residentBytes = GetResidentBytes();
+    ImGui::ProgressBar(budget > 0 ? std::min((float)residentBytes / budget, 1.f) : 1.f, ImVec2(-1.f, 0.f));
+    ImGui::Text("Resident: %.1f MB / %.0f MB (%d evictions, %d reloads)", residentBytes / MB, budget / MB, evictionCount, reloadCount);
+
+    // Per owner
+    if (ImGui::BeginTable("Owners", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        ImGui::TableSetupColumn("Demo");
+        ImGui::TableSetupColumn("Resident (MB)");
+        ImGui::TableSetupColumn("Evicted (MB)");
+        ImGui::TableSetupColumn("Last used (frames)");
+        ImGui::TableHeadersRow();
+
+        for (int owner = -1; owner < ownerCount; ++owner)
+        {
+            size_t ownerResident = 0;
+            size_t ownerEvicted = 0;
+            int lastUsedFrame = 0;
+            bool hasResources = false;
+            for (const Resource& resource : resources)
+            {
+                if (resource.owner != owner)
+                    continue;
+                hasResources = true;
+                (resource.resident ? ownerResident : ownerEvicted) += resource.bytes;
+                lastUsedFrame = std::max(lastUsedFrame, resource.lastUsedFrame);
+            }
+            if (!hasResources)
+                continue;
+
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn(); ImGui::TextUnformatted(owner >= 0 ? ownerNames[owner] : "(shared)");
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", ownerResident / MB);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", ownerEvicted / MB);
+            ImGui::TableNextColumn(); ImGui::Text("%d", frame - lastUsedFrame);
+        }
+        ImGui::EndTable();
+    }
+
+    // Per resource
+    if (ImGui::TreeNode("Resources", "Resources (%d)", (int)resources.size()))
+    {
+        if (ImGui::BeginTable("Resources", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY, ImVec2(0.f, 300.f)))
+        {
+            ImGui::TableSetupColumn("Type");
+            ImGui::TableSetupColumn("Name");
+            ImGui::TableSetupColumn("Demo");
+            ImGui::TableSetupColumn("MB");
+            ImGui::TableSetupColumn("State");
+            ImGui::TableHeadersRow();
+
+            for (const Resource& resource : resources)
+            {
+                const char* state = !resource.resident ? "evicted" : (resource.pinned || !resource.evict) ? "resident (fixed)" : "resident";
+
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn(); ImGui::TextUnformatted(ResourceTypeName(resource.type));
+                ImGui::TableNextColumn(); ImGui::Text("%u", resource.name);
+                ImGui::TableNextColumn(); ImGui::TextUnformatted(resource.owner >= 0 && resource.owner < ownerCount ? ownerNames[resource.owner] : "(shared)");
+                ImGui::TableNextColumn(); ImGui::Text("%.2f", resource.bytes / MB);
+                ImGui::TableNextColumn(); ImGui::TextUnformatted(state);
+            }
+            ImGui::EndTable();
+        }
+        ImGui::TreePop();
+    }
+}
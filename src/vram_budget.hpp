@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+#include <glad/glad.h>
+
+// GPU memory accounting of the resources created through the gl:: helpers (sizes are estimated from formats)
+// Resources belong to the demo that created them: when over budget, the least recently used
+// resources of inactive demos are evicted, they are reloaded when their demo is used again
+namespace vram
+{
+    enum class ResourceType
+    {
+        TEXTURE,
+        BUFFER,
+        RENDERBUFFER,
+    };
+
+    // Owner of the resources tracked from now on (-1 for shared resources, never evicted)
+    void SetOwner(int owner);
+
+    // Record the storage size of a GL object (tracking the same object again updates it, the owner is kept)
+    // Only resources with evict/reload functions can be evicted (evict keeps the GL name valid)
+    void Track(ResourceType type, GLuint name, size_t bytes, std::function<void()> evict = nullptr, std::function<void()> reload = nullptr);
+    void Pin(ResourceType type, GLuint name); // Content was modified after loading, never evict it
+
+    // Forget a deleted object (GL reuses names, a new object must not inherit the owner and evict/reload functions)
+    void Untrack(ResourceType type, GLuint name);
+
+    // Call once per frame before rendering: the active owner becomes the current owner, its resources are marked
+    // as used (and reloaded if evicted), then resources of the other owners are evicted while over budget
+    void Update(int activeOwner);
+
+    void SetBudget(size_t bytes);
+    size_t GetResidentBytes();
+
+    void ShowPanel(const char* const* ownerNames, int ownerCount);
+}
@@ -0,0 +1,594 @@
+// Offline asset cooker: builds all texture/mesh/cubemap/atlas caches of media/ ahead of time
+// and optionally packs them in the asset archive read by the demos.
+//
+// Usage: ibl-cook [--pack] [--benchmark] [--mip-filter box|kaiser|lanczos] [media directory]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <stb_image.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "asset_archive.hpp"
+#include "brdf_lut.hpp"
+#include "dds.hpp"
+#include "environment.hpp"
+#include "jobs.hpp"
+#include "lz.hpp"
+#include "mesh_builder.hpp"
+#include "mip_generator.hpp"
+#include "probe.hpp"
+#include "texture_atlas.hpp"
+#include "texture_cache.hpp"
+
+// Textures loaded with gl::UploadImage(file, true) (float caches)
+static const char* floatTextures[] =
+{
+    "media/fantasy_game_inn_diffuse.png",
+    "media/fantasy_game_inn_emissive.png",
+};
+
+// Folders loaded with gl::UploadImageCubeMap (faces are decoded at runtime, packed as is), with their irradiance SH
+// and GGX prefiltered cubemap
+static const char* cubemapFolders[] =
+{
+    "media/skybox/",
+};
+
+enum class AssetType
+{
+    TEXTURE,
+    FLOAT_TEXTURE,
+    PACKED_TEXTURE,
+    ATLAS,
+    MESH,
+    CUBEMAP,
+    ENVIRONMENT,
+    BRDF_LUT,
+    RAW,
+};
+
+struct Asset
+{
+    std::string path;
+    AssetType type;
+
+    // Filled by the cooker
+    bool success = false;
+    float milliseconds = 0.f;
+    std::vector<std::string> outputs; // Files to pack
+};
+
+static const char* AssetTypeName(AssetType type)
+{
+    switch (type)
+    {
+    case AssetType::TEXTURE:        return "texture";
+    case AssetType::FLOAT_TEXTURE:  return "texture (float)";
+    case AssetType::PACKED_TEXTURE: return "texture (packed)";
+    case AssetType::ATLAS:          return "atlas";
+    case AssetType::MESH:           return "mesh";
+    case AssetType::CUBEMAP:        return "cubemap";
+    case AssetType::ENVIRONMENT:    return "environment";
+    case AssetType::BRDF_LUT:       return "BRDF LUT";
+    case AssetType::RAW:            return "raw";
+    default:                        return "unknown";
+    }
+}
+
+static bool HasExtension(const std::string& path, const char* extension)
+{
+    std::string lower = path;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+    size_t length = strlen(extension);
+    return lower.size() >= length && lower.compare(lower.size() - length, length, extension) == 0;
+}
+
+static bool StartsWith(const std::string& path, const char* prefix)
+{
+    return path.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static bool FindAssetType(const std::string& path, AssetType* type)
+{
+    bool isImage = HasExtension(path, ".jpg") || HasExtension(path, ".png");
+
+    for (const char* folder : cubemapFolders)
+    {
+        if (isImage && StartsWith(path, folder))
+        {
+            *type = AssetType::RAW;
+            return true;
+        }
+    }
+
+    // Cooked with their atlas
+    if (isImage && StartsWith(path, ATLAS_FOLDER))
+        return false;
+
+    for (const char* floatTexture : floatTextures)
+    {
+        if (path == floatTexture)
+        {
+            *type = AssetType::FLOAT_TEXTURE;
+            return true;
+        }
+    }
+
+    if (isImage)
+        *type = AssetType::TEXTURE;
+    else if (HasExtension(path, ".obj"))
+        *type = AssetType::MESH;
+    else if (HasExtension(path, ".dds"))
+        *type = AssetType::CUBEMAP;
+    else if (HasExtension(path, ".hdr"))
+        *type = AssetType::ENVIRONMENT; // Panorama, only its cubemap is packed
+    else
+        return false;
+
+    return true;
+}
+
+static bool CookTexture(Asset* asset, bool linear, mip::Filter mipFilter)
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    void* pixels;
+    if (linear)
+        pixels = stbi_loadf(asset->path.c_str(), &width, &height, &channels, 0);
+    else
+        pixels = stbi_load(asset->path.c_str(), &width, &height, &channels, 0);
+
+    if (pixels == nullptr)
+    {
+        fprintf(stderr, "Failed to load image '%s'\n", asset->path.c_str());
+        return false;
+    }
+
+    TextureCacheEntry entry;
+    bool success = BuildTextureCacheEntry(&entry, pixels, width, height, channels, linear, asset->path.c_str(), mipFilter);
+    stbi_image_free(pixels);
+    if (success)
+        SaveTextureToCache(entry, asset->path.c_str(), linear);
+    FreeTextureCacheEntry(&entry);
+
+    // Same name as in texture_cache.cpp
+    asset->outputs.push_back(asset->path + (linear ? ".texf.cache" : ".tex.cache"));
+    return success;
+}
+
+// Built from its source masks, it has no file of its own
+static bool CookPackedTexture(Asset* asset, mip::Filter mipFilter)
+{
+    const ChannelPackedTexture* packed = FindChannelPackedTexture(asset->path.c_str());
+    TextureCacheEntry entry;
+    bool success = packed != nullptr && BuildChannelPackedCacheEntry(&entry, *packed, mipFilter);
+    if (success)
+        SaveTextureToCache(entry, asset->path.c_str(), false);
+    FreeTextureCacheEntry(&entry);
+
+    asset->outputs.push_back(asset->path + ".tex.cache");
+    return success;
+}
+
+// Asset path is the atlas folder
+static bool CookAtlas(Asset* asset)
+{
+    atlas::Atlas atlas;
+    if (!atlas::BuildFromFolder(&atlas, asset->path.c_str()) || !atlas::SaveToCache(atlas))
+        return false;
+
+    asset->outputs.push_back(atlas::GetCacheFilename(atlas.name.c_str()));
+    for (int page = 0; page < atlas.pageCount; ++page)
+        asset->outputs.push_back(atlas::GetPageName(atlas, page) + ".tex.cache");
+    return true;
+}
+
+static bool CookMesh(Asset* asset)
+{
+    std::string mtlDir = std::filesystem::path(asset->path).parent_path().generic_string();
+    if (!CookObj(asset->path.c_str(), mtlDir.c_str()))
+        return false;
+
+    asset->outputs.push_back(asset->path + ".cache");
+    return true;
+}
+
+// Probe with the irradiance SH and the GGX prefiltered cubemap (DemoIBL settings), from faces decoded once
+static bool CookEnvironment(Asset* asset)
+{
+    env::Cubemap cubemap;
+    if (!env::LoadCubemap(&cubemap, asset->path.c_str()))
+        return false;
+    if (env::GetSourceType(asset->path.c_str()) == env::SourceType::EQUIRECT)
+        asset->outputs.push_back(env::GetEquirectCacheFilename(asset->path.c_str()));
+
+    if (!probe::Bake(asset->path.c_str(), probe::BakeSettings(), &cubemap))
+        return false;
+    asset->outputs.push_back(probe::GetProbeFilename(asset->path.c_str()));
+    return true;
+}
+
+// Fails when the integrator does not match its reference values
+static bool CookBRDFLut(Asset* asset)
+{
+    brdf::LutSettings settings;
+    brdf::Lut lut;
+    brdf::Generate(&lut, settings);
+    if (!brdf::Verify(settings.sampleCount) || !brdf::Save(lut, asset->path.c_str()))
+        return false;
+
+    asset->outputs.push_back(asset->path);
+    return true;
+}
+
+// Float cubemaps are converted to BC6H (gl::UploadCubemap converts them itself when BPTC is not supported)
+static bool CookCubemap(Asset* asset)
+{
+    dds::Image source;
+    if (!dds::Load(&source, asset->path.c_str()))
+        return false;
+
+    asset->outputs.push_back(asset->path);
+    if (source.faceCount == 6 && !CookEnvironment(asset))
+    {
+        dds::Free(&source);
+        return false;
+    }
+
+    if (source.format == dds::Format::RGBA32F && source.faceCount == 6)
+    {
+        std::string cacheFile = asset->path + ".bc6h.cache";
+
+        dds::Image compressed;
+        dds::Convert(source, dds::Format::BC6H, &compressed);
+        bool success = dds::Save(compressed, cacheFile.c_str());
+        dds::Free(&compressed);
+        if (!success)
+        {
+            dds::Free(&source);
+            return false;
+        }
+        asset->outputs.push_back(cacheFile);
+    }
+
+    dds::Free(&source);
+    return true;
+}
+
+static bool ReadFile(const std::string& path, std::vector<unsigned char>* data)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    data->resize(size > 0 ? size : 0);
+    size_t readSize = fread(data->data(), 1, data->size(), file);
+    fclose(file);
+    return readSize == data->size();
+}
+
+// Evict a file from the OS page cache, so that the next read comes from the disk
+static bool DropFromPageCache(const std::string& path)
+{
+#if defined(_WIN32)
+    (void)path;
+    return false; // No per file equivalent without admin rights
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    fdatasync(fd);
+    bool success = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return success;
+#endif
+}
+
+// Time to get the payload in memory: read only, or read and decompress
+static float TimePayloadLoad(const std::string& path, bool compressed, std::vector<unsigned char>* payload)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<unsigned char> data;
+    if (!ReadFile(path, &data))
+        return -1.f;
+    if (compressed && !lz::Decompress(data.data(), data.size(), payload->data(), payload->size()))
+        return -1.f;
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Compare raw and lz texture cache payloads, on a cold and warm page cache
+static void BenchmarkCaches(const std::vector<Asset>& assets)
+{
+    printf("\n%-48s %9s %9s %11s %11s %11s %11s\n", "Texture payload", "Raw (MB)", "LZ (MB)",
+           "Cold raw", "Cold LZ", "Warm raw", "Warm LZ");
+
+    float totals[6] = {};
+    bool cold = true;
+    for (const Asset& asset : assets)
+    {
+        bool linear = asset.type == AssetType::FLOAT_TEXTURE;
+        if (!asset.success || (asset.type != AssetType::TEXTURE && asset.type != AssetType::PACKED_TEXTURE && !linear))
+            continue;
+
+        TextureCacheEntry entry;
+        if (!LoadTextureFromCache(&entry, asset.path.c_str(), linear))
+            continue;
+
+        std::vector<unsigned char> payload;
+        for (int level = 0; level < entry.levelCount; ++level)
+        {
+            const unsigned char* data = (const unsigned char*)entry.levels[level].data;
+            payload.insert(payload.end(), data, data + entry.levels[level].size);
+        }
+        FreeTextureCacheEntry(&entry);
+
+        std::vector<unsigned char> compressed = lz::Compress(payload.data(), payload.size());
+        std::string rawFile = asset.path + ".bench.raw";
+        std::string lzFile  = asset.path + ".bench.lz";
+        FILE* file = fopen(rawFile.c_str(), "wb");
+        if (file)
+        {
+            fwrite(payload.data(), 1, payload.size(), file);
+            fclose(file);
+        }
+        file = fopen(lzFile.c_str(), "wb");
+        if (file)
+        {
+            fwrite(compressed.data(), 1, compressed.size(), file);
+            fclose(file);
+        }
+
+        // Cold: evicted before each read, warm: best of a few reads
+        float times[4] = {};
+        std::vector<unsigned char> decompressed(payload.size());
+        cold = cold && DropFromPageCache(rawFile) && DropFromPageCache(lzFile);
+        times[0] = TimePayloadLoad(rawFile, false, &decompressed);
+        times[1] = TimePayloadLoad(lzFile, true, &decompressed);
+        times[2] = times[3] = 1e9f;
+        for (int i = 0; i < 5; ++i)
+        {
+            times[2] = std::min(times[2], TimePayloadLoad(rawFile, false, &decompressed));
+            times[3] = std::min(times[3], TimePayloadLoad(lzFile, true, &decompressed));
+        }
+        bool valid = decompressed == payload;
+
+        remove(rawFile.c_str());
+        remove(lzFile.c_str());
+
+        float rawMB = payload.size() / (1024.f * 1024.f);
+        float lzMB  = compressed.size() / (1024.f * 1024.f);
+        printf("%-48s %9.2f %9.2f %8.2f ms %8.2f ms %8.2f ms %8.2f ms%s\n", asset.path.c_str(), rawMB, lzMB,
+               times[0], times[1], times[2], times[3], valid ? "" : "  MISMATCH");
+
+        totals[0] += rawMB;
+        totals[1] += lzMB;
+        for (int i = 0; i < 4; ++i)
+            totals[2 + i] += times[i];
+    }
+
+    printf("%-48s %9.2f %9.2f %8.2f ms %8.2f ms %8.2f ms %8.2f ms\n", "Total", totals[0], totals[1],
+           totals[2], totals[3], totals[4], totals[5]);
+    if (!cold)
+        printf("Page cache eviction is not available, cold timings are warm\n");
+}
+
+static archive::Format GetArchiveFormat(const std::string& path)
+{
+    if (HasExtension(path, ".tex.cache") || HasExtension(path, ".texf.cache"))
+        return archive::Format::TEXTURE_CACHE;
+    if (HasExtension(path, ".obj.cache"))
+        return archive::Format::MESH_CACHE;
+    if (HasExtension(path, ".dds") || HasExtension(path, ".bc6h.cache") || HasExtension(path, ".ggx.cache")
+        || HasExtension(path, ".cube.cache"))
+        return archive::Format::DDS;
+    return archive::Format::RAW;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string mediaDir = "media";
+    bool pack = false;
+    bool benchmark = false;
+    mip::Filter mipFilter = mip::Filter::KAISER;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--pack") == 0)
+        {
+            pack = true;
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0)
+        {
+            benchmark = true;
+        }
+        else if (strcmp(argv[i], "--mip-filter") == 0 && i + 1 < argc)
+        {
+            const char* name = argv[++i];
+            if      (strcmp(name, "box") == 0)     mipFilter = mip::Filter::BOX;
+            else if (strcmp(name, "kaiser") == 0)  mipFilter = mip::Filter::KAISER;
+            else if (strcmp(name, "lanczos") == 0) mipFilter = mip::Filter::LANCZOS;
+            else
+            {
+                fprintf(stderr, "Unknown mip filter '%s'\n", name);
+                return 1;
+            }
+        }
+        else if (argv[i][0] != '-')
+        {
+            mediaDir = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--pack] [--benchmark] [--mip-filter box|kaiser|lanczos] [media directory]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Collect assets (sorted, so that the report and the archive do not depend on the file system order)
+    std::vector<Asset> assets;
+    std::error_code error;
+    for (const auto& file : std::filesystem::recursive_directory_iterator(mediaDir, error))
+    {
+        if (!file.is_regular_file())
+            continue;
+
+        Asset asset;
+        asset.path = file.path().generic_string();
+        if (FindAssetType(asset.path, &asset.type))
+            assets.push_back(asset);
+    }
+    if (error)
+    {
+        fprintf(stderr, "Cannot read %s: %s\n", mediaDir.c_str(), error.message().c_str());
+        return 1;
+    }
+
+    const ChannelPackedTexture* packedTextures;
+    int packedTextureCount = GetChannelPackedTextures(&packedTextures);
+    for (int i = 0; i < packedTextureCount; ++i)
+    {
+        Asset asset;
+        asset.path = packedTextures[i].name;
+        asset.type = AssetType::PACKED_TEXTURE;
+        assets.push_back(asset);
+    }
+
+    // Atlas folders are optional
+    std::error_code atlasError;
+    for (const auto& folder : std::filesystem::directory_iterator(ATLAS_FOLDER, atlasError))
+    {
+        if (!folder.is_directory())
+            continue;
+
+        Asset asset;
+        asset.path = folder.path().generic_string();
+        asset.type = AssetType::ATLAS;
+        assets.push_back(asset);
+    }
+
+    for (const char* folder : cubemapFolders)
+    {
+        Asset asset;
+        asset.path = folder;
+        asset.type = AssetType::ENVIRONMENT;
+        assets.push_back(asset);
+    }
+
+    {
+        Asset asset;
+        asset.path = BRDF_LUT_CACHE_FILE;
+        asset.type = AssetType::BRDF_LUT;
+        assets.push_back(asset);
+    }
+    std::sort(assets.begin(), assets.end(), [](const Asset& a, const Asset& b) { return a.path < b.path; });
+
+    printf("Cooking %d assets on %d threads (%s mips)\n", (int)assets.size(), jobs::ThreadCount(), mip::FilterName(mipFilter));
+
+    // Environments first and one at a time: the faces are loaded without the vertical flip, and the bakers
+    // run their own jobs
+    auto start = std::chrono::steady_clock::now();
+    for (Asset& asset : assets)
+    {
+        if (asset.type != AssetType::ENVIRONMENT)
+            continue;
+
+        auto assetStart = std::chrono::steady_clock::now();
+        asset.success = CookEnvironment(&asset);
+        asset.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - assetStart).count();
+    }
+
+    // Same orientation as gl::UploadImage
+    stbi_set_flip_vertically_on_load(1);
+
+    // One asset per job (encoders run serially inside a job)
+    jobs::ParallelFor((int)assets.size(), [&](int index)
+    {
+        Asset& asset = assets[index];
+        if (asset.type == AssetType::ENVIRONMENT)
+            return;
+
+        auto assetStart = std::chrono::steady_clock::now();
+        switch (asset.type)
+        {
+        case AssetType::TEXTURE:        asset.success = CookTexture(&asset, false, mipFilter); break;
+        case AssetType::FLOAT_TEXTURE:  asset.success = CookTexture(&asset, true, mipFilter);  break;
+        case AssetType::PACKED_TEXTURE: asset.success = CookPackedTexture(&asset, mipFilter);  break;
+        case AssetType::ATLAS:          asset.success = CookAtlas(&asset);                     break;
+        case AssetType::MESH:           asset.success = CookMesh(&asset);                      break;
+        case AssetType::CUBEMAP:        asset.success = CookCubemap(&asset);                   break;
+        case AssetType::ENVIRONMENT:                                                           break;
+        case AssetType::BRDF_LUT:       asset.success = CookBRDFLut(&asset);                   break;
+        case AssetType::RAW:
+            asset.outputs.push_back(asset.path);
+            asset.success = true;
+            break;
+        }
+        asset.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - assetStart).count();
+    });
+    float totalSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+    // Report
+    int failedCount = 0;
+    float cpuMilliseconds = 0.f;
+    printf("\n%-48s %-16s %10s\n", "Asset", "Type", "Time (ms)");
+    for (const Asset& asset : assets)
+    {
+        printf("%-48s %-16s %10.1f%s\n", asset.path.c_str(), AssetTypeName(asset.type), asset.milliseconds, asset.success ? "" : "  FAILED");
+        cpuMilliseconds += asset.milliseconds;
+        failedCount += asset.success ? 0 : 1;
+    }
+    printf("%d assets cooked in %.2f s (%.2f s of work)\n", (int)assets.size() - failedCount, totalSeconds, cpuMilliseconds / 1000.f);
+
+    if (benchmark)
+        BenchmarkCaches(assets);
+
+    if (pack)
+    {
+        std::vector<archive::PackedFile> files;
+        for (const Asset& asset : assets)
+        {
+            if (!asset.success)
+                continue;
+
+            for (const std::string& output : asset.outputs)
+            {
+                archive::PackedFile file;
+                file.path = output;
+                file.format = GetArchiveFormat(output);
+                if (!ReadFile(output, &file.data))
+                {
+                    fprintf(stderr, "Cannot read %s\n", output.c_str());
+                    return 1;
+                }
+                files.push_back(std::move(file));
+            }
+        }
+
+        std::string archiveFile = mediaDir + "/" + std::filesystem::path(ARCHIVE_DEFAULT_FILE).filename().generic_string();
+        if (!archive::Write(archiveFile.c_str(), files))
+            return 1;
+
+        // Read back once, loaders do not check the payloads
+        bool verified = archive::Open(archiveFile.c_str()) && archive::Verify();
+        archive::Close();
+        if (!verified)
+            return 1;
+    }
+
+    return failedCount == 0 ? 0 : 1;
+}